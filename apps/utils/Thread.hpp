@@ -28,8 +28,13 @@ public:
         return mThreadId;
     }
 
+    /* Blocks until the thread has exited */
+    int join() {
+        return join(mThreadId);
+    }
+
     static int join(int threadId) {
-        return -1;
+        return thread_join(threadId);
     }
 
 private:
@@ -38,25 +43,84 @@ private:
     int mThreadId;
 };
 
+/**
+ * @brief Mutex blocking in the kernel only when contended.
+ * The word is 0 when unlocked, 1 when locked and 2 when locked with possible waiters,
+ * so lock and unlock without contention are a single atomic instruction and no system call.
+ */
 class Mutex {
 public:
-    Mutex() : mLocked(0) {}
+    Mutex() : mState(0) {}
 
     void lock() {
-        while (__sync_lock_test_and_set(&mLocked, 1)) {
-            yield();
+        int state = __sync_val_compare_and_swap(&mState, 0, 1);
+        if (state == 0) {
+            return;
+        }
+
+        /* Mark the lock contended before sleeping, so the holder wakes us on unlock */
+        if (state != 2) {
+            state = __sync_lock_test_and_set(&mState, 2);
         }
+        while (state != 0) {
+            futex_wait(&mState, 2);
+            state = __sync_lock_test_and_set(&mState, 2);
+        }
+    }
+
+    bool tryLock() {
+        return __sync_bool_compare_and_swap(&mState, 0, 1);
     }
 
     void unlock() {
-        __sync_lock_release(&mLocked);
+        if (__sync_fetch_and_sub(&mState, 1) != 1) {
+            mState = 0;
+            futex_wake(&mState, 1);
+        }
     }
 
 private:
-    volatile int mLocked;
+    friend class CondVar;
+
+    /* Takes the lock marked contended, used after waiting on a CondVar as others may still wait */
+    void lockContended() {
+        while (__sync_lock_test_and_set(&mState, 2) != 0) {
+            futex_wait(&mState, 2);
+        }
+    }
+
+    volatile int mState;
 };
 
+/**
+ * @brief Condition variable used together with a Mutex.
+ * Waiters sleep on a sequence number which every signal increments, so a signal sent
+ * between unlocking the mutex and sleeping makes the wait return at once.
+ * Wakeups may be spurious, the condition has to be checked again in a loop.
+ */
+class CondVar {
+public:
+    CondVar() : mSequence(0) {}
+
+    void wait(Mutex& mutex) {
+        int sequence = mSequence;
+        mutex.unlock();
+        futex_wait(&mSequence, sequence);
+        mutex.lockContended();
+    }
+
+    void signal() {
+        __sync_fetch_and_add(&mSequence, 1);
+        futex_wake(&mSequence, 1);
+    }
 
+    void broadcast() {
+        __sync_fetch_and_add(&mSequence, 1);
+        futex_wake(&mSequence, 0x7FFFFFFF);
+    }
 
+private:
+    volatile int mSequence;
+};
 
 #endif // !__THREAD_LIB_HPP
\ No newline at end of file
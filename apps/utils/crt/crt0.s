@@ -17,4 +17,7 @@ call_main:
 
 end_thread:
     /* Exit syscall or cleanup */
-    call exit
\ No newline at end of file
+    call exit
+
+/* No executable stack, the apps are linked as ELF */
+.section .note.GNU-stack,"",@progbits
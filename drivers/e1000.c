@@ -216,19 +216,33 @@ void e1000_attach(struct pci_device* dev)
 
     pci_enable_device_busmaster(dev->bus, dev->slot, dev->function);
 
+	/* Packet buffers are DMA targets, each ring gets one physically contiguous block */
+	char* tx_ring = palloc(TX_SIZE*PACKET_SIZE);
+	char* rx_ring = palloc(RX_SIZE*PACKET_SIZE);
+	if(tx_ring == NULL || rx_ring == NULL){
+		pfree(tx_ring);
+		pfree(rx_ring);
+		warningf("[e1000] Unable to allocate packet buffers\n");
+		return;
+	}
+
 	for (int i = 0; i < TX_SIZE; i++)
-		tx_buf[i] = palloc(PACKET_SIZE);
+		tx_buf[i] = tx_ring + i*PACKET_SIZE;
 	
 	for (int i = 0; i < RX_SIZE; i++)
-		rx_buf[i] = palloc(PACKET_SIZE);
+		rx_buf[i] = rx_ring + i*PACKET_SIZE;
 
 	_e1000_tx_init();
 	_e1000_rx_init();
 
 	_e1000_mac();
 
-    /* For now.. hard code irq to 11 */
-    interrupt_install_handler(32+dev->irq, &e1000_callback);
+	/* Message signalled if the device can, otherwise its pin through the IO APIC or PIC */
+	int vector = pci_enable_msi(dev, "e1000 MSI");
+	if(vector < 0){
+		vector = 32+dev->irq;
+	}
+	interrupt_install_handler(vector, &e1000_callback);
 
 	E1000_DEVICE_SET(E1000_RDTR) = 0;
 	E1000_DEVICE_SET(E1000_RADV) = 0;
@@ -21,6 +21,7 @@
 
 #include <vbe.h>
 #include <vbe.h>
+#include <gfx/composition.h>
 
 #define KB_IRQ		33 /* Default is 1, 33 after mapped. */
 #define KB_BUFFER_SIZE 255
@@ -94,6 +95,7 @@ void kb_add_char(unsigned char c)
 {
 	kb_buffer[kb_buffer_head] = c;
 	kb_buffer_head = (kb_buffer_head + 1) % KB_BUFFER_SIZE;
+	gfx_compositor_wake();
 }
 
 
@@ -133,6 +133,7 @@ void __int_handler __mouse_handler()
 
 						mouse_device.received = 0;
 						mouse_device.cycle = 0;
+						gfx_compositor_wake();
 					}
 					break;
 			}
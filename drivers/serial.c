@@ -19,6 +19,8 @@
 #define PORT 0x3f8          // COM1
 #define MAX_FMT_STR_SIZE 50
 static int serial_init_done = 0;
+/* Leaf lock, serial output is used from everywhere, including with other locks held */
+static spinlock_t serial_lock = SPINLOCK_UNLOCKED;
 
 void serial_put(char a)
 {
@@ -49,7 +51,7 @@ int32_t serial_printf(char* fmt, ...)
 	int written = 0;
 #ifdef KDEBUG_SERIAL
 
-	ENTER_CRITICAL();
+	uint32_t flags = spin_lock_irqsave(&serial_lock);
 	va_list args;
 
 	char str[MAX_FMT_STR_SIZE];
@@ -75,7 +77,11 @@ int32_t serial_printf(char* fmt, ...)
 						bytes[1] = (num >> 16) & 0xFF;
 						bytes[2] = (num >> 8) & 0xFF;
 						bytes[3] = num & 0xFF;
-						serial_printf("%d.%d.%d.%d", bytes[3], bytes[2], bytes[1], bytes[0]);
+						for (int i = 3; i >= 0; i--){
+							itoa(bytes[i], str);
+							serial_write(str);
+							if(i > 0) serial_put('.');
+						}
 						break;
 					case 'p': ; /* p for padded int */
 						num = va_arg(args, int);
@@ -115,7 +121,7 @@ int32_t serial_printf(char* fmt, ...)
 			}
         fmt++;
     }
-	LEAVE_CRITICAL();
+	spin_unlock_irqrestore(&serial_lock, flags);
 #endif
 	return written;
 }
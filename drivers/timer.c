@@ -1,7 +1,9 @@
 /**
  * @file timer.c
  * @author Joe Bayer (joexbayer)
- * @brief PIT driver, used for preemptive scheduling and timing.
+ * @brief System tick, used for preemptive scheduling and timing.
+ * The PIT ticks unless device interrupts go through the IO APIC, then the PIT is not
+ * routed and the local APIC timer of the bootstrap processor ticks instead.
  * @version 0.1
  * @date 2022-06-01
  * 
@@ -16,21 +18,276 @@
 #include <pcb.h>
 #include <arch/io.h>
 #include <kutils.h>
+#include <ktimer.h>
+#include <smp.h>
+#include <arch/lapic.h>
+#include <libc.h>
 
 #define PIT_IRQ		32
+#define PIT_FREQUENCY	1193180
+
+/* Channel 0, lobyte/hibyte access */
+#define PIT_CMD_PERIODIC	0x36 /* mode 3, square wave */
+#define PIT_CMD_ONESHOT		0x30 /* mode 0, interrupt on terminal count */
+#define PIT_CMD_LATCH		0x00
 
 static unsigned long tick = 0;
+
+/**
+ * @brief Dynamic tick state
+ * While no other pcb is waiting to run there is nothing to preempt, so the periodic tick
+ * is stopped and the PIT is programmed in one-shot mode for the next timer wheel expiry.
+ * Ticks skipped that way are accounted for when the one-shot fires or when a pcb is woken early.
+ */
+static struct timer_state {
+	/* counts per tick of the PIT or local APIC timer */
+	uint32_t divisor;
+	int lapic;
+	int oneshot_max;
+	/* ticks covered by the programmed one-shot, 0 while ticking periodically */
+	int stopped;
+	/* TSC when the one-shot was programmed, and TSC cycles per tick */
+	uint64_t stopped_tsc;
+	uint32_t tsc_per_tick;
+	/* another processor caught up, the bootstrap processor has to go back to periodic ticks */
+	int restart;
+	/* idle task is halted since idle_start */
+	int idling;
+	unsigned long idle_start;
+
+	struct timer_info info;
+} timer;
+
+static void __pit_program(uint8_t cmd, uint32_t count)
+{
+	outportb(0x43, cmd);
+	outportb(0x40, (uint8_t)(count & 0xFF));
+	outportb(0x40, (uint8_t)((count >> 8) & 0xFF));
+}
+
+static uint16_t __pit_read()
+{
+	outportb(0x43, PIT_CMD_LATCH);
+	uint8_t l = inportb(0x40);
+	uint8_t h = inportb(0x40);
+	return (h << 8) | l;
+}
+
+/* The local APIC timer can only be programmed by the bootstrap processor itself */
+static void __tick_periodic()
+{
+	if(timer.lapic){
+		lapic_timer_start(TIMER_HZ);
+		return;
+	}
+	__pit_program(PIT_CMD_PERIODIC, timer.divisor);
+}
+
+static void __tick_oneshot(int ticks)
+{
+	if(timer.lapic){
+		lapic_timer_oneshot(ticks * timer.divisor);
+		return;
+	}
+	__pit_program(PIT_CMD_ONESHOT, ticks * timer.divisor);
+}
+
+/**
+ * @brief Whole ticks which have passed since the one-shot was programmed.
+ * The local APIC timer of the bootstrap processor can not be read by other processors,
+ * they go by the TSC instead. ktimer_add relies on the tick being caught up on return.
+ */
+static int __tick_elapsed()
+{
+	if(timer.lapic && smp_cpu()->id != SMP_BSP){
+		uint64_t cycles = rdtsc() - timer.stopped_tsc;
+		if((cycles >> 32) != 0 || timer.tsc_per_tick == 0) return timer.stopped;
+		return (uint32_t)cycles / timer.tsc_per_tick;
+	}
+
+	uint32_t remaining = timer.lapic ? lapic_timer_current() : __pit_read();
+	return timer.stopped - (remaining + timer.divisor - 1) / timer.divisor;
+}
+
+/**
+ * @brief Advances the tick and the timer wheel by the given amount of ticks.
+ * @warning Must be called in a critical section.
+ */
+static void __timer_advance(int ticks)
+{
+	tick += ticks;
+	if($process->current != NULL){
+		$process->current->preempts += ticks;
+	}
+
+	if(timer.idling){
+		timer.info.idle_ticks += tick - timer.idle_start;
+		timer.idling = 0;
+	}
+
+	for (int i = 0; i < ticks; i++){
+		ktimer_tick();
+	}
+}
+
+/**
+ * @brief Stops the periodic tick until the next timer wheel expiry.
+ * @warning Must be called in a critical section.
+ */
+static void __timer_stop_tick()
+{
+	int ticks = ktimer_next_expiry(timer.oneshot_max);
+	if(ticks <= 1) return;
+
+	__tick_oneshot(ticks);
+	timer.stopped = ticks;
+	timer.stopped_tsc = rdtsc();
+	timer.restart = 0;
+	timer.info.oneshots++;
+}
+
+/**
+ * @brief Goes back to periodic ticks, accounting for the ticks which passed since the tick was stopped.
+ * Called when a pcb becomes runnable, as it might have to preempt the running one.
+ */
+void timer_tick_restart()
+{
+	ENTER_CRITICAL();
+
+	if(timer.stopped){
+		int ticks = timer.stopped;
+		/* Whole ticks which have passed of the one-shot, the current one is counted by the next interrupt */
+		int elapsed = __tick_elapsed();
+		if(elapsed < 0) elapsed = 0;
+		if(elapsed > ticks - 1) elapsed = ticks - 1;
+
+		/* Must be cleared first, timers expired below may wake pcbs and end up here again */
+		timer.stopped = 0;
+		if(timer.lapic && smp_cpu()->id != SMP_BSP){
+			/* The tick is caught up here, only the reprogramming is left to the bootstrap processor */
+			timer.restart = 1;
+			lapic_send_ipi(smp_get_cpu(SMP_BSP)->apic_id, LAPIC_TICK_VECTOR);
+		} else {
+			__tick_periodic();
+		}
+
+		timer.info.restarts++;
+		__timer_advance(elapsed);
+	}
+
+	LEAVE_CRITICAL();
+}
+
 static void __int_handler timer_callback()
 {
-	tick++;
-	$process->current->preempts++;
-	EOI(32);
-	if($process->current != NULL)
-	{
-		kernel_yield();
+	int ticks = 1;
+	int preempt = 0;
+
+	ENTER_CRITICAL();
+
+	if(timer.stopped){
+		ticks = timer.stopped;
+		timer.stopped = 0;
+		__tick_periodic();
+	} else if(timer.restart){
+		/* The one-shot fired before the restart interrupt came in */
+		timer.restart = 0;
+		__tick_periodic();
+	}
+	timer.info.interrupts++;
+	/* The local APIC was acknowledged by isr_handler */
+	if(!timer.lapic){
+		EOI(PIT_IRQ);
+	}
+
+	/* Expire timers before switching, so woken pcbs can be picked right away */
+	__timer_advance(ticks);
+
+	/* Preempt if someone else is waiting, otherwise nothing can change until the next timer or interrupt */
+	if($process->current != NULL){
+		if(sched_has_runnable(get_scheduler()) || $process->current->state != RUNNING){
+			preempt = 1;
+		} else {
+			__timer_stop_tick();
+		}
+	}
+
+	LEAVE_CRITICAL();
+
+	if(preempt){
+		kernel_preempt();
+	}
+}
+
+/**
+ * @brief Tick of the application processors, from their local APIC timer.
+ * Only preempts, time is kept by the bootstrap processor.
+ * All processors share the vector, the tick of the bootstrap processor is passed on to timer_callback.
+ */
+static void __int_handler timer_local_callback()
+{
+	if(timer.lapic && smp_cpu()->id == SMP_BSP){
+		timer_callback();
+		return;
+	}
+
+	struct pcb* current = $process->current;
+	if(current == NULL) return;
+
+	current->preempts++;
+	if(sched_has_runnable(get_scheduler()) || current->state != RUNNING){
+		kernel_preempt();
 	}
 }
 
+/**
+ * @brief Halts the idle task until the next interrupt.
+ * If nothing is runnable the periodic tick is stopped while halted.
+ */
+void timer_idle()
+{
+	ENTER_CRITICAL();
+
+	/* Application processors keep ticking, only the tick of the bootstrap processor is stopped */
+	if(smp_cpu()->id != SMP_BSP){
+		critical_leave_halt();
+		return;
+	}
+
+	if(!timer.stopped && !sched_has_runnable(get_scheduler())){
+		__timer_stop_tick();
+	}
+	timer.idling = 1;
+	timer.idle_start = tick;
+
+	critical_leave_halt();
+
+	CRITICAL_SECTION({
+		if(timer.idling){
+			timer.info.idle_ticks += tick - timer.idle_start;
+			timer.idling = 0;
+		}
+	});
+}
+
+/**
+ * @brief Gets tick statistics, how many interrupts the dynamic tick avoided and the idle residency.
+ * @param info Output statistics.
+ * @return 0 on success, error code on failure.
+ */
+error_t timer_get_info(struct timer_info* info)
+{
+	ERR_ON_NULL(info);
+
+	CRITICAL_SECTION({
+		*info = timer.info;
+		info->ticks = tick;
+		info->lapic = timer.lapic;
+	});
+
+	return ERROR_OK;
+}
+
 int timer_get_tick()
 {
 	return tick;
@@ -44,28 +301,59 @@ int time_get_difference(struct time* t1, struct time* t2)
 	return time1 - time2;
 }
 
-/* http://www.jamesmolloy.co.uk/tutorial_html/5.-IRQs%20and%20the%20PIT.html */
+/* Another processor caught up the stopped tick, the local APIC timer is still in one-shot mode */
+static void __int_handler timer_restart_callback()
+{
+	CRITICAL_SECTION({
+		if(timer.restart){
+			timer.restart = 0;
+			__tick_periodic();
+		}
+	});
+}
+
+/**
+ * @brief Starts the system tick on the bootstrap processor.
+ * Uses the local APIC timer if device interrupts come from the IO APIC, otherwise the PIT.
+ * @see http://www.jamesmolloy.co.uk/tutorial_html/5.-IRQs%20and%20the%20PIT.html
+ */
 void init_pit(uint32_t frequency)
 {
+	/* The PIT line is not routed by the IO APIC, see ioapic.c */
+	if(interrupt_ioapic_enabled()){
+		timer.lapic = 1;
+		timer.divisor = lapic_timer_period(frequency);
+		timer.tsc_per_tick = (lapic_tsc_rate() / frequency) * 1000;
+		/* The 32 bit count holds far longer one-shots, a second keeps the catch up loop in __timer_advance short */
+		timer.oneshot_max = TIMER_HZ;
+
+		interrupt_install_handler(LAPIC_TIMER_VECTOR, &timer_local_callback);
+		interrupt_install_handler(LAPIC_TICK_VECTOR, &timer_restart_callback);
+		lapic_timer_start(frequency);
+
+		dbgprintf("Local APIC timer initialized.\n");
+		return;
+	}
+	timer.oneshot_max = TIMER_ONESHOT_MAX_TICKS;
+
 	/* Firstly, register our timer callback. */
 	interrupt_install_handler(PIT_IRQ, &timer_callback);
 
 	/* The value we send to the PIT is the value to divide it's input clock */
 	/* (1193180 Hz) by, to get our required frequency. */
 	
-	uint32_t divisor = (1193180) / frequency;
-	//uint32_t divisor = (1193180) / frequency;
-
-	/* Send the command byte. */
-	outportb(0x43, 0x36);
-
-	/* Divisor has to be sent byte-wise, so split here into upper/lower bytes. */
-	uint8_t l = (uint8_t)(divisor & 0xFF);
-	uint8_t h = (uint8_t)( (divisor>>8) & 0xFF );
+	uint32_t divisor = PIT_FREQUENCY / frequency;
+	timer.divisor = divisor;
 
-	/* Send the frequency divisor. */
-	outportb(0x40, l);
-	outportb(0x40, h);
+	/* Send the command byte, followed by the divisor byte-wise. */
+	__pit_program(PIT_CMD_PERIODIC, divisor);
 
 	dbgprintf("PIT initialized.\n");
+}
+
+/* Starts the tick of the calling application processor */
+void init_local_timer()
+{
+	interrupt_install_handler(LAPIC_TIMER_VECTOR, &timer_local_callback);
+	lapic_timer_start(TIMER_HZ);
 }
\ No newline at end of file
@@ -26,8 +26,8 @@ static byte_t* fat_table_memory = NULL;  /* pointer to the in-memory FAT table *
 /* Temporary "current" directory */
 static uint16_t current_dir_block = 0;
 
-/* locks for read / write and management */
-static mutex_t fat16_table_lock; 
+/* locks for read / write and management, cluster chains are walked far more often than changed */
+static rwlock_t fat16_table_lock;
 static mutex_t fat16_write_lock;
 static mutex_t fat16_management_lock;
 
@@ -59,14 +59,37 @@ inline uint16_t get_data_start_block()
 }
 
 
+static inline uint16_t* __fat16_entry(uint32_t cluster)
+{
+    uint32_t fat_offset = cluster * 2;  /* Each entry is 2 bytes */
+    return (uint16_t*)(fat_table_memory + fat_offset);
+}
+
+/**
+ * @brief Cluster chains are walked with the table read lock held across the whole walk,
+ * a single entry read on its own needs no lock but the chain it belongs to could change under it.
+ */
+void fat16_table_read_lock()
+{
+    read_lock(&fat16_table_lock);
+}
+
+void fat16_table_read_unlock()
+{
+    read_unlock(&fat16_table_lock);
+}
+
+/**
+ * @brief Reads a FAT entry.
+ * @warning The table lock must be held when the entry is part of a chain walk.
+ */
 uint16_t fat16_get_fat_entry(uint32_t cluster)
 {
     if(fat_table_memory == NULL){
         return -1;
     }
 
-    uint32_t fat_offset = cluster * 2;  /* Each entry is 2 bytes */
-    return *(uint16_t*)(fat_table_memory + fat_offset);
+    return *__fat16_entry(cluster);
 }
 
 void fat16_set_fat_entry(uint32_t cluster, uint16_t value)
@@ -75,12 +98,9 @@ void fat16_set_fat_entry(uint32_t cluster, uint16_t value)
         return;
     }
 
-    acquire(&fat16_table_lock);
-
-    uint32_t fat_offset = cluster * 2;  /* Each entry is 2 bytes */
-    *(uint16_t*)(fat_table_memory + fat_offset) = value;
-
-    release(&fat16_table_lock);
+    write_lock(&fat16_table_lock);
+    *__fat16_entry(cluster) = value;
+    write_unlock(&fat16_table_lock);
 }
 
 void fat16_sync_fat_table()
@@ -89,14 +109,15 @@ void fat16_sync_fat_table()
         return;
     }
 
-    acquire(&fat16_table_lock);
+    /* Only reads the table, lookups may go on while it is written to disk */
+    read_lock(&fat16_table_lock);
 
     int start_block = get_fat_start_block();
     for (uint16_t i = 0; i < boot_table.fat_blocks; i++) {
         write_block(fat_table_memory + i * 512, start_block + i);
     }
 
-    release(&fat16_table_lock);
+    read_unlock(&fat16_table_lock);
 }
 
 /* wrapper functions TODO: inline replace */
@@ -112,19 +133,24 @@ inline void fat16_free_cluster(uint32_t cluster)
 
 uint32_t fat16_get_free_cluster()
 {
-    //acquire(&fat16_table_lock);
+    if(fat_table_memory == NULL){
+        return -1;
+    }
+
+    /* Finding and allocating has to be atomic, or two writers could get the same cluster */
+    write_lock(&fat16_table_lock);
 
     for (int i = 5; i < 65536; i++) {  /* Start from 2 as 0 and 1 are reserved entries */
-        if (fat16_get_fat_entry(i) == 0x0000) {
+        if (*__fat16_entry(i) == 0x0000) {
 
-            fat16_allocate_cluster(i);
+            *__fat16_entry(i) = 0xFFFF;  /* marking cluster as end of file */
 
-            release(&fat16_table_lock);
+            write_unlock(&fat16_table_lock);
             return i;
         }
     }
 
-    //release(&fat16_table_lock);
+    write_unlock(&fat16_table_lock);
     return -1;  /* no free cluster found */
 }
 
@@ -218,15 +244,23 @@ int fat16_rename_entry(int directory, int index, char* name)
 
 int fat16_free_clusters(int start_cluster)
 {
+    if(fat_table_memory == NULL){
+        return 0;
+    }
+
     int count = 0;
-    int current_cluster = start_cluster;
-    int last_cluster = 0;
-    while (current_cluster != 0xFFFF) {
+    uint32_t current_cluster = start_cluster;
+
+    /* The whole chain is freed under one write lock, the next entry is read before it is cleared */
+    write_lock(&fat16_table_lock);
+    while (current_cluster != 0 && current_cluster < 0xFFF8) {
+        uint16_t next_cluster = *__fat16_entry(current_cluster);
+        *__fat16_entry(current_cluster) = 0x0000;  /* marking cluster as free */
+        current_cluster = next_cluster;
         count++;
-        last_cluster = current_cluster;
-        fat16_free_cluster(current_cluster);
-        current_cluster = fat16_get_fat_entry(last_cluster);
     }
+    write_unlock(&fat16_table_lock);
+
     return count;
 }
 
@@ -335,10 +369,13 @@ int fat16_add_entry(uint16_t block, char *filename, const char *extension, byte_
 int fat16_used_blocks()
 {
     int used = 0;
+    fat16_table_read_lock();
     for(int i = 0; i < 65536; i++){
-        if(fat16_get_fat_entry(i) == 0xFFFF || fat16_get_fat_entry(i) == 0 ) continue;
+        uint16_t entry = fat16_get_fat_entry(i);
+        if(entry == 0xFFFF || entry == 0 ) continue;
         used++;
     }
+    fat16_table_read_unlock();
 
     return used;
 }
@@ -834,7 +871,7 @@ int fat16_load()
     }
 
         /* init mutexes */
-    mutex_init(&fat16_table_lock);
+    rwlock_init(&fat16_table_lock);
     mutex_init(&fat16_write_lock);
     mutex_init(&fat16_management_lock);
 
@@ -15,6 +15,7 @@
 #include <kutils.h>
 #include <errors.h>
 #include <memory.h>
+#include <rtc.h>
 
 #include <terminal.h>
 
@@ -115,9 +116,22 @@ static int fat16_write(struct filesystem* fs, struct file* file, const void* buf
         return -4;
     }
 
-    /* update the file size */
+    /* update the file size and modification time */
     entry.file_size = offset + written;
 
+    struct time t;
+    get_current_time(&t);
+
+    uint16_t local_date = 0;
+    fat16_set_date(&local_date, 2000 + t.year, t.month, t.day);
+    entry.created_date = local_date;
+
+    uint16_t local_time = 0;
+    fat16_set_time(&local_time, t.hour, t.minute, t.second);
+    entry.created_time = local_time;
+
+    file->mtime = FAT16_MTIME(entry);
+
     fat16_sync_directory_entry(file->directory, file->identifier, &entry);
 
     dbgprintf("Wrote %d bytes to cluster %d offset %d\n", written, cluster, offset);
@@ -234,6 +248,7 @@ static struct file* fat16_open(struct filesystem* fs, const char* path, int flag
     file->identifier = id.index; 
     file->nlinks = 1;
     file->size = entry.file_size;
+    file->mtime = FAT16_MTIME(entry);
 
     dbgprintf("File %s:\n", path);
     dbgprintf("  Directory: %d\n", file->directory);
@@ -407,6 +422,20 @@ static int fat16_rename(struct filesystem* fs, const char* path, const char* new
  */
 static int fat16_stat(struct filesystem* fs, const char* path, struct file* file)
 {
+    FS_VALIDATE(fs);
+    ERR_ON_NULL(file);
+
+    struct fat16_directory_entry entry;
+    struct fat16_file_identifier id = fat16_get_directory_entry((char*)path, &entry);
+    if(id.directory < 0){
+        return -1;
+    }
+
+    file->directory = id.directory;
+    file->identifier = id.index;
+    file->size = entry.file_size;
+    file->mtime = FAT16_MTIME(entry);
+
     return 0;
 }
 
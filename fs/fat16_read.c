@@ -54,6 +54,9 @@ int fat16_read_data(int first_cluster, uint32_t start_offset, void* _buffer, int
     int offset_within_cluster = start_offset % 512;  /* Calculate offset within the starting cluster */
     int clusters_skipped = start_offset / 512;  /* Calculate the number of clusters to skip */
 
+    /* The chain is walked under the table read lock, so it cannot be freed or relinked while it is read */
+    fat16_table_read_lock();
+
     /* Skip clusters to reach the start_offset */
     while (clusters_skipped > 0 && current_cluster != 0xFFFF) {
         //dbgprintf("Skipping cluster 0x%x\n", current_cluster);
@@ -75,6 +78,7 @@ int fat16_read_data(int first_cluster, uint32_t start_offset, void* _buffer, int
         current_cluster = fat16_get_fat_entry(current_cluster);
         offset_within_cluster = 0;  /* After the first cluster, we read from the start of subsequent clusters. */
     }
+    fat16_table_read_unlock();
 
     if (bytes_left_to_read > 0) {
         //dbgprintf("Unexpected end of data\n");
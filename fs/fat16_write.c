@@ -15,6 +15,10 @@
 #include <diskdev.h>
 #include <serial.h>
 
+/**
+ * @brief Finds the cluster holding the given offset of a chain.
+ * @warning The table read lock must be held.
+ */
 uint32_t fat16_find_cluster_by_offset(int first_cluster, int offset, int* cluster_offset)
 {
     uint32_t current_cluster = first_cluster;
@@ -42,11 +46,13 @@ int fat16_print_cluster_chain(int cluster)
 {
     uint32_t current_cluster = cluster;
     int i = 0;
+    fat16_table_read_lock();
     while (current_cluster < 0xFFF8 && current_cluster != 0xFFFF){
         //dbgprintf("Cluster %d: 0x%x ->\n", i, current_cluster);
         current_cluster = fat16_get_fat_entry(current_cluster);
         i++;
     }
+    fat16_table_read_unlock();
     return 0;
 }
 
@@ -72,6 +78,12 @@ int fat16_write_data(int first_cluster, int offset, void* data, int data_length)
 
     fat16_print_cluster_chain(first_cluster);
 
+    /**
+     * The chain is walked under the table read lock. It is only dropped to append a cluster,
+     * which takes the write lock, at the end of the chain where nothing else is linked yet.
+     */
+    fat16_table_read_lock();
+
     /* Determine the cluster and inner cluster offset where we should start writing. */
     int cluster_offset;
     uint32_t current_cluster = fat16_find_cluster_by_offset(first_cluster, offset, &cluster_offset);
@@ -80,14 +92,17 @@ int fat16_write_data(int first_cluster, int offset, void* data, int data_length)
     while (remaining_data_length > 0){
         /* If there is no allocated cluster or we've reached the end of the cluster chain, allocate a new one. */
         if (next_cluster < 0 || next_cluster == 0xFFFF || next_cluster >= 0xFFF8){
+            if (current_cluster <= 0){
+                fat16_table_read_unlock();
+                return -2; /* Error: Couldn't write data */
+            }
+
+            fat16_table_read_unlock();
             uint32_t free_cluster = fat16_get_free_cluster();
             if (free_cluster == MAX_UINT16_T) return -1;  /* Error: No free clusters */
 
-            if (current_cluster > 0){
-                fat16_set_fat_entry(current_cluster, free_cluster);
-            } else {
-                return -2; /* Error: Couldn't write data */
-            }
+            fat16_set_fat_entry(current_cluster, free_cluster);
+            fat16_table_read_lock();
             current_cluster = free_cluster;
         } else {
             current_cluster = next_cluster;
@@ -101,6 +116,7 @@ int fat16_write_data(int first_cluster, int offset, void* data, int data_length)
         int write_result = fat16_write_data_to_cluster_with_offset(current_cluster, cluster_offset, ((byte_t*)data) + data_offset, write_size);
         if (write_result < 0){
             //dbgprintf("Error writing data to cluster\n");
+            fat16_table_read_unlock();
             return -2;   /* Error: Couldn't write data */
         }
 
@@ -116,7 +132,9 @@ int fat16_write_data(int first_cluster, int offset, void* data, int data_length)
     }
 
     /* Mark the last cluster in the chain as end-of-file if necessary. */
-    if (fat16_get_fat_entry(current_cluster) != 0xFFFF){
+    uint16_t last_entry = fat16_get_fat_entry(current_cluster);
+    fat16_table_read_unlock();
+    if (last_entry != 0xFFFF){
         fat16_set_fat_entry(current_cluster, 0xFFFF);
     }
 
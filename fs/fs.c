@@ -152,6 +152,23 @@ int fs_load_from_file(const char* file, void* buf, int size)
 	return read;
 }
 
+/**
+ * @brief Gets size, identity and modification time of a file without opening it.
+ * @return 0 on success, negative on error.
+ */
+int fs_stat(const char* path, struct file* file)
+{
+    ERR_ON_NULL(path);
+    ERR_ON_NULL(file);
+
+    if(fs_current == NULL || fs_current->ops->stat == NULL){
+        return -1;
+    }
+
+    memset(file, 0, sizeof(struct file));
+    return fs_current->ops->stat(fs_current, path, file);
+}
+
 int fs_save_to_file(const char* file, void* buf, int size)
 {
     int inode = fs_open(file, FS_FILE_FLAG_WRITE);
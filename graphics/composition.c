@@ -15,12 +15,37 @@
 #include <gfx/windowserver.h>
 #include <windowmanager.h>
 #include <kthreads.h>
+#include <sync.h>
 
 /* prototypes */
 void __kthread_entry gfx_compositor_main();
 
 struct windowserver* ws;
 
+/* Input arrived since the compositor last went idle, see gfx_compositor_wake */
+static volatile int compositor_input = 0;
+static waitqueue_t compositor_waiters;
+
+/**
+ * @brief Wakes the compositor, called by the mouse and keyboard interrupts.
+ * The compositor runs in the latency class, so it runs as soon as the interrupt returns.
+ */
+void gfx_compositor_wake()
+{
+    compositor_input = 1;
+    wake_up_all(&compositor_waiters);
+}
+
+/**
+ * @brief Sleeps until input arrives or the given ticks have passed.
+ * Called by the compositor when a frame changed nothing.
+ */
+void gfx_compositor_idle(int ticks)
+{
+    wait_event_timeout(&compositor_waiters, compositor_input, ticks);
+    compositor_input = 0;
+}
+
 /**
  * @brief Removes a window from the "wind.order" list.
  * Important keep the wind.order list intact even if removing the first element.
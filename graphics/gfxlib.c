@@ -38,8 +38,7 @@ int gfx_push_event(struct window* w, struct gfx_event* e)
 		w->events.head = (w->events.head + 1) % GFX_MAX_EVENTS;
 	});
 
-	/* TODO: Check for a block reason */
-	if(w->owner->state == BLOCKED) w->owner->state = RUNNING;
+	wake_up_all(&w->events.waiters);
 
 	return 0;
 }
@@ -118,31 +117,25 @@ int gfx_put_icon32(unsigned char icon[], int x, int y)
 int gfx_event_loop(struct gfx_event* event, gfx_event_flag_t flags)
 {
 
-	ERR_ON_NULL($process->current->gfx_window);
+	struct window* w = $process->current->gfx_window;
+	ERR_ON_NULL(w);
 	/**
 	 * The gfx event loop is PCB specific,
 	 * checks if there is an event if true return.
-	 * Else block.
+	 * Else block on the window until gfx_push_event adds one.
 	 */
-	while(1){
-		if($process->current->gfx_window->events.tail == $process->current->gfx_window->events.head){
-			
-			if(flags & GFX_EVENT_BLOCKING){
-				/* FIXME: Should not global block, perhaps window manager block queue? */
-				$process->current->state = BLOCKED;
-				kernel_yield();
-			} else {
-				return -1;
-			}
-			continue;
+	if(w->events.tail == w->events.head){
+		if(!(flags & GFX_EVENT_BLOCKING)){
+			return -1;
 		}
-		
-		SPINLOCK($process->current->gfx_window, {
-			memcpy(event, &$process->current->gfx_window->events.list[$process->current->gfx_window->events.tail], sizeof(struct gfx_event));
-			$process->current->gfx_window->events.tail = ($process->current->gfx_window->events.tail + 1) % GFX_MAX_EVENTS;
-		});
-		return 0;
+		wait_event(&w->events.waiters, w->events.tail != w->events.head);
 	}
+
+	SPINLOCK(w, {
+		memcpy(event, &w->events.list[w->events.tail], sizeof(struct gfx_event));
+		w->events.tail = (w->events.tail + 1) % GFX_MAX_EVENTS;
+	});
+	return 0;
 }
 
 /**
@@ -20,6 +20,8 @@
 #include <errors.h>
 #include <kutils.h>
 #include <lib/icons.h>
+#include <memory.h>
+#include <assert.h>
 
 //#define __WINDOWS_95
 
@@ -56,6 +58,16 @@ static struct window_draw_ops default_window_draw_ops = {
     .bitmap = &kernel_gfx_draw_bitmap
 };
 
+/* Window structs are allocated from their own object cache */
+static struct kmem_cache* window_cache = NULL;
+
+static void gfx_init_window_cache()
+{
+    window_cache = kmem_cache_create("window", sizeof(struct window));
+    assert(window_cache != NULL);
+}
+EXPORT_KCTOR(gfx_init_window_cache);
+
 /**
  * @brief Draw given window to a frambuffer.
  * 
@@ -366,15 +378,28 @@ int gfx_destory_window(struct window* w)
     
     gfx_composition_remove_window(w);
 
-    kfree(w->inner);
     w->owner->gfx_window = NULL;
-    kfree(w);
+    gfx_window_put(w);
 
     LEAVE_CRITICAL();
 
     return ERROR_OK;
 }
 
+/**
+ * @brief Drops a reference to the window, the last one frees it.
+ * A window being dispatched an event stays alive until the dispatch is done.
+ */
+void gfx_window_put(struct window* w)
+{
+    if(kref_put(&w->_krefs) > 0){
+        return;
+    }
+
+    kfree(w->inner);
+    kmem_cache_free(window_cache, w);
+}
+
 
 static int gfx_window_maximize(struct window* window)
 {
@@ -401,7 +426,7 @@ struct window* gfx_new_window(int width, int height, window_flag_t flags)
     if($process->current->gfx_window != NULL)
         return $process->current->gfx_window;
 
-    struct window* w = create(struct window);
+    struct window* w = kmem_cache_zalloc(window_cache);
     if(w == NULL){
         warningf("window is NULL\n");
         return NULL;
@@ -410,7 +435,7 @@ struct window* gfx_new_window(int width, int height, window_flag_t flags)
     w->inner = kalloc(width*height);
     if(w->inner == NULL){
         warningf("Inner window is NULL\n");
-        kfree(w);
+        kmem_cache_free(window_cache, w);
         return NULL;
     }
     memset(w->inner, HAS_FLAG(flags, GFX_IS_TRANSPARENT) ? 255 : 0, width*height);
@@ -443,7 +468,9 @@ struct window* gfx_new_window(int width, int height, window_flag_t flags)
     w->color.border = 0;
     w->color.header = 0;
     w->color.text = 0;
-    w->spinlock = 0;
+    spinlock_init(&w->spinlock);
+    kref_init(&w->_krefs);
+    kref_get(&w->_krefs);
 
     w->next = NULL;
 
@@ -61,7 +61,7 @@ int init_windowmanager(struct windowmanager* wm, int flags)
     memset(wm->composition_buffer, 0x0, VBE_SIZE());
 
 
-    wm->spinlock = SPINLOCK_UNLOCKED;
+    rwlock_init(&wm->lock);
     wm->windows = NULL;
     wm->window_count = 0;
     wm->mouse_state = 0;
@@ -88,15 +88,18 @@ static int wm_default_changes(struct windowmanager* wm)
     ERR_ON_NULL(wm);
     WM_VALIDATE(wm);
 
-    struct window* w = wm->windows;
+    int changed = 0;
 
-    while(w != NULL){
-        if(w->changed)
-            return 1;
-        w = w->next;
+    read_lock(&wm->lock);
+    for (struct window* w = wm->windows; w != NULL; w = w->next){
+        if(w->changed){
+            changed = 1;
+            break;
+        }
     }
+    read_unlock(&wm->lock);
 
-    return 0;
+    return changed;
 }
 
 
@@ -114,12 +117,15 @@ static int wm_default_add(struct windowmanager* wm, struct window* window)
     ERR_ON_NULL(wm);
     ERR_ON_NULL(window);
 
+    write_lock(&wm->lock);
+
     if (wm->window_count == 0) {
         wm->windows = window;
         
         window->in_focus = 1;
 
         wm->window_count++;
+        write_unlock(&wm->lock);
         return ERROR_OK;
     }
 
@@ -134,6 +140,7 @@ static int wm_default_add(struct windowmanager* wm, struct window* window)
         current->in_focus = 0;
     }
 
+    write_unlock(&wm->lock);
 
     return ERROR_OK;
 }
@@ -146,6 +153,8 @@ static int wm_default_workspace(struct windowmanager* wm, int workspace)
         return -ERROR_INVALID_ARGUMENTS;
     }
 
+    write_lock(&wm->lock);
+
     /* store current windows in workspace */
     wm->workspaces[wm->workspace] = wm->windows;
 
@@ -153,28 +162,31 @@ static int wm_default_workspace(struct windowmanager* wm, int workspace)
     wm->windows = wm->workspaces[workspace];
     wm->workspace = workspace;
 
+    write_unlock(&wm->lock);
+
     return ERROR_OK;
 }
 
 /**
- * @brief wm_default_remove removes a window from the windowmanager
- * 
- * @param wm windowmanager
- * @param window window to remove
- * @return int 0 on success, error code otherwise
+ * @brief Checks if a window is in the window list.
+ * @warning Read or write lock must be held.
  */
-static int wm_default_remove(struct windowmanager* wm, struct window* window)
+static int __wm_contains(struct windowmanager* wm, struct window* window)
 {
-    ERR_ON_NULL(wm);
-
-    if (wm->window_count == 0) {
-        return -ERROR_WINDOW_NOT_FOUND;
+    for (struct window* i = wm->windows; i != NULL; i = i->next){
+        if(i == window) return 1;
     }
+    return 0;
+}
 
+/**
+ * @brief Unlinks a window from the window list.
+ * @warning Write lock must be held.
+ */
+static void __wm_remove(struct windowmanager* wm, struct window* window)
+{
     assert(wm->windows != NULL);
 
-    spin_lock(&wm->spinlock);
-
     if (wm->windows == window) {
         wm->windows = window->next;
         dbgprintf("Removing front window %s\n", window->name);
@@ -193,8 +205,26 @@ static int wm_default_remove(struct windowmanager* wm, struct window* window)
         wm->windows->in_focus = 1;
     }
     wm->window_count--;
+}
+
+/**
+ * @brief wm_default_remove removes a window from the windowmanager
+ * 
+ * @param wm windowmanager
+ * @param window window to remove
+ * @return int 0 on success, error code otherwise
+ */
+static int wm_default_remove(struct windowmanager* wm, struct window* window)
+{
+    ERR_ON_NULL(wm);
+
+    if (wm->window_count == 0) {
+        return -ERROR_WINDOW_NOT_FOUND;
+    }
 
-    spin_unlock(&wm->spinlock);
+    write_lock(&wm->lock);
+    __wm_remove(wm, window);
+    write_unlock(&wm->lock);
 
     return ERROR_OK; 
 }
@@ -211,9 +241,9 @@ static int wm_default_push_back(struct windowmanager* wm, struct window* window)
 
     window->in_focus = 0;
 
-    PANIC_ON_ERR(wm->ops->remove(wm, window));
+    write_lock(&wm->lock);
+    __wm_remove(wm, window);
 
-    spin_lock(&wm->spinlock);
     /* Replace wm->windows with window, pushing original wm->windows back. */
     struct window* i;
     for (i = wm->windows; i != NULL && i->next != NULL; i = i->next);
@@ -230,31 +260,25 @@ static int wm_default_push_back(struct windowmanager* wm, struct window* window)
         wm->windows->in_focus = 1;
     }
 
-    spin_unlock(&wm->spinlock);
+    write_unlock(&wm->lock);
 
     return ERROR_OK;
 }
 
 /**
- * @brief wm_default_push_front pushes a window to the front of the windowmanager
- * Used to bring a window to the front of the screen
- * @param wm windowmanager
- * @param window window to push 
- * @return int 0 on success, error code otherwise 
+ * @brief Moves a window to the front of the window list.
+ * @warning Write lock must be held.
  */
-static int wm_default_push_front(struct windowmanager* wm, struct window* window)
+static void __wm_push_front(struct windowmanager* wm, struct window* window)
 {
-    ERR_ON_NULL(wm);
-
     if(window == wm->windows){
-        return ERROR_OK;
+        return;
     }
 
     dbgprintf("Pushing window %s to front\n", window->name);
 
-    PANIC_ON_ERR(wm->ops->remove(wm, window));
+    __wm_remove(wm, window);
 
-    spin_lock(&wm->spinlock);
     /* Replace wm->windows with window, pushing original wm->windows back. */
 
     if(!HAS_FLAG(window->flags, GFX_HIDE_HEADER)){
@@ -269,11 +293,25 @@ static int wm_default_push_front(struct windowmanager* wm, struct window* window
 
     window->changed = 1;
     wm->window_count++;
+}
+
+/**
+ * @brief wm_default_push_front pushes a window to the front of the windowmanager
+ * Used to bring a window to the front of the screen
+ * @param wm windowmanager
+ * @param window window to push 
+ * @return int 0 on success, error code otherwise 
+ */
+static int wm_default_push_front(struct windowmanager* wm, struct window* window)
+{
+    ERR_ON_NULL(wm);
+    ERR_ON_NULL(window);
 
-    spin_unlock(&wm->spinlock);
+    write_lock(&wm->lock);
+    __wm_push_front(wm, window);
+    write_unlock(&wm->lock);
 
     return ERROR_OK;
-
 }
 
 /**
@@ -308,7 +346,11 @@ static int wm_default_mouse_event(struct windowmanager* wm, int x, int y, char f
     if (wm->window_count == 0) {
         return ERROR_OK;
     }
-    /* NOTE: no spinlock needed as windows are not changed */
+    struct window* target = NULL;
+    int inside = 0;
+    uint16_t x2 = 0, y2 = 0;
+
+    read_lock(&wm->lock);
 
     /* iterate over windows and check if a window was clicked, from front to back. */
     for (struct window* i = wm->windows; i != NULL; i = i->next){
@@ -316,43 +358,17 @@ static int wm_default_mouse_event(struct windowmanager* wm, int x, int y, char f
         if(gfx_point_in_rectangle(i->x, i->y, i->x+i->width, i->y+i->height, x, y)){
             /* get coordinates inside of the window */
             int offset = HAS_FLAG(i->flags, GFX_HIDE_HEADER) ? 0 : 8;
-            uint16_t x2 = CLAMP( (x - (i->x+offset)), 0,  i->inner_width);
-            uint16_t y2 = CLAMP( (y - (i->y+offset)), 0,  i->inner_height);
+            x2 = CLAMP( (x - (i->x+offset)), 0,  i->inner_width);
+            y2 = CLAMP( (y - (i->y+offset)), 0,  i->inner_height);
             
             /* check if the pixel is transparent (255) */
             if(WINDOW_GET_PIXEL(i, x2, y2) == 255 && HAS_FLAG(i->flags, GFX_IS_TRANSPARENT)){
                 continue;
             }
 
-            /* on click when left mouse down */
-            if((flags & MOUSE_LEFT) && wm->mouse_state == 0){
-                wm->mouse_state = 1;
-                i->ops->mousedown(i, x, y);
-                
-                /* If clicked window is not in front, push it. */
-                if(i != wm->windows){
-                    wm->ops->push_front(wm, i);
-                }
-
-            } else if(!(flags & MOUSE_LEFT) && wm->mouse_state == 1) {
-                /* If mouse state is "down" send click event */
-                wm->mouse_state = 0;
-                i->ops->click(i, x, y);
-                i->ops->mouseup(i, x, y);
-
-                /* Send mouse event */
-                struct gfx_event e = {
-                    .data = x2,
-                    .data2 = y2,
-                    .event = GFX_EVENT_MOUSE
-                };
-                gfx_push_event(i, &e);
-            }
-
-            /* always send a hover event */
-            i->ops->hover(i, x, y);
-
-            return ERROR_OK;
+            target = i;
+            inside = 1;
+            break;
         }
         /**
          * @brief Special edge case:
@@ -360,11 +376,54 @@ static int wm_default_mouse_event(struct windowmanager* wm, int x, int y, char f
          * and the mouse is not in the window, the window should snap to the mouse.
          */
         if(i->is_moving.state == GFX_WINDOW_MOVING){
-            i->ops->hover(i, x, y);
-            return ERROR_OK;
+            target = i;
+            break;
         }
     }
 
+    if(target == NULL){
+        read_unlock(&wm->lock);
+        return ERROR_OK;
+    }
+
+    /* The target is pinned so it is not freed if it is removed while its handlers run unlocked */
+    kref_get(&target->_krefs);
+    read_unlock(&wm->lock);
+
+    if(inside){
+        /* on click when left mouse down */
+        if((flags & MOUSE_LEFT) && wm->mouse_state == 0){
+            wm->mouse_state = 1;
+            target->ops->mousedown(target, x, y);
+            
+            /* If clicked window is not in front, push it. It may have been removed in the meantime. */
+            write_lock(&wm->lock);
+            if(__wm_contains(wm, target)){
+                __wm_push_front(wm, target);
+            }
+            write_unlock(&wm->lock);
+
+        } else if(!(flags & MOUSE_LEFT) && wm->mouse_state == 1) {
+            /* If mouse state is "down" send click event */
+            wm->mouse_state = 0;
+            target->ops->click(target, x, y);
+            target->ops->mouseup(target, x, y);
+
+            /* Send mouse event */
+            struct gfx_event e = {
+                .data = x2,
+                .data2 = y2,
+                .event = GFX_EVENT_MOUSE
+            };
+            gfx_push_event(target, &e);
+        }
+    }
+
+    /* always send a hover event */
+    target->ops->hover(target, x, y);
+
+    gfx_window_put(target);
+
     return ERROR_OK;
 }
 
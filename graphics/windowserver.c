@@ -10,6 +10,7 @@
  */
 
 #include <gfx/windowserver.h>
+#include <gfx/composition.h>
 #include <keyboard.h>
 #include <gfx/gfxlib.h>
 #include <scheduler.h>
@@ -326,7 +327,9 @@ static int ws_draw(struct windowserver* ws)
     if((ws->window_changes || mouse_changed ) && !ws->_is_fullscreen){
         memcpy(ws->_wm->composition_buffer, ws->background, ws->_wm->composition_buffer_size);
 
+        read_lock(&ws->_wm->lock);
         ws->_wm->ops->draw(ws->_wm, ws->_wm->windows);
+        read_unlock(&ws->_wm->lock);
         vesa_put_icon16(ws->_wm->composition_buffer, ws->m.x, ws->m.y);
     }
 
@@ -343,6 +346,11 @@ static int ws_draw(struct windowserver* ws)
         /* internal mouse event for windows */
         ws->_wm->ops->mouse_event(ws->_wm, ws->m.x, ws->m.y, ws->m.flags);
     }
+
+    /* Nothing changed, instead of polling sleep until input arrives or the next frame is due */
+    if(!mouse_changed && !ws->window_changes && key == 0){
+        gfx_compositor_idle(ws->sleep_time);
+    }
     //vesa_put_icon16((uint8_t*)vbe_info->framebuffer, ws->m.x, ws->m.y);
 
     return ERROR_OK;
@@ -384,6 +392,7 @@ static int ws_destroy(struct windowserver* ws)
     }
 
     ws->_wm->ops->destroy(ws->_wm);
+    pfree(ws->background);
 
     kfree(ws);
     return ERROR_OK;
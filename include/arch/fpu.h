@@ -0,0 +1,31 @@
+#ifndef __FPU_H
+#define __FPU_H
+
+/**
+ * @file fpu.h
+ * @author Joe Bayer (joexbayer)
+ * @brief Lazy FPU context switching.
+ * @version 0.1
+ * @date 2024-03-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <stdint.h>
+
+#define CR0_TS (1 << 3)
+
+/* Device not available, raised by FPU instructions while CR0.TS is set */
+#define FPU_TRAP_VECTOR 7
+
+struct cpu;
+struct pcb;
+
+void init_fpu();
+void fpu_switch(struct cpu* cpu, struct pcb* next);
+void fpu_trap();
+int fpu_is_loaded(struct pcb* pcb);
+void fpu_release(struct pcb* pcb);
+
+#endif /* !__FPU_H */
@@ -11,12 +11,16 @@
 #define GDT_PROCESS_CODE            3
 #define GDT_PROCESS_DATA            4
 #define GDT_TSS_INDEX               5
+#define GDT_CPU_INDEX               6
+#define GDT_ENTRIES                 7
 
 #define GDT_KERNEL_CS               (GDT_KERNEL_CODE << 3)
 #define GDT_KERNEL_DS               (GDT_KERNEL_DATA << 3)
 #define GDT_PROCESS_CS              (GDT_PROCESS_CODE << 3)
 #define GDT_PROCESS_DS              (GDT_PROCESS_DATA << 3)
 #define GDT_KERNEL_TSS              (GDT_TSS_INDEX << 3)
+/* Per processor data segment, based at the struct cpu of the processor (loaded in fs) */
+#define GDT_CPU_DS                  (GDT_CPU_INDEX << 3)
 
 #define GDT_CODE_SEGMENT            0x0A
 #define GDT_DATA_SEGMENT            0x02
@@ -28,7 +32,8 @@
 #define TSS_SIZE                    103
 
 
-void init_gdt();
+struct cpu;
+void init_gdt(struct cpu* cpu);
 
 struct gdt_segment {
     uint16_t limit_lo;
@@ -5,7 +5,11 @@
 #include <syscalls.h>
 #include <arch/io.h>
 
-#define ISR_LINES	49
+#define ISR_LINES	57
+
+/* Vectors handed out for message signalled interrupts, see interrupt_alloc_vector */
+#define INTERRUPT_MSI_BASE	53
+#define INTERRUPT_MSI_VECTORS	4
 #define PIC1		0x20		/* IO base address for master PIC */
 #define PIC2		0xA0		/* IO base address for slave PIC */
 #define PIC1_DATA	(PIC1+1)
@@ -24,6 +28,7 @@ struct registers
 };
 
 void init_interrupts();
+void interrupt_load_idt();
 void load_data_segments(int seg);
 void _syscall_entry(void);
 void page_fault_interrupt(unsigned long cr2, unsigned long err);
@@ -105,11 +110,23 @@ extern void isr44(struct registers*);
 extern void isr45(struct registers*);
 extern void isr46(struct registers*);
 extern void isr47(struct registers*);
-
-int system_call(int index, int arg1, int arg2, int arg3);
+extern void isr49(struct registers*);
+extern void isr50(struct registers*);
+extern void isr51(struct registers*);
+extern void isr52(struct registers*);
+extern void isr53(struct registers*);
+extern void isr54(struct registers*);
+extern void isr55(struct registers*);
+extern void isr56(struct registers*);
+extern void isr255(struct registers*);
+
+int system_call(int index, int arg1, int arg2, int arg3, uintptr_t eip);
 void _page_fault_entry(void);
 
 int interrupt_get_count(int interrupt);
+const char* interrupt_get_name(int interrupt);
+int interrupt_ioapic_enabled();
+int interrupt_alloc_vector(const char* name);
 
 void isr_handler(struct registers regs);
 void interrupt_install_handler(int i, void (*handler)());
@@ -0,0 +1,26 @@
+#ifndef __IOAPIC_H
+#define __IOAPIC_H
+
+/**
+ * @file ioapic.h
+ * @author Joe Bayer (joexbayer)
+ * @brief IO APIC driver, routes device interrupts to the local APIC of a processor.
+ * @version 0.1
+ * @date 2024-03-23
+ * @see https://wiki.osdev.org/IOAPIC
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <stdint.h>
+#include <errors.h>
+
+/* ISA lines keep the vectors they had on the PIC */
+#define IOAPIC_IRQ_VECTOR(irq) (32 + (irq))
+
+error_t init_ioapic();
+int ioapic_pin_count();
+void ioapic_route(int pin, uint8_t vector, uint8_t apic_id, int level, int active_low);
+void ioapic_mask(int pin);
+
+#endif /* !__IOAPIC_H */
@@ -0,0 +1,64 @@
+#ifndef __LAPIC_H
+#define __LAPIC_H
+
+/**
+ * @file lapic.h
+ * @author Joe Bayer (joexbayer)
+ * @brief Local APIC driver, interprocessor interrupts and the per processor timer.
+ * @version 0.1
+ * @date 2024-03-02
+ * @see https://wiki.osdev.org/APIC
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <stdint.h>
+#include <errors.h>
+
+#define LAPIC_DEFAULT_BASE  0xFEE00000
+
+/* Registers, offsets from the base */
+#define LAPIC_ID            0x20
+#define LAPIC_TPR           0x80
+#define LAPIC_EOI           0xB0
+#define LAPIC_SVR           0xF0
+#define LAPIC_ESR           0x280
+#define LAPIC_ICR_LOW       0x300
+#define LAPIC_ICR_HIGH      0x310
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_LVT_LINT0     0x350
+#define LAPIC_LVT_LINT1     0x360
+#define LAPIC_LVT_ERROR     0x370
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+/* Interrupt vectors, above the PIC lines and the system call */
+#define LAPIC_TIMER_VECTOR          49
+#define LAPIC_RESCHEDULE_VECTOR     50
+#define LAPIC_TLB_VECTOR            51
+/* Asks the bootstrap processor to restart its stopped tick, see timer.c */
+#define LAPIC_TICK_VECTOR           52
+#define LAPIC_SPURIOUS_VECTOR       0xFF
+
+error_t init_lapic(uint32_t base);
+int lapic_present();
+void lapic_enable(int bsp);
+void lapic_mask_lint0();
+uint8_t lapic_id();
+void lapic_eoi();
+
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector);
+void lapic_send_ipi_others(uint8_t vector);
+void lapic_send_init(uint8_t apic_id);
+void lapic_send_startup(uint8_t apic_id, uint8_t page);
+
+void lapic_timer_calibrate();
+void lapic_timer_start(int hz);
+void lapic_timer_oneshot(uint32_t count);
+uint32_t lapic_timer_current();
+uint32_t lapic_timer_period(int hz);
+uint32_t lapic_tsc_rate();
+void lapic_udelay(int us);
+
+#endif /* !__LAPIC_H */
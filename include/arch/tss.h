@@ -4,8 +4,6 @@
 
 #include <stdint.h>
 
-extern struct tss_entry tss;
-
 struct tss_entry {
     uint32_t prev_tss;
     uint32_t esp_0;
@@ -46,6 +44,7 @@ struct tss_entry {
     uint16_t iomap_base;
 } __attribute ((packed));
 
-void init_tss(void);
+struct cpu;
+void init_tss(struct cpu* cpu);
 
 #endif /* D4781427_7B1A_42F6_B2FD_197266BEA979 */
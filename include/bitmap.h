@@ -16,4 +16,29 @@ int get_bitmap_size(int n);
 int bitmap_get_continous(bitmap_t b, int n, int size);
 int bitmap_unset_continous(bitmap_t b, int start, int size);
 
+/**
+ * @brief Two level bitmap used by the in memory allocators.
+ * A bit set in words marks a used entry, a bit set in summary marks a full word.
+ */
+struct hbitmap {
+    uint32_t* words;
+    uint32_t* summary;
+    int bits;
+    int nwords;
+    int nsummary;
+    int hint;
+    int used;
+};
+
+int hbitmap_storage_size(int n);
+void hbitmap_init(struct hbitmap* map, void* storage, int n);
+struct hbitmap* hbitmap_create(int n);
+void hbitmap_destroy(struct hbitmap* map);
+
+int hbitmap_alloc(struct hbitmap* map);
+int hbitmap_alloc_range(struct hbitmap* map, int size);
+void hbitmap_free(struct hbitmap* map, int i);
+void hbitmap_free_range(struct hbitmap* map, int start, int size);
+int hbitmap_test(struct hbitmap* map, int i);
+
 #endif /* BITMAP_H */
@@ -0,0 +1,57 @@
+#ifndef _ELF_H
+#define _ELF_H
+
+#include <stdint.h>
+
+/**
+ * @brief ELF32 executables
+ * Only the parts needed to load statically linked i386 programs:
+ * the file header and the program headers describing the segments.
+ * | ELF header | Program headers | Segments ... | Section headers |
+ */
+
+#define ELF_MAGIC           0x464C457F  /* "\x7fELF" read as a little endian word */
+#define ELF_CLASS_32        1
+#define ELF_DATA_LSB        1
+#define ELF_TYPE_EXEC       2
+#define ELF_MACHINE_386     3
+
+#define ELF_PT_LOAD         1
+
+#define ELF_PF_X            (1 << 0)
+#define ELF_PF_W            (1 << 1)
+#define ELF_PF_R            (1 << 2)
+
+struct elf_header {
+    uint32_t magic;                 /* 4 bytes - ELF_MAGIC */
+    uint8_t class;                  /* 1 byte - 32 or 64 bit */
+    uint8_t data;                   /* 1 byte - Endianness */
+    uint8_t ident_version;          /* 1 byte - ELF version */
+    uint8_t ident_pad[9];           /* 9 bytes - OS ABI and padding */
+    uint16_t type;                  /* 2 bytes - Relocatable, executable, shared... */
+    uint16_t machine;               /* 2 bytes - Target architecture */
+    uint32_t version;               /* 4 bytes - ELF version */
+    uint32_t entry;                 /* 4 bytes - Virtual address of the entry point */
+    uint32_t phoff;                 /* 4 bytes - File offset of the program headers */
+    uint32_t shoff;                 /* 4 bytes - File offset of the section headers */
+    uint32_t flags;                 /* 4 bytes - Architecture specific flags */
+    uint16_t ehsize;                /* 2 bytes - Size of this header */
+    uint16_t phentsize;             /* 2 bytes - Size of one program header */
+    uint16_t phnum;                 /* 2 bytes - Number of program headers */
+    uint16_t shentsize;             /* 2 bytes - Size of one section header */
+    uint16_t shnum;                 /* 2 bytes - Number of section headers */
+    uint16_t shstrndx;              /* 2 bytes - Section name string table index */
+}__attribute__((packed));
+
+struct elf_program_header {
+    uint32_t type;                  /* 4 bytes - Segment type, only ELF_PT_LOAD is used */
+    uint32_t offset;                /* 4 bytes - File offset of the segment */
+    uint32_t vaddr;                 /* 4 bytes - Virtual address of the segment */
+    uint32_t paddr;                 /* 4 bytes - Physical address, unused */
+    uint32_t filesz;                /* 4 bytes - Bytes of the segment in the file */
+    uint32_t memsz;                 /* 4 bytes - Bytes of the segment in memory, the rest is zeroed (bss) */
+    uint32_t flags;                 /* 4 bytes - ELF_PF_* permissions */
+    uint32_t align;                 /* 4 bytes - Alignment */
+}__attribute__((packed));
+
+#endif /* _ELF_H */
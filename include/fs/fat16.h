@@ -73,6 +73,9 @@ struct fat16_directory_entry {
     uint32_t file_size;                 /* 4 bytes - File size in bytes */
 } __attribute__((packed));
 
+/* created_time and created_date sit where FAT keeps the last write time, they are updated on write. */
+#define FAT16_MTIME(entry) (((uint32_t)(entry).created_date << 16) | (entry).created_time)
+
 struct fat16_file_identifier {
     int16_t directory;
     int16_t index;
@@ -82,6 +85,8 @@ struct fat16_file_identifier {
 uint16_t get_fat_start_block(void);
 uint16_t get_root_directory_start_block(void);
 uint16_t get_data_start_block();
+void fat16_table_read_lock(void);
+void fat16_table_read_unlock(void);
 uint16_t fat16_get_fat_entry(uint32_t cluster);
 void fat16_set_fat_entry(uint32_t cluster, uint16_t value);
 void fat16_sync_fat_table(void);
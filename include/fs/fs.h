@@ -26,6 +26,8 @@ struct file {
     int identifier;
     int directory;
     int size;
+    /* time of last write, packed as (date << 16) | time */
+    uint32_t mtime;
 };
 
 /* none of the functions can ever be NULL */
@@ -69,6 +71,7 @@ int fs_register(struct filesystem* fs);
 int fs_unregister(struct filesystem* fs);
 
 int fs_load_from_file(const char* file, void* buf, int size);
+int fs_stat(const char* path, struct file* file);
 int fs_save_to_file(const char* file, void* buf, int size);
 
 struct file* fs_alloc_file();
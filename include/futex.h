@@ -0,0 +1,27 @@
+#ifndef __FUTEX_H
+#define __FUTEX_H
+
+/**
+ * @file futex.h
+ * @author Joe Bayer (joexbayer)
+ * @brief Wait and wake on user memory words, the slow path of userspace locks.
+ * @version 0.1
+ * @date 2024-03-16
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <stdint.h>
+#include <errors.h>
+
+/* Wait queues futexes are hashed into by physical address */
+#define FUTEX_BUCKETS 32
+
+/* Wakes all waiters of the futex */
+#define FUTEX_WAKE_ALL 0x7FFFFFFF
+
+error_t futex_wait(int* addr, int expected);
+int futex_wake(int* addr, int count);
+
+#endif /* !__FUTEX_H */
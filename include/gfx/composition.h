@@ -9,6 +9,8 @@ void gfx_composition_remove_window(struct window* w);
 int gfx_decode_background_image(const char* file);
 
 void gfx_compositor_main();
+void gfx_compositor_wake();
+void gfx_compositor_idle(int ticks);
 void gfx_set_fullscreen(struct window* w);
 int gfx_raw_background(char* path);
 int gfx_set_background_color(color_t color);
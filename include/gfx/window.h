@@ -81,6 +81,8 @@ struct window {
         struct gfx_event list[GFX_MAX_EVENTS];
         uint8_t head;
         uint8_t tail;
+        /* owner waiting in gfx_event_loop */
+        waitqueue_t waiters;
     } events;
 
     struct {
@@ -102,6 +104,8 @@ struct window {
 
     struct pcb* owner;
     spinlock_t spinlock;
+    /* held by the window list and by event dispatch, freed with the last reference */
+    struct kref _krefs;
 
     byte_t in_focus;
     
@@ -120,6 +124,7 @@ struct window* gfx_new_window(int width, int height, window_flag_t flags);
 
 void gfx_draw_window(uint8_t* buffer, struct window* window);
 int gfx_destory_window(struct window* w);
+void gfx_window_put(struct window* w);
 void gfx_window_set_resizable();
 
 
@@ -9,7 +9,8 @@
 
 #include <mouse.h>
 
-#define WINDOW_SERVER_SLEEP_TIME 2
+/* Ticks the compositor sleeps while nothing changes, input wakes it earlier. About 60 frames per second. */
+#define WINDOW_SERVER_SLEEP_TIME 16
 #define WS_VALIDATE(ws) if((ws)->ops == NULL || (ws)->ops->add == NULL || (ws)->ops->remove == NULL || (ws)->ops->draw == NULL) { return -ERROR_OPS_CORRUPTED; }
 #define WS_VALIDATE_FLAGS(ws) if((ws)->flags & ~(WINDOW_SERVER_INITIALIZED)) { return -ERROR_INVALID_ARGUMENTS; }
 
@@ -10,6 +10,9 @@
 #define PCB_MAX_PROCESSES 32
 #define PCB_MAX_THREADS 32
 
+/* Worker threads started for the kernel work queue */
+#define WORK_WORKERS 2
+
 /**
  * @brief Debug defines
  * 
@@ -42,6 +45,15 @@
 
 #define KERNEL_PANIC_ON_PAGE_FAULT
 
+/* Lock contention statistics, see lockstat.h and the lockstat shell command */
+//#define LOCKSTAT
+
+/* Save and restore the FPU on every context switch instead of on first use, see fpu.c */
+//#define FPU_EAGER
+
+/* Keep device interrupts and the tick on the PIC and PIT even if there is an IO APIC, see ioapic.c */
+//#define LEGACY_PIC
+
 
 
 
@@ -0,0 +1,45 @@
+#ifndef __KMEMTRACE_H
+#define __KMEMTRACE_H
+
+#include <stdint.h>
+#include <errors.h>
+
+/**
+ * @brief Allocation tracing
+ * When enabled every kalloc/kfree, vmem frame and user heap block is recorded
+ * with the address of its caller, its size and the pid it was allocated for.
+ * Records live in fixed size tables so tracing never allocates memory itself.
+ */
+
+#define KMEMTRACE_MAX_ALLOCATIONS   2048
+#define KMEMTRACE_MAX_SITES         256
+
+typedef enum __kmemtrace_kind {
+    KMEMTRACE_KALLOC,
+    KMEMTRACE_FRAME,
+    KMEMTRACE_HEAP,
+    KMEMTRACE_KINDS
+} kmemtrace_kind_t;
+
+struct kmemtrace_site_info {
+    uintptr_t caller;
+    kmemtrace_kind_t kind;
+    int live_bytes;
+    int live_allocations;
+    int total_allocations;
+    /* allocations still live when the owning process exited */
+    int leaks;
+};
+
+void kmemtrace_enable(int enable);
+int kmemtrace_enabled();
+void kmemtrace_clear();
+
+void kmemtrace_alloc(kmemtrace_kind_t kind, void* ptr, int size, uintptr_t caller, int pid);
+void kmemtrace_free(kmemtrace_kind_t kind, void* ptr, int pid);
+int kmemtrace_process_exit(int pid);
+
+int kmemtrace_top_sites(struct kmemtrace_site_info* sites, int max);
+int kmemtrace_dropped();
+
+#endif /* !__KMEMTRACE_H */
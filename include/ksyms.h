@@ -6,6 +6,7 @@
 
 void ksyms_add_symbol(const char* name, uintptr_t addr);
 uintptr_t ksyms_resolve_symbol(const char* name);
+const char* ksyms_resolve_addr(uintptr_t addr, uintptr_t* offset);
 void ksyms_list(void);
 int ksyms_init(void);
 
@@ -13,6 +13,7 @@ void tcpd();
 void image_viewer();
 
 error_t start(char* name, int argc, char* argv[]);
+error_t start_class(char* name, int argc, char* argv[], int class);
 error_t register_kthread(void (*f)(), char* name);
 void kthread_entry(int argc, char* args[]);
 
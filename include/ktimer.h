@@ -0,0 +1,44 @@
+#ifndef __KTIMER_H
+#define __KTIMER_H
+
+#include <stdint.h>
+#include <errors.h>
+
+/**
+ * @brief Kernel timers
+ * Timers are kept in a hierarchical timer wheel advanced by the PIT interrupt,
+ * adding, cancelling and expiring a timer is O(1). Timers are embedded in their
+ * owner, so arming one never allocates.
+ * Callbacks run in interrupt context with interrupts disabled and must not block.
+ */
+
+/* First level has one slot per tick, each further level covers 64 slots of the level below */
+#define KTIMER_ROOT_BITS    8
+#define KTIMER_LEVEL_BITS   6
+#define KTIMER_ROOT_SIZE    (1 << KTIMER_ROOT_BITS)
+#define KTIMER_LEVEL_SIZE   (1 << KTIMER_LEVEL_BITS)
+#define KTIMER_LEVELS       4
+
+typedef void (*ktimer_fn_t)(void* arg);
+
+struct ktimer {
+    uint32_t expires;
+    ktimer_fn_t callback;
+    void* arg;
+
+    /* slot the timer is linked into, NULL if it is not pending */
+    struct ktimer** slot;
+    struct ktimer* next;
+    struct ktimer* prev;
+};
+
+void ktimer_init(struct ktimer* timer, ktimer_fn_t callback, void* arg);
+error_t ktimer_add(struct ktimer* timer, int ticks);
+int ktimer_cancel(struct ktimer* timer);
+int ktimer_pending(struct ktimer* timer);
+
+void ktimer_tick();
+uint32_t ktimer_now();
+int ktimer_next_expiry(int max);
+
+#endif /* !__KTIMER_H */
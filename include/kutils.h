@@ -18,6 +18,38 @@
 #define lcr0(val) __asm__ __volatile__ ("mov %0, %%cr0" : : "r" (val))
 #define lcr3(val) __asm__ __volatile__ ("mov %0, %%cr3" : : "r" (val))
 #define lcr4(val) __asm__ __volatile__ ("mov %0, %%cr4" : : "r" (val))
+static inline unsigned int rcr0()
+{
+    unsigned int cr0;
+    __asm__ __volatile__ ("mov %%cr0, %0" : "=r" (cr0));
+    return cr0;
+}
+static inline unsigned int rcr3()
+{
+    unsigned int cr3;
+    __asm__ __volatile__ ("mov %%cr3, %0" : "=r" (cr3));
+    return cr3;
+}
+static inline unsigned int rcr4()
+{
+    unsigned int cr4;
+    __asm__ __volatile__ ("mov %%cr4, %0" : "=r" (cr4));
+    return cr4;
+}
+
+#define CR4_PSE (1 << 4)
+#define CR4_PGE (1 << 7)
+
+/* Feature flags returned in edx by cpuid leaf 1 */
+static inline unsigned int cpuid_edx(unsigned int leaf)
+{
+    unsigned int eax = leaf, ebx, ecx = 0, edx;
+    __asm__ __volatile__ ("cpuid" : "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx));
+    return edx;
+}
+#define CPUID_EDX_PSE (1 << 3)
+#define CPUID_EDX_APIC (1 << 9)
+#define CPUID_EDX_PGE (1 << 13)
 
 /* get / set gs register */
 #define get_gs() ({ unsigned int gs; __asm__ __volatile__ ("mov %%gs, %0" : "=r" (gs)); gs; })
@@ -79,18 +111,15 @@ void init_kctors();
 
 typedef volatile int signal_value_t;
 
-/* exeception to the exernal naming as its never supposed to be accessed without macro. */
-extern int __cli_cnt;
-
+/**
+ * Critical sections disable interrupts and exclude critical sections on all other processors.
+ * They nest, interrupts are enabled again when the outermost critical section is left.
+ */
 #define ENTER_CRITICAL()\
-    __cli_cnt++;\
-    asm ("cli");\
+    critical_enter();\
 
 #define LEAVE_CRITICAL()\
-    __cli_cnt--;\
-    if(__cli_cnt == 0){\
-        asm ("sti");\
-    }\
+    critical_leave();\
 
 
 #define HLT() asm ("hlt")
@@ -134,7 +163,7 @@ extern int __cli_cnt;
         LEAVE_CRITICAL(); \
     } while (0)
     
-#define ASSERT_CRITICAL() assert(__cli_cnt > 0)
+#define ASSERT_CRITICAL() assert(critical_depth() > 0)
 
 typedef enum {
     false = 0,
@@ -28,8 +28,15 @@ void* malloc(int size);
 void free(void* ptr);
 
 int thread_create(void* entry, void* arg, int flags);
+int thread_join(int id);
 void yield();
 
+int futex_wait(volatile int* addr, int expected);
+int futex_wake(volatile int* addr, int count);
+
+struct pcb_stats;
+int process_stats(int pid, struct pcb_stats* stats);
+
 
 #ifdef __cplusplus
 }
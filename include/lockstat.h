@@ -0,0 +1,57 @@
+#ifndef __LOCKSTAT_H
+#define __LOCKSTAT_H
+
+/**
+ * @file lockstat.h
+ * @author Joe Bayer (joexbayer)
+ * @brief Lock contention statistics, enabled with LOCKSTAT in kconfig.h.
+ * Locks are grouped in classes named after their declaration, so all
+ * socket locks count as one. Times are in TSC cycles.
+ * @version 0.1
+ * @date 2024-03-09
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <stdint.h>
+#include <errors.h>
+#include <sync.h>
+
+#define LOCKSTAT_CLASSES 64
+#define LOCKSTAT_SPINLOCKS 256
+#define LOCKSTAT_NAME_LENGTH 32
+
+struct lock_class {
+    const char* name;
+    /* protects the counters, classes are shared by many locks */
+    spinlock_t lock;
+    uint32_t acquisitions;
+    uint32_t contended;
+    uint64_t wait;
+    uint64_t hold_max;
+};
+
+struct lockstat_info {
+    char name[LOCKSTAT_NAME_LENGTH];
+    uint32_t acquisitions;
+    uint32_t contended;
+    /* in units of 1024 cycles */
+    uint32_t wait;
+    uint32_t hold_max;
+};
+
+struct lock_class* lockstat_class(const char* name);
+void lockstat_spinlock(spinlock_t* lock, const char* name);
+
+void lockstat_acquired(struct lock_class* lclass, uint64_t start, int contended);
+void lockstat_released(struct lock_class* lclass, uint64_t held_since);
+void lockstat_spin_acquired(spinlock_t* lock, uint64_t start, int contended);
+void lockstat_spin_released(spinlock_t* lock);
+void lockstat_kernel_acquired(uint64_t start, int contended);
+void lockstat_kernel_released();
+
+error_t lockstat_get_info(int index, struct lockstat_info* info);
+void lockstat_reset();
+
+#endif /* !__LOCKSTAT_H */
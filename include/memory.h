@@ -23,6 +23,13 @@ extern int kernel_size;
 #define VMEM_STACK          0xEFFFFFF0
 #define VMEM_HEAP           0xE0000000
 #define VMEM_DATA           0x1000000
+/* Program segments can be placed anywhere from VMEM_DATA up to the heap. */
+#define VMEM_DATA_LIMIT     VMEM_HEAP
+
+/* User stack grows down on demand from VMEM_STACK, the page below VMEM_STACK_LIMIT is a guard page. */
+#define VMEM_STACK_TOP      ((VMEM_STACK & ~PAGE_MASK) + PAGE_SIZE)
+#define VMEM_STACK_PAGES    64
+#define VMEM_STACK_LIMIT    (VMEM_STACK_TOP - VMEM_STACK_PAGES*PAGE_SIZE)
 
 #define SUPERVISOR          0
 #define PRESENT             1
@@ -31,6 +38,17 @@ extern int kernel_size;
 
 #define WRITE_THROUGH       8
 #define ACCESSED            32
+/* Directory entry maps a 4MB page (PSE) */
+#define PAGE_LARGE          0x80
+/* Not flushed from the TLB on CR3 reloads (PGE) */
+#define PAGE_GLOBAL         0x100
+/* Available bit marking a read-only page shared with a program image */
+#define PAGE_COW            0x200
+
+/* Page fault error code bits */
+#define PAGE_FAULT_PRESENT  1
+#define PAGE_FAULT_WRITE    2
+#define PAGE_FAULT_USER     4
 
 #define PAGE_DIRECTORY_BITS 22
 #define PAGE_TABLE_BITS     12
@@ -52,7 +70,14 @@ struct mem_info {
 	struct permanent {
 		int used;
 		int total;
+		int free_blocks;
+		int largest_free;
+		int fragmentation;
 	}permanent;
+	struct slab {
+		int used;
+		int total;
+	}slab;
 };
 
 struct memory_map {
@@ -77,29 +102,116 @@ struct memory_map {
 struct memory_map* memory_map_get();
 
 
-struct vmem_page_region {
-	int* bits;
-	uint32_t* basevaddr;
-	int refs;
-
-	int size;
-	int used;
-};
+#define VMEM_HEAP_SIZE 			(PAGE_SIZE*1024)
+#define VMEM_HEAP_PAGES 		(VMEM_HEAP_SIZE/PAGE_SIZE)
+#define VMEM_HEAP_ALIGN 		16
+#define VMEM_HEAP_SMALL_LIMIT 	256
+#define VMEM_HEAP_SMALL_CLASSES (VMEM_HEAP_SMALL_LIMIT/VMEM_HEAP_ALIGN)
+#define VMEM_HEAP_CLASSES 		30
+#define VMEM_HEAP_BUCKETS 		256
+/* Frames unmapped under the heap spinlock before they are freed outside of it */
+#define VMEM_HEAP_FREE_BATCH 	32
 
 struct virtual_allocations {
+	/* all blocks, ordered by address */
 	struct allocation* head;
-	struct allocation* tail;
+
+	/* segregated free lists, bit n of free_map is set if free[n] is not empty */
+	struct allocation* free[VMEM_HEAP_CLASSES];
+	uint32_t free_map;
+
+	/* allocated blocks by address */
+	struct allocation* hash[VMEM_HEAP_BUCKETS];
+
+	/* number of blocks using each heap page */
+	uint16_t* page_refs;
+
+	/* stats */
+	int allocated_bytes;
+	int allocated_blocks;
+	int free_bytes;
+	int free_blocks;
+	int mapped_pages;
+
+	/* process owning the heap, threads share it and its blocks are traced under this pid */
+	int pid;
 
 	spinlock_t spinlock;
+	/* serializes page faults of the threads sharing the address space */
+	semaphore_t fault_lock;
 };
 
 struct allocation {
-	int* bits;
 	uint32_t* address;
 	int size;
 	int used;
-	struct vmem_page_region* region;
+	struct allocation* prev;
 	struct allocation* next;
+	struct allocation* fprev;
+	struct allocation* fnext;
+	struct allocation* hnext;
+};
+
+struct vmem_heap_info {
+	int allocated_bytes;
+	int allocated_blocks;
+	int free_bytes;
+	int free_blocks;
+	int largest_free;
+	int mapped_pages;
+	int fragmentation;
+};
+
+/* Pre-zeroed frames kept by vmem_default, refilled by the idle task below the low watermark */
+#define VMEM_ZERO_POOL_SIZE 	64
+#define VMEM_ZERO_POOL_LOW 		16
+#define VMEM_ZERO_POOL_CHUNK 	4
+
+struct vmem_zero_pool_info {
+	int count;
+	int size;
+	int hits;
+	int misses;
+};
+
+/* Permanent memory is handed out in blocks of up to 2^PMEM_MAX_ORDER pages */
+#define PMEM_MAX_ORDER 			10
+
+struct pmem_info {
+	int used;
+	int total;
+	int free_blocks;
+	int largest_free;
+	int fragmentation;
+};
+
+#define KMEM_MAX_CACHES 		16
+#define KMEM_CACHE_NAME_LENGTH 	16
+#define KMEM_SLAB_SIZE 			4096
+#define KMEM_SLAB_MIN_OBJECTS 	4
+
+struct kmem_cache {
+	char name[KMEM_CACHE_NAME_LENGTH];
+	int size;
+	int per_slab;
+
+	void* freelist;
+	struct kmem_slab* slabs;
+
+	/* stats */
+	int slab_count;
+	int total;
+	int active;
+
+	spinlock_t spinlock;
+};
+
+struct kmem_cache_info {
+	char name[KMEM_CACHE_NAME_LENGTH];
+	int size;
+	int active;
+	int total;
+	int slabs;
 };
 
 #define TABLE_INDEX(vaddr) ((vaddr >> PAGE_TABLE_BITS) & PAGE_TABLE_MASK)
@@ -118,9 +230,20 @@ void kfree(void* ptr);
 int kmemory_used();
 int kmemory_total();
 
+/* Slab object caches */
+struct kmem_cache* kmem_cache_create(char* name, int size);
+void* kmem_cache_alloc(struct kmem_cache* cache);
+void* kmem_cache_zalloc(struct kmem_cache* cache);
+void kmem_cache_free(struct kmem_cache* cache, void* ptr);
+error_t kmem_cache_get_info(int index, struct kmem_cache_info* info);
+void kmem_cache_usage(int* used, int* total);
+
 /* Permanent memory */
+void pmem_init(uintptr_t from, uintptr_t to);
 void* palloc(int size);
+void pfree(void* ptr);
 int pmemory_used();
+error_t pmem_get_info(struct pmem_info* info);
 
 /* Userspace memory */
 void* malloc(unsigned int size);
@@ -129,18 +252,32 @@ void free(void* ptr);
 /* Assembly helper functions */
 void load_page_directory();
 void enable_paging();
+void tlb_flush_addr(uint32_t addr);
 
 /* Virtual memory API */
 void vmem_map_driver_region(uint32_t addr, int size);
 void vmem_init_kernel();
+void vmem_enable_global_pages();
 
 void vmem_cleanup_process(struct pcb* pcb);
 void vmem_cleanup_process_thead(struct pcb* thread);
 
 void vmem_init_process_thread(struct pcb* parent, struct pcb* thread);
-void vmem_init_process(struct pcb* pcb, byte_t* data, int size);
+struct program_image;
+void vmem_init_process(struct pcb* pcb, struct program_image* image);
+uint32_t* vmem_alloc_frame();
+uint32_t* vmem_alloc_zeroed_frame();
+void vmem_free_frame(void* frame);
+int vmem_zero_pool_refill(int max);
+error_t vmem_zero_pool_get_info(struct vmem_zero_pool_info* info);
 void vmem_stack_free(struct pcb* pcb, void* ptr);
-void* vmem_stack_alloc(struct pcb* pcb, int size);
+void* vmem_stack_alloc(struct pcb* pcb, int size, uintptr_t caller);
+struct virtual_allocations* vmem_heap_create(int pid);
+error_t vmem_page_fault(struct pcb* pcb, uint32_t addr, uint32_t err);
+error_t vmem_populate(struct pcb* pcb, uint32_t addr, int size);
+error_t vmem_fault_writable(struct pcb* pcb, uint32_t addr);
+error_t vmem_get_physical(struct pcb* pcb, uint32_t addr, uint32_t* physical);
+error_t vmem_heap_get_info(struct pcb* pcb, struct vmem_heap_info* info);
 void vmem_dump_heap(struct allocation* allocation);
 
 int vmem_total_usage();
@@ -40,6 +40,8 @@ struct networkmanager {
     uint8_t if_count;
 
     struct pcb* instance;
+    /* netd waits here for packets to send or receive */
+    waitqueue_t waiters;
 
     struct kref ref;
 };
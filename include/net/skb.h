@@ -61,17 +61,23 @@ void skb_free_queue(struct skb_queue* queue);
 struct sk_buff* skb_new();
 void skb_free(struct sk_buff* skb);
 
+#define SKB_DATA_SIZE 0x600
+
+/* Object caches for sk_buff structs and their data buffers, see skb.c */
+extern struct kmem_cache* skb_cache;
+extern struct kmem_cache* skb_data_cache;
+
 #define ALLOCATE_SKB(skb)               \
-    (skb)->data = kalloc(0x600);         \
-    memset((skb)->data, 0, 0x600);       \
+    (skb)->data = kmem_cache_alloc(skb_data_cache); \
+    memset((skb)->data, 0, SKB_DATA_SIZE); \
     (skb)->head = skb->data;            \
     (skb)->tail = skb->head;            \
-    (skb)->end = skb->head+0x600;       \
+    (skb)->end = skb->head+SKB_DATA_SIZE; \
     (skb)->len = 0;
 
 #define FREE_SKB(skb)           \
     if((skb)->head != NULL)     \
-        kfree((skb)->head);      \
+        kmem_cache_free(skb_data_cache, (skb)->head); \
     (skb)->len = -1;            \
     (skb)->head = NULL;
 
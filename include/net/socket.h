@@ -48,11 +48,14 @@ struct sock {
     /* if tcp socket */
     struct tcp_connection* tcp;
 
-    /* Should be a queue? Can multiple pcbs read from same socket? */
-    volatile struct pcb* waiting;
+    /* pcbs waiting for data, connection state changes or ACKs */
+    waitqueue_t waiters;
     struct pcb* owner;
 
     struct sock* accept_sock;
+
+    /* the socket table and packets being handled, see sock_hold */
+    int volatile refs;
 };
 
 #include <net/tcp.h>
@@ -77,6 +80,8 @@ error_t net_sock_data_ready(struct sock* sk, unsigned int length);
 error_t net_sock_add_data(struct sock* sock, struct sk_buff* skb);
 
 struct sock* sock_get(socket_t id);
+struct sock* sock_hold(struct sock* sk);
+void sock_put(struct sock* sk);
 
 error_t net_sock_read(struct sock* sock, uint8_t* buffer, unsigned int length);
 
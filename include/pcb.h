@@ -10,12 +10,18 @@ struct pcb;
 #include <fs/inode.h>
 #include <errors.h>
 #include <user.h>
+#include <smp.h>
+#include <pcb_stats.h>
 
-#define MAX_NUM_OF_PCBS 64
+/* Size of the pid space, pcbs themselves are allocated when they are created.
+ * Per pid tables are in the bss, which the bootloader loads below 0xA0000. */
+#define MAX_NUM_OF_PCBS 512
 #define PCB_MAX_NAME_LENGTH 25
 #define USER_MAX_NAME_LENGTH 32 
 
 #define PCB_STACK_SIZE 0x2000
+/* Top of a new kernel stack which is cleared, it holds the first frame */
+#define PCB_STACK_CLEAR 64
 
 #define AS_THREAD(block) \
 do { \
@@ -40,6 +46,26 @@ typedef enum pcb_states {
     CLEANING
 } pcb_state_t;
 
+/* Scheduler list a pcb is linked into, all lists share the next and prev links */
+typedef enum pcb_queued {
+    PCB_UNQUEUED,
+    PCB_QUEUED_RUN,
+    /* waiting in a queue owned by someone else, like a mutex, only the owner wakes it */
+    PCB_QUEUED_WAIT
+} pcb_queued_t;
+
+/* Run queue levels, lower is more important */
+#define PCB_PRIORITIES          8
+#define PCB_PRIORITY_HIGH       0
+#define PCB_PRIORITY_DEFAULT    3
+#define PCB_PRIORITY_IDLE       (PCB_PRIORITIES-1)
+
+/* Scheduling classes, latency class pcbs run before all others within a budget, see scheduler.h */
+typedef enum pcb_classes {
+    PCB_CLASS_NORMAL,
+    PCB_CLASS_LATENCY
+} pcb_class_t;
+
 typedef enum pcb_types {
     PCB_KTHREAD = 0,
     PCB_PROCESS = 1,
@@ -78,7 +104,10 @@ struct pcb {
     char name[PCB_MAX_NAME_LENGTH];
     volatile pcb_state_t state;
     int16_t pid;
-    uint16_t sleep;
+    uint8_t priority;
+    uint8_t queued;
+    /* wait queue the pcb is blocked on, linked with next and prev */
+    struct waitqueue* waitqueue;
     uint32_t stackptr;
     uint32_t* page_dir;
     uint32_t data_size;
@@ -88,6 +117,8 @@ struct pcb {
     int preempts;
     int yields;
     uint32_t blocked_count;
+    uint32_t minor_faults;  /* page faults resolved without I/O */
+    uint32_t major_faults;  /* page faults that had to read from disk */
 
     struct window* gfx_window;
     struct terminal* term;
@@ -99,13 +130,54 @@ struct pcb {
     struct virtual_allocations* allocations;
     int used_memory;
 
+    /* shared program image mapped at VMEM_DATA */
+    struct program_image* image;
+
     struct pcb* parent;
     struct pcb *next;
     struct pcb *prev;
+
+    /* processor whose run queue the pcb belongs to */
+    uint8_t cpu;
+    /* switched out by an interrupt in kernel mode, must resume on the same processor */
+    uint8_t preempted;
+    /* critical section depth and spinlocks held while switched out */
+    int critical;
+    int spinlocks;
+
+    /* physical address of the futex the pcb waits on, see futex.c */
+    uint32_t futex;
+    /* blocked queue of the mutex the pcb waits on, see pcb_queue.c */
+    struct pcb_queue* lockqueue;
+
+    /* TSC accounting, see pcb_account */
+    uint64_t cycles_user;
+    uint64_t cycles_kernel;
+    /* start of the current accounting period and whether it is spent in user mode */
+    uint64_t acct_stamp;
+    uint8_t acct_user;
+    /* put in a run queue, 0 while running or waiting */
+    uint64_t runnable_since;
+    uint32_t switches_voluntary;
+    uint32_t switches_involuntary;
+    uint32_t latency[PCB_LATENCY_BUCKETS];
+
+    /* ctx.fpu_state holds a saved state, the FPU is initialized on first use otherwise */
+    uint8_t fpu_used;
+
+    /* fair share scheduling, weighted CPU time in Kcycles and position in the run queue, see sched_fair.h */
+    uint64_t vruntime;
+    int fair_index;
+
+    /* pcb_class_t, changed with sched_set_class */
+    uint8_t sched_class;
+
+    /* EIP the system call being served was made from, 0 outside of one */
+    uintptr_t syscall_eip;
 }__attribute__((__packed__));
 
 struct pcb_info {
-    uint8_t pid;
+    pid_t pid;
     uint8_t state;
     uint32_t stack;
     uint32_t used_memory;
@@ -113,15 +185,13 @@ struct pcb_info {
     float usage;
     char name[PCB_MAX_NAME_LENGTH];
     char user[USER_MAX_NAME_LENGTH];
-};
-
-struct process {
-    struct pcb* current;
-    /* */
+    struct pcb_stats stats;
 };
 
 extern const char* pcb_status[];
-extern struct process* $process; 
+
+/* Process state of the current processor */
+#define $process (smp_process())
 
 /* Forward declaration */
 struct pcb_queue;
@@ -149,10 +219,24 @@ struct pcb_queue_operations {
 struct pcb_queue {
 	struct pcb_queue_operations* ops;
 	struct pcb* _list;
+	struct pcb* _tail;
 	spinlock_t spinlock;
 	int total;
 };
 
+/**
+ * @brief Run queue with one doubly linked FIFO per priority level.
+ * Bit n of bitmap is set when level n is not empty, so the most important
+ * runnable pcb is found with a single bit scan. Not locked, callers must be
+ * in a critical section.
+ */
+struct pcb_runqueue {
+	struct pcb* head[PCB_PRIORITIES];
+	struct pcb* tail[PCB_PRIORITIES];
+	uint32_t bitmap;
+	int total;
+};
+
 void init_pcbs();
 void start_pcb(struct pcb* pcb);
 
@@ -164,15 +248,26 @@ error_t pcb_create_thread(struct pcb* parent, void (*entry)(), void* arg, byte_t
 error_t pcb_create_process(char* program, int args, char** argv, pcb_flag_t flags);
 
 int pcb_await(int pid);
+int pcb_join(int pid);
 void pcb_kill(int pid);
 
 void pcb_dbg_print(struct pcb* pcb);
 
 int pcb_cleanup_routine(void* arg);
 
-error_t pcb_get_info(int pid, struct pcb_info* info);
+uint32_t pcb_total_usage();
+error_t pcb_get_info(int pid, uint32_t total, struct pcb_info* info);
+error_t pcb_get_stats(int pid, struct pcb_stats* stats);
+
+void pcb_account(struct pcb* pcb, int user);
 
 struct pcb_queue* pcb_new_queue();
+void pcb_queue_unlink(struct pcb* pcb);
+
+void pcb_runqueue_init(struct pcb_runqueue* rq);
+void pcb_runqueue_push(struct pcb_runqueue* rq, struct pcb* pcb);
+void pcb_runqueue_remove(struct pcb_runqueue* rq, struct pcb* pcb);
+struct pcb* pcb_runqueue_pop(struct pcb_runqueue* rq);
 
 /* functions in entry.s */
 void _start_pcb(struct pcb* pcb);
@@ -0,0 +1,55 @@
+#ifndef __PCB_STATS_H
+#define __PCB_STATS_H
+
+/**
+ * @file pcb_stats.h
+ * @author Joe Bayer (joexbayer)
+ * @brief CPU time and scheduling latency of a pcb, shared with userspace.
+ * Filled in by pcb_get_stats, also available through SYSCALL_PCB_STATS.
+ * @version 0.1
+ * @date 2024-03-16
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <stdint.h>
+
+/* Bucket i counts waits of 2^i up to 2^(i+1) Kcycles, the first and last bucket are open ended */
+#define PCB_LATENCY_BUCKETS 20
+
+struct pcb_stats {
+    /* time spent in user and kernel mode, in units of 2^20 cycles */
+    uint32_t user;
+    uint32_t kernel;
+    /* switched out by blocking, sleeping or yielding, or by a preemption */
+    uint32_t voluntary;
+    uint32_t involuntary;
+    /* time from being put in a run queue until running */
+    uint32_t latency[PCB_LATENCY_BUCKETS];
+};
+
+/**
+ * @brief Finds the latency bucket below which the given percent of waits fall.
+ * @return int bucket, -1 if the pcb never waited in a run queue.
+ */
+static inline int pcb_latency_percentile(const struct pcb_stats* stats, int percent)
+{
+    uint32_t total = 0;
+    for (int i = 0; i < PCB_LATENCY_BUCKETS; i++){
+        total += stats->latency[i];
+    }
+    if(total == 0) return -1;
+
+    uint32_t target = (total / 100) * percent + ((total % 100) * percent) / 100;
+    if(target == 0) target = 1;
+
+    uint32_t seen = 0;
+    for (int i = 0; i < PCB_LATENCY_BUCKETS; i++){
+        seen += stats->latency[i];
+        if(seen >= target) return i;
+    }
+    return PCB_LATENCY_BUCKETS - 1;
+}
+
+#endif /* !__PCB_STATS_H */
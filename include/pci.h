@@ -47,7 +47,23 @@ struct pci_driver {
 };
 
 
+/* Status register bit telling the capabilities pointer is valid */
+#define PCI_STATUS_CAPABILITIES 0x10
+#define PCI_CAPABILITIES_POINTER 0x34
+#define PCI_CAP_MSI 0x05
+
+#define PCI_COMMAND_INTX_DISABLE (1 << 10)
+
+/* MSI message control, the message address targets a local APIC */
+#define PCI_MSI_ENABLE 0x1
+#define PCI_MSI_MULTIPLE_ENABLE 0x70
+#define PCI_MSI_64BIT 0x80
+#define PCI_MSI_ADDRESS 0xFEE00000
+
 uint16_t pci_read_word(uint16_t bus, uint16_t slot, uint16_t func, uint16_t offset);
+void pci_write_dword(uint16_t bus, uint16_t slot, uint16_t func, uint16_t offset, uint32_t data);
+int pci_find_capability(struct pci_device* dev, uint8_t id);
+int pci_enable_msi(struct pci_device* dev, const char* name);
 uint8_t pci_find_device(uint16_t find_vendor, uint16_t find_device);
 void pci_enable_device_busmaster(uint16_t bus, uint16_t slot, uint16_t function);
 void init_pci();
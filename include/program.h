@@ -0,0 +1,74 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <stdint.h>
+#include <errors.h>
+#include <sync.h>
+
+#define PROGRAM_CACHE_SIZE 		8
+#define PROGRAM_PATH_LENGTH 	64
+#define PROGRAM_MAX_SEGMENTS 	8
+
+/* Flags of a single page of a program, see program_image_page_flags */
+#define PROGRAM_PAGE_MAPPED 	(1 << 0)
+#define PROGRAM_PAGE_WRITE 		(1 << 1)
+#define PROGRAM_PAGE_FILE 		(1 << 2)
+
+/**
+ * @brief A loadable segment of a program.
+ * Bytes past filesz up to memsz are zero (bss).
+ */
+struct program_segment {
+	uint32_t vaddr;
+	uint32_t memsz;
+	uint32_t offset;
+	uint32_t filesz;
+	int writable;
+};
+
+/**
+ * @brief A program image described by its segments.
+ * Pages with file contents are read from disk into frames the first time any process
+ * touches them. The frames are shared by every process running the program,
+ * read-only pages are mapped read-only and writable pages are copy-on-write.
+ * Pages only covering bss never get an image frame.
+ */
+struct program_image {
+	char path[PROGRAM_PATH_LENGTH];
+	uint32_t mtime;
+	int size;
+	/* file descriptor pages are read from, open while the image exists */
+	int fd;
+
+	uint32_t entry;
+	int nsegments;
+	struct program_segment segments[PROGRAM_MAX_SEGMENTS];
+
+	/* page aligned address of the first segment, pages covers all segments */
+	uint32_t start;
+	int pages;
+	/* frame of each page, 0 until the page is loaded */
+	uint32_t* frames;
+	int resident;
+
+	/* processes mapping the image */
+	int refs;
+	/* file changed while mapped, freed when the last process exits */
+	int stale;
+};
+
+struct program_cache_info {
+	int images;
+	int pages;
+	int resident;
+	int hits;
+	int misses;
+};
+
+struct program_image* program_image_get(const char* path);
+void program_image_put(struct program_image* image);
+int program_image_page_flags(struct program_image* image, uint32_t vaddr);
+uint32_t program_image_frame(struct program_image* image, uint32_t vaddr, int* loaded);
+error_t program_cache_get_info(struct program_cache_info* info);
+
+#endif /* PROGRAM_H */
@@ -0,0 +1,55 @@
+#ifndef __SCHED_FAIR_H
+#define __SCHED_FAIR_H
+
+/**
+ * @file sched_fair.h
+ * @author Joe Bayer (joexbayer)
+ * @brief Fair share run queue, pcbs ordered by weighted virtual runtime.
+ * The pcb that received the least CPU time relative to its weight runs next.
+ * Weights are derived from pcb->priority like nice values, each level apart
+ * gives roughly three times the share. Not locked, callers must be in a critical section.
+ * @version 0.1
+ * @date 2024-03-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <stdint.h>
+#include <pcb.h>
+
+/* Weight of PCB_PRIORITY_DEFAULT, virtual runtime passes at real time for it */
+#define FAIR_WEIGHT_DEFAULT 1024
+
+/**
+ * Virtual runtime a woken pcb may lag behind min_vruntime, in Kcycles.
+ * Sleepers run soon after waking, but a long sleep cannot be turned into a long burst.
+ */
+#define FAIR_WAKEUP_BONUS (4 << 10)
+
+/* How a pcb enters the run queue */
+#define FAIR_ENQUEUE_NEW     (1 << 0)
+#define FAIR_ENQUEUE_WAKEUP  (1 << 1)
+/* Moved from another run queue, its virtual runtime is relative, see fair_dequeue */
+#define FAIR_ENQUEUE_MIGRATE (1 << 2)
+
+/**
+ * @brief Min heap of runnable pcbs keyed on pcb->vruntime.
+ * Each pcb keeps its heap index, so any pcb is removed in O(log n) without searching.
+ */
+struct fair_runqueue {
+    struct pcb* heap[MAX_NUM_OF_PCBS];
+    int total;
+    /* never decreases, new and woken pcbs are placed relative to it */
+    uint64_t min_vruntime;
+};
+
+void fair_runqueue_init(struct fair_runqueue* rq);
+void fair_enqueue(struct fair_runqueue* rq, struct pcb* pcb, int flags);
+void fair_dequeue(struct fair_runqueue* rq, struct pcb* pcb, int migrate);
+struct pcb* fair_pop(struct fair_runqueue* rq);
+struct pcb* fair_peek(struct fair_runqueue* rq);
+void fair_charge(struct fair_runqueue* rq, struct pcb* pcb, uint32_t ran);
+uint32_t fair_weight(int priority);
+
+#endif /* !__SCHED_FAIR_H */
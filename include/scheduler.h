@@ -2,12 +2,16 @@
 #define __SCHEDULER_H
 
 #include <pcb.h>
+#include <sched_fair.h>
 
 void kernel_sleep(int time);
 void kernel_yield();
+void kernel_preempt();
 void kernel_exit();
 void block();
 void unblock(int pid);
+void kernel_set_timeout(int ticks);
+void kernel_clear_timeout();
 void context_switch_process();
 
 #define WAIT(pred) while(pred){kernel_yield();}
@@ -24,8 +28,28 @@ typedef enum scheduler_flags {
     SCHED_INITIATED = 1 << 1
 } sched_flag_t;
 
-/* Scheduler operations */
+/**
+ * Latency class budget, in every period of SCHED_LATENCY_PERIOD ticks latency class pcbs
+ * may use SCHED_LATENCY_BUDGET ticks worth of CPU time while other pcbs wait to run.
+ */
+#define SCHED_LATENCY_PERIOD 100
+#define SCHED_LATENCY_BUDGET 50
+
+/* How a pcb enters a run queue, passed to the enqueue operation */
+typedef enum scheduler_enqueue {
+    SCHED_ENQUEUE_REQUEUE = 0,
+    SCHED_ENQUEUE_NEW = 1 << 0,
+    SCHED_ENQUEUE_WAKEUP = 1 << 1,
+    SCHED_ENQUEUE_MIGRATE = 1 << 2
+} sched_enqueue_t;
+
+/**
+ * @brief Scheduler operations
+ * A policy only decides the order of the run queue through enqueue, dequeue, pick and steal,
+ * blocking, sleeping and switching are shared. Selected at boot with sched_set_policy.
+ */
 struct scheduler_ops {
+    const char* name;
     error_t (*prioritize)(struct scheduler* sched, struct pcb* pcb);
     error_t (*schedule)(struct scheduler* sched);
     error_t (*add)(struct scheduler* sched, struct pcb* pcb);
@@ -33,18 +57,55 @@ struct scheduler_ops {
     error_t (*sleep)(struct scheduler* sched, int time);
     error_t (*exit)(struct scheduler* sched);
     error_t (*yield)(struct scheduler* sched);
+    error_t (*wake)(struct scheduler* sched, struct pcb* pcb);
     struct pcb* (*consume)(struct scheduler* sched);
+
+    void (*enqueue)(struct scheduler* sched, struct pcb* pcb, int flags);
+    void (*dequeue)(struct scheduler* sched, struct pcb* pcb, int migrate);
+    /* next pcb to run, removed from the run queue */
+    struct pcb* (*pick)(struct scheduler* sched);
+    /* queued pcb another processor may take, left in the run queue */
+    struct pcb* (*steal)(struct scheduler* sched);
+    /* CPU time in cycles the running pcb used before switching out, may be NULL */
+    void (*charge)(struct scheduler* sched, struct pcb* pcb, uint64_t ran);
 };
 
+/* One scheduler per processor, see get_scheduler */
 struct scheduler {
     unsigned char flags;
     unsigned int yields;
     unsigned int exits;
+    /* processor the scheduler runs on */
+    int cpu;
+    /* pcbs taken from other processors while idle */
+    unsigned int pulled;
 
     struct scheduler_ops* ops;
-    /* queue is the list of ready PCBs */
-    struct pcb_queue* queue;
-    struct pcb_queue* priority;
+    /* ready PCBs, blocked and sleeping PCBs are in no queue until they are woken */
+    struct pcb_runqueue runqueue;
+    /* used by the fair policy, idle priority pcbs stay in runqueue */
+    struct fair_runqueue fair;
+    /* TSC when the running pcb was switched in */
+    uint64_t slice_start;
+    /* zombies whose cleanup could not be queued yet, linked through next, see __sched_reap */
+    struct pcb* zombies;
+
+    /**
+     * Latency class, runs before the policy and preempts on wake up.
+     * Throttled once it used its budget in the current period, it then only runs if nothing else can.
+     */
+    struct {
+        struct pcb_runqueue queue;
+        /* cycles used in the current period, starting at tick period_start and TSC period_stamp */
+        uint64_t used;
+        uint64_t period_stamp;
+        int period_start;
+        /* measured over the last full period, 0 until then */
+        uint32_t cycles_per_tick;
+        int throttled;
+        uint32_t throttles;
+        uint32_t preempts;
+    } latency;
 
     struct {
         struct pcb* running;
@@ -53,6 +114,10 @@ struct scheduler {
 
 
 error_t sched_init_default(struct scheduler* sched, sched_flag_t flags);
+int sched_has_runnable(struct scheduler* sched);
+int sched_queued(struct scheduler* sched);
+error_t sched_set_policy(const char* name);
+error_t sched_set_class(struct pcb* pcb, pcb_class_t class);
 
 /* asm functions */
 void pcb_restore_ctx();
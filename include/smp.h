@@ -15,6 +15,119 @@
  */
 
 #include <stdint.h>
+#include <errors.h>
+#include <arch/gdt.h>
+#include <arch/tss.h>
+
+/* Most processors brought up at boot, further processors are left halted */
+#define SMP_MAX_CPUS 8
+
+/* Page the application processor startup code is copied to, the SIPI vector is its page number */
+#define SMP_TRAMPOLINE 0x9000
+#define SMP_STACK_SIZE 0x2000
+
+/* Processor the kernel booted on */
+#define SMP_BSP 0
+
+/* Context switches averaged for struct cpu switch_cycles, a power of two */
+#define SMP_SWITCH_SAMPLES 256
+
+struct pcb;
+struct scheduler;
+
+struct process {
+    struct pcb* current;
+};
+
+/**
+ * @brief Per processor state
+ * Reached through the per processor data segment loaded in fs, so every processor
+ * finds its own struct cpu at %fs:0 without knowing its id.
+ * Processors only ever touch their own struct, except for started, tlb_generation and fpu_owner.
+ */
+struct cpu {
+    /* must be first, smp_cpu reads it from %fs:0 */
+    struct cpu* self;
+    int id;
+    uint8_t apic_id;
+
+    /* critical section depth, the kernel lock is held while it is above 0 */
+    int critical;
+    /* spinlocks held, interrupts stay disabled while any are held */
+    int spinlocks;
+    /* spinning for the kernel lock in critical_enter, see spin_lock */
+    volatile int kernel_waiting;
+    /* the interrupt being handled came from user mode */
+    int irq_user;
+    /* the running pcb is switched out by kernel_preempt, see sched_round_robin */
+    int preempting;
+    /* a latency class pcb was woken, switch before returning from the interrupt */
+    int need_resched;
+
+    struct process process;
+    struct scheduler* sched;
+
+    volatile int started;
+    /* last TLB shootdown this processor has flushed for */
+    volatile uint32_t tlb_generation;
+
+    uint32_t ipis;
+    uint8_t* stack;
+
+    /* pcb whose FPU state is in the registers, see fpu.c */
+    struct pcb* volatile fpu_owner;
+    uint32_t fpu_traps;
+
+    /* context switch cost, average of the last SMP_SWITCH_SAMPLES switches in cycles */
+    uint64_t switch_start;
+    uint32_t switch_sum;
+    uint32_t switch_samples;
+    uint32_t switch_cycles;
+    /* switches which kept the page directory loaded */
+    uint32_t cr3_skips;
+
+    struct tss_entry tss;
+    struct gdt_segment gdt[GDT_ENTRIES];
+};
+
+struct smp_cpu_info {
+    int id;
+    int apic_id;
+    int started;
+    /* pid running on the processor */
+    int pid;
+    /* pcbs in its run queue */
+    int runnable;
+    /* pcbs it pulled from other processors */
+    uint32_t pulled;
+    /* reschedule interrupts sent to it */
+    uint32_t ipis;
+    /* average context switch in cycles */
+    uint32_t switch_cycles;
+    uint32_t fpu_traps;
+    uint32_t cr3_skips;
+    /* latency class wake ups which preempted, and periods it was throttled in */
+    uint32_t latency_preempts;
+    uint32_t latency_throttles;
+};
+
+/**
+ * @brief How an ISA interrupt line reaches the IO APIC, see smp_get_irq.
+ * PCI interrupts are steered onto ISA lines by the chipset, such a line is level triggered and active low.
+ */
+struct smp_irq {
+    uint8_t pin;
+    uint8_t level;
+    uint8_t active_low;
+};
+
+/* Current processor, the per processor segment is loaded on every entry to the kernel */
+static inline struct cpu* smp_cpu()
+{
+    struct cpu* cpu;
+    __asm__ __volatile__ ("movl %%fs:0, %0" : "=r" (cpu));
+    return cpu;
+}
 
 struct mp_info {
     char signature[4];
@@ -91,4 +204,19 @@ struct entry_local_interrupt {
 int smp_parse();
 struct mp_info* find_mp_floating_ptr();
 
+void smp_init_bsp();
+void smp_init();
+void smp_start_aps();
+
+struct process* smp_process();
+struct cpu* smp_get_cpu(int id);
+int smp_cpu_count();
+uint32_t smp_io_apic_address();
+void smp_get_irq(int irq, struct smp_irq* line);
+error_t smp_get_info(int index, struct smp_cpu_info* info);
+
+void smp_send_reschedule(int id);
+void smp_tlb_shootdown();
+void smp_tlb_poll();
+
 #endif /* !__SMP_H */
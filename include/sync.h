@@ -17,17 +17,166 @@ typedef enum {
 
 void spin_lock(int volatile *p);
 void spin_unlock(int volatile *p);
+uint32_t spin_lock_irqsave(int volatile *p);
+void spin_unlock_irqrestore(int volatile *p, uint32_t flags);
 typedef int volatile spinlock_t;
 
+/* Unlocks the spinlock and names it after its declaration for lockstat */
+#define spinlock_init(l) __spinlock_init(l, #l)
+void __spinlock_init(spinlock_t* lock, const char* name);
+
+struct lock_class;
+
+/* Critical sections, see ENTER_CRITICAL and LEAVE_CRITICAL */
+void critical_enter();
+void critical_leave();
+void critical_leave_noirq();
+void critical_leave_halt();
+int critical_depth();
+
 typedef struct _mutex {
     lock_state_t state;
     struct pcb_queue* blocked;
+    /* lockstat, see lockstat.h */
+    struct lock_class* lclass;
+    uint64_t held_since;
 } mutex_t;
 
-void mutex_init(mutex_t* l);
+#define mutex_init(l) __mutex_init(l, #l)
+void __mutex_init(mutex_t* l, const char* name);
 void acquire(mutex_t* l);
+int try_acquire(mutex_t* l);
 void release(mutex_t* l);
 
+struct pcb;
+
+/**
+ * @brief Wait queue
+ * Blocked pcbs waiting for a condition, linked through their own next/prev pointers
+ * so waiting never allocates. A zeroed wait queue is empty and ready to use.
+ * Waiters consume no CPU until they are woken, their timeout passes or they are killed.
+ */
+typedef struct waitqueue {
+    struct pcb* head;
+    struct pcb* tail;
+    int count;
+} waitqueue_t;
+
+/* No timeout for waitqueue_sleep and wait_event_timeout */
+#define WAIT_FOREVER -1
+
+void waitqueue_init(waitqueue_t* wq);
+int waitqueue_sleep(waitqueue_t* wq, int ticks);
+void waitqueue_remove(struct pcb* pcb);
+int wake_up_one(waitqueue_t* wq);
+int wake_up_all(waitqueue_t* wq);
+
+/**
+ * @brief Blocks until condition is true or the given ticks have passed.
+ * The condition is checked in a critical section, so a wake up between
+ * checking it and blocking cannot be lost.
+ * @return int ticks left, 0 if the condition is still false after the timeout.
+ */
+#define wait_event_timeout(wq, condition, ticks) __extension__ ({ \
+    int __left = (ticks); \
+    ENTER_CRITICAL(); \
+    while(!(condition) && __left != 0){ \
+        __left = waitqueue_sleep((wq), __left); \
+    } \
+    if(__left == 0 && (condition)) __left = 1; \
+    LEAVE_CRITICAL(); \
+    __left; \
+})
+
+#define wait_event(wq, condition) (void) wait_event_timeout(wq, condition, WAIT_FOREVER)
+
+/* Condition variable, always used together with a mutex_t protecting the condition */
+typedef struct condvar {
+    waitqueue_t waiters;
+} condvar_t;
+
+void cond_init(condvar_t* cv);
+void cond_wait(condvar_t* cv, mutex_t* l);
+void cond_signal(condvar_t* cv);
+void cond_broadcast(condvar_t* cv);
+
+/* Counting semaphore */
+typedef struct semaphore {
+    int count;
+    waitqueue_t waiters;
+} semaphore_t;
+
+void sem_init(semaphore_t* sem, int count);
+void sem_wait(semaphore_t* sem);
+int sem_trywait(semaphore_t* sem);
+void sem_post(semaphore_t* sem);
+
+/**
+ * @brief Reader-writer lock
+ * Any number of readers or a single writer, waiters sleep. Writer preferring:
+ * once a writer waits no new readers get in, so a stream of lookups cannot starve updates.
+ * Uncontended locking is a single atomic operation and never enters a critical section.
+ * A zeroed rwlock is unlocked and ready to use.
+ */
+typedef struct rwlock {
+    /* number of readers, RWLOCK_WRITER while write locked */
+    int volatile state;
+    int volatile writers_waiting;
+    int volatile readers_waiting;
+    waitqueue_t readers;
+    waitqueue_t writers;
+    /* lockstat, only write locks are timed */
+    struct lock_class* lclass;
+    uint64_t held_since;
+} rwlock_t;
+
+#define RWLOCK_WRITER -1
+
+#define rwlock_init(rw) __rwlock_init(rw, #rw)
+void __rwlock_init(rwlock_t* rw, const char* name);
+void read_lock(rwlock_t* rw);
+void read_unlock(rwlock_t* rw);
+void write_lock(rwlock_t* rw);
+void write_unlock(rwlock_t* rw);
+
+/**
+ * @brief Sequence lock
+ * For small tables which are read far more often than written. Writers serialize on
+ * the spinlock and bump the sequence before and after the update, readers never write
+ * shared memory and retry if the sequence was odd or changed while they copied the data.
+ * Readers must only copy data out, never follow pointers read inside the section.
+ *
+ *  do {
+ *      seq = read_seqbegin(&lock);
+ *      ... copy ...
+ *  } while(read_seqretry(&lock, seq));
+ */
+typedef struct seqlock {
+    uint32_t volatile sequence;
+    spinlock_t lock;
+} seqlock_t;
+
+#define seqlock_init(sl) __seqlock_init(sl, #sl)
+void __seqlock_init(seqlock_t* sl, const char* name);
+void write_seqlock(seqlock_t* sl);
+void write_sequnlock(seqlock_t* sl);
+
+static inline uint32_t read_seqbegin(seqlock_t* sl)
+{
+    uint32_t seq;
+    while((seq = sl->sequence) & 1){
+        asm volatile ("pause");
+    }
+    asm volatile ("" : : : "memory");
+    return seq;
+}
+
+static inline int read_seqretry(seqlock_t* sl, uint32_t start)
+{
+    asm volatile ("" : : : "memory");
+    return sl->sequence != start;
+}
+
 /* Assuming that obj has a lock, acquire it and run the code before releasing. */
 #define LOCK(obj, code_block) \
     acquire(&obj->lock); \
@@ -43,6 +43,11 @@ enum {
     SYSCALL_YIELD,
     SYSCALL_JOIN_THREAD,
     SYSCALL_AWAIT_PROCESS,
+    SYSCALL_FUTEX_WAIT,
+    SYSCALL_FUTEX_WAKE,
+
+    /* Process system calls */
+    SYSCALL_PCB_STATS,
 };
 
 #endif /* __SYSCALL_HELPER_H */
@@ -5,7 +5,7 @@
 
 typedef int (*syscall_t) ();
 void add_system_call(int index, syscall_t fn);
-int system_call(int index, int arg1, int arg2, int arg3);
+int system_call(int index, int arg1, int arg2, int arg3, uintptr_t eip);
 
 #define testsd #
 
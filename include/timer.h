@@ -3,13 +3,39 @@
 
 #include <stdint.h>
 #include <rtc.h>
+#include <errors.h>
 
 #define TIME_TO_INT(time) (((time)->hour*3600) + ((time)->minute*60) + (time)->second)
 
+/* Tick frequency, one tick per millisecond */
+#define TIMER_HZ 1000
+#define TIMER_MS_TO_TICKS(ms) (((ms) * TIMER_HZ) / 1000)
+
+/* Longest one-shot the 16 bit PIT counter can hold */
+#define TIMER_ONESHOT_MAX_TICKS ((0xFFFF * TIMER_HZ) / 1193180)
+
+struct timer_info {
+    uint32_t ticks;
+    /* timer interrupts taken, the rest of the ticks were skipped */
+    uint32_t interrupts;
+    /* ticks the idle task spent halted */
+    uint32_t idle_ticks;
+    /* times the tick was stopped and restarted early */
+    uint32_t oneshots;
+    uint32_t restarts;
+    /* ticking from the local APIC timer instead of the PIT */
+    uint32_t lapic;
+};
+
 
 void init_pit(uint32_t frequency);
+void init_local_timer();
 struct time* get_datetime();
 int timer_get_tick();
 int time_get_difference();
 
+void timer_idle();
+void timer_tick_restart();
+error_t timer_get_info(struct timer_info* info);
+
 #endif // !TIMER_H
\ No newline at end of file
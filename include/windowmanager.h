@@ -55,7 +55,8 @@ struct windowmanager {
     int workspace;
 
     uint32_t window_count;
-    spinlock_t spinlock;
+    /* window list, read by every mouse event and frame */
+    rwlock_t lock;
 
     /* state */
     windowmanager_state_t state;
@@ -1,7 +1,15 @@
 #ifndef C344935F_66B9_4B70_A26F_D6BCDAF73498
 #define C344935F_66B9_4B70_A26F_D6BCDAF73498
 
+#include <kconfig.h>
+#include <errors.h>
 #include <sync.h>
+#include <ktimer.h>
+
+/* Works each worker can hold per priority class before spilling into the shared overflow list */
+#define WORK_DEQUE_SIZE 32
+/* Upper bound on allocated works, queued and delayed */
+#define WORK_MAX_PENDING 1024
 
 enum work_states {
     WORK_WAITING,
@@ -9,23 +17,75 @@ enum work_states {
     WORK_FINISHED
 };
 
+/* Higher classes are always run first, by any worker */
+enum work_priority {
+    WORK_PRIO_HIGH,
+    WORK_PRIO_NORMAL,
+    WORK_PRIO_LOW,
+    WORK_PRIO_CLASSES
+};
+
 struct work {
     int (*work_fn)(void*);
     void (*callback)(int);
+    /* link in the overflow list */
     struct work* next;
     char state;
-    int in_use;
+    char priority;
     void* arg;
+    /* delays queueing of the work */
+    struct ktimer timer;
+};
+
+/**
+ * @brief Bounded ring of works owned by one worker.
+ * New work is pushed at the tail, the owner takes from the head (oldest first)
+ * and other workers steal from the tail.
+ */
+struct work_deque {
+    struct work* slots[WORK_DEQUE_SIZE];
+    int head;
+    int count;
+};
+
+struct worker {
+    int pid;
+    struct work_deque deques[WORK_PRIO_CLASSES];
+
+    /* stats */
+    int executed;
+    int steals;
 };
 
 struct work_queue {
-    struct work* head;
-    struct work* tail;
+    struct worker workers[WORK_WORKERS];
+    int worker_count;
+    /* worker the next work from outside the workers is given to */
+    int next;
+
+    /* works which did not fit in the deque of their worker */
+    struct work* overflow[WORK_PRIO_CLASSES];
+    struct work* overflow_tail[WORK_PRIO_CLASSES];
+
+    /* idle workers */
+    waitqueue_t waiters;
+
+    int queued;
+    int delayed;
+    int overflowed;
+};
 
-    int size;
+struct work_worker_info {
+    int pid;
+    int depth;
+    int executed;
+    int steals;
 };
 
 int work_queue_add(int (*fn)(void*), void* arg, void(*callback)(int));
+int work_queue_add_prio(int (*fn)(void*), void* arg, void(*callback)(int), int priority);
+int work_queue_add_delayed(int (*fn)(void*), void* arg, void(*callback)(int), int ticks);
+error_t work_queue_get_info(int index, struct work_worker_info* info);
 void worker_thread();
 void init_worker();
 #endif /* C344935F_66B9_4B70_A26F_D6BCDAF73498 */
@@ -0,0 +1,137 @@
+/**
+ * @file fpu.c
+ * @author Joe Bayer (joexbayer)
+ * @brief Lazy FPU context switching.
+ * @version 0.1
+ * @date 2024-03-17
+ *
+ * The FPU registers of a processor keep the state of its fpu_owner, which is only saved
+ * once another pcb uses the FPU. Switching to any other pcb sets CR0.TS, so its first FPU
+ * instruction raises a device not available trap which saves the owner and loads the pcb.
+ * Most pcbs never touch the FPU and switch without saving or restoring anything.
+ *
+ * The state of an owner is in the registers of one processor, so an owner is never pulled
+ * by another processor. Wakes, mutex handoffs included, go to the processor a pcb last ran on
+ * and the load balancer skips owners, see fpu_is_loaded. Only pcbs which never ran and killed
+ * pcbs waiting to be reaped are added to another processor.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <kconfig.h>
+#include <arch/fpu.h>
+#include <smp.h>
+#include <pcb.h>
+#include <serial.h>
+
+#ifndef KDEBUG_FPU
+#undef dbgprintf
+#define dbgprintf(...)
+#endif
+
+static inline void __fpu_clts()
+{
+    asm volatile ("clts");
+}
+
+static inline void __fpu_save(struct pcb* pcb)
+{
+    asm volatile ("fnsave (%0)" : : "r" (pcb->ctx.fpu_state) : "memory");
+}
+
+static inline void __fpu_load(struct pcb* pcb)
+{
+    if(!pcb->fpu_used){
+        asm volatile ("fninit");
+        pcb->fpu_used = 1;
+        return;
+    }
+    asm volatile ("frstor (%0)" : : "r" (pcb->ctx.fpu_state) : "memory");
+}
+
+/**
+ * @brief Initializes the FPU of the calling processor, it belongs to no pcb.
+ * The trampoline copies CR0 of the bootstrap processor, so TS may be set.
+ */
+void init_fpu()
+{
+    __fpu_clts();
+    asm volatile ("fninit");
+    smp_cpu()->fpu_owner = NULL;
+}
+
+/**
+ * @brief Prepares the FPU for the pcb being switched to.
+ * Only the owner may use the FPU directly, everyone else traps on first use.
+ * CR0 is only written when TS has to change.
+ * @warning Must be called in a critical section.
+ */
+void fpu_switch(struct cpu* cpu, struct pcb* next)
+{
+#ifdef FPU_EAGER
+    /* Switches the state right away, as every switch did before, to compare switch costs */
+    if(next != cpu->fpu_owner){
+        __fpu_clts();
+        if(cpu->fpu_owner != NULL){
+            __fpu_save(cpu->fpu_owner);
+        }
+        __fpu_load(next);
+        cpu->fpu_owner = next;
+    }
+    return;
+#endif
+
+    uint32_t cr0 = rcr0();
+    if(next == cpu->fpu_owner){
+        if(cr0 & CR0_TS) __fpu_clts();
+    } else if(!(cr0 & CR0_TS)){
+        lcr0(cr0 | CR0_TS);
+    }
+}
+
+/**
+ * @brief Device not available handler, gives the FPU to the running pcb.
+ * Runs with interrupts disabled and without the kernel lock, it only touches
+ * the FPU of this processor, the running pcb and the pcb whose state it saves.
+ */
+void fpu_trap()
+{
+    struct cpu* cpu = smp_cpu();
+    struct pcb* current = cpu->process.current;
+
+    __fpu_clts();
+
+    /* Early kernel code before scheduling, the FPU state does not belong to anyone */
+    if(current == NULL || cpu->fpu_owner == current) return;
+
+    if(cpu->fpu_owner != NULL){
+        __fpu_save(cpu->fpu_owner);
+    }
+    __fpu_load(current);
+
+    cpu->fpu_owner = current;
+    cpu->fpu_traps++;
+}
+
+/**
+ * @brief Checks if the FPU state of the pcb is only in the registers of its processor.
+ * @return int 1 if the pcb cannot run on another processor yet.
+ */
+int fpu_is_loaded(struct pcb* pcb)
+{
+    struct cpu* cpu = smp_get_cpu(pcb->cpu);
+    return cpu != NULL && cpu->fpu_owner == pcb;
+}
+
+/**
+ * @brief Drops the FPU state of a pcb which is freed, a new pcb in its place must not inherit it.
+ */
+void fpu_release(struct pcb* pcb)
+{
+    for (int i = 0; i < smp_cpu_count(); i++){
+        struct cpu* cpu = smp_get_cpu(i);
+        if(__sync_bool_compare_and_swap(&cpu->fpu_owner, pcb, NULL)){
+            dbgprintf("[FPU] Released state of %s on CPU %d\n", pcb->name, i);
+        }
+    }
+}
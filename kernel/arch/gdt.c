@@ -11,19 +11,16 @@
 
 #include <arch/gdt.h>
 #include <arch/tss.h>
+#include <smp.h>
 
 #define FLUSH_GDT() asm volatile ("lgdt %0" : : "m" (gdt_addr))
 
-static struct gdt_segment gdt[7];
-
-static struct gdt_address
+struct gdt_address
 {
 	uint16_t limit;
 	uint32_t base;
 } __attribute__((packed));
 
-static struct gdt_address gdt_addr;
-
 void gdt_set_segment(struct gdt_segment *segment, uint32_t base, uint32_t limit, char type, char privilege, char system)
 {
 	segment->limit_lo = (uint16_t)limit;
@@ -36,10 +33,19 @@ void gdt_set_segment(struct gdt_segment *segment, uint32_t base, uint32_t limit,
 }
 
 
-void init_gdt()
+/**
+ * @brief Loads the GDT of the given processor.
+ * Every processor has its own GDT, as the TSS descriptor is marked busy when loaded
+ * and the per processor data segment is based at its own struct cpu.
+ * @param cpu Processor to load the GDT for, must be the calling processor.
+ */
+void init_gdt(struct cpu* cpu)
 {
-	gdt_addr.limit =  7 * 8 - 1;
-	gdt_addr.base = (uint32_t) gdt;
+	struct gdt_segment* gdt = cpu->gdt;
+	struct gdt_address gdt_addr = {
+		.limit = GDT_ENTRIES * 8 - 1,
+		.base = (uint32_t) gdt
+	};
 
 	/* Code segment for the kernel */
 	gdt_set_segment(gdt + GDT_KERNEL_CODE, 0, 0xfffff, GDT_CODE_SEGMENT, KERNEL_PRIVILEGE, MEMORY);
@@ -50,10 +56,15 @@ void init_gdt()
 	/* Data segment for processes */
 	gdt_set_segment(gdt + GDT_PROCESS_DATA, 0, 0xfffff, GDT_DATA_SEGMENT, PROCESSS_PRIVILEGE, MEMORY);
 	/* TSS segment */
-	gdt_set_segment(gdt + GDT_TSS_INDEX, (uint32_t)&tss, TSS_SIZE, GDT_TSS_SEGMENT, KERNEL_PRIVILEGE, SYSTEM); /* is a system segment */
+	gdt_set_segment(gdt + GDT_TSS_INDEX, (uint32_t)&cpu->tss, TSS_SIZE, GDT_TSS_SEGMENT, KERNEL_PRIVILEGE, SYSTEM); /* is a system segment */
+	/* Per processor data segment */
+	gdt_set_segment(gdt + GDT_CPU_INDEX, (uint32_t)cpu, 0xfffff, GDT_DATA_SEGMENT, KERNEL_PRIVILEGE, MEMORY);
 
 	FLUSH_GDT();
 
+	/* The bootloader may have used another code selector */
+	asm volatile ("ljmp %0, $1f\n1:" : : "i" (GDT_KERNEL_CS));
+
 	/* Reload the Segment registers*/
 	asm volatile ("pushl %ds");
 	asm volatile ("popl %ds");
@@ -63,4 +74,6 @@ void init_gdt()
 
 	asm volatile ("pushl %ss");
 	asm volatile ("popl %ss");
+
+	asm volatile ("movw %0, %%fs" : : "r" ((uint16_t)GDT_CPU_DS));
 }
@@ -11,6 +11,10 @@
  */
 #include <arch/interrupts.h>
 #include <arch/gdt.h>
+#include <arch/lapic.h>
+#include <arch/ioapic.h>
+#include <arch/fpu.h>
+#include <smp.h>
 #include <pcb.h>
 #include <serial.h>
 #include <scheduler.h>
@@ -33,15 +37,30 @@ static void (*irqs[ISR_LINES])(struct registers*) = {
 	isr12,isr13,isr14,isr15,isr16,isr17,isr18,isr19,isr20,isr21,
 	isr22,isr23,isr24,isr25,isr26,isr27,isr28,isr29,isr30,isr31,
 	isr32,isr33,isr34,isr35,isr36,isr37,isr38,isr39,isr40,isr41,
-	isr42,isr43,isr44,isr45,isr46,isr47,
+	isr42,isr43,isr44,isr45,isr46,isr47,0,isr49,isr50,isr51,
+	isr52,isr53,isr54,isr55,isr56
 };
 
 static int interrupt_counter[ISR_LINES];
 int interrupt_get_count(int interrupt)
 {
+	if(interrupt < 0 || interrupt >= ISR_LINES) return 0;
 	return interrupt_counter[interrupt];
 }
 
+/* Vectors which are not an ISA line, message signalled vectors are named when allocated */
+static const char* interrupt_names[ISR_LINES] = {
+	[32] = "PIT",
+	[LAPIC_TIMER_VECTOR] = "local timer",
+	[LAPIC_RESCHEDULE_VECTOR] = "reschedule IPI",
+	[LAPIC_TLB_VECTOR] = "TLB shootdown IPI",
+	[LAPIC_TICK_VECTOR] = "tick restart IPI"
+};
+static int interrupt_msi_next = INTERRUPT_MSI_BASE;
+
+/* Device interrupts come from the IO APIC, the PIC is masked */
+static int interrupts_ioapic = 0;
+
 static const char* __exceptions_names[32] = {
 	"Divide by zero","Debug","NMI","Breakpoint","Overflow",
 	"OOB","Invalid opcode","No coprocessor","Double fault",
@@ -52,6 +71,40 @@ static const char* __exceptions_names[32] = {
 	"RESERVED","RESERVED","RESERVED","RESERVED","RESERVED","RESERVED",
 	"RESERVED"
 };
+
+/**
+ * @brief Gets the name of a vector, NULL for ISA lines and unused vectors.
+ */
+const char* interrupt_get_name(int interrupt)
+{
+	if(interrupt < 0 || interrupt >= ISR_LINES) return NULL;
+	if(interrupt < 32){
+		return __exceptions_names[interrupt] != NULL ? __exceptions_names[interrupt] : "RESERVED";
+	}
+	return interrupt_names[interrupt];
+}
+
+int interrupt_ioapic_enabled()
+{
+	return interrupts_ioapic;
+}
+
+/**
+ * @brief Allocates a vector for a message signalled interrupt, they are delivered by the local APIC.
+ * Vectors are never freed, they are only used by drivers attached at boot.
+ * @param name Shown with the interrupt counts.
+ * @return int vector, -ERROR_NOT_SUPPORTED without a local APIC or -ERROR_INDEX if none are left.
+ */
+int interrupt_alloc_vector(const char* name)
+{
+	if(!lapic_present()) return -ERROR_NOT_SUPPORTED;
+	if(interrupt_msi_next >= INTERRUPT_MSI_BASE + INTERRUPT_MSI_VECTORS) return -ERROR_INDEX;
+
+	int vector = interrupt_msi_next++;
+	interrupt_names[vector] = name;
+	return vector;
+}
+
 /* Definition for PAGE_TABLE_ADDRESS macro */
 #define PAGE_TABLE_ADDRESS(x) (((x) >> 12) << 12)
 #define PRESENT_BIT 0x1
@@ -67,7 +120,10 @@ void print_page_fault_info(unsigned long cr2) {
     page_dir_entry = $process->current->page_dir[DIRECTORY_INDEX(cr2)];
 
     /* Check if the page directory entry is present */
-    if (page_dir_entry & PRESENT_BIT) {
+    if ((page_dir_entry & PRESENT_BIT) && (page_dir_entry & PAGE_LARGE)) {
+		dbgprintf("Page Fault Address: 0x%x\n", cr2);
+		dbgprintf("Page Directory Entry: 0x%x (4MB page)\n", page_dir_entry);
+    } else if (page_dir_entry & PRESENT_BIT) {
         unsigned long *page_table = (unsigned long *)PAGE_TABLE_ADDRESS(page_dir_entry);
 
         page_table_entry = page_table[TABLE_INDEX(cr2)];
@@ -89,6 +145,18 @@ void print_page_fault_info(unsigned long cr2) {
 
 void page_fault_interrupt(unsigned long cr2, unsigned long err)
 {
+	if(err & PAGE_FAULT_USER){
+		pcb_account($process->current, 0);
+	}
+
+	/* Not present heap and stack pages are mapped on demand */
+	if(vmem_page_fault($process->current, cr2, err) == ERROR_OK){
+		if(err & PAGE_FAULT_USER){
+			pcb_account($process->current, 1);
+		}
+		return;
+	}
+
     uint32_t *ebp = (uint32_t*) __builtin_frame_address(0);
    	__backtrace_from((uintptr_t*)ebp);
 	
@@ -155,16 +223,46 @@ void load_data_segments(int seg)
     asm volatile ("movw %%ax, %%ds \n\t" "movw %% ax, %%es " : : "a" (seg));
 }
 
-/* Main interrupt handler, calls interrupt specific hanlder if installed. */
+/**
+ * @brief Main interrupt handler, calls interrupt specific hanlder if installed.
+ * Handlers run in a critical section. Local APIC interrupts are acknowledged before
+ * the handler, as it may switch to another pcb, the PIT handler acknowledges itself.
+ */
 void isr_handler(struct registers regs)
 {	
+	/* The processor asking for a TLB shootdown may hold the kernel lock while it waits */
+	if(regs.int_no == LAPIC_TLB_VECTOR){
+		__sync_add_and_fetch(&interrupt_counter[regs.int_no], 1);
+		lapic_eoi();
+		smp_tlb_poll();
+		return;
+	}
+
+	/* Lazy FPU switching, only touches state of this processor */
+	if(regs.int_no == FPU_TRAP_VECTOR){
+		__sync_add_and_fetch(&interrupt_counter[regs.int_no], 1);
+		fpu_trap();
+		return;
+	}
+
+	critical_enter();
+	smp_cpu()->irq_user = (regs.cs & 3) == 3;
+	if(smp_cpu()->irq_user){
+		pcb_account($process->current, 0);
+	}
+
 	interrupt_counter[regs.int_no]++;
 	if(regs.int_no < 32){
 		__interrupt_exception_handler(regs.int_no);
 		EOI(regs.int_no);
+		critical_leave_noirq();
 		return;
 	}
 
+	if(regs.int_no >= LAPIC_TIMER_VECTOR){
+		lapic_eoi();
+	}
+
 	if (handlers[regs.int_no] != 0){
 		// if(regs.int_no != 32)
 		// 	EOI(regs.int_no);
@@ -180,8 +278,26 @@ void isr_handler(struct registers regs)
 		
 	}
 
-	if(regs.int_no != 32)
-		EOI(regs.int_no);
+	/* Level triggered lines are acknowledged after the handler, once the device stopped asserting */
+	if(regs.int_no != 32 && regs.int_no < LAPIC_TIMER_VECTOR){
+		if(interrupts_ioapic){
+			lapic_eoi();
+		} else {
+			EOI(regs.int_no);
+		}
+	}
+
+	/* A latency class pcb woken by the handler runs now instead of after the next tick */
+	if(smp_cpu()->need_resched && $process->current != NULL){
+		kernel_preempt();
+	}
+
+	/* The handler may have switched pcbs, regs belong to the pcb returning now */
+	if((regs.cs & 3) == 3){
+		pcb_account($process->current, 1);
+	}
+
+	critical_leave_noirq();
 }
 
 static void idt_set_gate(uint8_t num, uint32_t base, uint16_t sel, uint8_t type, uint8_t access)
@@ -203,11 +319,13 @@ static void init_idt()
 	memset(&idt_entries, 0, sizeof(struct idt_entry)*256);
 
 	/* Set all ISR_LINES to go to ISR0 */
-	for (int i = 0; i < 48; i++){ 
+	for (int i = 0; i < ISR_LINES; i++){ 
+		if(irqs[i] == 0) continue;
 		idt_set_gate(i, (uint32_t) irqs[i] , GDT_KERNEL_CS, 0x0E, 0);
 	}
 	
 	idt_set_gate(48, (uint32_t)&_syscall_entry, GDT_KERNEL_CS, 0x0E, 3);
+	idt_set_gate(LAPIC_SPURIOUS_VECTOR, (uint32_t)&isr255, GDT_KERNEL_CS, 0x0E, 0);
 	idt_set_gate(14, (uint32_t)&_page_fault_entry, GDT_KERNEL_CS, 0x0E, 0);
 
 	interrupt_install_handler(13, &general_protection_fault);
@@ -215,6 +333,11 @@ static void init_idt()
 	idt_flush((uint32_t)&idt);
 }
 
+/* Loads the shared IDT on an application processor */
+void interrupt_load_idt()
+{
+	idt_flush((uint32_t)&idt);
+}
 
 void init_interrupts()
 {
@@ -232,6 +355,16 @@ void init_interrupts()
 
 	init_idt();
 
+#ifndef LEGACY_PIC
+	/* The PIC is only a fallback, if there is an IO APIC it is masked */
+	if(init_ioapic() == ERROR_OK){
+		outportb(PIC1_DATA, 0xFF);
+		outportb(PIC2_DATA, 0xFF);
+		lapic_mask_lint0();
+		interrupts_ioapic = 1;
+	}
+#endif
+
 	dbgprintf("[IQR] Interrupts initialized.");
 }
 
@@ -0,0 +1,127 @@
+/**
+ * @file ioapic.c
+ * @author Joe Bayer (joexbayer)
+ * @brief IO APIC driver, routes device interrupts to the local APIC of a processor.
+ * @version 0.1
+ * @date 2024-03-23
+ *
+ * The IO APIC is found in the MP configuration table, see smp.c. Its registers are reached
+ * through an index and a data window. Every pin has a redirection entry holding the vector,
+ * trigger mode and destination processor of its interrupt.
+ * ISA lines are routed to the bootstrap processor on the vectors they had on the PIC, so
+ * drivers install their handlers the same way in both modes. The PIT line is left masked,
+ * the local APIC timer ticks instead.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <kconfig.h>
+#include <arch/ioapic.h>
+#include <arch/lapic.h>
+#include <memory.h>
+#include <serial.h>
+#include <smp.h>
+
+#ifndef KDEBUG_IOAPIC
+#undef dbgprintf
+#define dbgprintf(...)
+#endif
+
+#define IOAPIC_REGSEL           0x00
+#define IOAPIC_WINDOW           0x10
+
+#define IOAPIC_VERSION          0x01
+#define IOAPIC_REDIRECTION(pin) (0x10 + (pin) * 2)
+
+#define IOAPIC_MASKED           0x10000
+#define IOAPIC_LEVEL            0x8000
+#define IOAPIC_ACTIVE_LOW       0x2000
+
+#define IOAPIC_ISA_IRQS         16
+#define IOAPIC_PIT_IRQ          0
+#define IOAPIC_CASCADE_IRQ      2
+
+static uint32_t ioapic_base = 0;
+static int ioapic_pins = 0;
+
+static inline uint32_t __ioapic_read(uint32_t reg)
+{
+    *(volatile uint32_t*)(ioapic_base + IOAPIC_REGSEL) = reg;
+    return *(volatile uint32_t*)(ioapic_base + IOAPIC_WINDOW);
+}
+
+static inline void __ioapic_write(uint32_t reg, uint32_t value)
+{
+    *(volatile uint32_t*)(ioapic_base + IOAPIC_REGSEL) = reg;
+    *(volatile uint32_t*)(ioapic_base + IOAPIC_WINDOW) = value;
+}
+
+/**
+ * @brief Maps the IO APIC and routes the ISA lines to the calling processor, all other pins stay masked.
+ * Must be called on the bootstrap processor after its local APIC is enabled.
+ * @return error_t 0 on success, -ERROR_NOT_SUPPORTED if there is no IO APIC or local APIC.
+ */
+error_t init_ioapic()
+{
+    uint32_t base = smp_io_apic_address();
+    if(base == 0 || !lapic_present()){
+        return -ERROR_NOT_SUPPORTED;
+    }
+
+    ioapic_base = base;
+    vmem_map_driver_region(ioapic_base, 1);
+
+    ioapic_pins = ((__ioapic_read(IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+    for (int pin = 0; pin < ioapic_pins; pin++){
+        ioapic_mask(pin);
+    }
+
+    uint8_t apic_id = lapic_id();
+    for (int irq = 0; irq < IOAPIC_ISA_IRQS; irq++){
+        if(irq == IOAPIC_PIT_IRQ || irq == IOAPIC_CASCADE_IRQ) continue;
+
+        struct smp_irq line;
+        smp_get_irq(irq, &line);
+        if(line.pin >= ioapic_pins) continue;
+
+        ioapic_route(line.pin, IOAPIC_IRQ_VECTOR(irq), apic_id, line.level, line.active_low);
+    }
+
+    dbgprintf("[IOAPIC] IO APIC at 0x%x with %d pins\n", ioapic_base, ioapic_pins);
+
+    return ERROR_OK;
+}
+
+int ioapic_pin_count()
+{
+    return ioapic_pins;
+}
+
+/**
+ * @brief Delivers the interrupt of a pin to a processor.
+ * @param pin IO APIC pin.
+ * @param vector Interrupt vector.
+ * @param apic_id Local APIC id of the destination processor.
+ * @param level Level triggered, otherwise edge triggered.
+ * @param active_low Asserted when low, otherwise when high.
+ */
+void ioapic_route(int pin, uint8_t vector, uint8_t apic_id, int level, int active_low)
+{
+    if(pin < 0 || pin >= ioapic_pins) return;
+
+    uint32_t low = vector;
+    if(level) low |= IOAPIC_LEVEL;
+    if(active_low) low |= IOAPIC_ACTIVE_LOW;
+
+    /* Destination first, the entry is live once the mask bit in the low half is cleared */
+    __ioapic_write(IOAPIC_REDIRECTION(pin) + 1, ((uint32_t)apic_id) << 24);
+    __ioapic_write(IOAPIC_REDIRECTION(pin), low);
+
+    dbgprintf("[IOAPIC] Pin %d to vector %d on APIC %d (%s, %s)\n", pin, vector, apic_id, level ? "level" : "edge", active_low ? "low" : "high");
+}
+
+void ioapic_mask(int pin)
+{
+    if(pin < 0 || pin >= ioapic_pins) return;
+    __ioapic_write(IOAPIC_REDIRECTION(pin), IOAPIC_MASKED);
+}
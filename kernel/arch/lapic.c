@@ -0,0 +1,267 @@
+/**
+ * @file lapic.c
+ * @author Joe Bayer (joexbayer)
+ * @brief Local APIC driver, interprocessor interrupts and the per processor timer.
+ * @version 0.1
+ * @date 2024-03-02
+ *
+ * Every processor has its own local APIC at the same physical address, so the
+ * registers always refer to the processor accessing them.
+ * Device interrupts come from the IO APIC when there is one, see ioapic.c. Otherwise the
+ * legacy PIC is used, on the bootstrap processor its interrupts are passed through LINT0 as ExtINT.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <kconfig.h>
+#include <arch/lapic.h>
+#include <arch/io.h>
+#include <memory.h>
+#include <serial.h>
+#include <kutils.h>
+#include <libc.h>
+
+#ifndef KDEBUG_LAPIC
+#undef dbgprintf
+#define dbgprintf(...)
+#endif
+
+#define LAPIC_SVR_ENABLE        0x100
+#define LAPIC_LVT_MASKED        0x10000
+#define LAPIC_LVT_PERIODIC      0x20000
+#define LAPIC_LVT_EXTINT        0x700
+#define LAPIC_LVT_NMI           0x400
+
+#define LAPIC_ICR_PENDING       0x1000
+#define LAPIC_ICR_INIT          0x4500
+#define LAPIC_ICR_INIT_DEASSERT 0x8500
+#define LAPIC_ICR_STARTUP       0x4600
+#define LAPIC_ICR_OTHERS        0xC0000
+
+/* Timer counts down at the bus frequency divided by 16 */
+#define LAPIC_TIMER_DIVIDE_16   0x3
+
+/* PIT channel 2 is used as reference while calibrating, it is gated through port 0x61 */
+#define PIT_FREQUENCY           1193180
+#define PIT_CHANNEL2            0x42
+#define PIT_CMD                 0x43
+#define PIT_CMD_CHANNEL2_ONESHOT 0xB0
+#define PIT_GATE                0x61
+#define PIT_GATE_OUT            0x20
+#define LAPIC_CALIBRATE_MS      10
+
+static uint32_t lapic_base = 0;
+static uint32_t lapic_ticks_per_ms = 0;
+static uint32_t lapic_tsc_per_ms = 0;
+
+static inline uint32_t __lapic_read(uint32_t reg)
+{
+    return *(volatile uint32_t*)(lapic_base + reg);
+}
+
+static inline void __lapic_write(uint32_t reg, uint32_t value)
+{
+    *(volatile uint32_t*)(lapic_base + reg) = value;
+}
+
+static void __lapic_icr_wait()
+{
+    while(__lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING){
+        asm volatile ("pause");
+    }
+}
+
+static void __lapic_icr_send(uint8_t apic_id, uint32_t command)
+{
+    __lapic_icr_wait();
+    __lapic_write(LAPIC_ICR_HIGH, ((uint32_t)apic_id) << 24);
+    __lapic_write(LAPIC_ICR_LOW, command);
+    __lapic_icr_wait();
+}
+
+/**
+ * @brief Maps the local APIC registers, they are inherited by all page directories created afterwards.
+ * @param base Physical address of the local APIC, 0 for the default.
+ * @return error_t 0 on success, -ERROR_NOT_SUPPORTED if the processor has no local APIC.
+ */
+error_t init_lapic(uint32_t base)
+{
+    if(!(cpuid_edx(1) & CPUID_EDX_APIC)){
+        return -ERROR_NOT_SUPPORTED;
+    }
+
+    lapic_base = base != 0 ? base : LAPIC_DEFAULT_BASE;
+    vmem_map_driver_region(lapic_base, 1);
+
+    dbgprintf("[LAPIC] Local APIC at 0x%x\n", lapic_base);
+
+    return ERROR_OK;
+}
+
+int lapic_present()
+{
+    return lapic_base != 0;
+}
+
+/**
+ * @brief Enables the local APIC of the calling processor.
+ * The bootstrap processor keeps receiving PIC interrupts through LINT0,
+ * the other processors only get interprocessor and timer interrupts.
+ * @param bsp The calling processor is the bootstrap processor.
+ */
+void lapic_enable(int bsp)
+{
+    __lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    __lapic_write(LAPIC_TPR, 0);
+
+    __lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    __lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    if(bsp){
+        __lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_EXTINT);
+        __lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_NMI);
+    } else {
+        __lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+        __lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_MASKED);
+    }
+
+    /* Error status has to be written before it is read */
+    __lapic_write(LAPIC_ESR, 0);
+    __lapic_write(LAPIC_ESR, 0);
+
+    lapic_eoi();
+}
+
+/* The PIC is masked once the IO APIC delivers device interrupts, nothing should come through LINT0 */
+void lapic_mask_lint0()
+{
+    __lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+}
+
+uint8_t lapic_id()
+{
+    return __lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi()
+{
+    __lapic_write(LAPIC_EOI, 0);
+}
+
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector)
+{
+    __lapic_icr_send(apic_id, vector);
+}
+
+/* Sends the interrupt to all processors but the calling one */
+void lapic_send_ipi_others(uint8_t vector)
+{
+    __lapic_icr_send(0, LAPIC_ICR_OTHERS | vector);
+}
+
+void lapic_send_init(uint8_t apic_id)
+{
+    __lapic_icr_send(apic_id, LAPIC_ICR_INIT);
+    __lapic_icr_send(apic_id, LAPIC_ICR_INIT_DEASSERT);
+}
+
+/**
+ * @brief Sends a startup interrupt, the processor starts in real mode at page * 4096.
+ */
+void lapic_send_startup(uint8_t apic_id, uint8_t page)
+{
+    __lapic_icr_send(apic_id, LAPIC_ICR_STARTUP | page);
+}
+
+/**
+ * @brief Measures the local APIC timer and the TSC against the PIT, all processors share the bus frequency.
+ * Uses PIT channel 2, channel 0 keeps driving the system tick.
+ */
+void lapic_timer_calibrate()
+{
+    uint16_t count = (PIT_FREQUENCY * LAPIC_CALIBRATE_MS) / 1000;
+
+    /* Gate channel 2 on, speaker off */
+    outportb(PIT_GATE, (inportb(PIT_GATE) & ~0x2) | 0x1);
+    outportb(PIT_CMD, PIT_CMD_CHANNEL2_ONESHOT);
+    outportb(PIT_CHANNEL2, count & 0xFF);
+    outportb(PIT_CHANNEL2, (count >> 8) & 0xFF);
+
+    __lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    __lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+
+    /* Restart the count by toggling the gate */
+    uint8_t gate = inportb(PIT_GATE) & ~0x1;
+    outportb(PIT_GATE, gate);
+    outportb(PIT_GATE, gate | 0x1);
+    __lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    uint64_t tsc_start = rdtsc();
+
+    while(!(inportb(PIT_GATE) & PIT_GATE_OUT));
+
+    uint32_t elapsed = 0xFFFFFFFF - __lapic_read(LAPIC_TIMER_CURRENT);
+    uint32_t tsc_elapsed = (uint32_t)(rdtsc() - tsc_start);
+    __lapic_write(LAPIC_TIMER_INITIAL, 0);
+
+    lapic_ticks_per_ms = elapsed / LAPIC_CALIBRATE_MS;
+    lapic_tsc_per_ms = tsc_elapsed / LAPIC_CALIBRATE_MS;
+
+    dbgprintf("[LAPIC] Timer runs at %d ticks per ms\n", lapic_ticks_per_ms);
+}
+
+/**
+ * @brief Starts the periodic timer of the calling processor on LAPIC_TIMER_VECTOR.
+ * @param hz Interrupts per second.
+ */
+void lapic_timer_start(int hz)
+{
+    __lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    __lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_PERIODIC | LAPIC_TIMER_VECTOR);
+    __lapic_write(LAPIC_TIMER_INITIAL, lapic_timer_period(hz));
+}
+
+/**
+ * @brief Fires LAPIC_TIMER_VECTOR once on the calling processor after the given count.
+ * @param count Timer ticks, see lapic_timer_period.
+ */
+void lapic_timer_oneshot(uint32_t count)
+{
+    __lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    __lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR);
+    __lapic_write(LAPIC_TIMER_INITIAL, count);
+}
+
+/* Count left until the timer of the calling processor fires */
+uint32_t lapic_timer_current()
+{
+    return __lapic_read(LAPIC_TIMER_CURRENT);
+}
+
+/* TSC cycles per millisecond, measured by lapic_timer_calibrate */
+uint32_t lapic_tsc_rate()
+{
+    return lapic_tsc_per_ms;
+}
+
+/* Timer count of one period at the given frequency, after lapic_timer_calibrate */
+uint32_t lapic_timer_period(int hz)
+{
+    return (lapic_ticks_per_ms * 1000) / hz;
+}
+
+/**
+ * @brief Busy waits using the timer of the calling processor, its periodic timer is stopped.
+ * Only used while starting processors, after lapic_timer_calibrate.
+ * @param us Microseconds to wait.
+ */
+void lapic_udelay(int us)
+{
+    __lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    __lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    /* Split so long waits do not overflow */
+    uint32_t ticks = (lapic_ticks_per_ms / 1000) * us + ((lapic_ticks_per_ms % 1000) * us) / 1000;
+    __lapic_write(LAPIC_TIMER_INITIAL, ticks + 1);
+
+    while(__lapic_read(LAPIC_TIMER_CURRENT) != 0){
+        asm volatile ("pause");
+    }
+}
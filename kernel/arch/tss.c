@@ -1,17 +1,21 @@
 #include <arch/tss.h>
 #include <arch/gdt.h>
 #include <libc.h>
+#include <smp.h>
 
 #define FLUSH_TSS() asm volatile ("ltr %0" : : "m" (tss_selector))
 
-struct tss_entry tss;
-
-void init_tss(void)
+/**
+ * @brief Loads the TSS of the given processor, its GDT has to be loaded first.
+ * The kernel stack in the TSS is updated by the scheduler on every switch.
+ */
+void init_tss(struct cpu* cpu)
 {
     uint16_t tss_selector = GDT_KERNEL_TSS;
-    tss.ldt_selector = 0;
-    tss.prev_tss = GDT_KERNEL_TSS;
-    tss.iomap_base = sizeof(struct tss_entry);
+    cpu->tss.ldt_selector = 0;
+    cpu->tss.prev_tss = GDT_KERNEL_TSS;
+    cpu->tss.ss_0 = GDT_KERNEL_DS;
+    cpu->tss.iomap_base = sizeof(struct tss_entry);
 
     FLUSH_TSS();
 }
\ No newline at end of file
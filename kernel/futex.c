@@ -0,0 +1,137 @@
+/**
+ * @file futex.c
+ * @author Joe Bayer (joexbayer)
+ * @brief Wait and wake on user memory words, the slow path of userspace locks.
+ * @version 0.1
+ * @date 2024-03-16
+ *
+ * Userspace locks change their word with atomic instructions and only call into the
+ * kernel to block while it holds an expected value, or to wake blocked pcbs after changing it.
+ * A futex is identified by the physical address of its word, so threads of a process and
+ * processes sharing a frame meet on the same futex whatever address they use. The word is
+ * made writable first, a copy-on-write page of the program image would otherwise be swapped
+ * for a private frame by the first write and waiters would sleep on a frame no one wakes.
+ * Waiters of all futexes hashing to the same bucket share its wait queue, the futex
+ * a pcb waits on is kept in the pcb so wakes only pick the matching ones.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <kconfig.h>
+#include <futex.h>
+#include <sync.h>
+#include <pcb.h>
+#include <memory.h>
+#include <scheduler.h>
+#include <syscalls.h>
+#include <syscall_helper.h>
+#include <serial.h>
+
+#ifndef KDEBUG_SYNC
+#undef dbgprintf
+#define dbgprintf(...)
+#endif
+
+static waitqueue_t futex_buckets[FUTEX_BUCKETS];
+
+static inline waitqueue_t* __futex_bucket(uint32_t key)
+{
+    return &futex_buckets[(key >> 2) % FUTEX_BUCKETS];
+}
+
+/**
+ * @brief Blocks until the futex is woken, if its word still holds the expected value.
+ * Checking the word and queueing happen in one critical section and wakes take the
+ * same critical section, so a wake after the word was changed can not be missed.
+ * Like any futex wait it may return without the word having changed, callers check again.
+ * @param addr Word aligned user address.
+ * @param expected Value the caller saw in the word.
+ * @return error_t 0 when woken, -ERROR_AGAIN if the word changed,
+ * -ERROR_ACCESS_DENIED if the address is not writable user memory.
+ */
+error_t futex_wait(int* addr, int expected)
+{
+    uint32_t key;
+    struct pcb* current = $process->current;
+
+    if((uint32_t)addr & (sizeof(int) - 1)){
+        return -ERROR_INVALID_ARGUMENTS;
+    }
+
+    /* May block on the fault lock, so done before the critical section */
+    error_t err = vmem_fault_writable(current, (uint32_t)addr);
+    if(err < 0){
+        return err;
+    }
+
+    ENTER_CRITICAL();
+
+    /* Translated inside the critical section, so the frame can not be replaced before the word is read */
+    err = vmem_get_physical(current, (uint32_t)addr, &key);
+    if(err < 0){
+        LEAVE_CRITICAL();
+        return err;
+    }
+
+    if(*addr != expected){
+        LEAVE_CRITICAL();
+        return -ERROR_AGAIN;
+    }
+
+    dbgprintf("[FUTEX] %s waits on 0x%x\n", current->name, key);
+
+    current->futex = key;
+    waitqueue_sleep(__futex_bucket(key), WAIT_FOREVER);
+    current->futex = 0;
+
+    LEAVE_CRITICAL();
+
+    return ERROR_OK;
+}
+EXPORT_SYSCALL(SYSCALL_FUTEX_WAIT, futex_wait);
+
+/**
+ * @brief Wakes pcbs waiting on the futex, the longest waiting first.
+ * @param addr Word aligned user address.
+ * @param count Most pcbs to wake, FUTEX_WAKE_ALL for all.
+ * @return int number of pcbs woken, negative error code otherwise.
+ */
+int futex_wake(int* addr, int count)
+{
+    uint32_t key;
+    int woken = 0;
+
+    if((uint32_t)addr & (sizeof(int) - 1)){
+        return -ERROR_INVALID_ARGUMENTS;
+    }
+
+    error_t err = vmem_fault_writable($process->current, (uint32_t)addr);
+    if(err < 0){
+        return err;
+    }
+
+    ENTER_CRITICAL();
+
+    err = vmem_get_physical($process->current, (uint32_t)addr, &key);
+    if(err < 0){
+        LEAVE_CRITICAL();
+        return err;
+    }
+
+    waitqueue_t* bucket = __futex_bucket(key);
+    struct pcb* pcb = bucket->head;
+    while(pcb != NULL && woken < count){
+        struct pcb* next = pcb->next;
+        if(pcb->futex == key){
+            waitqueue_remove(pcb);
+            get_scheduler()->ops->wake(get_scheduler(), pcb);
+            woken++;
+        }
+        pcb = next;
+    }
+
+    LEAVE_CRITICAL();
+
+    return woken;
+}
+EXPORT_SYSCALL(SYSCALL_FUTEX_WAKE, futex_wake);
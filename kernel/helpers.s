@@ -59,7 +59,8 @@ enable_paging:
     movl %esp, %ebp
 
     mov %cr0, %eax
-    or $0x80000000, %eax
+    /* Paging and write protect, so kernel writes to copy-on-write pages fault too */
+    or $0x80010000, %eax
     mov %eax, %cr0
     
     movl %ebp, %esp
@@ -88,7 +89,6 @@ pcb_save_context:
     pushfl
     popl %ebx
     movl %ebx, PCB_EFLAGS(%eax)
-    fnsave PCB_FPU_STATE(%eax)
 
     popl %ebx
 
@@ -113,7 +113,7 @@ pcb_restore_context:
     movl PCB_EBP(%eax), %ebp  /* ebp */
     movl PCB_ESP(%eax), %esp  /* esp */
 
-    frstor PCB_FPU_STATE(%eax)  /* fpu_state */
+    /* The FPU state is switched lazily, see fpu.c */
 
     movl PCB_EBX(%eax), %ebx  /* ebx */
     movl PCB_ECX(%eax), %ecx   /* ecx */
@@ -133,7 +133,7 @@ pcb_restore_context:
 
 .global _start_pcb
 _start_pcb:
-    subl $1, __cli_cnt
+    call critical_leave_noirq
     # movl $process->current, %eax
     movl 4(%esp), %eax
 
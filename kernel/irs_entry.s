@@ -82,12 +82,31 @@ ISR_NO_ERR 44
 ISR_NO_ERR 45
 ISR_NO_ERR 46
 ISR_NO_ERR 47
+/* 48 is the system call, see _syscall_entry */
+ISR_NO_ERR 49
+ISR_NO_ERR 50
+ISR_NO_ERR 51
+ISR_NO_ERR 52
+/* Message signalled interrupts */
+ISR_NO_ERR 53
+ISR_NO_ERR 54
+ISR_NO_ERR 55
+ISR_NO_ERR 56
+
+/* Spurious local APIC interrupts are not acknowledged */
+.global isr255
+isr255:
+  iret
 
 isr_entry:
   cli
 
   pushal
 
+  /* Per processor data segment, GDT_CPU_DS */
+  movw $0x30, %ax
+  movw %ax, %fs
+
   pushl	%ds
   pushl	$16
   call	load_data_segments
@@ -105,12 +124,9 @@ isr_entry:
 
   iret
 
-syscall_return_value:
-  .long	0
 .global _syscall_entry
 _syscall_entry:
     cli
-    addl $1, __cli_cnt
 
     pushl %ebp
     movl %esp, %ebp
@@ -118,8 +134,13 @@ _syscall_entry:
     pushfl
     pushal
 
+    movw $0x30, %ax
+    movw %ax, %fs
+    movl -8(%ebp), %eax	/* Syscall number, saved by pushal */
+
     pushl	%ds
 
+    pushl	4(%ebp)	/* EIP of the caller, pushed by int */
 	  pushl	%edx	/* Arg 3 */
     pushl	%ecx	/* Arg 2 */
     pushl	%ebx	/* Arg 1 */
@@ -129,59 +150,52 @@ _syscall_entry:
     call	load_data_segments
     addl	$4, %esp
 
+    call critical_enter
     call system_call
-    movl	%eax, (syscall_return_value)
+    /* Return value replaces the saved eax, a shared variable could be overwritten by another processor */
+    movl	%eax, -8(%ebp)
+    call critical_leave_noirq
 	
-    popl	%edx	/* Arg 3 */
-    popl	%ecx	/* Arg 2 */
-    popl	%ebx	/* Arg 1 */
-    popl	%eax	/* Syscall number */
+    addl	$20, %esp	/* Syscall number, args and EIP */
     
     popl	%ds
 
     popal 
     popfl
-    
-    movl	(syscall_return_value), %eax
 
     movl %ebp, %esp
     popl %ebp
 
-    subl $1, __cli_cnt
     iret
 
-page_fault_save:
-  .long	0
-page_fault_error:
-  .long	0
 .global _page_fault_entry
 _page_fault_entry:
     cli
 
-    movl	%eax, (page_fault_save)
-    popl	%eax
-    /* Get error code */
-    movl	%eax, (page_fault_error)
-    movl	(page_fault_save), %eax
-
     pushal
 
+    movw $0x30, %ax
+    movw %ax, %fs
+
     pushl	%ds
     pushl	$16
     call	load_data_segments
     addl	$4, %esp
 
     /* Push error code, and then contents of cr2 */
-    movl	(page_fault_error), %eax
-    pushl	%eax
+    pushl	36(%esp)
     movl	%cr2, %eax
     pushl	%eax
 
+    call critical_enter
     call page_fault_interrupt
+    call critical_leave_noirq
 
     addl	$8, %esp
     
     popl	%ds
     popal
 
+    /* Pop error code */
+    addl	$4, %esp
     iret
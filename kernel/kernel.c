@@ -95,6 +95,8 @@ static void kernel_boot_printf(char* message) {
  */
 void kernel(uint32_t magic) 
 {
+	/* Per processor state has to be set up before the first critical section */
+	smp_init_bsp();
 	ENTER_CRITICAL();
 
 #ifdef GRUB_MULTIBOOT
@@ -136,6 +138,7 @@ void kernel(uint32_t magic)
 	/* Initilize memory map and then kernel and virtual memory */
 	memory_map_init(__kernel_context.boot_info->extended_memory_low * 1024, __kernel_context.boot_info->extended_memory_high * 64 * 1024);
 	init_memory();
+	smp_init();
 	kernel_boot_printf("Memory initialized.");
 	
 	/* Initilize the kernel constructors */
@@ -207,7 +210,6 @@ void kernel(uint32_t magic)
 
 
 	add_system_call(SYSCALL_FREE, (syscall_t)&free);
-	add_system_call(SYSCALL_MALLOC, (syscall_t)&malloc);
 
 	add_system_call(SYSCALL_OPEN, (syscall_t)&fs_open);
 	add_system_call(SYSCALL_READ, (syscall_t)&fs_read);
@@ -217,9 +219,8 @@ void kernel(uint32_t magic)
 #pragma GCC diagnostic pop
 
 	load_page_directory(kernel_page_dir);
-	init_gdt();
-	init_tss();
 	enable_paging();
+	vmem_enable_global_pages();
 	kernel_boot_printf("Virtual memory initialized.");
 
 	dbgprintf("[KERNEL] Enabled paging!\n");
@@ -229,6 +230,11 @@ void kernel(uint32_t magic)
 
 	kernel_config_load("sysutil/default.cfg");
 
+	char* scheduler = config_get_value("kernel", "scheduler");
+	if(scheduler != NULL && sched_set_policy(scheduler) < 0){
+		warningf("Unknown scheduler %s, using %s", scheduler, get_scheduler()->ops->name);
+	}
+
 	$services->usermanager = usermanager_create();
 	$services->usermanager->ops->load($services->usermanager);
 
@@ -237,18 +243,23 @@ void kernel(uint32_t magic)
 
 	start("idled", 0, NULL);
 	if(__kernel_context.graphic_mode != KERNEL_FLAG_TEXTMODE){
-		start("wind", 0, NULL);
+		start_class("wind", 0, NULL, PCB_CLASS_LATENCY);
 	} else {
 		start("textshell", 0, NULL);	
 	}
-	start("workd", 0, NULL);
-	start("netd", 0, NULL);
+	for (int i = 0; i < WORK_WORKERS; i++){
+		start("workd", 0, NULL);
+	}
+	start_class("netd", 0, NULL, PCB_CLASS_LATENCY);
 	kernel_boot_printf("Deamons initialized.");
 
-	init_pit(1000);
+	smp_start_aps();
+	kernel_boot_printf("Processors initialized.");
+
+	init_pit(TIMER_HZ);
 	kernel_boot_printf("Timer initialized.");
 
-	dbgprintf("Critical counter: %d\n", __cli_cnt);
+	dbgprintf("Critical counter: %d\n", critical_depth());
 
 	$services->kevents->ops->add($services->kevents, KEVENT_INFO, "Kernel successfully booted.");
 	
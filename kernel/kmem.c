@@ -14,6 +14,7 @@
 #include <sync.h>
 #include <bitmap.h>
 #include <assert.h>
+#include <kmemtrace.h>
 
 
 #ifndef KDEBUG_MEMORY
@@ -24,52 +25,15 @@
 /* Dynamic kernel memory */
 
 #define KMEM_BLOCK_SIZE 		256
-#define KMEM_BLOCKS_PER_BYTE 	8
-#define KMEM_BITMAP_INDEX(addr) ((addr - KERNEL_MEMORY_START) / KMEM_BLOCK_SIZE / KMEM_BLOCKS_PER_BYTE)
-#define KMEM_BITMAP_OFFSET(addr) ((addr - KERNEL_MEMORY_START) / KMEM_BLOCK_SIZE % KMEM_BLOCKS_PER_BYTE)
 
 /* values determined by memory map, set at runtime */
 static uint32_t KERNEL_MEMORY_START = 0;
 static uint32_t KERNEL_MEMORY_END = 0;
 
-static uint8_t* __kmemory_bitmap;
+static struct hbitmap __kmemory_bitmap;
 static spinlock_t __kmemory_lock = 0;
 static uint32_t __kmemory_used = 0;
 
-static inline int __kmemory_find_blocks(int num_blocks, int total_blocks)
-{
-    int free_blocks = 0;
-    for (int i = 0; i < total_blocks; i++) {
-        uint32_t index = KMEM_BITMAP_INDEX(KERNEL_MEMORY_START + i * KMEM_BLOCK_SIZE);
-        uint32_t offset = KMEM_BITMAP_OFFSET(KERNEL_MEMORY_START + i * KMEM_BLOCK_SIZE);
-        if (!(__kmemory_bitmap[index] & (1 << offset))) {
-            free_blocks++;
-            if (free_blocks == num_blocks) {
-                return i - num_blocks + 1;
-            }
-        } else {
-            free_blocks = 0;
-        }
-    }
-    return -1;  /* No free block found */
-}
-
-static inline void __kmemory_mark_blocks(int start_block, int num_blocks)
-{
-    for (int i = start_block; i < start_block + num_blocks; i++) {
-        uint32_t index = KMEM_BITMAP_INDEX(KERNEL_MEMORY_START + i * KMEM_BLOCK_SIZE);
-        uint32_t offset = KMEM_BITMAP_OFFSET(KERNEL_MEMORY_START + i * KMEM_BLOCK_SIZE);
-        __kmemory_bitmap[index] |= (1 << offset);
-    }
-}
-
-static inline void __kmemory_write_metadata(int start_block, int num_blocks)
-{
-    int* metadata = (int*) (KERNEL_MEMORY_START + start_block * KMEM_BLOCK_SIZE);
-    *metadata = num_blocks;
-}
-
-
 /**
  * @brief Allocates sequential chunks of fixed size (256 bytes each) from a region of kernel memory.
  * 
@@ -82,17 +46,16 @@ static inline void __kmemory_write_metadata(int start_block, int num_blocks)
  * @param size The amount of memory to allocate, in bytes. It is recommended that this value be 4KB-aligned.
  * @return A void pointer to the allocated memory block, or NULL if no contiguous region of memory was found.
  */
-void* kalloc(int size)
+static void* __kalloc(int size, uintptr_t caller)
 {
     if (size <= 0) return NULL;
 
     size = ALIGN(size, PTR_SIZE);
     int num_blocks = (size + sizeof(int) + KMEM_BLOCK_SIZE - 1) / KMEM_BLOCK_SIZE;
-    int total_blocks = (KERNEL_MEMORY_END - KERNEL_MEMORY_START) / KMEM_BLOCK_SIZE;
 
 	spin_lock(&__kmemory_lock);
 
-    int start_block = __kmemory_find_blocks(num_blocks, total_blocks);
+    int start_block = hbitmap_alloc_range(&__kmemory_bitmap, num_blocks);
     if (start_block == -1) {
         /* No contiguous free region of memory was found */
         warningf("Out of memory: %d\n", __kmemory_used);
@@ -101,8 +64,9 @@ void* kalloc(int size)
         return NULL;
     }
 
-    __kmemory_mark_blocks(start_block, num_blocks);
-    __kmemory_write_metadata(start_block, num_blocks);
+    /* Store the number of blocks in the first word of the allocation */
+    int* metadata = (int*) (KERNEL_MEMORY_START + start_block * KMEM_BLOCK_SIZE);
+    *metadata = num_blocks;
 
     void* ptr = (void*)(KERNEL_MEMORY_START + start_block * KMEM_BLOCK_SIZE + sizeof(int));
 
@@ -118,12 +82,19 @@ void* kalloc(int size)
 
     spin_unlock(&__kmemory_lock);
 
+    kmemtrace_alloc(KMEMTRACE_KALLOC, ptr, num_blocks * KMEM_BLOCK_SIZE, caller, $process->current->pid);
+
     return ptr;
 }
 
+void* kalloc(int size)
+{
+    return __kalloc(size, (uintptr_t) __builtin_return_address(0));
+}
+
 void* kcalloc(int size)
 {
-    void* ptr = kalloc(size);
+    void* ptr = __kalloc(size, (uintptr_t) __builtin_return_address(0));
     if(ptr == NULL) return NULL;
 
     memset(ptr, 0, size);
@@ -145,6 +116,8 @@ void* kcalloc(int size)
 void kfree(void* ptr)
 {
 	if (!ptr) return;
+
+	kmemtrace_free(KMEMTRACE_KALLOC, ptr, $process->current->pid);
 	
 	spin_lock(&__kmemory_lock);
 
@@ -157,45 +130,12 @@ void kfree(void* ptr)
 	dbgprintf("[MEMORY] %s freeing %d blocks of data\n", $process->current->name, num_blocks);
 
 	/* Mark the blocks as free in the bitmap */
-	for (int i = 0; i < num_blocks; i++) {
-		uint32_t index = KMEM_BITMAP_INDEX(KERNEL_MEMORY_START + (block_index + i) * KMEM_BLOCK_SIZE);
-		uint32_t offset = KMEM_BITMAP_OFFSET(KERNEL_MEMORY_START + (block_index + i) * KMEM_BLOCK_SIZE);
-		__kmemory_bitmap[index] &= ~(1 << offset);
-	}
+	hbitmap_free_range(&__kmemory_bitmap, block_index, num_blocks);
 
     __kmemory_used -= num_blocks * KMEM_BLOCK_SIZE;
 	spin_unlock(&__kmemory_lock);
 }
 
-/**
- * @brief Arena style permanent memory allocation scheme for memory that wont be freed.
- * Mainly by the windowservers framebuffer, and E1000's buffers.
- */
-static uintptr_t memory_permanent_start = 0;
-static uintptr_t memory_permanent_end = 0;
-void* palloc(int size)
-{
-	if(size <= 0) return NULL;
-    if(memory_permanent_start == 0 || memory_permanent_end == 0) return NULL;
-
-    size = ALIGN(size, PTR_SIZE);
-
-	if(memory_permanent_start + size >= memory_permanent_end){
-		dbgprintf("[WARNING] Not enough permanent memory!\n");
-		return NULL;
-	}
-
-	uint32_t new = memory_permanent_start + size;
-	memory_permanent_start += size;
-
-	return (void*) new;
-}
-
-int pmemory_used()
-{
-    return memory_permanent_start-memory_map_get()->permanent.from;
-}
-
 int kmemory_used()
 {
     return __kmemory_used;
@@ -208,17 +148,17 @@ int kmemory_total()
 
 void kmem_init()
 {
-    memory_permanent_start = (uint32_t) memory_map_get()->permanent.from;
-    memory_permanent_end = (uint32_t) memory_map_get()->permanent.to;
+    pmem_init(memory_map_get()->permanent.from, memory_map_get()->permanent.to);
 
     KERNEL_MEMORY_START = (uint32_t) memory_map_get()->kernel.from;
     KERNEL_MEMORY_END = (uint32_t) memory_map_get()->kernel.to;
 
-    /* Initialize the bitmap */
-    __kmemory_bitmap = palloc((memory_map_get()->kernel.total) / KMEM_BLOCK_SIZE / KMEM_BLOCKS_PER_BYTE);
-    assert(__kmemory_bitmap != NULL);
-    memset(__kmemory_bitmap, 0, (memory_map_get()->kernel.total) / KMEM_BLOCK_SIZE / KMEM_BLOCKS_PER_BYTE);
+    /* Initialize the bitmap, kalloc is not available yet so storage comes from permanent memory */
+    int total_blocks = (KERNEL_MEMORY_END - KERNEL_MEMORY_START) / KMEM_BLOCK_SIZE;
+    void* storage = palloc(hbitmap_storage_size(total_blocks));
+    assert(storage != NULL);
+    hbitmap_init(&__kmemory_bitmap, storage, total_blocks);
 
-	__kmemory_lock = 0;
+	spinlock_init(&__kmemory_lock);
     dbgprintf("Lock 0x%x initiated by %s\n", &__kmemory_lock, $process->current->name);
 }
\ No newline at end of file
@@ -0,0 +1,281 @@
+/**
+ * @file kmemtrace.c
+ * @author Joe Bayer (joexbayer)
+ * @brief Allocation site tracing and leak detection.
+ * @version 0.1
+ * @date 2024-02-18
+ *
+ * Every traced allocation is kept in a hash table keyed by address (and the pid owning the heap for heap blocks), pointing to
+ * the allocation site (caller address and kind) it came from. Sites keep running totals
+ * so the biggest owners of memory can be listed at any time. When a process exits,
+ * allocations still owned by it are counted as leaks on their site.
+ * Both tables are static, tracing never allocates and can be used from inside the allocators.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <kconfig.h>
+#include <kmemtrace.h>
+#include <serial.h>
+#include <libc.h>
+#include <kutils.h>
+
+#ifndef KDEBUG_MEMORY
+#undef dbgprintf
+#define dbgprintf(...)
+#endif
+
+#define KMEMTRACE_BUCKETS 1024
+#define KMEMTRACE_HASH(ptr) ((((uintptr_t)(ptr)) >> 4) % KMEMTRACE_BUCKETS)
+#define KMEMTRACE_SITE_HASH(caller, kind) (((caller) + (kind)) % KMEMTRACE_MAX_SITES)
+
+/* Allocations of exited processes, no longer owned by any pid */
+#define KMEMTRACE_NO_OWNER -1
+
+static struct kmemtrace {
+	struct kmemtrace_allocation {
+		uintptr_t ptr;
+		int size;
+		short pid;
+		short site;
+		/* next allocation in bucket or free list, -1 terminates */
+		short next;
+		char kind;
+	} allocations[KMEMTRACE_MAX_ALLOCATIONS];
+	short buckets[KMEMTRACE_BUCKETS];
+	short free;
+	int live;
+
+	/* open addressed by caller, caller 0 marks an unused site */
+	struct kmemtrace_site_info sites[KMEMTRACE_MAX_SITES];
+	int nsites;
+
+	/* allocations which did not fit in the tables */
+	int dropped;
+	int enabled;
+} __kmemtrace;
+static struct kmemtrace* kmemtrace = &__kmemtrace;
+
+/**
+ * @brief Finds or creates the site of the given caller.
+ * @warning Must be called in a critical section.
+ * @return struct kmemtrace_site_info* site, NULL if the site table is full.
+ */
+static struct kmemtrace_site_info* __kmemtrace_site(uintptr_t caller, kmemtrace_kind_t kind)
+{
+	int index = KMEMTRACE_SITE_HASH(caller, kind);
+	for (int i = 0; i < KMEMTRACE_MAX_SITES; i++){
+		struct kmemtrace_site_info* site = &kmemtrace->sites[(index + i) % KMEMTRACE_MAX_SITES];
+		if(site->caller == caller && site->kind == kind) return site;
+		if(site->caller != 0) continue;
+
+		if(kmemtrace->nsites >= KMEMTRACE_MAX_SITES - 1) return NULL;
+
+		site->caller = caller;
+		site->kind = kind;
+		kmemtrace->nsites++;
+		return site;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Clears all records and sites.
+ */
+void kmemtrace_clear()
+{
+	CRITICAL_SECTION({
+		memset(kmemtrace->sites, 0, sizeof(kmemtrace->sites));
+		kmemtrace->nsites = 0;
+		kmemtrace->dropped = 0;
+		kmemtrace->live = 0;
+
+		for (int i = 0; i < KMEMTRACE_BUCKETS; i++){
+			kmemtrace->buckets[i] = -1;
+		}
+
+		for (int i = 0; i < KMEMTRACE_MAX_ALLOCATIONS; i++){
+			kmemtrace->allocations[i].ptr = 0;
+			kmemtrace->allocations[i].next = i + 1 < KMEMTRACE_MAX_ALLOCATIONS ? i + 1 : -1;
+		}
+		kmemtrace->free = 0;
+	});
+}
+
+/**
+ * @brief Starts or stops recording new allocations.
+ * Frees of already recorded allocations are tracked until the records are cleared.
+ */
+void kmemtrace_enable(int enable)
+{
+	if(enable && !kmemtrace->enabled && kmemtrace->live == 0 && kmemtrace->nsites == 0){
+		kmemtrace_clear();
+	}
+	kmemtrace->enabled = enable;
+}
+
+int kmemtrace_enabled()
+{
+	return kmemtrace->enabled;
+}
+
+int kmemtrace_dropped()
+{
+	return kmemtrace->dropped;
+}
+
+/**
+ * @brief Records a new allocation.
+ * @param kind Allocator the memory came from.
+ * @param ptr Address of the allocation.
+ * @param size Bytes taken from the allocator.
+ * @param caller Return address of the allocating call.
+ * @param pid Process the allocation belongs to.
+ */
+void kmemtrace_alloc(kmemtrace_kind_t kind, void* ptr, int size, uintptr_t caller, int pid)
+{
+	if(!kmemtrace->enabled || ptr == NULL) return;
+
+	CRITICAL_SECTION({
+		struct kmemtrace_site_info* site = __kmemtrace_site(caller, kind);
+		int index = kmemtrace->free;
+
+		if(site == NULL || index < 0){
+			kmemtrace->dropped++;
+		} else {
+			struct kmemtrace_allocation* allocation = &kmemtrace->allocations[index];
+			kmemtrace->free = allocation->next;
+
+			allocation->ptr = (uintptr_t) ptr;
+			allocation->size = size;
+			allocation->pid = pid;
+			allocation->kind = kind;
+			allocation->site = site - kmemtrace->sites;
+			allocation->next = kmemtrace->buckets[KMEMTRACE_HASH(ptr)];
+			kmemtrace->buckets[KMEMTRACE_HASH(ptr)] = index;
+			kmemtrace->live++;
+
+			site->live_bytes += size;
+			site->live_allocations++;
+			site->total_allocations++;
+		}
+	});
+}
+
+/**
+ * @brief Removes the record of an allocation from its bucket and updates its site.
+ * @warning Must be called in a critical section.
+ */
+static void __kmemtrace_remove(short* link)
+{
+	int index = *link;
+	struct kmemtrace_allocation* allocation = &kmemtrace->allocations[index];
+	struct kmemtrace_site_info* site = &kmemtrace->sites[(int)allocation->site];
+
+	site->live_bytes -= allocation->size;
+	site->live_allocations--;
+
+	*link = allocation->next;
+	allocation->ptr = 0;
+	allocation->next = kmemtrace->free;
+	kmemtrace->free = index;
+	kmemtrace->live--;
+}
+
+/**
+ * @brief Records that an allocation was freed, unknown addresses are ignored.
+ * @param kind Allocator the memory came from.
+ * @param ptr Address of the allocation.
+ * @param pid Process the allocation belongs to, only compared for heap blocks
+ * as every process heap starts at the same virtual address. Heap blocks belong to
+ * the process owning the heap, not to the thread which allocated them.
+ */
+void kmemtrace_free(kmemtrace_kind_t kind, void* ptr, int pid)
+{
+	if(kmemtrace->live == 0 || ptr == NULL) return;
+
+	CRITICAL_SECTION({
+		short* link = &kmemtrace->buckets[KMEMTRACE_HASH(ptr)];
+		while(*link >= 0){
+			struct kmemtrace_allocation* allocation = &kmemtrace->allocations[(int)*link];
+			if(allocation->ptr == (uintptr_t) ptr && allocation->kind == (char) kind && (kind != KMEMTRACE_HEAP || allocation->pid == pid)){
+				__kmemtrace_remove(link);
+				break;
+			}
+			link = &allocation->next;
+		}
+	});
+}
+
+/**
+ * @brief Reports leak candidates of an exited process, called once all its memory was released.
+ * Heap blocks go away with the process heap and are dropped, any other allocation still
+ * owned by the process is counted as a leak on its site and no longer belongs to the pid.
+ * @param pid Process which exited.
+ * @return int number of leak candidates.
+ */
+int kmemtrace_process_exit(int pid)
+{
+	int leaks = 0;
+	int leaked_bytes = 0;
+	if(kmemtrace->live == 0) return 0;
+
+	CRITICAL_SECTION({
+		for (int i = 0; i < KMEMTRACE_BUCKETS; i++){
+			short* link = &kmemtrace->buckets[i];
+			while(*link >= 0){
+				struct kmemtrace_allocation* allocation = &kmemtrace->allocations[(int)*link];
+				if(allocation->pid != pid){
+					link = &allocation->next;
+					continue;
+				}
+
+				if(allocation->kind == KMEMTRACE_HEAP){
+					__kmemtrace_remove(link);
+					continue;
+				}
+
+				kmemtrace->sites[(int)allocation->site].leaks++;
+				allocation->pid = KMEMTRACE_NO_OWNER;
+				leaked_bytes += allocation->size;
+				leaks++;
+				link = &allocation->next;
+			}
+		}
+	});
+
+	if(leaks > 0){
+		dbgprintf("[MEMTRACE] Process %d exited with %d live allocations (%d bytes)\n", pid, leaks, leaked_bytes);
+	}
+
+	return leaks;
+}
+
+/**
+ * @brief Gets the sites holding the most memory, largest first.
+ * @param sites Output array.
+ * @param max Size of the output array.
+ * @return int number of sites written.
+ */
+int kmemtrace_top_sites(struct kmemtrace_site_info* sites, int max)
+{
+	int count = 0;
+
+	CRITICAL_SECTION({
+		for (int i = 0; i < KMEMTRACE_MAX_SITES; i++){
+			struct kmemtrace_site_info* site = &kmemtrace->sites[i];
+			if(site->caller == 0 || (site->live_allocations == 0 && site->leaks == 0)) continue;
+
+			/* Insertion into the sorted output, dropping the smallest if full */
+			int j = count < max ? count++ : max;
+			while(j > 0 && sites[j-1].live_bytes < site->live_bytes){
+				if(j < max) sites[j] = sites[j-1];
+				j--;
+			}
+			if(j < max) sites[j] = *site;
+		}
+	});
+
+	return count;
+}
@@ -170,6 +170,28 @@ uintptr_t ksyms_resolve_symbol(const char* name)
     return 0;
 }
 
+/**
+ * @brief Finds the closest symbol at or below the given address in symbols.map.
+ * 
+ * @param addr address to resolve
+ * @param offset set to the distance from the start of the symbol, can be NULL
+ * @return const char* name of the symbol, NULL if not found.
+ */
+const char* ksyms_resolve_addr(uintptr_t addr, uintptr_t* offset)
+{
+    if(__symbols == NULL || __symbols->num_symbols == 0) return NULL;
+    if(addr < __symbols->min) return NULL;
+
+    for (int j = 0; j < __symbols->num_symbols; j++) {
+        if (__symbols->symtable[j].addr <= addr && (j == __symbols->num_symbols - 1 || __symbols->symtable[j + 1].addr > addr)) {
+            if(offset != NULL) *offset = addr - __symbols->symtable[j].addr;
+            return __symbols->symtable[j].name;
+        }
+    }
+
+    return NULL;
+}
+
 #define MAX_BACKTRACE_DEPTH 100
 
 void __backtrace_from(uintptr_t* ebp)
@@ -189,27 +211,11 @@ void __backtrace_from(uintptr_t* ebp)
         uintptr_t addr = stack[i];
         
         // Find the closest symbol
-        int found = 0;
-        for (int j = 0; j < __symbols->num_symbols; j++) {
-            if (__symbols->symtable[j].addr <= addr && (j == __symbols->num_symbols - 1 || __symbols->symtable[j + 1].addr > addr)) {
-                
-                dbgprintf("%s: 0x%x - 0x%x = 0x%x\n", 
-                    __symbols->symtable[j].name, 
-                    addr, 
-                    __symbols->symtable[j].addr, 
-                    addr - __symbols->symtable[j].addr);
-
-                /*vesa_printf((uint8_t*)vbe_info->framebuffer, 0, i*8 + 100, 0, "%s: 0x%x - 0x%x = 0x%x\n", 
-                    __symbols->symtable[j].name, 
-                    addr, 
-                    __symbols->symtable[j].addr, 
-                    addr - __symbols->symtable[j].addr);*/
-                found = 1;
-                break;
-            }
-        }
-
-        if (!found) {
+        uintptr_t offset = 0;
+        const char* name = ksyms_resolve_addr(addr, &offset);
+        if (name != NULL) {
+            dbgprintf("%s: 0x%x - 0x%x = 0x%x\n", name, addr, addr - offset, offset);
+        } else {
             dbgprintf("0x%x\n", addr);
         }
     }
@@ -83,12 +83,28 @@ error_t register_kthread(void (*f)(), char* name)
  * @return error_t ERROR_OK on success, else error code
  */
 error_t start(char* name, int argc, char* argv[])
+{
+    return start_class(name, argc, argv, PCB_CLASS_NORMAL);
+}
+
+/**
+ * @brief Starts a kernel thread in the given scheduling class.
+ * Threads handling input, drawing or packets start in PCB_CLASS_LATENCY,
+ * so they run as soon as they are woken instead of sharing slices with everyone else.
+ * @param class pcb_class_t of the new thread
+ * @return error_t pid on success, else error code
+ */
+error_t start_class(char* name, int argc, char* argv[], int class)
 {
     ERR_ON_NULL(name);
 
     for (int i = 0; i < total_kthreads; i++){
         if(memcmp(name, kthread_table[i].name, strlen(kthread_table[i].name)) == 0){
-            return pcb_create_kthread(kthread_table[i].entry, kthread_table[i].name, argc, argv);
+            pid_t pid = pcb_create_kthread(kthread_table[i].entry, kthread_table[i].name, argc, argv);
+            if(pid >= 0 && class != PCB_CLASS_NORMAL){
+                sched_set_class(pcb_get_by_pid(pid), class);
+            }
+            return pid;
         }
     }
 
@@ -28,7 +28,7 @@ static struct terminal term  = {
 void logd_attach_by_pid(int pid)
 {
     struct pcb* pcb = pcb_get_by_pid(pid);
-    if(pcb->state == STOPPED){
+    if(pcb == NULL || pcb->state == STOPPED){
         warningf("Failed to attach logd to pid %d", pid);
         return;
     }
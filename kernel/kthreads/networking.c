@@ -142,9 +142,7 @@ void __callback net_incoming_packet(struct netdev* dev)
     netd.packets++;
     netd.stats.recvd++;
 
-    if(netd.instance != NULL && netd.instance->state == BLOCKED){ 
-        netd.instance->state = RUNNING;
-    }
+    wake_up_one(&netd.waiters);
 
 }
 
@@ -224,9 +222,7 @@ int net_send_skb(struct sk_buff* skb)
     RETURN_ON_ERR(netd.skb_tx_queue->ops->add(netd.skb_tx_queue, skb));
     netd.packets++;
 
-    if(netd.instance != NULL && netd.instance->state == BLOCKED){ 
-        netd.instance->state = RUNNING;
-    }
+    wake_up_one(&netd.waiters);
 
     return 0;
 }
@@ -306,13 +302,10 @@ void __kthread_entry networking_main()
     
     //start("udp_server", 0, NULL);
     start("tcp_server", 0, NULL); 
-    int todos =0;
     while(1){
-        
-        todos = netd.skb_tx_queue->size + netd.skb_rx_queue->size;
-        /**
-         * @brief Query RX an    TX queue for netd.packets.
-         */
+        /* Sleep until packets are queued, the queues are filled from interrupts and other threads */
+        wait_event(&netd.waiters, SKB_QUEUE_READY(netd.skb_tx_queue) || SKB_QUEUE_READY(netd.skb_rx_queue));
+
         if(SKB_QUEUE_READY(netd.skb_tx_queue)){
             dbgprintf("Sending new SKB from TX queue\n");
             struct sk_buff* skb = netd.skb_tx_queue->ops->remove(netd.skb_tx_queue);
@@ -328,14 +321,11 @@ void __kthread_entry networking_main()
             assert(skb != NULL);
 
             /* Offload skb parsing to worker thread. */
-            work_queue_add(&net_handle_recieve, (void*)skb, NULL);
+            if(work_queue_add_prio(&net_handle_recieve, (void*)skb, NULL, WORK_PRIO_HIGH) < 0){
+                netd.stats.dropped++;
+                skb_free(skb);
+            }
             //net_handle_recieve(skb);
         }
-
-        if(todos == 0){
-            $process->current->state = BLOCKED;
-        }
-
-        kernel_yield();
     }
 }
\ No newline at end of file
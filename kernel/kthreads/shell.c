@@ -44,6 +44,13 @@
 #include <kutils.h>
 #include <script.h>
 #include <vbe.h>
+#include <program.h>
+#include <kmemtrace.h>
+#include <timer.h>
+#include <work.h>
+#include <smp.h>
+#include <arch/interrupts.h>
+#include <lockstat.h>
 
 #define SHELL_HEIGHT 225 /* 275 */
 #define SHELL_WIDTH 400 /* 300 */
@@ -91,9 +98,63 @@ void ifconfig()
 }
 EXPORT_KSYMBOL(ifconfig);
 
+/* Upper bound of a latency bucket in Kcycles, see pcb_stats.h */
+static int ps_latency_bound(int bucket)
+{
+	return bucket < 0 ? 0 : 1 << (bucket + 1);
+}
+
+/* Runnable to running latency histogram of a single pcb */
+static void ps_latency(int pid)
+{
+	struct pcb_info info;
+	if(pcb_get_info(pid, 0, &info) < 0){
+		twritef("ps: no pid %d\n", pid);
+		return;
+	}
+
+	uint32_t most = 0;
+	for (int i = 0; i < PCB_LATENCY_BUCKETS; i++){
+		if(info.stats.latency[i] > most) most = info.stats.latency[i];
+	}
+
+	twritef("\n%s: waited in run queue (Kcycles)\n", info.name);
+	for (int i = 0; i < PCB_LATENCY_BUCKETS; i++){
+		if(info.stats.latency[i] == 0) continue;
+
+		char bar[33] = {0};
+		int length = info.stats.latency[i] / ((most + 31) / 32);
+		memset(bar, '#', length == 0 ? 1 : length);
+		twritef("%s%d %s %d\n", i == PCB_LATENCY_BUCKETS-1 ? ">" : "<", i == PCB_LATENCY_BUCKETS-1 ? ps_latency_bound(i-1) : ps_latency_bound(i), bar, info.stats.latency[i]);
+	}
+}
+
+/* CPU time, switches and latency percentiles of all pcbs */
+static void ps_times()
+{
+	twritef("\nPID  NAME     USER  KERNEL  VOL  INVOL  P50  P99\n");
+	for (int i = 1; i < MAX_NUM_OF_PCBS; i++){
+		struct pcb_info info;
+		if(pcb_get_info(i, 0, &info) < 0) continue;
+		twritef(" %d   %8s %d  %d  %d  %d  %d  %d\n", info.pid, info.name, info.stats.user, info.stats.kernel,
+			info.stats.voluntary, info.stats.involuntary,
+			ps_latency_bound(pcb_latency_percentile(&info.stats, 50)), ps_latency_bound(pcb_latency_percentile(&info.stats, 99)));
+	}
+	twritef("Time in Mcycles, latency below Kcycles\n");
+}
+
 /* Shell commands */
 void ps(int argc, char* argv[])
 {
+	if(argc >= 2 && memcmp(argv[1], "-t", 3) == 0){
+		if(argc == 3){
+			ps_latency(atoi(argv[2]));
+			return;
+		}
+		ps_times();
+		return;
+	}
+
 	ubyte_t spin = 0;
 	if(argc == 2){
 		if(memcmp(argv[1], "-s", 2) == 0){
@@ -105,9 +166,10 @@ void ps(int argc, char* argv[])
 		while(1){
 			$process->current->term->ops->reset($process->current->term);
 			twritef("\nPID  USER    USAGE    TYPE     STATE    NAME    \n");
+			uint32_t total = pcb_total_usage();
 			for (int i = 1; i < MAX_NUM_OF_PCBS; i++){
 				struct pcb_info info;
-				int ret = pcb_get_info(i, &info);
+				int ret = pcb_get_info(i, total, &info);
 				if(ret < 0) continue;
 				int usage = (int)(info.usage*100);
 				twritef(" %d   %8s %s%d%      %s  %s  %s\n", info.pid, info.user, usage < 10 ? " ": "", usage, info.is_process ? "process" : "kthread", pcb_status[info.state], info.name);
@@ -138,9 +200,10 @@ void ps(int argc, char* argv[])
 	int ret;
 	int usage;
 	twritef("\nPID  USER    USAGE    TYPE     STATE     NAME    \n");
+	uint32_t total = pcb_total_usage();
 	for (int i = 1; i < MAX_NUM_OF_PCBS; i++){
 		struct pcb_info info;
-		int ret = pcb_get_info(i, &info);
+		int ret = pcb_get_info(i, total, &info);
 		if(ret < 0) continue;
 		int usage = (int)(info.usage*100);
 		twritef(" %d   %8s %s%d%      %s  %s  %s\n", info.pid, info.user, usage < 10 ? " ": "", usage, info.is_process ? "process" : "kthread", pcb_status[info.state], info.name);
@@ -403,6 +466,24 @@ EXPORT_KSYMBOL(fdisk);
 
 void meminfo(int argc, char* argv[])
 {
+	if(argc == 2){
+		struct pcb* pcb = pcb_get_by_pid(atoi(argv[1]));
+		struct vmem_heap_info hinfo;
+		if(pcb == NULL || vmem_heap_get_info(pcb, &hinfo) < 0){
+			twritef("meminfo: no such process\n");
+			return;
+		}
+
+		twritef("Heap of %s:\n", pcb->name);
+		twritef("  Allocated: %d bytes in %d blocks\n", hinfo.allocated_bytes, hinfo.allocated_blocks);
+		twritef("  Free:      %d bytes in %d blocks\n", hinfo.free_bytes, hinfo.free_blocks);
+		twritef("  Largest free block: %d bytes\n", hinfo.largest_free);
+		twritef("  Mapped pages: %d\n", hinfo.mapped_pages);
+		twritef("  Fragmentation: %d percent\n", hinfo.fragmentation);
+		twritef("  Page faults: %d minor, %d major\n", pcb->minor_faults, pcb->major_faults);
+		return;
+	}
+
 	struct mem_info minfo;
 	get_mem_info(&minfo);
 
@@ -423,9 +504,286 @@ void meminfo(int argc, char* argv[])
 	twritef("  Permanent: %d%s/%d%s\n", permanent.size, permanent.unit, permanent_total.size, permanent_total.unit);
 	twritef("  Virtual:   %d%s/%d%s\n", virtual.size, virtual.unit, virtual_total.size, virtual_total.unit);
 	twritef("  Total:     %d%s\n", total.size, total.unit);
+
+	struct unit largest = calculate_size_unit(minfo.permanent.largest_free);
+	twritef("Permanent blocks: %d free, largest %d%s, %d percent fragmented\n", minfo.permanent.free_blocks, largest.size, largest.unit, minfo.permanent.fragmentation);
+
+	struct unit slab = calculate_size_unit(minfo.slab.used);
+	struct unit slab_total = calculate_size_unit(minfo.slab.total);
+
+	twritef("Slab caches: %d%s/%d%s\n", slab.size, slab.unit, slab_total.size, slab_total.unit);
+
+	struct kmem_cache_info cinfo;
+	for (int i = 0; i < KMEM_MAX_CACHES; i++){
+		if(kmem_cache_get_info(i, &cinfo) < 0) continue;
+		twritef("  %s: %d bytes, %d/%d objects, %d slabs\n", cinfo.name, cinfo.size, cinfo.active, cinfo.total, cinfo.slabs);
+	}
+
+	struct program_cache_info pinfo;
+	program_cache_get_info(&pinfo);
+	twritef("Program images: %d cached, %d/%d pages resident, %d hits, %d misses\n", pinfo.images, pinfo.resident, pinfo.pages, pinfo.hits, pinfo.misses);
 }
 EXPORT_KSYMBOL(meminfo);
 
+#define MEMTRACE_TOP_SITES 10
+
+void memtrace(int argc, char* argv[])
+{
+	static const char* kinds[KMEMTRACE_KINDS] = {"kalloc", "frame", "heap"};
+
+	if(argc == 2){
+		if(memcmp(argv[1], "on", 3) == 0){
+			kmemtrace_enable(1);
+		} else if(memcmp(argv[1], "off", 4) == 0){
+			kmemtrace_enable(0);
+		} else if(memcmp(argv[1], "clear", 6) == 0){
+			kmemtrace_clear();
+		} else {
+			twritef("usage: memtrace [on, off, clear]\n");
+		}
+		return;
+	}
+
+	struct kmemtrace_site_info sites[MEMTRACE_TOP_SITES];
+	int count = kmemtrace_top_sites(sites, MEMTRACE_TOP_SITES);
+
+	twritef("Memory tracing: %s, %d dropped\n", kmemtrace_enabled() ? "on" : "off", kmemtrace_dropped());
+	for (int i = 0; i < count; i++){
+		uintptr_t offset = 0;
+		const char* name = ksyms_resolve_addr(sites[i].caller, &offset);
+		if(name != NULL){
+			twritef("  %s+0x%x (%s)\n", name, offset, kinds[sites[i].kind]);
+		} else {
+			twritef("  0x%x (%s)\n", sites[i].caller, kinds[sites[i].kind]);
+		}
+		twritef("    %d bytes in %d live, %d total, %d leaked\n", sites[i].live_bytes, sites[i].live_allocations, sites[i].total_allocations, sites[i].leaks);
+	}
+}
+EXPORT_KSYMBOL(memtrace);
+
+#define SCHEDBENCH_THREADS 64
+#define SCHEDBENCH_TICKS 1000
+
+static volatile int schedbench_running = 0;
+static volatile int schedbench_threads = 0;
+static volatile int schedbench_switches = 0;
+
+static void schedbench_thread(int argc, char* argv[])
+{
+	__sync_fetch_and_add(&schedbench_threads, 1);
+	while(schedbench_running){
+		__sync_fetch_and_add(&schedbench_switches, 1);
+		kernel_yield();
+	}
+	__sync_fetch_and_sub(&schedbench_threads, 1);
+}
+
+/**
+ * @brief cmd: schedbench [threads]
+ * Measures the context switch rate with the given number of runnable threads,
+ * all yielding in a loop for SCHEDBENCH_TICKS ticks.
+ */
+void schedbench(int argc, char* argv[])
+{
+	int threads = argc == 2 ? atoi(argv[1]) : SCHEDBENCH_THREADS;
+	if(threads <= 0 || schedbench_running){
+		twritef("usage: schedbench [threads]\n");
+		return;
+	}
+
+	schedbench_running = 1;
+
+	int created = 0;
+	while(created < threads && pcb_create_kthread(&schedbench_thread, "schedbench", 0, NULL) >= 0){
+		created++;
+	}
+
+	/* Let every thread start before measuring */
+	WAIT(schedbench_threads < created);
+
+	schedbench_switches = 0;
+	int start = timer_get_tick();
+	kernel_sleep(SCHEDBENCH_TICKS);
+	int switches = schedbench_switches;
+	int ticks = timer_get_tick() - start;
+
+	schedbench_running = 0;
+	WAIT(schedbench_threads > 0);
+
+	twritef("%d threads: %d switches in %d ticks, %d per tick\n", created, switches, ticks, ticks > 0 ? switches / ticks : 0);
+}
+EXPORT_KSYMBOL(schedbench);
+
+#define SPAWNBENCH_COUNT 1000
+#define SPAWNBENCH_BATCH 128
+
+/* Exits right away, only creation and cleanup are measured */
+static void spawnbench_thread(int argc, char* argv[])
+{
+	return;
+}
+
+/**
+ * @brief cmd: spawnbench [count]
+ * Measures kernel thread creation, from spawning until the exited thread is cleaned up.
+ * Threads are spawned in batches of SPAWNBENCH_BATCH, more than used to fit the pcb table.
+ */
+void spawnbench(int argc, char* argv[])
+{
+	int count = argc == 2 ? atoi(argv[1]) : SPAWNBENCH_COUNT;
+	if(count <= 0){
+		twritef("usage: spawnbench [count]\n");
+		return;
+	}
+
+	static pid_t pids[SPAWNBENCH_BATCH];
+	int spawned = 0;
+	int failed = 0;
+	uint64_t cycles = 0;
+	int start = timer_get_tick();
+
+	while(spawned < count && !failed){
+		int batch = 0;
+		uint64_t stamp = rdtsc();
+		while(batch < SPAWNBENCH_BATCH && spawned + batch < count){
+			pid_t pid = pcb_create_kthread(&spawnbench_thread, "spawnbench", 0, NULL);
+			if(pid < 0){
+				failed = 1;
+				break;
+			}
+			pids[batch++] = pid;
+		}
+		cycles += rdtsc() - stamp;
+
+		for (int i = 0; i < batch; i++){
+			pcb_await(pids[i]);
+		}
+		spawned += batch;
+	}
+
+	int ticks = timer_get_tick() - start;
+	if(ticks <= 0) ticks = 1;
+
+	twritef("%d threads spawned and exited in %d ticks, %d per second\n", spawned, ticks, (spawned * TIMER_HZ) / ticks);
+	twritef("  create %d Kcycles each\n", spawned > 0 ? (int)(cycles >> 10) / spawned : 0);
+	if(failed){
+		twritef("  stopped early, no pid or memory left\n");
+	}
+}
+EXPORT_KSYMBOL(spawnbench);
+
+/**
+ * @brief cmd: uptime
+ * Shows the uptime, the timer interrupts avoided by the dynamic tick and the idle residency.
+ */
+void uptime(int argc, char* argv[])
+{
+	struct timer_info info;
+	if(timer_get_info(&info) < 0) return;
+
+	int ticks = info.ticks > 0 ? info.ticks : 1;
+	twritef("Up %d seconds (%d ticks from the %s)\n", info.ticks / TIMER_HZ, info.ticks, info.lapic ? "local APIC timer" : "PIT");
+	twritef("Timer interrupts: %d taken, %d avoided (%d percent)\n", info.interrupts, info.ticks - info.interrupts, ((info.ticks - info.interrupts) * 100) / ticks);
+	twritef("Tick stopped %d times, restarted early %d times\n", info.oneshots, info.restarts);
+	twritef("Idle: %d ticks halted (%d percent)\n", info.idle_ticks, (info.idle_ticks * 100) / ticks);
+}
+EXPORT_KSYMBOL(uptime);
+
+/**
+ * @brief cmd: workq
+ * Shows the queue depth, executed works and steals of each work queue worker.
+ */
+void workq(int argc, char* argv[])
+{
+	struct work_worker_info info;
+	for (int i = 0; i < WORK_WORKERS; i++){
+		if(work_queue_get_info(i, &info) < 0) continue;
+		twritef("Worker %d (pid %d): %d queued, %d executed, %d stolen\n", i, info.pid, info.depth, info.executed, info.steals);
+	}
+}
+EXPORT_KSYMBOL(workq);
+
+/**
+ * @brief cmd: cpus
+ * Shows the running pid, run queue length, pulled pcbs and reschedule interrupts of each processor,
+ * the average context switch cost with the lazy FPU traps and skipped CR3 reloads behind it,
+ * and how often the latency class preempted on wake up or was throttled.
+ */
+void cpus(int argc, char* argv[])
+{
+	struct smp_cpu_info info;
+	for (int i = 0; i < smp_cpu_count(); i++){
+		if(smp_get_info(i, &info) < 0) continue;
+		if(!info.started){
+			twritef("CPU %d (APIC %d): not started\n", info.id, info.apic_id);
+			continue;
+		}
+		twritef("CPU %d (APIC %d): pid %d, %d runnable, %d pulled, %d IPIs\n", info.id, info.apic_id, info.pid, info.runnable, info.pulled, info.ipis);
+		twritef("  switch %d cycles, %d FPU traps, %d CR3 reloads skipped\n", info.switch_cycles, info.fpu_traps, info.cr3_skips);
+		twritef("  latency class: %d wake up preemptions, %d periods throttled\n", info.latency_preempts, info.latency_throttles);
+	}
+}
+EXPORT_KSYMBOL(cpus);
+
+/**
+ * @brief cmd: irqs
+ * Shows how often each vector was taken and whether device interrupts come from the IO APIC or the PIC.
+ */
+void irqs(int argc, char* argv[])
+{
+	twritef("Device interrupts from the %s\n", interrupt_ioapic_enabled() ? "IO APIC" : "PIC");
+	for (int i = 0; i < ISR_LINES; i++){
+		int count = interrupt_get_count(i);
+		if(count == 0) continue;
+
+		const char* name = interrupt_get_name(i);
+		if(name == NULL){
+			twritef("%d: %d - IRQ %d\n", i, count, i - 32);
+			continue;
+		}
+		twritef("%d: %d - %s\n", i, count, name);
+	}
+}
+EXPORT_KSYMBOL(irqs);
+
+#define LOCKSTAT_TOP 10
+
+void lockstat(int argc, char* argv[])
+{
+#ifndef LOCKSTAT
+	twritef("lockstat is disabled, enable LOCKSTAT in kconfig.h\n");
+#else
+	if(argc > 1 && memcmp(argv[1], "reset", 6) == 0){
+		lockstat_reset();
+		return;
+	}
+
+	/* Most contended classes first, times in units of 1024 cycles */
+	twritef("%s: acquired, contended, wait, max hold (Kcycles)\n", "lock");
+	char shown[LOCKSTAT_CLASSES] = {0};
+	struct lockstat_info info;
+	for (int n = 0; n < LOCKSTAT_TOP; n++){
+		int best = -1;
+		uint32_t best_contended = 0;
+		for (int i = 0; i < LOCKSTAT_CLASSES; i++){
+			if(lockstat_get_info(i, &info) < 0) break;
+			if(shown[i]) continue;
+			if(best == -1 || info.contended > best_contended){
+				best = i;
+				best_contended = info.contended;
+			}
+		}
+		if(best == -1) break;
+
+		lockstat_get_info(best, &info);
+		if(info.acquisitions == 0) break;
+		twritef("%s: %d, %d, %d, %d\n", info.name, info.acquisitions, info.contended, info.wait, info.hold_max);
+		shown[best] = 1;
+	}
+#endif
+}
+EXPORT_KSYMBOL(lockstat);
+
 void res(int argc, char* argv[])
 {
 	twritef("Screen resolution: %dx%d\n", vbe_info->width, vbe_info->height);
@@ -562,7 +920,7 @@ void testfn()
 int c_test = 0;
 void __kthread_entry shell(int argc, char* argv[])
 {
-	dbgprintf("shell is running %d!\n", __cli_cnt);
+	dbgprintf("shell is running %d!\n", critical_depth());
 
 	//testfn();
 	struct window* window = gfx_new_window(SHELL_WIDTH, SHELL_HEIGHT, GFX_IS_RESIZABLE);
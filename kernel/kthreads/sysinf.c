@@ -25,22 +25,24 @@
 #include <fs/fs.h>
 #include <fs/fat16.h>
 #include <scheduler.h>
+#include <pcb.h>
 #include <mbr.h>
 #include <net/dhcp.h>
 #include <lib/display.h>
 
 #include <kernel.h>
 
-#define WIDTH 300
+#define WIDTH 340
 #define HEIGHT 275
 
-#define TABS 5
+#define TABS 6
 
 enum tab_type {
     TAB_MEM,
     TAB_NET,
     TAB_DISK,
     TAB_DEV,
+    TAB_PROC,
     TAB_DISPLAY
 };
 
@@ -97,11 +99,19 @@ static struct tab_view {
             .y = 12,
             .active = false,
         },
+        [TAB_PROC] = {
+            .type = TAB_PROC,
+            .name = "Procs",
+            .width = 50,
+            .x = 12 + 200,
+            .y = 12,
+            .active = false,
+        },
         [TAB_DISPLAY] = {
             .type = TAB_DISPLAY,
             .name = "Display",
-            .width = WIDTH - 200-24,
-            .x = 12 + 200,
+            .width = WIDTH - 250-24,
+            .x = 12 + 250,
             .y = 12,
             .active = false,
         },
@@ -130,6 +140,11 @@ static void sysinf_draw_mem(struct window* w, struct tab* tab)
     w->draw->textf(w, 30, 45+20, 0,     "Virtual:       %d MB", map->virtual_memory.total / 1024 / 1024);
     w->draw->textf(w, 30, 45+30, 0,     "Permanent:     %d MB", map->permanent.total / 1024 / 1024);
 
+    struct vmem_zero_pool_info pool;
+    vmem_zero_pool_get_info(&pool);
+    w->draw->textf(w, 30, 45+50, 0,     "Zero pool:     %d/%d pages", pool.count, pool.size);
+    w->draw->textf(w, 30, 45+60, 0,     "Pool hits:     %d (%d misses)", pool.hits, pool.misses);
+
     char* kernel = "Usage";
     SECTION(w, 24, HEIGHT/2+10, WIDTH-48, HEIGHT/2-48, kernel);
 
@@ -276,6 +291,37 @@ static void sysinf_draw_dev(struct window* w, struct tab* tab)
 
 }
 
+static void sysinf_draw_proc(struct window* w, struct tab* tab)
+{
+    SECTION(w, 24, 48, WIDTH-48, HEIGHT-48-24, "Processes");
+
+    w->draw->text(w, 30, 45+10, "Name", 0);
+    w->draw->text(w, 118, 45+10, "CPU", 0);
+    w->draw->text(w, 158, 45+10, "Sys", 0);
+    w->draw->text(w, 198, 45+10, "Preempt", 0);
+    w->draw->text(w, 262, 45+10, "P99", 0);
+
+    /* P99 is the time waited for a processor after becoming runnable, in Kcycles */
+    int row = 0;
+    for (int i = 1; i < MAX_NUM_OF_PCBS && row < (HEIGHT-48-24-30)/10; i++){
+        struct pcb_info info;
+        if(pcb_get_info(i, 0, &info) < 0) continue;
+
+        uint32_t total = info.stats.user + info.stats.kernel;
+        int kernel = total > 0 ? (int)(((float)info.stats.kernel / (float)total)*100) : 0;
+        int p99 = pcb_latency_percentile(&info.stats, 99);
+
+        int y = 45+25 + row*10;
+        info.name[10] = 0;
+        w->draw->textf(w, 30, y, 0, "%s", info.name);
+        w->draw->textf(w, 118, y, 0, "%d%", (int)(info.usage*100));
+        w->draw->textf(w, 158, y, 0, "%d%", kernel);
+        w->draw->textf(w, 198, y, 0, "%d", info.stats.involuntary);
+        w->draw->textf(w, 262, y, p99 >= PCB_LATENCY_BUCKETS-4 ? COLOR_VGA_RED : 0, "%d", p99 < 0 ? 0 : 1 << (p99 + 1));
+        row++;
+    }
+}
+
 static void sysinf_draw_display(struct window* w, struct tab* tab)
 {
     struct display_info info;
@@ -327,6 +373,9 @@ static void sysinf_draw_tab(struct window* w, struct tab* tab)
         case TAB_DEV:
             sysinf_draw_dev(w, tab);
             break;
+        case TAB_PROC:
+            sysinf_draw_proc(w, tab);
+            break;
     }
 }
 
@@ -335,7 +384,7 @@ static void sysinf_draw(struct window* w)
     w->draw->rect(w, 0, 0, WIDTH, HEIGHT, 30);
     w->draw->box(w, 12, 12, WIDTH-24, HEIGHT-24, 30);
 
-    for(int i = 0; i < 5; i++){
+    for(int i = 0; i < TABS; i++){
         struct tab* tab = &tab_view.tabs[i];
         sysinf_draw_tab(w, tab);
     }
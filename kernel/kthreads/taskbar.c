@@ -389,9 +389,9 @@ static void __callback taskbar_wolfstein()
 
 static void __callback taskbar_terminal()
 {
-    dbgprintf("Starting terminal %d\n", __cli_cnt);
+    dbgprintf("Starting terminal %d\n", critical_depth());
     start("shell",  0, NULL);
-    dbgprintf("Started terminal %d\n", __cli_cnt);
+    dbgprintf("Started terminal %d\n", critical_depth());
 }
 
 static void __callback taskbar_finder()
@@ -0,0 +1,240 @@
+/**
+ * @file ktimer.c
+ * @author Joe Bayer (joexbayer)
+ * @brief Hierarchical timer wheel for kernel timers.
+ * @version 0.1
+ * @date 2024-02-24
+ *
+ * The root level has one slot per tick for the next 256 ticks, every further level
+ * has 64 slots each covering a whole rotation of the level below, together spanning 32 bits of ticks.
+ * A timer is put in the lowest level which reaches its expiry. Whenever the root level wraps around,
+ * the next slot of the level above is cascaded, re-adding its timers closer to the root.
+ * Only the slot of the current tick is ever looked at, so the cost of a tick does not depend
+ * on the number of pending timers.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <kconfig.h>
+#include <ktimer.h>
+#include <timer.h>
+#include <kutils.h>
+#include <serial.h>
+#include <libc.h>
+
+#ifndef KDEBUG_KTIMER
+#undef dbgprintf
+#define dbgprintf(...)
+#endif
+
+#define KTIMER_ROOT_MASK    (KTIMER_ROOT_SIZE - 1)
+#define KTIMER_LEVEL_MASK   (KTIMER_LEVEL_SIZE - 1)
+#define KTIMER_LEVEL_SHIFT(level) (KTIMER_ROOT_BITS + (level) * KTIMER_LEVEL_BITS)
+
+static struct ktimer_wheel {
+    /* last tick which was expired */
+    uint32_t now;
+    int pending;
+
+    struct ktimer* root[KTIMER_ROOT_SIZE];
+    struct ktimer* levels[KTIMER_LEVELS][KTIMER_LEVEL_SIZE];
+} __ktimer_wheel;
+static struct ktimer_wheel* wheel = &__ktimer_wheel;
+
+/**
+ * @brief Finds the slot a timer expiring at the given tick belongs in.
+ * @warning Must be called in a critical section.
+ */
+static struct ktimer** __ktimer_slot(uint32_t expires)
+{
+    uint32_t delta = expires - wheel->now;
+
+    if(delta < KTIMER_ROOT_SIZE){
+        return &wheel->root[expires & KTIMER_ROOT_MASK];
+    }
+
+    for (int level = 0; level < KTIMER_LEVELS - 1; level++){
+        if(delta < (1u << KTIMER_LEVEL_SHIFT(level + 1))){
+            return &wheel->levels[level][(expires >> KTIMER_LEVEL_SHIFT(level)) & KTIMER_LEVEL_MASK];
+        }
+    }
+
+    return &wheel->levels[KTIMER_LEVELS - 1][(expires >> KTIMER_LEVEL_SHIFT(KTIMER_LEVELS - 1)) & KTIMER_LEVEL_MASK];
+}
+
+static void __ktimer_link(struct ktimer** slot, struct ktimer* timer)
+{
+    timer->slot = slot;
+    timer->prev = NULL;
+    timer->next = *slot;
+    if(*slot != NULL) (*slot)->prev = timer;
+    *slot = timer;
+}
+
+static void __ktimer_unlink(struct ktimer* timer)
+{
+    if(timer->prev != NULL) timer->prev->next = timer->next;
+    else *timer->slot = timer->next;
+    if(timer->next != NULL) timer->next->prev = timer->prev;
+
+    timer->slot = NULL;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+/**
+ * @brief Moves all timers of a slot down to the levels below.
+ * @warning Must be called in a critical section.
+ * @return int index of the cascaded slot, 0 means the level wrapped as well.
+ */
+static int __ktimer_cascade(int level)
+{
+    int index = (wheel->now >> KTIMER_LEVEL_SHIFT(level)) & KTIMER_LEVEL_MASK;
+
+    struct ktimer* timer = wheel->levels[level][index];
+    wheel->levels[level][index] = NULL;
+
+    while(timer != NULL){
+        struct ktimer* next = timer->next;
+        __ktimer_link(__ktimer_slot(timer->expires), timer);
+        timer = next;
+    }
+
+    return index;
+}
+
+void ktimer_init(struct ktimer* timer, ktimer_fn_t callback, void* arg)
+{
+    timer->callback = callback;
+    timer->arg = arg;
+    timer->expires = 0;
+    timer->slot = NULL;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+/**
+ * @brief Arms a timer to expire after the given number of ticks.
+ * A timer which is already pending is moved to its new expiry.
+ * @param timer Initialized timer.
+ * @param ticks Ticks from now, at least 1.
+ * @return error_t 0 on success, error code on failure.
+ */
+error_t ktimer_add(struct ktimer* timer, int ticks)
+{
+    ERR_ON_NULL(timer);
+    ERR_ON_NULL(timer->callback);
+
+    if(ticks < 1) ticks = 1;
+
+    /* The tick may be stopped, catch up first so the expiry is relative to the current tick */
+    timer_tick_restart();
+
+    CRITICAL_SECTION({
+        if(timer->slot != NULL){
+            __ktimer_unlink(timer);
+            wheel->pending--;
+        }
+
+        timer->expires = wheel->now + ticks;
+        __ktimer_link(__ktimer_slot(timer->expires), timer);
+        wheel->pending++;
+    });
+
+    return ERROR_OK;
+}
+
+/**
+ * @brief Cancels a pending timer, cancelling a timer which is not pending does nothing.
+ * @return int 1 if the timer was pending, 0 otherwise.
+ */
+int ktimer_cancel(struct ktimer* timer)
+{
+    int pending = 0;
+
+    CRITICAL_SECTION({
+        if(timer->slot != NULL){
+            __ktimer_unlink(timer);
+            wheel->pending--;
+            pending = 1;
+        }
+    });
+
+    return pending;
+}
+
+int ktimer_pending(struct ktimer* timer)
+{
+    return timer->slot != NULL;
+}
+
+/**
+ * @brief Gets the number of ticks until the wheel has work to do.
+ * That is the next root slot with a timer, or the next cascade as the levels above
+ * are not ordered within a slot. Used to decide how long ticks can be skipped.
+ * @param max Largest number of ticks of interest.
+ * @return int ticks until the next expiry or cascade, at most max.
+ */
+int ktimer_next_expiry(int max)
+{
+    int ticks = max;
+
+    CRITICAL_SECTION({
+        if(wheel->pending > 0){
+            for (int i = 1; i < max; i++){
+                uint32_t tick = wheel->now + i;
+                if(wheel->root[tick & KTIMER_ROOT_MASK] != NULL || (tick & KTIMER_ROOT_MASK) == 0){
+                    ticks = i;
+                    break;
+                }
+            }
+        }
+    });
+
+    return ticks;
+}
+
+uint32_t ktimer_now()
+{
+    return wheel->now;
+}
+
+/**
+ * @brief Advances the wheel by one tick and runs all timers expiring at it.
+ * Called from the PIT interrupt.
+ */
+void ktimer_tick()
+{
+    struct ktimer* expired;
+
+    ENTER_CRITICAL();
+
+    wheel->now++;
+
+    /* Root level wrapped, pull the next rotation down from the levels above */
+    if((wheel->now & KTIMER_ROOT_MASK) == 0){
+        for (int level = 0; level < KTIMER_LEVELS; level++){
+            if(__ktimer_cascade(level) != 0) break;
+        }
+    }
+
+    /* Detach the slot, callbacks may add timers which hash to the same slot again */
+    expired = NULL;
+    struct ktimer** slot = &wheel->root[wheel->now & KTIMER_ROOT_MASK];
+    while(*slot != NULL){
+        struct ktimer* timer = *slot;
+        __ktimer_unlink(timer);
+        __ktimer_link(&expired, timer);
+    }
+
+    while(expired != NULL){
+        struct ktimer* timer = expired;
+        __ktimer_unlink(timer);
+        wheel->pending--;
+
+        dbgprintf("[KTIMER] Timer 0x%x expired at %d\n", timer, wheel->now);
+        timer->callback(timer->arg);
+    }
+
+    LEAVE_CRITICAL();
+}
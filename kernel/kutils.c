@@ -139,31 +139,35 @@ void kernel_panic(const char* reason)
 int kref_init(struct kref* ref)
 {
     ref->refs = 0;
-    ref->spinlock = 0;
+    spinlock_init(&ref->spinlock);
 
     return 0;
 }
 
 int kref_get(struct kref* ref)
 {
+    int refs;
+
     spin_lock(&ref->spinlock);
 
-    ref->refs++;
+    refs = ++ref->refs;
 
     spin_unlock(&ref->spinlock);
 
-    return ref->refs;
+    return refs;
 }
 
 int kref_put(struct kref* ref)
 {
+    int refs;
+
     spin_lock(&ref->spinlock);
 
-    ref->refs--;
+    refs = --ref->refs;
 
     spin_unlock(&ref->spinlock);
 
-    return ref->refs;
+    return refs;
 }
 
 #define MAX_FMT_STR_SIZE 256
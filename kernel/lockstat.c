@@ -0,0 +1,243 @@
+/**
+ * @file lockstat.c
+ * @author Joe Bayer (joexbayer)
+ * @brief Lock contention statistics.
+ * @version 0.1
+ * @date 2024-03-09
+ *
+ * Enabled with LOCKSTAT in kconfig.h, the lock functions in sync.c then report every
+ * acquisition, how long it waited and how long the lock was held.
+ * mutex_t and rwlock_t find their class through a pointer set by their init function.
+ * A spinlock is only an int, so spinlocks are found in an address table filled by
+ * spinlock_init, spinlocks which were never initialized that way end up in "(unnamed)".
+ * The counters of a class are protected by its own irqsave lock, which is a leaf lock
+ * and never reports statistics itself.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <kconfig.h>
+#include <lockstat.h>
+#include <libc.h>
+#include <smp.h>
+#include <serial.h>
+
+#ifndef KDEBUG_SYNC
+#undef dbgprintf
+#define dbgprintf(...)
+#endif
+
+/* Spinlock instance, the hold time has to be kept per lock */
+struct lockstat_spinlock {
+    spinlock_t* volatile lock;
+    struct lock_class* lclass;
+    uint64_t held_since;
+};
+
+static struct lock_class lock_classes[LOCKSTAT_CLASSES] = {
+    { .name = "kernel_lock" },
+    { .name = "(unnamed)" }
+};
+static int lock_class_count = 2;
+static struct lock_class* kernel_class = &lock_classes[0];
+static struct lock_class* unnamed_class = &lock_classes[1];
+
+static struct lockstat_spinlock spinlocks[LOCKSTAT_SPINLOCKS];
+static uint64_t kernel_held_since[SMP_MAX_CPUS];
+
+/* Protects adding classes and spinlocks */
+static spinlock_t lockstat_lock = SPINLOCK_UNLOCKED;
+
+/**
+ * @brief Finds or adds the class of the given name.
+ * Names are compared by address, each declaration passes its own string.
+ * @return struct lock_class* class, NULL if the table is full.
+ */
+struct lock_class* lockstat_class(const char* name)
+{
+    struct lock_class* lclass = NULL;
+
+    uint32_t flags = spin_lock_irqsave(&lockstat_lock);
+    for (int i = 0; i < lock_class_count; i++){
+        if(lock_classes[i].name == name){
+            lclass = &lock_classes[i];
+            break;
+        }
+    }
+
+    if(lclass == NULL && lock_class_count < LOCKSTAT_CLASSES){
+        lclass = &lock_classes[lock_class_count++];
+        lclass->name = name;
+    }
+    spin_unlock_irqrestore(&lockstat_lock, flags);
+
+    if(lclass == NULL){
+        dbgprintf("[LOCKSTAT] No lock class left for %s\n", name);
+    }
+
+    return lclass;
+}
+
+static inline int __lockstat_hash(spinlock_t* lock)
+{
+    return (((uint32_t)lock) >> 2) % LOCKSTAT_SPINLOCKS;
+}
+
+/* Finds the slot of the spinlock, or the free slot it would be added to. NULL if the table is full. */
+static struct lockstat_spinlock* __lockstat_spinlock_slot(spinlock_t* lock)
+{
+    int hash = __lockstat_hash(lock);
+    for (int i = 0; i < LOCKSTAT_SPINLOCKS; i++){
+        struct lockstat_spinlock* slot = &spinlocks[(hash + i) % LOCKSTAT_SPINLOCKS];
+        if(slot->lock == lock || slot->lock == NULL){
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+/* Adds or renames a spinlock, the lock pointer is set last so lookups without the lock see a complete slot */
+static struct lockstat_spinlock* __lockstat_spinlock_add(spinlock_t* lock, struct lock_class* lclass)
+{
+    uint32_t flags = spin_lock_irqsave(&lockstat_lock);
+    struct lockstat_spinlock* slot = __lockstat_spinlock_slot(lock);
+    if(slot != NULL){
+        slot->lclass = lclass;
+        __sync_synchronize();
+        slot->lock = lock;
+    }
+    spin_unlock_irqrestore(&lockstat_lock, flags);
+
+    return slot;
+}
+
+void lockstat_spinlock(spinlock_t* lock, const char* name)
+{
+    struct lock_class* lclass = lockstat_class(name);
+    __lockstat_spinlock_add(lock, lclass != NULL ? lclass : unnamed_class);
+}
+
+static inline void __lockstat_count(struct lock_class* lclass, uint64_t start, uint64_t now, int contended)
+{
+    uint32_t flags = spin_lock_irqsave(&lclass->lock);
+    lclass->acquisitions++;
+    if(contended){
+        lclass->contended++;
+        lclass->wait += now - start;
+    }
+    spin_unlock_irqrestore(&lclass->lock, flags);
+}
+
+static inline void __lockstat_hold(struct lock_class* lclass, uint64_t held)
+{
+    uint32_t flags = spin_lock_irqsave(&lclass->lock);
+    if(held > lclass->hold_max){
+        lclass->hold_max = held;
+    }
+    spin_unlock_irqrestore(&lclass->lock, flags);
+}
+
+/**
+ * @brief Counts an acquisition of a mutex_t or rwlock_t.
+ * @param start TSC when the caller started to acquire.
+ * @param contended the lock was not free.
+ */
+void lockstat_acquired(struct lock_class* lclass, uint64_t start, int contended)
+{
+    if(lclass == NULL) return;
+    __lockstat_count(lclass, start, rdtsc(), contended);
+}
+
+/**
+ * @brief Records the hold time of a lock which is released.
+ * @param held_since TSC when the lock was taken.
+ */
+void lockstat_released(struct lock_class* lclass, uint64_t held_since)
+{
+    if(lclass == NULL || held_since == 0) return;
+    __lockstat_hold(lclass, rdtsc() - held_since);
+}
+
+void lockstat_spin_acquired(spinlock_t* lock, uint64_t start, int contended)
+{
+    uint64_t now = rdtsc();
+
+    struct lockstat_spinlock* slot = __lockstat_spinlock_slot(lock);
+    if(slot == NULL) return;
+    if(slot->lock != lock){
+        slot = __lockstat_spinlock_add(lock, unnamed_class);
+        if(slot == NULL) return;
+    }
+
+    __lockstat_count(slot->lclass, start, now, contended);
+    slot->held_since = rdtsc();
+}
+
+/* Called while the spinlock is still held, so the next holder cannot overwrite the start */
+void lockstat_spin_released(spinlock_t* lock)
+{
+    struct lockstat_spinlock* slot = __lockstat_spinlock_slot(lock);
+    if(slot == NULL || slot->lock != lock || slot->held_since == 0) return;
+
+    __lockstat_hold(slot->lclass, rdtsc() - slot->held_since);
+}
+
+/* The kernel lock belongs to a processor, not to a pcb, so its hold time is kept per processor */
+void lockstat_kernel_acquired(uint64_t start, int contended)
+{
+    uint64_t now = rdtsc();
+    __lockstat_count(kernel_class, start, now, contended);
+    kernel_held_since[smp_cpu()->id] = rdtsc();
+}
+
+void lockstat_kernel_released()
+{
+    uint64_t held_since = kernel_held_since[smp_cpu()->id];
+    if(held_since == 0) return;
+
+    __lockstat_hold(kernel_class, rdtsc() - held_since);
+}
+
+/**
+ * @brief Gets the statistics of a lock class.
+ * @param index Class index, 0 to LOCKSTAT_CLASSES-1.
+ * @param info Output statistics.
+ * @return error_t 0 on success, -ERROR_INDEX if there is no such class.
+ */
+error_t lockstat_get_info(int index, struct lockstat_info* info)
+{
+    ERR_ON_NULL(info);
+    if(index < 0 || index >= lock_class_count){
+        return -ERROR_INDEX;
+    }
+
+    struct lock_class* lclass = &lock_classes[index];
+    const char* name = lclass->name[0] == '&' ? lclass->name + 1 : lclass->name;
+
+    int length = strlen(name);
+    if(length >= LOCKSTAT_NAME_LENGTH) length = LOCKSTAT_NAME_LENGTH - 1;
+    memcpy(info->name, name, length);
+    info->name[length] = 0;
+
+    uint32_t flags = spin_lock_irqsave(&lclass->lock);
+    info->acquisitions = lclass->acquisitions;
+    info->contended = lclass->contended;
+    info->wait = (uint32_t)(lclass->wait >> 10);
+    info->hold_max = (uint32_t)(lclass->hold_max >> 10);
+    spin_unlock_irqrestore(&lclass->lock, flags);
+
+    return ERROR_OK;
+}
+
+void lockstat_reset()
+{
+    for (int i = 0; i < lock_class_count; i++){
+        struct lock_class* lclass = &lock_classes[i];
+        uint32_t flags = spin_lock_irqsave(&lclass->lock);
+        lclass->acquisitions = 0;
+        lclass->contended = 0;
+        lclass->wait = 0;
+        lclass->hold_max = 0;
+        spin_unlock_irqrestore(&lclass->lock, flags);
+    }
+}
@@ -16,6 +16,9 @@
 #include <bitmap.h>
 #include <assert.h>
 #include <kutils.h>
+#include <syscalls.h>
+#include <syscall_helper.h>
+#include <pcb.h>
 
 #define MB(mb) (mb*1024*1024)
 #define KB(kb) (kb*1024)
@@ -98,15 +101,12 @@ void free(void* ptr)
 	dbgprintf("Freeing %x\n", ptr);
 	if(ptr == NULL)return;
 		
-	/* lock on free as multiple threads can free at the same time */
-	spin_lock(&$process->current->allocations->spinlock);
-	
-	vmem_stack_free($process->current, ptr);	
-
-	spin_unlock(&$process->current->allocations->spinlock);
+	/* takes the heap spinlock itself, frames are freed after dropping it */
+	vmem_stack_free($process->current, ptr);
 }
 
-void* malloc(unsigned int size)
+/* caller is the allocation site the block is traced under, see kmemtrace */
+static void* __malloc(unsigned int size, uintptr_t caller)
 {	
 	if (size <= 0){
 		return NULL;
@@ -117,7 +117,7 @@ void* malloc(unsigned int size)
 	/* lock on malloc as multiple threads can malloc at the same time */
 	spin_lock(&$process->current->allocations->spinlock);
 
-	void* ptr = vmem_stack_alloc($process->current, size);
+	void* ptr = vmem_stack_alloc($process->current, size, caller);
 	if(ptr == NULL){
 		spin_unlock(&$process->current->allocations->spinlock);
 		return NULL;
@@ -131,24 +131,48 @@ void* malloc(unsigned int size)
 	return ptr;
 }
 
+void* malloc(unsigned int size)
+{
+	return __malloc(size, (uintptr_t) __builtin_return_address(0));
+}
+
 void* calloc(int size, int val)
 {
-	void* m = malloc(size);
+	void* m = __malloc(size, (uintptr_t) __builtin_return_address(0));
 	if(m == NULL) return NULL;
 
 	memset(m, val, size);
 	return m;
 }
 
+/* System call path of malloc, the return address would only be system_call */
+static int sys_malloc(unsigned int size)
+{
+	return (int) __malloc(size, $process->current->syscall_eip);
+}
+EXPORT_SYSCALL(SYSCALL_MALLOC, sys_malloc);
+
 error_t get_mem_info(struct mem_info* info)
 {
+	int slab_used, slab_total;
+	kmem_cache_usage(&slab_used, &slab_total);
+
+	struct pmem_info pinfo;
+	pmem_get_info(&pinfo);
+
 	struct mem_info inf = {
 		.kernel.total = memory_map_get()->kernel.total,
 		.kernel.used = kmemory_used(),
 		.permanent.total = memory_map_get()->permanent.total,
-		.permanent.used = pmemory_used(),
+		.permanent.used = pinfo.used,
+		.permanent.free_blocks = pinfo.free_blocks,
+		.permanent.largest_free = pinfo.largest_free,
+		.permanent.fragmentation = pinfo.fragmentation,
 		.virtual_memory.total = memory_map_get()->virtual_memory.total,
 		.virtual_memory.used = vmem_total_usage(),
+		/* slab memory is allocated from kernel memory */
+		.slab.total = slab_total,
+		.slab.used = slab_used,
 	};
 
 	*info = inf;
@@ -10,6 +10,7 @@
  */
 
 #include <arch/gdt.h>
+#include <arch/fpu.h>
 #include <pcb.h>
 #include <serial.h>
 #include <memory.h>
@@ -20,54 +21,65 @@
 #include <kutils.h>
 #include <libc.h>
 #include <errors.h>
+#include <bitmap.h>
 
 #include <syscalls.h>
 #include <syscall_helper.h>
 
 #include <fs/fs.h>
+#include <program.h>
+#include <kmemtrace.h>
+#include <timer.h>
 
 #include <user.h>
 #include <admin.h>
 #include <usermanager.h>
 
-static struct pcb pcb_table[MAX_NUM_OF_PCBS];
-static struct process __process = {
-	.current = &(struct pcb){
-		.name = "kernel",
-		.pid = 0,
-		.user = &(struct user){
-			.name = "system",
-			.permissions = SYSTEM_FULL_ACCESS,
-		}
-	},
-};
-struct process* $process = &__process;
-
 /**
- * Current running PCB, used for context aware
- * functions such as windows drawing to the screen.
+ * @brief PCBs are allocated from their own cache when a pcb is created, so only live pcbs use memory.
+ * Pids come from a bitmap and index pcb_by_pid, a pid without a pcb maps to NULL.
+ * Lookups and frees happen in critical sections, a pcb is never freed while it is looked up.
  */
-
+static struct pcb* pcb_by_pid[MAX_NUM_OF_PCBS];
+static struct hbitmap* pcb_pids = NULL;
+static struct kmem_cache* pcb_cache = NULL;
+static struct kmem_cache* pcb_stack_cache = NULL;
+/* Every new pcb starts as a copy of the template instead of being zeroed and filled in field by field */
+static struct pcb pcb_template;
 const char* pcb_status[] = {"stopped ", "running ", "new     ", "blocked ", "sleeping", "zombie"};
 static int pcb_count = 0;
+/* pcbs waiting for another pcb to be cleaned up, see pcb_join and pcb_await */
+static waitqueue_t pcb_exit_waiters;
 
+/**
+ * @brief Returns the pcb, its kernel stack and its pid.
+ * @warning Must be called in a critical section.
+ */
 static void __pcb_free(struct pcb* pcb)
 {
-	memset(pcb, 0, sizeof(struct pcb));
+	fpu_release(pcb);
+	if(pcb->stackptr != 0){
+		kmem_cache_free(pcb_stack_cache, (void*)pcb->stackptr);
+	}
+
+	if(pcb->pid >= 0){
+		pcb_by_pid[pcb->pid] = NULL;
+		hbitmap_free(pcb_pids, pcb->pid);
+	}
 	pcb->state = STOPPED;
-	pcb->parent = NULL;
 	pcb->pid = -1;
-	pcb->next = NULL;
-	pcb->prev = NULL;
+
+	kmem_cache_free(pcb_cache, pcb);
 }
 
 static int __pcb_init_kernel_stack(struct pcb* pcb)
 {
-	int32_t stack = (uint32_t) kalloc(PCB_STACK_SIZE);
+	int32_t stack = (uint32_t) kmem_cache_alloc(pcb_stack_cache);
 	if((void*)stack == NULL){
 		return -ERROR_ALLOC;
 	}
-	memset((void*)stack, 0, PCB_STACK_SIZE);
+	/* Only the first frame is built from the top, the rest of the stack is never read before it is written */
+	memset((void*)(stack+PCB_STACK_SIZE-PCB_STACK_CLEAR), 0, PCB_STACK_CLEAR);
 
 	/* Stack grows down so we want the upper part of allocated memory.*/ 
 	pcb->ctx.ebp = stack+PCB_STACK_SIZE-1;
@@ -120,29 +132,30 @@ static error_t pcb_kthread_init_args(struct pcb* pcb, int argc, char** argv)
 }
 
 
+/**
+ * @brief Allocates a new pcb with a pid, initialized from the template.
+ * @return struct pcb* new pcb, NULL if there is no pid or memory left.
+ */
 static struct pcb* __pcb_get_free()
 {
 	ASSERT_CRITICAL();
-	int i; /* Find a pcb is that is "free" */
-	for(i = 0; i < MAX_NUM_OF_PCBS; i++)
-		if(pcb_table[i].state == STOPPED){
-			struct pcb* pcb = &pcb_table[i];
-
-			pcb->pid = i;
-			pcb->state = PCB_NEW;
-			pcb->used_memory = 0;
-			pcb->kallocs = 0;
-			pcb->preempts = 0;
-			pcb->is_process = 0;
-			pcb->args = 0;
-			pcb->argv = NULL;
-			pcb->current_directory = 0;
-			pcb->yields = 0;
-
-			return pcb;
-		}
 
-	return NULL;
+	int pid = hbitmap_alloc(pcb_pids);
+	if(pid < 0){
+		return NULL;
+	}
+
+	struct pcb* pcb = kmem_cache_alloc(pcb_cache);
+	if(pcb == NULL){
+		hbitmap_free(pcb_pids, pid);
+		return NULL;
+	}
+
+	memcpy(pcb, &pcb_template, sizeof(struct pcb));
+	pcb->pid = pid;
+	pcb_by_pid[pid] = pcb;
+
+	return pcb;
 }
 
 static struct pcb* __pcb_init_process(byte_t flags, uint32_t entry_point)
@@ -184,12 +197,20 @@ static int __pcb_init_virt_args(struct pcb* pcb, int argc, char** argv)
 
 	if(argc == 0) return ERROR_OK;
 
-	struct args* virtual_args = vmem_stack_alloc(pcb, sizeof(struct args));
+	struct args* virtual_args = NULL;
+	SPINLOCK(pcb->allocations, {
+		virtual_args = vmem_stack_alloc(pcb, sizeof(struct args), (uintptr_t) __builtin_return_address(0));
+	});
 	if(virtual_args == NULL){
 		dbgprintf("[PCB] Failed to allocate memory for virtual args\n");
 		return -ERROR_ALLOC;
 	}
 
+	/* process is not running, map the pages now instead of on first access */
+	if(vmem_populate(pcb, (uint32_t)virtual_args, sizeof(struct args)) < 0){
+		return -ERROR_ALLOC;
+	}
+
 	/* get physical address */
 	uint32_t* heap_table = (uint32_t*)(pcb->page_dir[DIRECTORY_INDEX(VMEM_HEAP)] & ~PAGE_MASK);
 	uint32_t heap_page = (uint32_t)((uint32_t*)heap_table)[TABLE_INDEX((uint32_t)virtual_args)]& ~PAGE_MASK;
@@ -215,42 +236,110 @@ static int __pcb_init_virt_args(struct pcb* pcb, int argc, char** argv)
 void init_pcbs()
 {   
 
-	/* Stopped processes are eligible to be "replaced." */
 	for (int i = 0; i < MAX_NUM_OF_PCBS; i++){
-		pcb_table[i].state = STOPPED;
-		pcb_table[i].pid = -1;
-		pcb_table[i].next = NULL;
+		pcb_by_pid[i] = NULL;
 	}
+	pcb_pids = hbitmap_create(MAX_NUM_OF_PCBS);
+	assert(pcb_pids != NULL);
+
+	/* PCBs and kernel stacks are recycled through their own caches */
+	pcb_cache = kmem_cache_create("pcb", sizeof(struct pcb));
+	pcb_stack_cache = kmem_cache_create("kstack", PCB_STACK_SIZE);
+	assert(pcb_cache != NULL && pcb_stack_cache != NULL);
+
+	memset(&pcb_template, 0, sizeof(struct pcb));
+	pcb_template.pid = -1;
+	pcb_template.state = PCB_NEW;
+	pcb_template.priority = PCB_PRIORITY_DEFAULT;
+	pcb_template.sched_class = PCB_CLASS_NORMAL;
+	pcb_template.queued = PCB_UNQUEUED;
 
 	dbgprintf("[PCB] All process control blocks are ready.\n");
 }
 
-int pcb_total_usage()
+/* CPU time of a pcb in units of 2^20 cycles */
+static inline uint32_t __pcb_mcycles(struct pcb* pcb)
 {
-	int total = 0;
+	return (uint32_t)((pcb->cycles_user + pcb->cycles_kernel) >> 20);
+}
+
+/**
+ * @brief CPU time of all pcbs but the idle task, the usage of pcb_get_info is relative to it.
+ * Scans every pid, so listings take it once and pass it to pcb_get_info for each pcb.
+ */
+uint32_t pcb_total_usage()
+{
+	uint32_t total = 0;
 	/* Do not include idle task at pid 0 */
 	for (int i = 1; i < MAX_NUM_OF_PCBS; i++){
-		total += pcb_table[i].preempts;
+		if(pcb_by_pid[i] == NULL) continue;
+		total += __pcb_mcycles(pcb_by_pid[i]);
 	}
 	return total;
 }
 
-error_t pcb_get_info(int pid, struct pcb_info* info)
+/**
+ * @brief Charges the cycles since the last call to the mode the pcb was in.
+ * Called when the pcb enters the kernel from user mode, when it returns to user mode
+ * and when it is switched in or out, only ever by the processor running the pcb.
+ * @param pcb The running pcb.
+ * @param user The pcb continues in user mode.
+ */
+void pcb_account(struct pcb* pcb, int user)
 {
-	if(pid < 0 || pid > MAX_NUM_OF_PCBS || pcb_table[pid].state == STOPPED)
+	if(pcb == NULL) return;
+
+	uint64_t now = rdtsc();
+	if(pcb->acct_stamp != 0){
+		if(pcb->acct_user){
+			pcb->cycles_user += now - pcb->acct_stamp;
+		} else {
+			pcb->cycles_kernel += now - pcb->acct_stamp;
+		}
+	}
+	pcb->acct_stamp = now;
+	pcb->acct_user = user;
+}
+
+error_t pcb_get_stats(int pid, struct pcb_stats* stats)
+{
+	ERR_ON_NULL(stats);
+	struct pcb* pcb = pcb_get_by_pid(pid);
+	if(pcb == NULL)
+		return -ERROR_INDEX;
+
+	stats->user = (uint32_t)(pcb->cycles_user >> 20);
+	stats->kernel = (uint32_t)(pcb->cycles_kernel >> 20);
+	stats->voluntary = pcb->switches_voluntary;
+	stats->involuntary = pcb->switches_involuntary;
+	memcpy(stats->latency, pcb->latency, sizeof(stats->latency));
+
+	return ERROR_OK;
+}
+EXPORT_SYSCALL(SYSCALL_PCB_STATS, pcb_get_stats);
+
+/**
+ * @brief Gets a snapshot of the given pcb.
+ * @param total CPU time of all pcbs from pcb_total_usage, 0 leaves the usage at 0.
+ */
+error_t pcb_get_info(int pid, uint32_t total, struct pcb_info* info)
+{
+	struct pcb* pcb = pcb_get_by_pid(pid);
+	if(pcb == NULL)
 		return -ERROR_INDEX;
 
 	struct pcb_info _info = {
 		.pid = pid,
-		.stack = pcb_table[pid].ctx.esp,
-		.state = pcb_table[pid].state,
-		.used_memory = pcb_table[pid].used_memory,
-		.is_process = pcb_table[pid].is_process,
-		.usage = (float)pcb_table[pid].preempts / (float)pcb_total_usage(),
+		.stack = pcb->ctx.esp,
+		.state = pcb->state,
+		.used_memory = pcb->used_memory,
+		.is_process = pcb->is_process,
+		.usage = total > 0 ? (float)__pcb_mcycles(pcb) / (float)total : 0,
 		.name = {0}
 	};
-	memcpy(_info.name, pcb_table[pid].name, PCB_MAX_NAME_LENGTH);
-	memcpy(_info.user, pcb_table[pid].user->name, USER_MAX_NAME_LENGTH);
+	memcpy(_info.name, pcb->name, PCB_MAX_NAME_LENGTH);
+	memcpy(_info.user, pcb->user->name, USER_MAX_NAME_LENGTH);
+	pcb_get_stats(pid, &_info.stats);
 
 	*info = _info;
 
@@ -259,8 +348,21 @@ error_t pcb_get_info(int pid, struct pcb_info* info)
 
 void pcb_kill(int pid)
 {
-	if(pid < 0 || pid > MAX_NUM_OF_PCBS) return;
-	pcb_table[pid].state = ZOMBIE;
+	if(pid < 0 || pid >= MAX_NUM_OF_PCBS) return;
+
+	CRITICAL_SECTION({
+		struct pcb* pcb = pcb_by_pid[pid];
+		if(pcb != NULL && pcb->state != STOPPED && pcb->state != ZOMBIE && pcb->state != CLEANING){
+			/* A pcb waiting on a mutex must not be handed the lock once it is a zombie */
+			if(pcb->queued == PCB_QUEUED_WAIT && pcb->lockqueue != NULL){
+				pcb_queue_unlink(pcb);
+				pcb->queued = PCB_UNQUEUED;
+			}
+			/* Blocked and sleeping pcbs are in no run queue, wake them so the zombie is seen by the scheduler */
+			unblock(pid);
+			pcb->state = ZOMBIE;
+		}
+	});
 }
 
 void Genesis()
@@ -270,21 +372,38 @@ void Genesis()
 
 void idletask(){
 	dbgprintf("Hello world!\n");
+
+	/* Only scheduled when nothing else is runnable */
+	$process->current->priority = PCB_PRIORITY_IDLE;
+
 	while(1){
-		HLT();
+		/* Zero frames ahead of time while nothing else runs, yielding between chunks. */
+		if(vmem_zero_pool_refill(VMEM_ZERO_POOL_CHUNK) > 0){
+			kernel_yield();
+			continue;
+		}
+
+		/* Halts with the tick stopped until the next timer or interrupt, then lets the woken pcbs run */
+		timer_idle();
+		kernel_yield();
 	};
 }
 
+/**
+ * @brief Finds the pcb of a pid.
+ * @return struct pcb* pcb, NULL if no pcb has the pid.
+ */
 struct pcb* pcb_get_by_pid(int pid)
 {
-	return &pcb_table[pid];
+	if(pid < 0 || pid >= MAX_NUM_OF_PCBS) return NULL;
+	return pcb_by_pid[pid];
 }
 
 struct pcb* pcb_get_by_name(char* name)
 {
 	for (int i = 0; i < MAX_NUM_OF_PCBS; i++){
-		if(strncmp(pcb_table[i].name, name, strlen(name)) == 0){
-			return &pcb_table[i];
+		if(pcb_by_pid[i] != NULL && strncmp(pcb_by_pid[i]->name, name, strlen(name)) == 0){
+			return pcb_by_pid[i];
 		}
 	}
 	return NULL;
@@ -292,12 +411,39 @@ struct pcb* pcb_get_by_name(char* name)
 
 int pcb_await(int pid)
 {
-	if(pid < 0 || pid > MAX_NUM_OF_PCBS) return -1;
-	while(pcb_table[pid].state != STOPPED);
+	if(pid < 0 || pid >= MAX_NUM_OF_PCBS) return -1;
+	wait_event(&pcb_exit_waiters, pcb_by_pid[pid] == NULL);
 	return 0;
 }
 EXPORT_SYSCALL(SYSCALL_AWAIT_PROCESS, pcb_await);
 
+/**
+ * @brief Blocks until the given thread of the current pcb has exited and been cleaned up.
+ * Only threads created by the current pcb can be joined. Once the thread is cleaned up
+ * its pid may be reused right away, a pid no longer belonging to a child is gone as well.
+ * @param pid Thread to wait for.
+ * @return int 0 once the thread is gone, negative error code otherwise.
+ */
+int pcb_join(int pid)
+{
+	if(pid < 0 || pid >= MAX_NUM_OF_PCBS) return -ERROR_INDEX;
+
+	struct pcb* current = $process->current;
+
+	/* Checked in a critical section, the thread cannot be freed while its parent is read */
+	ENTER_CRITICAL();
+	if(pcb_by_pid[pid] == NULL || pcb_by_pid[pid] == current || pcb_by_pid[pid]->parent != current){
+		LEAVE_CRITICAL();
+		return -ERROR_INVALID_ARGUMENTS;
+	}
+
+	wait_event(&pcb_exit_waiters, pcb_by_pid[pid] == NULL || pcb_by_pid[pid]->parent != current);
+	LEAVE_CRITICAL();
+
+	return ERROR_OK;
+}
+EXPORT_SYSCALL(SYSCALL_JOIN_THREAD, pcb_join);
+
 
 void pcb_dbg_print(struct pcb* pcb)
 {
@@ -317,13 +463,14 @@ int pcb_cleanup_routine(void* arg)
 	AUTHORIZED_GUARD(SYSTEM_FULL_ACCESS);
 
 	int pid = (int)arg;
-	assert(pid != $process->current->pid && !(pid < 0 || pid > MAX_NUM_OF_PCBS));
+	assert(pid != $process->current->pid && !(pid < 0 || pid >= MAX_NUM_OF_PCBS));
 
-	dbgprintf("%d\n", __cli_cnt);
-	struct pcb* pcb = &pcb_table[pid];
+	dbgprintf("%d\n", critical_depth());
+	struct pcb* pcb = pcb_by_pid[pid];
+	assert(pcb != NULL);
 
 	if(pcb->gfx_window != NULL){
-		gfx_destory_window(pcb_table[pid].gfx_window);
+		gfx_destory_window(pcb->gfx_window);
 	}
 
 	/**
@@ -331,8 +478,9 @@ int pcb_cleanup_routine(void* arg)
 	 * Therefor loop over all pcbs and kill them if current is their parent.
 	 */
 	for (int i = 0; i < MAX_NUM_OF_PCBS; i++){
-		if(pcb_table[i].parent == pcb && pcb_table[i].is_process == PCB_THREAD){
-			pcb_table[i].state = ZOMBIE;
+		struct pcb* child = pcb_by_pid[i];
+		if(child != NULL && child->parent == pcb && child->is_process == PCB_THREAD){
+			pcb_kill(i);
 		}
 	}
 	
@@ -349,17 +497,19 @@ int pcb_cleanup_routine(void* arg)
 		}
 		break;
 	}
-	kfree((void*)pcb->stackptr);
+	/* Anything still traced to the pid after cleanup is a leak candidate */
+	kmemtrace_process_exit(pid);
 
 	pcb_count--;
 
 	CRITICAL_SECTION({
 		__pcb_free(pcb);
+		wake_up_all(&pcb_exit_waiters);
 	});
 
 	dbgprintf("[PCB] Cleanup on PID %d [DONE]\n", pid);
 
-	dbgprintf("%d\n", __cli_cnt);
+	dbgprintf("%d\n", critical_depth());
 
 	return pid;
 }
@@ -377,8 +527,8 @@ error_t pcb_create_thread(struct pcb* parent, void (*entry)(), void* arg, byte_t
 {
 	AUTHORIZED_GUARD(CTRL_PROC_CREATE | SYSTEM_FULL_ACCESS | ADMIN_FULL_ACCESS);
 
-	/* Initialize PCB and set privileges */
-    struct pcb* pcb = __pcb_init_process(flags, VMEM_DATA);
+	/* Initialize PCB and set privileges, threads start in the program entry which calls thread_eip */
+    struct pcb* pcb = __pcb_init_process(flags, parent->image != NULL ? parent->image->entry : VMEM_DATA);
 	if(pcb == NULL){
         return -ERROR_NULL_POINTER;
     }
@@ -413,30 +563,23 @@ error_t pcb_create_process(char* program, int argc, char** argv, pcb_flag_t flag
 {
 	AUTHORIZED_GUARD(CTRL_PROC_CREATE | SYSTEM_FULL_ACCESS | ADMIN_FULL_ACCESS);
 
-	char* buf;
-	int ret, size;
+	int ret;
 	struct pcb* pcb;
 
-	/* Load program into memory */
-	buf = kalloc(32*1024);
-	if(buf == NULL){return -ERROR_ALLOC;}
-	
-	ret = fs_load_from_file(program, buf, 32*1024);
-	if(ret < 0){
+	/* Get the program image, shared with other instances of the program */
+	struct program_image* image = program_image_get(program);
+	if(image == NULL){
 		dbgprintf("Error loading %s\n", program);
-		
-		kfree(buf);
 		return -ERROR_FILE_NOT_FOUND;
 	}
-	size = ret;
 
-	pcb = __pcb_init_process(flags, VMEM_DATA);
+	pcb = __pcb_init_process(flags, image->entry);
 	if(pcb == NULL){
-		kfree(buf);
+		program_image_put(image);
         return -ERROR_NULL_POINTER;
     }
 
-	pcb->data_size = size;
+	pcb->data_size = image->size;
 	memcpy(pcb->name, program, strlen(program)+1);
 
 	pcb->term = $process->current->term;
@@ -446,12 +589,15 @@ error_t pcb_create_process(char* program, int argc, char** argv, pcb_flag_t flag
 	pcb->thread_eip = 0;
 
 	/* Memory map data */
-	vmem_init_process(pcb, buf, size);
+	vmem_init_process(pcb, image);
 
 	ret = __pcb_init_virt_args(pcb, argc, argv);
 	if(ret < 0){
-		kfree(buf);
-		__pcb_free(pcb);
+		/* Also drops the reference on the program image */
+		vmem_cleanup_process(pcb);
+		CRITICAL_SECTION({
+			__pcb_free(pcb);
+		});
 
 		return -ERROR_ALLOC;
 	}
@@ -460,7 +606,6 @@ error_t pcb_create_process(char* program, int argc, char** argv, pcb_flag_t flag
 	// TODO: Check for errors
 
 	pcb_count++;
-	kfree(buf);
 
 	dbgprintf("Created new process!\n");
 	/* Run */
@@ -492,7 +637,9 @@ error_t pcb_create_kthread(void (*entry)(), char* name, int argc, char** argv)
 	/* Set up stack */
 	int ret = __pcb_init_kernel_stack(pcb);
 	if(ret < 0){
+		__pcb_free(pcb);
 		dbgprintf("[PCB] Failed to allocate stack\n");
+		LEAVE_CRITICAL();
 		return -ERROR_ALLOC;
 	}
 
@@ -510,7 +657,7 @@ error_t pcb_create_kthread(void (*entry)(), char* name, int argc, char** argv)
 	memcpy(pcb->name, name, strlen(name)+1);
 	
 	/* this is done for processes in vmem.c, should probably be moved there? */
-	pcb->allocations = create(struct virtual_allocations);
+	pcb->allocations = vmem_heap_create(pcb->pid);
 	if(pcb->allocations == NULL){
 		__pcb_free(pcb);
 		dbgprintf("[PCB] Failed to allocate memory for virtual allocations\n");
@@ -49,20 +49,20 @@ struct pcb_queue* pcb_new_queue()
 	}
 
 	queue->_list = NULL;
+	queue->_tail = NULL;
 	queue->ops = &pcb_queue_default_ops;
-	queue->spinlock = 0;
+	spinlock_init(&queue->spinlock);
 	queue->total = 0;
 
 	return queue;
 }
 
 /**
- * @brief Pushes a PCB onto the single linked PCB queue.
+ * @brief Pushes a PCB onto the double linked PCB queue.
  *
  * The `__pcb_queue_push()` function adds a PCB to the end of the specified queue. The function takes a pointer to
  * the `pcb_queue` structure and a pointer to the `pcb` structure to be added as arguments. The function uses
- * a spinlock to protect the critical section and adds the PCB to the end of the queue by traversing the current
- * list of PCBs and adding the new PCB to the end.
+ * a spinlock to protect the critical section and links the PCB after the tail of the queue.
  *
  * @param queue A pointer to the `pcb_queue` structure to add the `pcb` to.
  * @param pcb A pointer to the `pcb` structure to add to the queue.
@@ -74,21 +74,18 @@ static error_t __pcb_queue_push(struct pcb_queue* queue, struct pcb* pcb)
 		return -ERROR_PCB_QUEUE_NULL;
 	}
 
-	/* This approach is suboptimal for large pcb queues, as you have to iterate over all pcbs */
 	SPINLOCK(queue, {
 
-		struct pcb* current = queue->_list;
-		if(current == NULL){
+		pcb->next = NULL;
+		pcb->prev = queue->_tail;
+		if(queue->_tail != NULL){
+			queue->_tail->next = pcb;
+		} else {
 			queue->_list = pcb;
-			break;
 		}
-		while (current->next != NULL){
-			current = current->next;
-		}
-		current->next = pcb;
-		pcb->next = NULL;
+		queue->_tail = pcb;
 		queue->total++;
-
+		pcb->lockqueue = queue;
 
 	});
 
@@ -96,7 +93,7 @@ static error_t __pcb_queue_push(struct pcb_queue* queue, struct pcb* pcb)
 }
 
 /**
- * @brief Adds a PCB to the single linked PCB queue.
+ * @brief Adds a PCB to the double linked PCB queue.
  *
  * The `__pcb_queue_add()` function adds a PCB to the beginning of the specified queue. The function takes a pointer to
  * the `pcb_queue` structure and a pointer to the `pcb` structure to be added as arguments. The function uses
@@ -117,9 +114,16 @@ static error_t __pcb_queue_add(struct pcb_queue* queue, struct pcb* pcb)
 
 		/* Add the pcb to the front of the queue */
 		pcb->next = queue->_list; /* Set the next pointer of the new pcb to the current head of the queue */
+		pcb->prev = NULL;
+		if(queue->_list != NULL){
+			queue->_list->prev = pcb;
+		} else {
+			queue->_tail = pcb;
+		}
 		queue->_list = pcb; /* Set the head of the queue to the new pcb */
 
 		queue->total++;
+		pcb->lockqueue = queue;
 
 	});
 
@@ -145,25 +149,37 @@ static void __pcb_queue_remove(struct pcb_queue* queue, struct pcb* pcb)
 
 	SPINLOCK(queue, {
 
-		if(queue->_list == pcb){
-			queue->_list = pcb->next;
+		/* The links are shared with other queues, make sure the pcb is in this one */
+		if(pcb->lockqueue != queue){
 			break;
 		}
 
+		if(pcb->prev != NULL) pcb->prev->next = pcb->next;
+		else queue->_list = pcb->next;
+		if(pcb->next != NULL) pcb->next->prev = pcb->prev;
+		else queue->_tail = pcb->prev;
 
-		/* Remove pcb from linked list queue */
-		struct pcb* current = queue->_list;
-		while ( current->next != NULL && current->next != pcb){
-			current = current->next;
-		}
+		pcb->next = NULL;
+		pcb->prev = NULL;
+		pcb->lockqueue = NULL;
+		queue->total--;
+	});
 
-		if(current->next == NULL){
-			break;
-		}
+}
 
-		current->next = pcb->next;
-	});
+/**
+ * @brief Removes a PCB from the PCB queue it is waiting in, if any.
+ * Used when a pcb waiting on a mutex is killed, so the mutex is never handed to it.
+ *
+ * @param pcb A pointer to the `pcb` structure to unlink.
+ */
+void pcb_queue_unlink(struct pcb* pcb)
+{
+	if(pcb == NULL || pcb->lockqueue == NULL){
+		return;
+	}
 
+	pcb->lockqueue->ops->remove(pcb->lockqueue, pcb);
 }
 
 /**
@@ -188,9 +204,16 @@ static struct pcb* __pcb_queue_pop(struct pcb_queue* queue)
 
 		front = queue->_list;
 		queue->_list = front->next;
+		if(queue->_list != NULL){
+			queue->_list->prev = NULL;
+		} else {
+			queue->_tail = NULL;
+		}
+		queue->total--;
 
 		front->next = NULL;
 		front->prev = NULL;
+		front->lockqueue = NULL;
 	});
 
     return front;
@@ -218,4 +241,83 @@ static struct pcb* __pcb_queue_peek(struct pcb_queue* queue)
 	});
 
 	return front;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Initializes an empty run queue.
+ * @param rq run queue to initialize.
+ */
+void pcb_runqueue_init(struct pcb_runqueue* rq)
+{
+	for (int i = 0; i < PCB_PRIORITIES; i++){
+		rq->head[i] = NULL;
+		rq->tail[i] = NULL;
+	}
+	rq->bitmap = 0;
+	rq->total = 0;
+}
+
+/**
+ * @brief Appends a PCB to the level of its priority.
+ * @warning Must be called in a critical section.
+ * @param rq run queue to add to.
+ * @param pcb PCB to add, must not be in any other queue.
+ */
+void pcb_runqueue_push(struct pcb_runqueue* rq, struct pcb* pcb)
+{
+	int level = pcb->priority < PCB_PRIORITIES ? pcb->priority : PCB_PRIORITY_IDLE;
+	pcb->priority = level;
+
+	pcb->next = NULL;
+	pcb->prev = rq->tail[level];
+	if(rq->tail[level] != NULL){
+		rq->tail[level]->next = pcb;
+	} else {
+		rq->head[level] = pcb;
+		rq->bitmap |= 1 << level;
+	}
+	rq->tail[level] = pcb;
+	rq->total++;
+}
+
+/**
+ * @brief Unlinks a PCB from the run queue.
+ * @warning Must be called in a critical section, the pcb must be in the run queue.
+ * @param rq run queue to remove from.
+ * @param pcb PCB to remove.
+ */
+void pcb_runqueue_remove(struct pcb_runqueue* rq, struct pcb* pcb)
+{
+	int level = pcb->priority;
+
+	if(pcb->prev != NULL) pcb->prev->next = pcb->next;
+	else rq->head[level] = pcb->next;
+	if(pcb->next != NULL) pcb->next->prev = pcb->prev;
+	else rq->tail[level] = pcb->prev;
+
+	if(rq->head[level] == NULL){
+		rq->bitmap &= ~(1 << level);
+	}
+
+	pcb->next = NULL;
+	pcb->prev = NULL;
+	rq->total--;
+}
+
+/**
+ * @brief Removes and returns the first PCB of the most important non empty level.
+ * @warning Must be called in a critical section.
+ * @param rq run queue to pop from.
+ * @return struct pcb* first PCB, NULL if the run queue is empty.
+ */
+struct pcb* pcb_runqueue_pop(struct pcb_runqueue* rq)
+{
+	if(rq->bitmap == 0){
+		return NULL;
+	}
+
+	struct pcb* front = rq->head[__builtin_ctz(rq->bitmap)];
+	pcb_runqueue_remove(rq, front);
+
+	return front;
+}
@@ -15,6 +15,8 @@
 #include <terminal.h>
 #include <serial.h>
 #include <arch/io.h>
+#include <arch/interrupts.h>
+#include <arch/lapic.h>
 #include <ksyms.h>
 
 static const char* pci_classes[] =
@@ -174,6 +176,62 @@ void pci_enable_device_busmaster(uint16_t bus, uint16_t slot, uint16_t function)
     pci_write_dword(bus, slot, function, 0x04, (uint32_t)dev_status_reg << 16 | (uint32_t) dev_command_reg);
 }
 
+/**
+ * @brief Finds a capability in the capability list of a device.
+ * @return int config space offset of the capability, -1 if the device does not have it.
+ */
+int pci_find_capability(struct pci_device* dev, uint8_t id)
+{
+    if(!(pci_read_word(dev->bus, dev->slot, dev->function, 0x06) & PCI_STATUS_CAPABILITIES)) return -1;
+
+    uint8_t offset = pci_read_word(dev->bus, dev->slot, dev->function, PCI_CAPABILITIES_POINTER) & 0xFC;
+    /* Bounded, a broken list could loop */
+    for (int i = 0; i < 48 && offset != 0; i++){
+        uint16_t header = pci_read_word(dev->bus, dev->slot, dev->function, offset);
+        if((header & 0xFF) == id) return offset;
+        offset = (header >> 8) & 0xFC;
+    }
+    return -1;
+}
+
+/**
+ * @brief Switches a device from its interrupt pin to a message signalled interrupt.
+ * The message is a write to the local APIC of the calling processor, no IO APIC or PIC is involved.
+ * @param name Shown with the interrupt counts.
+ * @return int vector to install the handler on, -ERROR_NOT_SUPPORTED if the device or processor
+ * cannot do MSI, or the error of interrupt_alloc_vector.
+ */
+int pci_enable_msi(struct pci_device* dev, const char* name)
+{
+    int cap = pci_find_capability(dev, PCI_CAP_MSI);
+    if(cap < 0) return -ERROR_NOT_SUPPORTED;
+
+    int vector = interrupt_alloc_vector(name);
+    if(vector < 0) return vector;
+
+    uint16_t control = pci_read_word(dev->bus, dev->slot, dev->function, cap + 2);
+    pci_write_dword(dev->bus, dev->slot, dev->function, cap + 4, PCI_MSI_ADDRESS | ((uint32_t)lapic_id() << 12));
+    if(control & PCI_MSI_64BIT){
+        pci_write_dword(dev->bus, dev->slot, dev->function, cap + 8, 0);
+        pci_write_dword(dev->bus, dev->slot, dev->function, cap + 12, vector);
+    } else {
+        pci_write_dword(dev->bus, dev->slot, dev->function, cap + 8, vector);
+    }
+
+    /* A single message, edge triggered with fixed delivery */
+    control = (control & ~PCI_MSI_MULTIPLE_ENABLE) | PCI_MSI_ENABLE;
+    uint16_t header = pci_read_word(dev->bus, dev->slot, dev->function, cap);
+    pci_write_dword(dev->bus, dev->slot, dev->function, cap, (uint32_t)control << 16 | header);
+
+    uint16_t command = pci_read_word(dev->bus, dev->slot, dev->function, 0x04);
+    uint16_t status = pci_read_word(dev->bus, dev->slot, dev->function, 0x06);
+    pci_write_dword(dev->bus, dev->slot, dev->function, 0x04, (uint32_t)status << 16 | (command | PCI_COMMAND_INTX_DISABLE));
+
+    dbgprintf("[PCI] MSI on vector %d for 0x%x:0x%x\n", vector, dev->vendor, dev->device);
+
+    return vector;
+}
+
 int pci_register_device(uint32_t bus, uint32_t slot, uint32_t function, uint16_t vendor, uint16_t device, uint16_t class, uint8_t irq, uint32_t base)
 {
     if(_pci_devices_size > 25) return -1;
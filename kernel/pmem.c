@@ -0,0 +1,249 @@
+/**
+ * @file pmem.c
+ * @author Joe Bayer (joexbayer)
+ * @brief Buddy allocator for the permanent memory region.
+ * @version 0.1
+ * @date 2024-02-20
+ *
+ * Hands out physically contiguous, page aligned blocks of 2^order pages,
+ * used for framebuffers and DMA buffers which cannot come from kalloc.
+ * Each page has one byte of metadata at the end of the region, the head page
+ * of a block stores its order and whether it is free. Free blocks are kept on a
+ * doubly linked list per order, threaded through the blocks themselves.
+ * On free a block is merged with its buddy as long as the buddy is free and of the same order.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <kconfig.h>
+#include <memory.h>
+#include <serial.h>
+#include <sync.h>
+#include <libc.h>
+#include <assert.h>
+
+#ifndef KDEBUG_MEMORY
+#undef dbgprintf
+#define dbgprintf(...)
+#endif
+
+/* Page metadata, only set on the head page of a block */
+#define PMEM_PAGE_FREE 	0x80
+#define PMEM_PAGE_USED 	0x40
+#define PMEM_ORDER_MASK 0x3f
+
+#define PMEM_BLOCK_PAGES(order) (1 << (order))
+
+struct pmem_block {
+	struct pmem_block* next;
+	struct pmem_block* prev;
+};
+
+static struct pmem {
+	uintptr_t base;
+	int pages;
+	/* pages used by the metadata itself, after the last managed page */
+	int reserved;
+	uint8_t* meta;
+
+	struct pmem_block* free[PMEM_MAX_ORDER+1];
+	int free_count[PMEM_MAX_ORDER+1];
+
+	int used_pages;
+	spinlock_t lock;
+} __pmem;
+static struct pmem* pmem = &__pmem;
+
+#define PMEM_INDEX(block) ((((uintptr_t)(block)) - pmem->base) / PAGE_SIZE)
+#define PMEM_BLOCK(index) ((struct pmem_block*)(pmem->base + (index) * PAGE_SIZE))
+
+static void __pmem_free_list_add(int index, int order)
+{
+	struct pmem_block* block = PMEM_BLOCK(index);
+	block->prev = NULL;
+	block->next = pmem->free[order];
+	if(pmem->free[order] != NULL) pmem->free[order]->prev = block;
+	pmem->free[order] = block;
+	pmem->free_count[order]++;
+
+	pmem->meta[index] = PMEM_PAGE_FREE | order;
+}
+
+static void __pmem_free_list_remove(int index, int order)
+{
+	struct pmem_block* block = PMEM_BLOCK(index);
+	if(block->prev != NULL) block->prev->next = block->next;
+	else pmem->free[order] = block->next;
+	if(block->next != NULL) block->next->prev = block->prev;
+	pmem->free_count[order]--;
+
+	pmem->meta[index] = 0;
+}
+
+/**
+ * @brief Initializes the allocator over the given region.
+ * The region does not have to be a power of two, it is carved into the largest
+ * aligned blocks that fit.
+ * @param from start of the region.
+ * @param to end of the region.
+ */
+void pmem_init(uintptr_t from, uintptr_t to)
+{
+	memset(pmem, 0, sizeof(struct pmem));
+
+	/* Metadata goes last so blocks stay aligned to the (usually MB aligned) start of the region */
+	pmem->base = ALIGN(from, PAGE_SIZE);
+	int pages = (to - pmem->base) / PAGE_SIZE;
+	pmem->reserved = ALIGN(pages, PAGE_SIZE) / PAGE_SIZE;
+	assert(pages > pmem->reserved);
+
+	pmem->pages = pages - pmem->reserved;
+	pmem->meta = (uint8_t*) PMEM_BLOCK(pmem->pages);
+	memset(pmem->meta, 0, pmem->reserved * PAGE_SIZE);
+
+	int index = 0;
+	while(index < pmem->pages){
+		int order = PMEM_MAX_ORDER;
+		while(order > 0 && ((index & (PMEM_BLOCK_PAGES(order) - 1)) || index + PMEM_BLOCK_PAGES(order) > pmem->pages)){
+			order--;
+		}
+		__pmem_free_list_add(index, order);
+		index += PMEM_BLOCK_PAGES(order);
+	}
+
+	pmem->used_pages = 0;
+	spinlock_init(&pmem->lock);
+
+	dbgprintf("[PMEM] %d pages at 0x%x, %d reserved for metadata\n", pmem->pages, pmem->base, pmem->reserved);
+}
+
+/**
+ * @brief Allocates a physically contiguous, page aligned block of permanent memory.
+ * The block is rounded up to a power of two number of pages and is not zeroed.
+ * @param size bytes to allocate.
+ * @return void* start of the block, NULL if no block is large enough.
+ */
+void* palloc(int size)
+{
+	if(size <= 0 || pmem->meta == NULL) return NULL;
+
+	int order = 0;
+	while(order <= PMEM_MAX_ORDER && PMEM_BLOCK_PAGES(order) * PAGE_SIZE < size){
+		order++;
+	}
+	if(order > PMEM_MAX_ORDER){
+		dbgprintf("[PMEM] Allocation of %d bytes is too large\n", size);
+		return NULL;
+	}
+
+	void* ptr = NULL;
+
+	spin_lock(&pmem->lock);
+
+	int current = order;
+	while(current <= PMEM_MAX_ORDER && pmem->free[current] == NULL){
+		current++;
+	}
+
+	if(current <= PMEM_MAX_ORDER){
+		int index = PMEM_INDEX(pmem->free[current]);
+		__pmem_free_list_remove(index, current);
+
+		/* Split until the block has the requested order, upper halves go back on the free lists */
+		while(current > order){
+			current--;
+			__pmem_free_list_add(index + PMEM_BLOCK_PAGES(current), current);
+		}
+
+		pmem->meta[index] = PMEM_PAGE_USED | order;
+		pmem->used_pages += PMEM_BLOCK_PAGES(order);
+		ptr = PMEM_BLOCK(index);
+	}
+
+	spin_unlock(&pmem->lock);
+
+	if(ptr == NULL){
+		dbgprintf("[WARNING] Not enough permanent memory for %d bytes!\n", size);
+	}
+
+	return ptr;
+}
+
+/**
+ * @brief Frees a block allocated by palloc, merging it with free buddies.
+ * @param ptr start of the block.
+ */
+void pfree(void* ptr)
+{
+	if(ptr == NULL) return;
+
+	uintptr_t addr = (uintptr_t) ptr;
+	if(addr < pmem->base || addr >= pmem->base + pmem->pages * PAGE_SIZE || (addr & PAGE_MASK)){
+		warningf("Trying to free unknown permanent memory 0x%x.\n", ptr);
+		return;
+	}
+
+	spin_lock(&pmem->lock);
+
+	int index = PMEM_INDEX(addr);
+	if(!(pmem->meta[index] & PMEM_PAGE_USED)){
+		spin_unlock(&pmem->lock);
+		warningf("Trying to free unallocated permanent memory 0x%x.\n", ptr);
+		return;
+	}
+
+	int order = pmem->meta[index] & PMEM_ORDER_MASK;
+	pmem->meta[index] = 0;
+	pmem->used_pages -= PMEM_BLOCK_PAGES(order);
+
+	while(order < PMEM_MAX_ORDER){
+		int buddy = index ^ PMEM_BLOCK_PAGES(order);
+		if(buddy + PMEM_BLOCK_PAGES(order) > pmem->pages || pmem->meta[buddy] != (PMEM_PAGE_FREE | order)){
+			break;
+		}
+
+		__pmem_free_list_remove(buddy, order);
+		if(buddy < index) index = buddy;
+		order++;
+	}
+
+	__pmem_free_list_add(index, order);
+
+	spin_unlock(&pmem->lock);
+}
+
+int pmemory_used()
+{
+	return pmem->used_pages * PAGE_SIZE;
+}
+
+/**
+ * @brief Gets usage and fragmentation statistics of permanent memory.
+ * @param info Output statistics.
+ * @return 0 on success, error code on failure.
+ */
+error_t pmem_get_info(struct pmem_info* info)
+{
+	ERR_ON_NULL(info);
+
+	struct pmem_info _info = {0};
+	int free_pages = 0;
+
+	spin_lock(&pmem->lock);
+	for (int order = 0; order <= PMEM_MAX_ORDER; order++){
+		if(pmem->free_count[order] == 0) continue;
+
+		_info.free_blocks += pmem->free_count[order];
+		_info.largest_free = PMEM_BLOCK_PAGES(order) * PAGE_SIZE;
+		free_pages += pmem->free_count[order] * PMEM_BLOCK_PAGES(order);
+	}
+	_info.used = pmem->used_pages * PAGE_SIZE;
+	_info.total = pmem->pages * PAGE_SIZE;
+	spin_unlock(&pmem->lock);
+
+	/* Percentage of free memory not usable by the largest possible allocation */
+	_info.fragmentation = free_pages == 0 ? 0 : 100 - (_info.largest_free / PAGE_SIZE * 100) / free_pages;
+
+	*info = _info;
+	return ERROR_OK;
+}
@@ -0,0 +1,425 @@
+/**
+ * @file program.c
+ * @author Joe Bayer (joexbayer)
+ * @brief Cache of program images shared between processes.
+ * @version 0.2
+ * @date 2024-02-10
+ *
+ * Programs are ELF executables (flat binaries are loaded as a single writable
+ * segment at VMEM_DATA). Opening a program only reads its headers, the pages
+ * are read from disk into frames when a process first touches them (see
+ * vmem_page_fault), so startup cost depends on the pages a program uses
+ * rather than its size. Frames are keyed by path and modification time and
+ * shared by every process running the program, writable pages are copied on the
+ * first write. Unused images stay cached until their slot is needed by another program.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <kconfig.h>
+#include <program.h>
+#include <memory.h>
+#include <serial.h>
+#include <libc.h>
+#include <assert.h>
+#include <elf.h>
+#include <fs/fs.h>
+
+#ifndef KDEBUG_PROGRAM
+#undef dbgprintf
+#define dbgprintf(...)
+#endif
+
+/* Upper bound for the program headers read from an ELF file */
+#define PROGRAM_MAX_HEADERS 32
+
+static struct program_cache {
+	struct program_image* images[PROGRAM_CACHE_SIZE];
+	/* last use of each slot, used to pick which image to evict */
+	uint32_t used[PROGRAM_CACHE_SIZE];
+	uint32_t clock;
+
+	int hits;
+	int misses;
+
+	mutex_t lock;
+} __program_cache;
+static struct program_cache* program_cache = &__program_cache;
+
+static void __program_image_free(struct program_image* image)
+{
+	for (int i = 0; i < image->pages; i++){
+		if(image->frames[i] != 0) vmem_free_frame((void*) image->frames[i]);
+	}
+	fs_close(image->fd);
+	kfree(image->frames);
+	kfree(image);
+}
+
+static int __program_read_at(int fd, int offset, void* buf, int size)
+{
+	if(fs_seek(fd, offset, FS_SEEK_START) < 0){
+		return -1;
+	}
+
+	return fs_read(fd, buf, size);
+}
+
+/**
+ * @brief Adds a loadable segment to the image after checking that it
+ * lies inside the file and inside the part of the address space reserved for programs.
+ * @return 0 on success, -ERROR_INVALID_ARGUMENTS if the segment is invalid.
+ */
+static error_t __program_add_segment(struct program_image* image, uint32_t vaddr, uint32_t memsz, uint32_t offset, uint32_t filesz, int writable)
+{
+	if(image->nsegments >= PROGRAM_MAX_SEGMENTS || filesz > memsz){
+		return -ERROR_INVALID_ARGUMENTS;
+	}
+
+	if(offset > (uint32_t) image->size || filesz > image->size - offset){
+		return -ERROR_INVALID_ARGUMENTS;
+	}
+
+	if(vaddr < VMEM_DATA || vaddr >= VMEM_DATA_LIMIT || memsz > VMEM_DATA_LIMIT - vaddr){
+		return -ERROR_INVALID_ARGUMENTS;
+	}
+
+	/* Kernel mappings are copied into every process directory */
+	for (uint32_t addr = vaddr & ~PAGE_MASK; addr < vaddr + memsz; addr += PAGE_SIZE*1024){
+		if(kernel_page_dir[DIRECTORY_INDEX(addr)] != 0) return -ERROR_INVALID_ARGUMENTS;
+	}
+
+	image->segments[image->nsegments++] = (struct program_segment) {
+		.vaddr = vaddr,
+		.memsz = memsz,
+		.offset = offset,
+		.filesz = filesz,
+		.writable = writable
+	};
+
+	return ERROR_OK;
+}
+
+/**
+ * @brief Reads the loadable segments and entry point from an ELF header.
+ * @return 0 on success, negative error code if the file is not a valid i386 executable.
+ */
+static error_t __program_parse_elf(struct program_image* image, int fd, struct elf_header* header)
+{
+	if(header->class != ELF_CLASS_32 || header->data != ELF_DATA_LSB || header->type != ELF_TYPE_EXEC || header->machine != ELF_MACHINE_386){
+		return -ERROR_INVALID_ARGUMENTS;
+	}
+
+	if(header->phentsize != sizeof(struct elf_program_header) || header->phnum > PROGRAM_MAX_HEADERS){
+		return -ERROR_INVALID_ARGUMENTS;
+	}
+
+	for (int i = 0; i < header->phnum; i++){
+		struct elf_program_header ph;
+		if(__program_read_at(fd, header->phoff + i*sizeof(ph), &ph, sizeof(ph)) != (int) sizeof(ph)){
+			return -ERROR_INVALID_ARGUMENTS;
+		}
+
+		if(ph.type != ELF_PT_LOAD || ph.memsz == 0) continue;
+
+		RETURN_ON_ERR(__program_add_segment(image, ph.vaddr, ph.memsz, ph.offset, ph.filesz, ph.flags & ELF_PF_W));
+	}
+
+	image->entry = header->entry;
+	return ERROR_OK;
+}
+
+/**
+ * @brief Reads the headers of a program and sets up an image without any resident pages.
+ * @param path Path of the program.
+ * @param stat File status from fs_stat.
+ * @return struct program_image* new image with no references, NULL on error.
+ */
+static struct program_image* __program_image_load(const char* path, struct file* stat)
+{
+	if(stat->size <= 0 || strlen(path) >= PROGRAM_PATH_LENGTH){
+		return NULL;
+	}
+
+	struct program_image* image = create(struct program_image);
+	if(image == NULL){
+		return NULL;
+	}
+	image->size = stat->size;
+	image->mtime = stat->mtime;
+	memcpy(image->path, path, strlen(path)+1);
+
+	/* Kept open for the lifetime of the image, pages are read through it on demand. */
+	int fd = fs_open(path, FS_FILE_FLAG_READ);
+	if(fd < 0){
+		kfree(image);
+		return NULL;
+	}
+	image->fd = fd;
+
+	struct elf_header header = {0};
+	int ret = __program_read_at(fd, 0, &header, sizeof(header));
+	if(ret == (int) sizeof(header) && header.magic == ELF_MAGIC){
+		ret = __program_parse_elf(image, fd, &header);
+	} else {
+		/* Flat binary, the whole file is loaded at VMEM_DATA and entered at its start. */
+		image->entry = VMEM_DATA;
+		ret = __program_add_segment(image, VMEM_DATA, image->size, 0, image->size, 1);
+	}
+
+	if(ret < 0 || image->nsegments == 0){
+		warningf("Invalid executable %s\n", path);
+		fs_close(fd);
+		kfree(image);
+		return NULL;
+	}
+
+	uint32_t start = VMEM_DATA_LIMIT, end = 0;
+	for (int i = 0; i < image->nsegments; i++){
+		struct program_segment* segment = &image->segments[i];
+		if(segment->vaddr < start) start = segment->vaddr;
+		if(segment->vaddr + segment->memsz > end) end = segment->vaddr + segment->memsz;
+	}
+	image->start = start & ~PAGE_MASK;
+	image->pages = (end - image->start + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	image->frames = kcalloc(sizeof(uint32_t)*image->pages);
+	if(image->frames == NULL){
+		fs_close(fd);
+		kfree(image);
+		return NULL;
+	}
+
+	dbgprintf("[PROGRAM] Opened %s (%d bytes, %d segments, %d pages)\n", path, image->size, image->nsegments, image->pages);
+
+	return image;
+}
+
+/**
+ * @brief Gets the flags of the program page containing vaddr.
+ * A page is writable if any segment on it is writable,
+ * pages only covering bss have no PROGRAM_PAGE_FILE flag.
+ * @return int PROGRAM_PAGE_* flags, 0 if the page is not part of the program.
+ */
+int program_image_page_flags(struct program_image* image, uint32_t vaddr)
+{
+	int flags = 0;
+	vaddr &= ~PAGE_MASK;
+
+	for (int i = 0; i < image->nsegments; i++){
+		struct program_segment* segment = &image->segments[i];
+		if(vaddr >= segment->vaddr + segment->memsz || vaddr + PAGE_SIZE <= segment->vaddr) continue;
+
+		flags |= PROGRAM_PAGE_MAPPED;
+		if(segment->writable) flags |= PROGRAM_PAGE_WRITE;
+		if(vaddr < segment->vaddr + segment->filesz) flags |= PROGRAM_PAGE_FILE;
+	}
+
+	return flags;
+}
+
+/**
+ * @brief Reads the file contents of a single page into a zeroed frame.
+ * Several segments can share a page, bss parts of the page are left zero.
+ * The page is only read if the file still is the one the image was loaded from,
+ * so a program whose binary was replaced never mixes pages of two files.
+ * @warning Cache lock must be held.
+ */
+static uint32_t* __program_image_read_page(struct program_image* image, uint32_t vaddr)
+{
+	struct file stat;
+	if(fs_stat(image->path, &stat) < 0 || stat.mtime != image->mtime || stat.size != image->size){
+		warningf("%s changed on disk while it is running\n", image->path);
+		return NULL;
+	}
+
+	uint32_t* frame = vmem_alloc_zeroed_frame();
+	if(frame == NULL){
+		return NULL;
+	}
+
+	for (int i = 0; i < image->nsegments; i++){
+		struct program_segment* segment = &image->segments[i];
+		uint32_t from = vaddr > segment->vaddr ? vaddr : segment->vaddr;
+		uint32_t to = vaddr + PAGE_SIZE < segment->vaddr + segment->filesz ? vaddr + PAGE_SIZE : segment->vaddr + segment->filesz;
+		if(from >= to) continue;
+
+		/* A short read would leave zeroed code behind. */
+		if(__program_read_at(image->fd, segment->offset + (from - segment->vaddr), (byte_t*) frame + (from - vaddr), to - from) != (int) (to - from)){
+			vmem_free_frame(frame);
+			return NULL;
+		}
+	}
+
+	return frame;
+}
+
+/**
+ * @brief Gets the shared frame of the program page containing vaddr,
+ * reading it from disk if no process has touched it yet.
+ * @param image Image of the program.
+ * @param vaddr Address inside a page with PROGRAM_PAGE_FILE set.
+ * @param loaded Set to 1 if the page had to be read from disk.
+ * @return uint32_t frame, 0 on error.
+ */
+uint32_t program_image_frame(struct program_image* image, uint32_t vaddr, int* loaded)
+{
+	int page = ((vaddr & ~PAGE_MASK) - image->start) / PAGE_SIZE;
+	if(vaddr < image->start || page >= image->pages){
+		return 0;
+	}
+
+	*loaded = 0;
+
+	uint32_t frame = 0;
+	LOCK(program_cache, {
+		if(image->frames[page] == 0){
+			uint32_t* read = __program_image_read_page(image, vaddr & ~PAGE_MASK);
+			if(read == NULL){
+				warningf("Unable to read page 0x%x of %s\n", vaddr & ~PAGE_MASK, image->path);
+				break;
+			}
+
+			image->frames[page] = (uint32_t) read;
+			image->resident++;
+			*loaded = 1;
+		}
+		frame = image->frames[page];
+	});
+
+	return frame;
+}
+
+/**
+ * @brief Finds a slot for a new image, evicting the least recently used unmapped image.
+ * @warning Cache lock must be held.
+ * @return int slot index, -1 if all images are in use.
+ */
+static int __program_cache_slot()
+{
+	int slot = -1;
+	for (int i = 0; i < PROGRAM_CACHE_SIZE; i++){
+		if(program_cache->images[i] == NULL) return i;
+		if(program_cache->images[i]->refs > 0) continue;
+
+		if(slot == -1 || program_cache->used[i] < program_cache->used[slot]){
+			slot = i;
+		}
+	}
+
+	if(slot != -1){
+		dbgprintf("[PROGRAM] Evicting %s\n", program_cache->images[slot]->path);
+		__program_image_free(program_cache->images[slot]);
+		program_cache->images[slot] = NULL;
+	}
+
+	return slot;
+}
+
+/**
+ * @brief Gets the image of a program, loading it from disk if it is not cached
+ * or the file was modified since it was cached. Takes a reference on the image.
+ * @param path Path of the program.
+ * @return struct program_image* image, NULL if the program could not be loaded.
+ */
+struct program_image* program_image_get(const char* path)
+{
+	struct file stat;
+	if(fs_stat(path, &stat) < 0){
+		return NULL;
+	}
+
+	struct program_image* image = NULL;
+	LOCK(program_cache, {
+		program_cache->clock++;
+
+		for (int i = 0; i < PROGRAM_CACHE_SIZE; i++){
+			struct program_image* cached = program_cache->images[i];
+			if(cached == NULL || strcmp(cached->path, path) != 0) continue;
+
+			if(cached->mtime == stat.mtime && cached->size == stat.size){
+				image = cached;
+				image->refs++;
+				program_cache->used[i] = program_cache->clock;
+				program_cache->hits++;
+				break;
+			}
+
+			/* Program was modified, drop the old image once it is unused. */
+			program_cache->images[i] = NULL;
+			if(cached->refs == 0){
+				__program_image_free(cached);
+			} else {
+				cached->stale = 1;
+			}
+		}
+
+		if(image == NULL){
+			program_cache->misses++;
+
+			image = __program_image_load(path, &stat);
+			if(image == NULL) break;
+			image->refs++;
+
+			int slot = __program_cache_slot();
+			if(slot < 0){
+				/* Every cached image is in use, this one is not kept around. */
+				image->stale = 1;
+				break;
+			}
+			program_cache->images[slot] = image;
+			program_cache->used[slot] = program_cache->clock;
+		}
+	});
+
+	return image;
+}
+
+/**
+ * @brief Drops a reference on an image, stale images are freed on the last reference.
+ * @param image Image to release, NULL is ignored.
+ */
+void program_image_put(struct program_image* image)
+{
+	if(image == NULL) return;
+
+	LOCK(program_cache, {
+		assert(image->refs > 0);
+		image->refs--;
+		if(image->refs == 0 && image->stale){
+			__program_image_free(image);
+		}
+	});
+}
+
+/**
+ * @brief Gets statistics of the program image cache.
+ * @param info Output statistics.
+ * @return 0 on success, error code on failure.
+ */
+error_t program_cache_get_info(struct program_cache_info* info)
+{
+	ERR_ON_NULL(info);
+
+	struct program_cache_info _info = {0};
+	LOCK(program_cache, {
+		for (int i = 0; i < PROGRAM_CACHE_SIZE; i++){
+			if(program_cache->images[i] == NULL) continue;
+
+			_info.images++;
+			_info.pages += program_cache->images[i]->pages;
+			_info.resident += program_cache->images[i]->resident;
+		}
+		_info.hits = program_cache->hits;
+		_info.misses = program_cache->misses;
+	});
+
+	*info = _info;
+	return ERROR_OK;
+}
+
+static void program_cache_init()
+{
+	mutex_init(&program_cache->lock);
+}
+EXPORT_KCTOR(program_cache_init);
@@ -48,7 +48,7 @@ struct ring_buffer* rbuffer_new(int size)
     rbuf->size = size;
     rbuf->start = 0;
     rbuf->end = 0;
-    rbuf->spinlock = 0;
+    spinlock_init(&rbuf->spinlock);
 
     return rbuf;
 }
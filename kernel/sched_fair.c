@@ -0,0 +1,193 @@
+/**
+ * @file sched_fair.c
+ * @author Joe Bayer (joexbayer)
+ * @brief Fair share run queue, see sched_fair.h.
+ * @version 0.1
+ * @date 2024-03-18
+ *
+ * Every pcb has a virtual runtime, the CPU time it received scaled by
+ * FAIR_WEIGHT_DEFAULT / weight. The pcb with the lowest virtual runtime runs next,
+ * so over time every runnable pcb gets CPU time in proportion to its weight.
+ * The weights follow the nice table of Linux at five nice levels per priority.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <sched_fair.h>
+#include <pcb.h>
+
+/* Scaled inverse weight, charging is a multiplication and a shift instead of a 64 bit division */
+#define FAIR_INVERSE(weight) ((FAIR_WEIGHT_DEFAULT << 16) / (weight))
+
+static const uint32_t fair_weights[PCB_PRIORITIES] = {
+    29154, 9548, 3121, FAIR_WEIGHT_DEFAULT, 335, 110, 36, 15
+};
+
+static const uint32_t fair_inverse[PCB_PRIORITIES] = {
+    FAIR_INVERSE(29154), FAIR_INVERSE(9548), FAIR_INVERSE(3121), FAIR_INVERSE(FAIR_WEIGHT_DEFAULT),
+    FAIR_INVERSE(335), FAIR_INVERSE(110), FAIR_INVERSE(36), FAIR_INVERSE(15)
+};
+
+static inline int __fair_level(struct pcb* pcb)
+{
+    return pcb->priority < PCB_PRIORITIES ? pcb->priority : PCB_PRIORITY_IDLE;
+}
+
+/* Virtual runtimes only grow, the signed difference keeps comparisons right if they wrap */
+static inline int __fair_before(uint64_t a, uint64_t b)
+{
+    return (int64_t)(a - b) < 0;
+}
+
+static inline void __fair_place(struct fair_runqueue* rq, int index, struct pcb* pcb)
+{
+    rq->heap[index] = pcb;
+    pcb->fair_index = index;
+}
+
+static void __fair_sift_up(struct fair_runqueue* rq, int index)
+{
+    struct pcb* pcb = rq->heap[index];
+    while(index > 0){
+        int parent = (index - 1) / 2;
+        if(!__fair_before(pcb->vruntime, rq->heap[parent]->vruntime)) break;
+        __fair_place(rq, index, rq->heap[parent]);
+        index = parent;
+    }
+    __fair_place(rq, index, pcb);
+}
+
+static void __fair_sift_down(struct fair_runqueue* rq, int index)
+{
+    struct pcb* pcb = rq->heap[index];
+    while(1){
+        int child = index * 2 + 1;
+        if(child >= rq->total) break;
+        if(child + 1 < rq->total && __fair_before(rq->heap[child + 1]->vruntime, rq->heap[child]->vruntime)){
+            child++;
+        }
+        if(!__fair_before(rq->heap[child]->vruntime, pcb->vruntime)) break;
+        __fair_place(rq, index, rq->heap[child]);
+        index = child;
+    }
+    __fair_place(rq, index, pcb);
+}
+
+/**
+ * @brief Moves min_vruntime up to the lowest virtual runtime of the queue and the running pcb.
+ * @param running pcb which is running, it is in no queue. May be NULL.
+ */
+static void __fair_update_min(struct fair_runqueue* rq, struct pcb* running)
+{
+    struct pcb* first = rq->total > 0 ? rq->heap[0] : NULL;
+    uint64_t min;
+
+    if(running != NULL && (first == NULL || __fair_before(running->vruntime, first->vruntime))){
+        min = running->vruntime;
+    } else if(first != NULL){
+        min = first->vruntime;
+    } else {
+        return;
+    }
+
+    if(__fair_before(rq->min_vruntime, min)){
+        rq->min_vruntime = min;
+    }
+}
+
+void fair_runqueue_init(struct fair_runqueue* rq)
+{
+    for (int i = 0; i < MAX_NUM_OF_PCBS; i++){
+        rq->heap[i] = NULL;
+    }
+    rq->total = 0;
+    rq->min_vruntime = 0;
+}
+
+uint32_t fair_weight(int priority)
+{
+    if(priority < 0 || priority >= PCB_PRIORITIES) return fair_weights[PCB_PRIORITY_IDLE];
+    return fair_weights[priority];
+}
+
+/**
+ * @brief Adds a runnable pcb.
+ * New pcbs start at min_vruntime, so they neither wait for nor overtake everyone else.
+ * Woken pcbs keep their virtual runtime but lag at most FAIR_WAKEUP_BONUS behind.
+ * A pcb which was preempted is queued with the virtual runtime it has.
+ * @warning The pcb must be in no run queue.
+ */
+void fair_enqueue(struct fair_runqueue* rq, struct pcb* pcb, int flags)
+{
+    if(flags & FAIR_ENQUEUE_MIGRATE){
+        pcb->vruntime += rq->min_vruntime;
+    }
+
+    if(flags & FAIR_ENQUEUE_NEW){
+        pcb->vruntime = rq->min_vruntime;
+    } else if(flags & FAIR_ENQUEUE_WAKEUP){
+        uint64_t floor = rq->min_vruntime - FAIR_WAKEUP_BONUS;
+        if(__fair_before(pcb->vruntime, floor)){
+            pcb->vruntime = floor;
+        }
+    }
+
+    pcb->fair_index = rq->total;
+    rq->heap[rq->total++] = pcb;
+    __fair_sift_up(rq, pcb->fair_index);
+}
+
+/**
+ * @brief Removes a pcb from anywhere in the queue.
+ * @param migrate the pcb moves to another run queue, its virtual runtime is made relative
+ * to this queue and fair_enqueue with FAIR_ENQUEUE_MIGRATE makes it absolute again.
+ */
+void fair_dequeue(struct fair_runqueue* rq, struct pcb* pcb, int migrate)
+{
+    int index = pcb->fair_index;
+    struct pcb* last = rq->heap[--rq->total];
+    rq->heap[rq->total] = NULL;
+
+    if(last != pcb){
+        __fair_place(rq, index, last);
+        __fair_sift_down(rq, index);
+        __fair_sift_up(rq, last->fair_index);
+    }
+
+    if(migrate){
+        pcb->vruntime -= rq->min_vruntime;
+    }
+}
+
+struct pcb* fair_peek(struct fair_runqueue* rq)
+{
+    return rq->total > 0 ? rq->heap[0] : NULL;
+}
+
+/**
+ * @brief Removes and returns the pcb with the lowest virtual runtime, it is about to run.
+ * @return struct pcb* pcb, NULL if the queue is empty.
+ */
+struct pcb* fair_pop(struct fair_runqueue* rq)
+{
+    if(rq->total == 0){
+        return NULL;
+    }
+
+    struct pcb* first = rq->heap[0];
+    fair_dequeue(rq, first, 0);
+    __fair_update_min(rq, first);
+
+    return first;
+}
+
+/**
+ * @brief Charges CPU time to a running pcb.
+ * @param pcb The pcb which ran, it is in no queue.
+ * @param ran CPU time in Kcycles.
+ */
+void fair_charge(struct fair_runqueue* rq, struct pcb* pcb, uint32_t ran)
+{
+    pcb->vruntime += ((uint64_t)ran * fair_inverse[__fair_level(pcb)]) >> 16;
+    __fair_update_min(rq, pcb);
+}
@@ -15,9 +15,12 @@
 #include <serial.h>
 #include <assert.h>
 #include <work.h>
+#include <ktimer.h>
+#include <smp.h>
 
 #include <arch/gdt.h>
 #include <arch/tss.h>
+#include <arch/fpu.h>
 
 /* exposed operator functions */
 static error_t sched_prioritize(struct scheduler* sched, struct pcb* pcb);
@@ -27,11 +30,25 @@ static error_t sched_block(struct scheduler* sched, struct pcb* pcb);
 static error_t sched_sleep(struct scheduler* sched, int time);
 static struct pcb* sched_consume(struct scheduler* sched);
 static error_t sched_exit(struct scheduler* sched);
+static error_t sched_wake(struct scheduler* sched, struct pcb* pcb);
 
 static error_t sched_round_robin(struct scheduler* sched);
 
-/* Default scheduler operations */
+/* run queue policies */
+static void rr_enqueue(struct scheduler* sched, struct pcb* pcb, int flags);
+static void rr_dequeue(struct scheduler* sched, struct pcb* pcb, int migrate);
+static struct pcb* rr_pick(struct scheduler* sched);
+static struct pcb* rr_steal(struct scheduler* sched);
+
+static void fair_sched_enqueue(struct scheduler* sched, struct pcb* pcb, int flags);
+static void fair_sched_dequeue(struct scheduler* sched, struct pcb* pcb, int migrate);
+static struct pcb* fair_sched_pick(struct scheduler* sched);
+static struct pcb* fair_sched_steal(struct scheduler* sched);
+static void fair_sched_charge(struct scheduler* sched, struct pcb* pcb, uint64_t ran);
+
+/* Default scheduler operations, round robin over the priority levels */
 static struct scheduler_ops sched_default_ops = {
+    .name = "roundrobin",
     .prioritize = &sched_prioritize,
     .add = &sched_add,
     .schedule = &sched_default,
@@ -39,20 +56,58 @@ static struct scheduler_ops sched_default_ops = {
     .exit = &sched_exit,
     .yield = &sched_default,
     .consume = &sched_consume,
-    .block = &sched_block
+    .block = &sched_block,
+    .wake = &sched_wake,
+    .enqueue = &rr_enqueue,
+    .dequeue = &rr_dequeue,
+    .pick = &rr_pick,
+    .steal = &rr_steal,
+    .charge = NULL
 };
 
-/* Default scheduler instance */
-static struct scheduler sched_default_instance = {
-    .ops = &sched_default_ops,
-    .queue = NULL,
-    .priority = NULL,
-    .ctx.running = NULL,
-    .yields = 0,
-    .exits = 0,
-    .flags = SCHED_UNUSED
+/* Fair share scheduler operations, see sched_fair.h */
+static struct scheduler_ops sched_fair_ops = {
+    .name = "fair",
+    .prioritize = &sched_prioritize,
+    .add = &sched_add,
+    .schedule = &sched_default,
+    .sleep = &sched_sleep,
+    .exit = &sched_exit,
+    .yield = &sched_default,
+    .consume = &sched_consume,
+    .block = &sched_block,
+    .wake = &sched_wake,
+    .enqueue = &fair_sched_enqueue,
+    .dequeue = &fair_sched_dequeue,
+    .pick = &fair_sched_pick,
+    .steal = &fair_sched_steal,
+    .charge = &fair_sched_charge
 };
 
+static struct scheduler_ops* sched_policies[] = {
+    &sched_default_ops,
+    &sched_fair_ops
+};
+
+/* Operations new schedulers start with, see sched_set_policy */
+static struct scheduler_ops* sched_policy = &sched_default_ops;
+
+/**
+ * @brief Wake up timers of sleeping pcbs and blocking waits with a timeout, by pid.
+ * Kept outside of the packed pcb so the timers stay aligned.
+ */
+static struct ktimer sched_timers[MAX_NUM_OF_PCBS];
+#define SCHED_TIMER(pcb) (&sched_timers[(pcb)->pid])
+
+/**
+ * @brief Scheduler instances, one per processor.
+ * Each processor only picks pcbs from its own run queue, pcbs stay on the processor they
+ * were added or woken on. A processor with nothing to run pulls work from the busiest one.
+ * All run queues are protected by the kernel lock.
+ */
+static struct scheduler sched_instances[SMP_MAX_CPUS];
+#define SCHED_OF(pcb) (&sched_instances[(pcb)->cpu])
+
 /**
  * @brief Initializes the default scheduler
  * Sets up the default scheduler with the given flags.
@@ -68,28 +123,339 @@ error_t sched_init_default(struct scheduler* sched, sched_flag_t flags)
         return -ERROR_SCHED_EXISTS;
     }
     
-    sched->ops = &sched_default_ops;
+    sched->ops = sched_policy;
+    sched->cpu = smp_cpu()->id;
+    sched->ctx.running = NULL;
+    sched->zombies = NULL;
+    smp_cpu()->sched = sched;
+
+    pcb_runqueue_init(&sched->runqueue);
+    fair_runqueue_init(&sched->fair);
+    pcb_runqueue_init(&sched->latency.queue);
+
+    sched->flags = flags | SCHED_INITIATED;
 
-    sched->priority = pcb_new_queue();
-    if(sched->priority == NULL){
-        return -ERROR_PCB_QUEUE_CREATE;
+    return ERROR_OK;
+}
+
+/**
+ * @brief Loads the page directory of the next pcb.
+ * Kernel threads share the kernel directory, switching between them keeps CR3 and the TLB.
+ * The TLB of a directory which stays loaded is kept current by invlpg and shootdowns anyway.
+ */
+static inline void __sched_load_directory(struct cpu* cpu, struct pcb* next)
+{
+    if(rcr3() == (uint32_t)next->page_dir){
+        cpu->cr3_skips++;
+        return;
     }
+    load_page_directory(next->page_dir);
+}
+
+/* Context switch cost, from saving the previous context until the next one is restored */
+static inline void __sched_switch_begin()
+{
+    smp_cpu()->switch_start = rdtsc();
+}
 
-    sched->queue = pcb_new_queue();
-    if(sched->queue == NULL){
-        return -ERROR_PCB_QUEUE_CREATE;
+static inline void __sched_switch_end()
+{
+    struct cpu* cpu = smp_cpu();
+    if(cpu->switch_start == 0) return;
+
+    cpu->switch_sum += (uint32_t)(rdtsc() - cpu->switch_start);
+    cpu->switch_start = 0;
+    if(++cpu->switch_samples == SMP_SWITCH_SAMPLES){
+        cpu->switch_cycles = cpu->switch_sum / SMP_SWITCH_SAMPLES;
+        cpu->switch_sum = 0;
+        cpu->switch_samples = 0;
     }
+}
 
-    sched->flags = flags | SCHED_INITIATED;
+static void __sched_enqueue(struct scheduler* sched, struct pcb* pcb, int flags)
+{
+    pcb->runnable_since = rdtsc();
+    if(pcb->sched_class == PCB_CLASS_LATENCY){
+        pcb_runqueue_push(&sched->latency.queue, pcb);
+    } else {
+        sched->ops->enqueue(sched, pcb, flags);
+    }
+    pcb->queued = PCB_QUEUED_RUN;
+    pcb->cpu = sched->cpu;
+}
 
-    return ERROR_OK;
+static void __sched_dequeue(struct scheduler* sched, struct pcb* pcb, int migrate)
+{
+    if(pcb->sched_class == PCB_CLASS_LATENCY){
+        pcb_runqueue_remove(&sched->latency.queue, pcb);
+    } else {
+        sched->ops->dequeue(sched, pcb, migrate);
+    }
+    pcb->queued = PCB_UNQUEUED;
+}
+
+/* Any pcb of the policy other than the idle task is waiting to run */
+static inline int __sched_has_normal(struct scheduler* sched)
+{
+    return sched->fair.total > 0 || (sched->runqueue.bitmap & ~(1 << PCB_PRIORITY_IDLE)) != 0;
+}
+
+/**
+ * @brief Starts a new latency period once SCHED_LATENCY_PERIOD ticks have passed.
+ * The length of a tick in cycles is taken from the period that ended,
+ * unless the tick was stopped for longer than a period.
+ */
+static void __sched_latency_period(struct scheduler* sched)
+{
+    int now = timer_get_tick();
+    int ticks = now - sched->latency.period_start;
+    if(ticks < SCHED_LATENCY_PERIOD) return;
+
+    uint64_t stamp = rdtsc();
+    uint64_t cycles = stamp - sched->latency.period_stamp;
+    if(sched->latency.period_stamp != 0 && ticks < 2*SCHED_LATENCY_PERIOD && cycles < 0xFFFFFFFF){
+        sched->latency.cycles_per_tick = (uint32_t)cycles / ticks;
+    }
+
+    sched->latency.period_start = now;
+    sched->latency.period_stamp = stamp;
+    sched->latency.used = 0;
+    sched->latency.throttled = 0;
+}
+
+/* Charges CPU time of a latency class pcb to the budget of the period */
+static void __sched_latency_charge(struct scheduler* sched, uint64_t ran)
+{
+    sched->latency.used += ran;
+
+    uint64_t budget = (uint64_t)sched->latency.cycles_per_tick * SCHED_LATENCY_BUDGET;
+    if(!sched->latency.throttled && budget != 0 && sched->latency.used >= budget){
+        sched->latency.throttled = 1;
+        sched->latency.throttles++;
+        dbgprintf("[SCHED] Latency class throttled on CPU %d\n", sched->cpu);
+    }
+}
+
+/**
+ * @brief Picks the next pcb to run, the latency class before the policy.
+ * A throttled latency class only runs if the policy has nothing but the idle task.
+ * @param yielded a latency class pcb yielded, the policy goes first so polling loops cannot take over the processor.
+ */
+static struct pcb* __sched_pick(struct scheduler* sched, int yielded)
+{
+    __sched_latency_period(sched);
+
+    if(sched->latency.queue.total > 0 && (!(sched->latency.throttled || yielded) || !__sched_has_normal(sched))){
+        return pcb_runqueue_pop(&sched->latency.queue);
+    }
+    return sched->ops->pick(sched);
+}
+
+/* A woken pcb should take over from the running one right away */
+static inline int __sched_latency_preempts(struct scheduler* sched, struct pcb* pcb)
+{
+    struct pcb* running = sched->ctx.running;
+    return pcb->sched_class == PCB_CLASS_LATENCY && !sched->latency.throttled
+        && (running == NULL || running->sched_class != PCB_CLASS_LATENCY);
+}
+
+/**
+ * @brief Checks if a queued pcb may move to another processor.
+ * PCBs interrupted in kernel mode are left alone, they may still use state of their processor.
+ * So are pcbs whose FPU state is only in the registers of their processor, see fpu.c.
+ * So are new pcbs, which are started soon anyway, idle tasks among them.
+ */
+static inline int __sched_can_migrate(struct pcb* pcb)
+{
+    return pcb->state == RUNNING && !pcb->preempted && !fpu_is_loaded(pcb) && pcb->priority != PCB_PRIORITY_IDLE;
+}
+
+/**
+ * @brief Moves a runnable pcb from the busiest other processor to the given scheduler.
+ * @warning Must be called in a critical section.
+ * @return int 1 if a pcb was pulled, 0 otherwise.
+ */
+static int __sched_pull(struct scheduler* sched)
+{
+    struct scheduler* busiest = NULL;
+
+    for (int i = 0; i < smp_cpu_count(); i++){
+        struct scheduler* other = &sched_instances[i];
+        if(other == sched || !(other->flags & SCHED_INITIATED) || !sched_has_runnable(other)) continue;
+
+        if(busiest == NULL || sched_queued(other) > sched_queued(busiest)){
+            busiest = other;
+        }
+    }
+    if(busiest == NULL) return 0;
+
+    struct pcb* pcb = busiest->ops->steal(busiest);
+    if(pcb == NULL) return 0;
+
+    /* Still waiting to run, its latency keeps counting */
+    uint64_t runnable_since = pcb->runnable_since;
+    __sched_dequeue(busiest, pcb, 1);
+    __sched_enqueue(sched, pcb, SCHED_ENQUEUE_MIGRATE);
+    pcb->runnable_since = runnable_since;
+    sched->pulled++;
+
+    return 1;
+}
+
+/* Round robin, a FIFO per priority level */
+static void rr_enqueue(struct scheduler* sched, struct pcb* pcb, int flags)
+{
+    pcb_runqueue_push(&sched->runqueue, pcb);
+}
+
+static void rr_dequeue(struct scheduler* sched, struct pcb* pcb, int migrate)
+{
+    pcb_runqueue_remove(&sched->runqueue, pcb);
+}
+
+static struct pcb* rr_pick(struct scheduler* sched)
+{
+    return pcb_runqueue_pop(&sched->runqueue);
+}
+
+/* Most important level first */
+static struct pcb* rr_steal(struct scheduler* sched)
+{
+    for (int level = 0; level < PCB_PRIORITY_IDLE; level++){
+        for (struct pcb* pcb = sched->runqueue.head[level]; pcb != NULL; pcb = pcb->next){
+            if(__sched_can_migrate(pcb)) return pcb;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Fair share, pcbs ordered by virtual runtime.
+ * Idle priority pcbs are kept in the round robin queue and only run when no other pcb can,
+ * a share of CPU time for an idle task would halt the processor while others wait.
+ */
+static void fair_sched_enqueue(struct scheduler* sched, struct pcb* pcb, int flags)
+{
+    if(pcb->priority >= PCB_PRIORITY_IDLE){
+        pcb_runqueue_push(&sched->runqueue, pcb);
+        return;
+    }
+
+    int fair_flags = 0;
+    if(flags & SCHED_ENQUEUE_NEW) fair_flags |= FAIR_ENQUEUE_NEW;
+    if(flags & SCHED_ENQUEUE_WAKEUP) fair_flags |= FAIR_ENQUEUE_WAKEUP;
+    if(flags & SCHED_ENQUEUE_MIGRATE) fair_flags |= FAIR_ENQUEUE_MIGRATE;
+    fair_enqueue(&sched->fair, pcb, fair_flags);
+}
+
+static void fair_sched_dequeue(struct scheduler* sched, struct pcb* pcb, int migrate)
+{
+    if(pcb->priority >= PCB_PRIORITY_IDLE){
+        pcb_runqueue_remove(&sched->runqueue, pcb);
+        return;
+    }
+    fair_dequeue(&sched->fair, pcb, migrate);
+}
+
+static struct pcb* fair_sched_pick(struct scheduler* sched)
+{
+    struct pcb* next = fair_pop(&sched->fair);
+    return next != NULL ? next : pcb_runqueue_pop(&sched->runqueue);
+}
+
+static struct pcb* fair_sched_steal(struct scheduler* sched)
+{
+    for (int i = 0; i < sched->fair.total; i++){
+        if(__sched_can_migrate(sched->fair.heap[i])) return sched->fair.heap[i];
+    }
+    return NULL;
+}
+
+static void fair_sched_charge(struct scheduler* sched, struct pcb* pcb, uint64_t ran)
+{
+    if(pcb->priority >= PCB_PRIORITY_IDLE) return;
+
+    ran >>= 10;
+    fair_charge(&sched->fair, pcb, ran > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)ran);
+}
+
+/**
+ * @brief Timer callback of a sleeping or blocked pcb whose time ran out.
+ * Runs in interrupt context.
+ */
+static void __sched_timeout(void* arg)
+{
+    struct scheduler* sched = get_scheduler();
+    sched->ops->wake(sched, (struct pcb*) arg);
+}
+
+/**
+ * @brief Arms the wake up timer of a pcb.
+ * @warning Must be called in a critical section.
+ */
+static void __sched_arm_timeout(struct pcb* pcb, int ticks)
+{
+    ktimer_cancel(SCHED_TIMER(pcb));
+    ktimer_init(SCHED_TIMER(pcb), &__sched_timeout, pcb);
+    ktimer_add(SCHED_TIMER(pcb), ticks);
+}
+
+/**
+ * @brief Hands the cleanup of zombies to the work queue.
+ * Zombies stay on the list while the work queue is full and are retried on the next schedule,
+ * so a full queue never leaks a pcb, its stack or its address space.
+ * @warning Must be called in a critical section.
+ */
+static void __sched_reap(struct scheduler* sched)
+{
+    while(sched->zombies != NULL){
+        struct pcb* pcb = sched->zombies;
+        if(work_queue_add(&pcb_cleanup_routine, (void*)((int)pcb->pid), NULL) < 0){
+            return;
+        }
+
+        sched->zombies = pcb->next;
+        pcb->next = NULL;
+    }
+}
+
+/**
+ * @brief Puts a pcb which is not running anymore where its state says it belongs.
+ * Runnable pcbs go to the back of their run queue level, sleeping and blocked pcbs are kept
+ * in no queue until they are woken and zombies are handed to the cleanup work.
+ * @warning Must be called in a critical section.
+ */
+static void __sched_put(struct scheduler* sched, struct pcb* pcb)
+{
+    pcb->queued = PCB_UNQUEUED;
+
+    switch (pcb->state){
+    case RUNNING:
+        __sched_enqueue(sched, pcb, SCHED_ENQUEUE_REQUEUE);
+        break;
+    case PCB_NEW:
+        __sched_enqueue(sched, pcb, SCHED_ENQUEUE_NEW);
+        break;
+    case ZOMBIE:
+        /**
+         * @brief A PCB is in the ZOMBIE state if it has been killed by another process
+         * or has exited. The ZOMBIE pcb will not be scheduled again and a work thread will
+         * deal with cleaning up the pcb, as we want to spend as little time as possible in the scheduler.
+         */
+        pcb->next = sched->zombies;
+        sched->zombies = pcb;
+        break;
+    default:
+        /* Blocked or sleeping, sched_wake puts it back in the run queue */
+        break;
+    }
 }
 
 /**
  * @brief Puts the current running process to sleep for the given time
- * 
+ * The pcb timer wakes it once the time has passed.
  * @param sched  The scheduler to sleep on
- * @param time  The time to sleep for
+ * @param time  The time to sleep for in ticks
  * @return int  0 on success, error code on failure
  */
 static error_t sched_sleep(struct scheduler* sched, int time)
@@ -99,8 +465,10 @@ static error_t sched_sleep(struct scheduler* sched, int time)
 
     assert(sched->ctx.running != NULL);
 
-    sched->ctx.running->sleep = timer_get_tick() + time;
-    sched->ctx.running->state = SLEEPING;
+    CRITICAL_SECTION({
+        __sched_arm_timeout(sched->ctx.running, time);
+        sched->ctx.running->state = SLEEPING;
+    });
 
     (void)sched->ops->schedule(sched);
 
@@ -109,7 +477,7 @@ static error_t sched_sleep(struct scheduler* sched, int time)
 
 /**
  * @brief Prioritizes the given pcb in the scheduler
- * 
+ * The pcb is moved to the highest priority level of the run queue.
  * @param sched  The scheduler to prioritize on
  * @param pcb  The pcb to prioritize
  * @return int  0 on success, error code on failure
@@ -120,8 +488,17 @@ static error_t sched_prioritize(struct scheduler* sched, struct pcb* pcb)
     ERR_ON_NULL(pcb);
     SCHED_VALIDATE(sched);
 
-    /* Add pcb to priority queue */
-    RETURN_ON_ERR(sched->priority->ops->push(sched->priority, pcb));
+    /* Move pcb to the highest level, relinking it if it is waiting to run */
+    CRITICAL_SECTION({
+        if(pcb->queued == PCB_QUEUED_RUN){
+            __sched_dequeue(SCHED_OF(pcb), pcb, 0);
+            pcb->priority = PCB_PRIORITY_HIGH;
+            /* Placed like a woken pcb, it may come from the idle level without a virtual runtime */
+            __sched_enqueue(SCHED_OF(pcb), pcb, SCHED_ENQUEUE_WAKEUP);
+        } else {
+            pcb->priority = PCB_PRIORITY_HIGH;
+        }
+    });
 
     return ERROR_OK;
 }
@@ -160,19 +537,58 @@ static error_t sched_block(struct scheduler* sched, struct pcb* pcb)
     assert(sched->ctx.running == NULL);
 
     pcb->state = BLOCKED;
+    pcb->queued = PCB_QUEUED_WAIT;
 
     CRITICAL_SECTION({
+        __sched_switch_begin();
         pcb_save_context(pcb);
 
         /* Switch to next PCB, should be chosen by flag? */
         assert(sched_round_robin(sched) == ERROR_OK);
 
         pcb_restore_context(sched->ctx.running);
+        __sched_switch_end();
     });
 
     return ERROR_OK;
 }
 
+/**
+ * @brief Accounts a switch from prev to next.
+ * The cycles prev ran are charged to it, a switch counts as involuntary if prev was still
+ * runnable and switched out by kernel_preempt. The time next waited in the run queue is
+ * added to its latency histogram.
+ * @param user next continues in user mode, only new pcbs start there.
+ */
+static void __sched_account(struct cpu* cpu, struct pcb* prev, struct pcb* next, int user)
+{
+    if(prev != NULL && prev != next){
+        pcb_account(prev, 0);
+        if(prev->state == RUNNING && cpu->preempting){
+            prev->switches_involuntary++;
+        } else {
+            prev->switches_voluntary++;
+        }
+    }
+    cpu->preempting = 0;
+
+    if(next->runnable_since != 0){
+        uint64_t now = rdtsc();
+        uint64_t waited = now > next->runnable_since ? (now - next->runnable_since) >> 11 : 0;
+        int bucket = 0;
+        while(waited != 0 && bucket < PCB_LATENCY_BUCKETS-1){
+            waited >>= 1;
+            bucket++;
+        }
+        next->latency[bucket]++;
+        next->runnable_since = 0;
+    }
+
+    if(prev != next){
+        pcb_account(next, user);
+    }
+}
+
 /**
  * @brief round robin scheduler
  * 
@@ -183,95 +599,103 @@ static error_t sched_round_robin(struct scheduler* sched)
 {
     struct pcb* next;
     
+    struct cpu* cpu = smp_cpu();
+
     ERR_ON_NULL(sched);
     SCHED_VALIDATE(sched);
     ASSERT_CRITICAL();
 
-    /* If queue is empty, return error */
-    next = sched->queue->ops->peek(sched->queue); 
-    if(next == NULL){
-        warningf("Queue is empty");
-        return -ERROR_PCB_QUEUE_EMPTY;
-    }
+    struct pcb* prev = sched->ctx.running;
+    int yielded = prev != NULL && prev->sched_class == PCB_CLASS_LATENCY && prev->state == RUNNING && !cpu->preempting;
+    cpu->need_resched = 0;
 
-    /* Add current running context to queue */
+    /* Put the previous running context back into the queues, with the lock state it switched out with */
     if(sched->ctx.running != NULL){
-        sched->queue->ops->push(sched->queue, sched->ctx.running);
+        uint64_t ran = rdtsc() - sched->slice_start;
+        if(sched->ctx.running->sched_class == PCB_CLASS_LATENCY){
+            __sched_latency_charge(sched, ran);
+        } else if(sched->ops->charge != NULL){
+            sched->ops->charge(sched, sched->ctx.running, ran);
+        }
+        sched->ctx.running->critical = cpu->critical;
+        sched->ctx.running->spinlocks = cpu->spinlocks;
+        __sched_put(sched, sched->ctx.running);
         sched->ctx.running = NULL;
     }
 
-    /**
-     * @brief Loops through the queue until it finds a pcb that is ready to run.
-     * Multiple iterations should be rare, athe first pcb will most likely be ready to run.
-     * Uses a switch case for all relevant states.
-     */
-    do {
-        next = sched->queue->ops->pop(sched->queue);
+    __sched_reap(sched);
 
-        switch (next->state){
-        case RUNNING:
-            break;
-        case PCB_NEW:{
-                /**
-                 * @brief This is where the new process is started
-                 * This calls the start_pcb function and sets up the page directory.
-                 * Should only be called once for each pcb.
-                 */
-
-                if(next->is_process){
-                    tss.esp_0 = (uint32_t)next->kebp;
-                    tss.ss_0 = GDT_KERNEL_DS;
-                }
+    if(!sched_has_runnable(sched)){
+        __sched_pull(sched);
+    }
 
-                sched->ctx.running = next;
-                $process->current = next;
-                load_page_directory(next->page_dir);
-                //load_data_segments(GDT_KERNEL_DS);
-                start_pcb(next);
-                kernel_panic("Illegal return of 'start_pcb'");/* not sure if it should return or break */
-            }
-            break; /* Never reached. */
-        case ZOMBIE:{
-                /**
-                 * @brief A PCB is in the ZOMBIE state if it has been killed by another process
-                 * or has exited. This is where the PCB is cleaned up.
-                 * The ZOMBIE pcb will not be scheduled again and a work thread will deal with cleaning up the pcb.
-                 * This is because we want to spend as little time as possible in the scheduler.
-                 */
-                work_queue_add(&pcb_cleanup_routine, (void*)((int)next->pid), NULL);
-            }
-            break;
-        /* If next is sleeping, check if it should be woken up */
-        case SLEEPING:{
-                /**
-                 * @brief When a pcb is sleeping, we need to know if we should wake it up.
-                 * If the pcb's sleep time is less than the current tick we can wake it up
-                 * and schedule it as running, else it will be put at the end of the queue.
-                 */
-                if(next->sleep < timer_get_tick()){
-                    next->state = RUNNING;
-                    break;
-                }
+    /**
+     * @brief Pops the most important pcb until one is ready to run.
+     * Only runnable pcbs are kept in the run queue, so multiple iterations should be rare,
+     * they only happen when a queued pcb was killed or changed state from the outside.
+     */
+    while(1){
+        next = __sched_pick(sched, yielded);
+        if(next == NULL){
+            warningf("Queue is empty");
+            return -ERROR_PCB_QUEUE_EMPTY;
+        }
+        next->queued = PCB_UNQUEUED;
+        next->preempted = 0;
+
+        if(next->state == RUNNING) break;
+
+        if(next->state == PCB_NEW){
+            /**
+             * @brief This is where the new process is started
+             * This calls the start_pcb function and sets up the page directory.
+             * Should only be called once for each pcb.
+             * _start_pcb leaves the critical section of the scheduler.
+             */
+
+            if(next->is_process){
+                cpu->tss.esp_0 = (uint32_t)next->kebp;
+                cpu->tss.ss_0 = GDT_KERNEL_DS;
             }
-        /* fall through */
-        case BLOCKED:
-            /* Blocked just means we want to add it back to the queue */
-        default:
-            /* push next back into queue, should be very rare. */
-            sched->queue->ops->push(sched->queue, next);
-            break;
+
+            cpu->critical = 1;
+            cpu->spinlocks = 0;
+
+            /* _start_pcb returns to user mode if the pcb has user segments */
+            __sched_account(cpu, prev, next, (next->cs & 3) == 3);
+
+            sched->ctx.running = next;
+            sched->slice_start = rdtsc();
+            $process->current = next;
+            fpu_switch(cpu, next);
+            cpu->switch_start = 0;
+            __sched_load_directory(cpu, next);
+            //load_data_segments(GDT_KERNEL_DS);
+            start_pcb(next);
+            kernel_panic("Illegal return of 'start_pcb'");/* not sure if it should return or break */
         }
-    } while(next->state != RUNNING);
+
+        __sched_put(sched, next);
+    }
+
+    /* Killed pcbs found in the run queue */
+    __sched_reap(sched);
+
+    __sched_account(cpu, prev, next, 0);
     
     sched->ctx.running = next;
+    sched->slice_start = rdtsc();
     $process->current = next;
+    cpu->critical = next->critical;
+    cpu->spinlocks = next->spinlocks;
 
     if(next->is_process){
-        tss.esp_0 = (uint32_t)next->kebp;
-        tss.ss_0 = GDT_KERNEL_DS;
+        cpu->tss.esp_0 = (uint32_t)next->kebp;
+        cpu->tss.ss_0 = GDT_KERNEL_DS;
     }
 
-    load_page_directory(sched->ctx.running->page_dir);
+    fpu_switch(cpu, next);
+    __sched_load_directory(cpu, next);
     return ERROR_OK;
 }
 
@@ -283,7 +707,9 @@ static error_t sched_default(struct scheduler* sched)
 
     /* If no running process, get one from queue */
     if (sched->ctx.running == NULL){
-        sched->ctx.running = sched->queue->ops->pop(sched->queue);
+        sched->ctx.running = __sched_pick(sched, 0);
+        sched->slice_start = rdtsc();
+        sched->ctx.running->queued = PCB_UNQUEUED;
         /* Temporary fix */
         $process->current = sched->ctx.running;
     }
@@ -292,12 +718,14 @@ static error_t sched_default(struct scheduler* sched)
 
     CRITICAL_SECTION({
 
+        __sched_switch_begin();
         pcb_save_context(sched->ctx.running);
 
         /* Switch to next PCB, should be chosen by flag? */
         PANIC_ON_ERR(sched_round_robin(sched));
 
         pcb_restore_context(sched->ctx.running);
+        __sched_switch_end();
         
         //dbgprintf("Switching too PCB %s with page dir: %x, stack: %x, kstack: %x\n", sched->ctx.running->name, sched->ctx.running->page_dir, sched->ctx.running->ctx.esp, sched->ctx.running->kesp);
     });
@@ -325,12 +753,14 @@ static error_t sched_exit(struct scheduler* sched)
     
     CRITICAL_SECTION({
 
+        __sched_switch_begin();
         pcb_save_context(sched->ctx.running);
 
         /* Switch to next PCB, dont need to store context */
         PANIC_ON_ERR(sched_round_robin(sched));
 
         pcb_restore_context(sched->ctx.running);
+        __sched_switch_end();
     });
 
 
@@ -348,14 +778,177 @@ static error_t sched_add(struct scheduler* sched, struct pcb* pcb)
 {
     SCHED_VALIDATE(sched);
 
-    RETURN_ON_ERR(sched->queue->ops->push(sched->queue, pcb));
+    /* Only new pcbs start at the fair share minimum, others keep their vruntime as a wake would */
+    CRITICAL_SECTION({
+        __sched_enqueue(sched, pcb, pcb->state == PCB_NEW ? SCHED_ENQUEUE_NEW : SCHED_ENQUEUE_WAKEUP);
+    });
+
+    /* The tick might be stopped, the new pcb has to be able to preempt the running one */
+    timer_tick_restart();
     
     return ERROR_OK;
 }
 
+/**
+ * @brief Wakes a blocked or sleeping pcb, putting it back in the run queue.
+ * A pcb woken before it switched out is still running and is only marked runnable.
+ * PCBs in a wait queue are removed from it, so timeouts and kills wake them as well.
+ * PCBs waiting in a queue owned by someone else (mutexes) are left alone.
+ * @param sched  The scheduler to wake on
+ * @param pcb  The pcb to wake
+ * @return int 0 on success, error code on failure
+ */
+static error_t sched_wake(struct scheduler* sched, struct pcb* pcb)
+{
+    ERR_ON_NULL(sched);
+    ERR_ON_NULL(pcb);
+    SCHED_VALIDATE(sched);
+
+    CRITICAL_SECTION({
+        if((pcb->state == BLOCKED || pcb->state == SLEEPING) && pcb->queued != PCB_QUEUED_WAIT){
+            ktimer_cancel(SCHED_TIMER(pcb));
+            if(pcb->waitqueue != NULL){
+                waitqueue_remove(pcb);
+            }
+
+            /* Woken on the processor it last ran on, which may be another one */
+            struct scheduler* target = SCHED_OF(pcb);
+
+            pcb->state = RUNNING;
+            if(pcb != target->ctx.running && pcb->queued == PCB_UNQUEUED){
+                __sched_enqueue(target, pcb, SCHED_ENQUEUE_WAKEUP);
+                if(target->cpu == SMP_BSP){
+                    timer_tick_restart();
+                }
+
+                /* An idle processor only notices on its next tick, kick it. So would a latency class pcb. */
+                int preempts = __sched_latency_preempts(target, pcb);
+                if(preempts){
+                    target->latency.preempts++;
+                }
+                if(target->cpu != smp_cpu()->id){
+                    if(preempts || target->ctx.running == NULL || target->ctx.running->priority == PCB_PRIORITY_IDLE){
+                        smp_send_reschedule(target->cpu);
+                    }
+                } else if(preempts){
+                    smp_cpu()->need_resched = 1;
+                }
+            }
+        }
+    });
+
+    /* Woken outside of an interrupt and critical section, switch now. Interrupts switch on their way out, see isr_handler. */
+    if(smp_cpu()->need_resched && critical_depth() == 0 && $process->current != NULL){
+        smp_cpu()->preempting = 1;
+        kernel_yield();
+    }
+
+    return ERROR_OK;
+}
+
+/**
+ * @brief Checks if any pcb other than the idle task is waiting to run.
+ * If not, the running pcb cannot be preempted and the tick can be stopped.
+ * @param sched  The scheduler to check
+ * @return int 1 if a pcb is waiting to run, 0 otherwise
+ */
+int sched_has_runnable(struct scheduler* sched)
+{
+    return sched->latency.queue.total > 0 || __sched_has_normal(sched);
+}
+
+/* Number of pcbs waiting to run, idle tasks included */
+int sched_queued(struct scheduler* sched)
+{
+    return sched->runqueue.total + sched->fair.total + sched->latency.queue.total;
+}
+
+/**
+ * @brief Moves a pcb to the given scheduling class, see pcb_class_t.
+ * Kernel threads opt in to the latency class with start_class.
+ * @param pcb The pcb to move.
+ * @param class PCB_CLASS_NORMAL or PCB_CLASS_LATENCY.
+ * @return error_t 0 on success, -ERROR_INVALID_ARGUMENTS for an unknown class.
+ */
+error_t sched_set_class(struct pcb* pcb, pcb_class_t class)
+{
+    ERR_ON_NULL(pcb);
+    if(class != PCB_CLASS_NORMAL && class != PCB_CLASS_LATENCY){
+        return -ERROR_INVALID_ARGUMENTS;
+    }
+
+    CRITICAL_SECTION({
+        if(pcb->queued == PCB_QUEUED_RUN && pcb->sched_class != class){
+            __sched_dequeue(SCHED_OF(pcb), pcb, 0);
+            pcb->sched_class = class;
+            __sched_enqueue(SCHED_OF(pcb), pcb, pcb->state == PCB_NEW ? SCHED_ENQUEUE_NEW : SCHED_ENQUEUE_WAKEUP);
+        } else {
+            pcb->sched_class = class;
+        }
+    });
+
+    return ERROR_OK;
+}
+
+/**
+ * @brief Switches all schedulers to the named policy, "roundrobin" or "fair".
+ * Queued pcbs are moved over as new pcbs, so none starts far ahead or behind.
+ * Called at boot from the [kernel] scheduler option of the kernel config.
+ * @param name Name of the policy.
+ * @return error_t 0 on success, -ERROR_INVALID_ARGUMENTS if there is no such policy.
+ */
+error_t sched_set_policy(const char* name)
+{
+    ERR_ON_NULL(name);
+
+    struct scheduler_ops* policy = NULL;
+    for (int i = 0; i < (int)(sizeof(sched_policies) / sizeof(sched_policies[0])); i++){
+        if(strcmp(sched_policies[i]->name, name) == 0){
+            policy = sched_policies[i];
+            break;
+        }
+    }
+    if(policy == NULL){
+        return -ERROR_INVALID_ARGUMENTS;
+    }
+
+    ENTER_CRITICAL();
+    sched_policy = policy;
+    for (int i = 0; i < SMP_MAX_CPUS; i++){
+        struct scheduler* sched = &sched_instances[i];
+        if(!(sched->flags & SCHED_INITIATED) || sched->ops == policy) continue;
+
+        /* Popped pcbs are in no queue, their links keep them in order meanwhile */
+        struct pcb* head = NULL;
+        struct pcb* tail = NULL;
+        struct pcb* pcb;
+        while((pcb = sched->ops->pick(sched)) != NULL){
+            pcb->next = NULL;
+            if(tail != NULL) tail->next = pcb; else head = pcb;
+            tail = pcb;
+        }
+
+        sched->ops = policy;
+        while(head != NULL){
+            pcb = head;
+            head = head->next;
+            uint64_t runnable_since = pcb->runnable_since;
+            policy->enqueue(sched, pcb, SCHED_ENQUEUE_NEW);
+            pcb->runnable_since = runnable_since;
+        }
+        sched->slice_start = rdtsc();
+    }
+    LEAVE_CRITICAL();
+
+    dbgprintf("[SCHED] Using %s scheduler\n", policy->name);
+
+    return ERROR_OK;
+}
+
+/* Scheduler of the current processor */
 struct scheduler* get_scheduler()
 {
-    return &sched_default_instance;
+    return &sched_instances[smp_cpu()->id];
 }
 
 /* Kernel scheduling API */
@@ -370,6 +963,18 @@ void kernel_yield()
     assert(get_scheduler()->ops->schedule(get_scheduler()) == 0);
 }
 
+/**
+ * @brief Switches away from the running pcb, called by timer and reschedule interrupts.
+ * A pcb interrupted in kernel mode may hold on to state of this processor,
+ * so it is kept on this processor until it switches away by itself.
+ */
+void kernel_preempt()
+{
+    $process->current->preempted = !smp_cpu()->irq_user;
+    smp_cpu()->preempting = 1;
+    kernel_yield();
+}
+
 void kernel_exit()
 {
     get_scheduler()->ops->exit(get_scheduler());
@@ -377,6 +982,23 @@ void kernel_exit()
     UNREACHABLE();
 }
 
+/**
+ * @brief Arms the wake up timer of the current pcb, bounding a blocking wait.
+ * Once the ticks have passed the pcb is woken like with unblock.
+ * @param ticks Ticks to wait at most.
+ */
+void kernel_set_timeout(int ticks)
+{
+    CRITICAL_SECTION({
+        __sched_arm_timeout($process->current, ticks);
+    });
+}
+
+void kernel_clear_timeout()
+{
+    ktimer_cancel(SCHED_TIMER($process->current));
+}
+
 void block()
 {
     struct pcb* current = get_scheduler()->ops->consume(get_scheduler());
@@ -385,6 +1007,9 @@ void block()
 
 void unblock(int pid)
 {
-    //pcb_set_running(pid);
+    struct pcb* pcb = pcb_get_by_pid(pid);
+    if(pcb == NULL) return;
+
+    get_scheduler()->ops->wake(get_scheduler(), pcb);
 }
 
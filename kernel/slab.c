@@ -0,0 +1,223 @@
+/**
+ * @file slab.c
+ * @author Joe Bayer (joexbayer)
+ * @brief Slab object caches for frequently allocated kernel objects.
+ * @version 0.1
+ * @date 2024-02-04
+ *
+ * Each cache carves objects of a single size out of larger slabs allocated
+ * with kalloc. Free objects are kept on a singly linked free list threaded
+ * through the objects themselves, which makes allocation and free O(1) and
+ * avoids the 256 byte block rounding (and int header) of kalloc per object.
+ * Slabs are retained by the cache once allocated.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <kconfig.h>
+#include <memory.h>
+#include <serial.h>
+#include <sync.h>
+#include <libc.h>
+#include <assert.h>
+
+#ifndef KDEBUG_MEMORY
+#undef dbgprintf
+#define dbgprintf(...)
+#endif
+
+/* Each slab starts with a small header linking it into its cache. */
+struct kmem_slab {
+	struct kmem_slab* next;
+};
+
+/* Free objects store the pointer to the next free object in their first word. */
+struct kmem_free_object {
+	struct kmem_free_object* next;
+};
+
+static struct kmem_cache __kmem_caches[KMEM_MAX_CACHES];
+static spinlock_t __kmem_caches_lock = 0;
+
+/**
+ * @brief Allocates a new slab for the given cache and pushes all its objects on the free list.
+ * @warning Cache spinlock must be held.
+ * @param cache Cache to grow.
+ * @return 0 on success, -ERROR_ALLOC if kalloc failed.
+ */
+static int __kmem_cache_grow(struct kmem_cache* cache)
+{
+	struct kmem_slab* slab = kalloc(sizeof(struct kmem_slab) + cache->size*cache->per_slab);
+	if(slab == NULL){
+		return -ERROR_ALLOC;
+	}
+
+	slab->next = cache->slabs;
+	cache->slabs = slab;
+	cache->slab_count++;
+
+	/* Thread the free list through the new objects, first object ends up at the head. */
+	byte_t* objects = (byte_t*)(slab+1);
+	for (int i = cache->per_slab-1; i >= 0; i--){
+		struct kmem_free_object* obj = (struct kmem_free_object*)(objects + i*cache->size);
+		obj->next = cache->freelist;
+		cache->freelist = obj;
+	}
+	cache->total += cache->per_slab;
+
+	dbgprintf("[SLAB] %s grew by %d objects (%d total)\n", cache->name, cache->per_slab, cache->total);
+
+	return ERROR_OK;
+}
+
+/**
+ * @brief Creates a new object cache for objects of the given size.
+ * The cache struct is taken from a static table so caches can be created
+ * before anything else depends on kalloc. Slabs are allocated lazily on first use.
+ * @param name Name of the cache, shown in meminfo.
+ * @param size Size of each object in bytes.
+ * @return struct kmem_cache* new cache, NULL if there are no free cache slots.
+ */
+struct kmem_cache* kmem_cache_create(char* name, int size)
+{
+	if(size <= 0) return NULL;
+
+	struct kmem_cache* cache = NULL;
+
+	spin_lock(&__kmem_caches_lock);
+	for (int i = 0; i < KMEM_MAX_CACHES; i++){
+		if(__kmem_caches[i].size == 0){
+			cache = &__kmem_caches[i];
+			break;
+		}
+	}
+
+	if(cache == NULL){
+		spin_unlock(&__kmem_caches_lock);
+		warningf("No free kmem caches for %s\n", name);
+		return NULL;
+	}
+
+	/* Objects must be able to hold a free list pointer. */
+	size = ALIGN(size, PTR_SIZE);
+
+	cache->size = size;
+	cache->per_slab = KMEM_SLAB_SIZE / size < KMEM_SLAB_MIN_OBJECTS ? KMEM_SLAB_MIN_OBJECTS : KMEM_SLAB_SIZE / size;
+	cache->freelist = NULL;
+	cache->slabs = NULL;
+	cache->slab_count = 0;
+	cache->total = 0;
+	cache->active = 0;
+	spinlock_init(&cache->spinlock);
+	memcpy(cache->name, name, strlen(name)+1 > KMEM_CACHE_NAME_LENGTH ? KMEM_CACHE_NAME_LENGTH : strlen(name)+1);
+	cache->name[KMEM_CACHE_NAME_LENGTH-1] = 0;
+
+	spin_unlock(&__kmem_caches_lock);
+
+	dbgprintf("[SLAB] Created cache %s (%d bytes, %d per slab)\n", cache->name, cache->size, cache->per_slab);
+
+	return cache;
+}
+
+/**
+ * @brief Allocates a single object from the given cache.
+ * Pops the head of the free list, growing the cache by one slab if it is empty.
+ * @param cache Cache to allocate from.
+ * @return void* pointer to the object, NULL on error.
+ */
+void* kmem_cache_alloc(struct kmem_cache* cache)
+{
+	ERR_ON_NULL_PTR(cache);
+
+	struct kmem_free_object* obj = NULL;
+	SPINLOCK(cache, {
+		if(cache->freelist == NULL && __kmem_cache_grow(cache) < 0){
+			break;
+		}
+
+		obj = cache->freelist;
+		cache->freelist = obj->next;
+		cache->active++;
+	});
+
+	if(obj == NULL){
+		warningf("Unable to allocate from cache %s\n", cache->name);
+	}
+
+	return (void*) obj;
+}
+
+/**
+ * @brief Allocates a single zeroed object from the given cache.
+ * @param cache Cache to allocate from.
+ * @return void* pointer to the object, NULL on error.
+ */
+void* kmem_cache_zalloc(struct kmem_cache* cache)
+{
+	void* ptr = kmem_cache_alloc(cache);
+	if(ptr == NULL) return NULL;
+
+	memset(ptr, 0, cache->size);
+	return ptr;
+}
+
+/**
+ * @brief Returns an object to the cache it was allocated from.
+ * @param cache Cache the object belongs to.
+ * @param ptr Object to free, NULL is ignored.
+ */
+void kmem_cache_free(struct kmem_cache* cache, void* ptr)
+{
+	if(cache == NULL || ptr == NULL) return;
+
+	struct kmem_free_object* obj = (struct kmem_free_object*) ptr;
+	SPINLOCK(cache, {
+		obj->next = cache->freelist;
+		cache->freelist = obj;
+		cache->active--;
+	});
+}
+
+/**
+ * @brief Gets statistics for the cache at the given index.
+ * @param index Index in the cache table.
+ * @param info Output statistics.
+ * @return 0 on success, -ERROR_INDEX if no cache exists at index.
+ */
+error_t kmem_cache_get_info(int index, struct kmem_cache_info* info)
+{
+	ERR_ON_NULL(info);
+	if(index < 0 || index >= KMEM_MAX_CACHES || __kmem_caches[index].size == 0){
+		return -ERROR_INDEX;
+	}
+
+	struct kmem_cache* cache = &__kmem_caches[index];
+	SPINLOCK(cache, {
+		info->size = cache->size;
+		info->active = cache->active;
+		info->total = cache->total;
+		info->slabs = cache->slab_count;
+		memcpy(info->name, cache->name, KMEM_CACHE_NAME_LENGTH);
+	});
+
+	return ERROR_OK;
+}
+
+/**
+ * @brief Sums up the memory held by all caches.
+ * @param used Bytes held by allocated objects.
+ * @param total Bytes held by all slabs.
+ */
+void kmem_cache_usage(int* used, int* total)
+{
+	int _used = 0, _total = 0;
+	for (int i = 0; i < KMEM_MAX_CACHES; i++){
+		if(__kmem_caches[i].size == 0) continue;
+
+		_used += __kmem_caches[i].active * __kmem_caches[i].size;
+		_total += __kmem_caches[i].slab_count * (int)(sizeof(struct kmem_slab) + __kmem_caches[i].size*__kmem_caches[i].per_slab);
+	}
+
+	*used = _used;
+	*total = _total;
+}
@@ -4,6 +4,11 @@
  * @brief Symmetric multiprocessing.
  * @version 0.1
  * @date 2024-01-10
+ *
+ * Processors are found in the MP configuration table and started with INIT and
+ * startup interrupts through the local APIC. Each processor gets its own GDT, TSS,
+ * current pcb and scheduler, all kept in its struct cpu. Kernel state is protected
+ * by the kernel lock taken by critical sections, see sync.c.
  * 
  * @copyright Copyright (c) 2024
  * 
@@ -13,15 +18,107 @@
 #include <libc.h>
 #include <kutils.h>
 #include <serial.h>
+#include <pcb.h>
+#include <scheduler.h>
+#include <memory.h>
+#include <timer.h>
+#include <kthreads.h>
+#include <admin.h>
+#include <assert.h>
+#include <arch/lapic.h>
+#include <arch/interrupts.h>
+#include <arch/fpu.h>
+
+#define MP_PROCESSOR_ENABLED 0x1
+#define MP_PROCESSOR_BSP 0x2
+
+/* I/O interrupt entry flags, a field of 0 conforms to the bus: edge high for ISA, level low for PCI */
+#define MP_IRQ_INT 0
+#define MP_IRQ_POLARITY(flags) ((flags) & 0x3)
+#define MP_IRQ_TRIGGER(flags) (((flags) >> 2) & 0x3)
+#define MP_IRQ_CONFORMS 0
+#define MP_IRQ_ACTIVE_LOW 0x3
+#define MP_IRQ_LEVEL 0x3
+
+/* ISA interrupt lines, and the bus ids looked at when parsing I/O interrupt entries */
+#define SMP_ISA_IRQS 16
+#define SMP_MAX_BUSES 32
+
+/* Startup code in trampoline.s */
+extern char smp_trampoline_start[];
+extern char smp_trampoline_end[];
+extern char smp_trampoline_args[];
+
+/* Filled in for every processor started, layout matches trampoline.s */
+struct smp_trampoline_args {
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t cr0;
+    uint32_t stack;
+    uint32_t cpu;
+    uint32_t entry;
+} __attribute__((packed));
+
+static struct smp {
+    struct cpu cpus[SMP_MAX_CPUS];
+    /* processors found, started ones are marked in their struct cpu */
+    int count;
+    int started;
+    int lapic;
+
+    uint32_t lapic_address;
+    uint32_t io_apic_address;
+    uint8_t io_apic_id;
+
+    /* bus types from the bus entries, a bit per bus id */
+    uint32_t isa_buses;
+    uint32_t pci_buses;
+    struct smp_irq irqs[SMP_ISA_IRQS];
+
+    /* bumped by every TLB shootdown, processors flush until they caught up */
+    volatile uint32_t tlb_generation;
+} __smp = {
+    .count = 1,
+    .started = 1
+};
+static struct smp* smp = &__smp;
+
+/* Context the boot code runs in on every processor, until their first pcb is scheduled */
+static struct user boot_user = {
+    .name = "system",
+    .permissions = SYSTEM_FULL_ACCESS,
+};
+static struct pcb boot_pcb = {
+    .name = "kernel",
+    .pid = 0,
+    .user = &boot_user
+};
 
 static void smp_print_processor(const struct entry_processor* proc)
 {
     dbgprintf("Processor: APIC ID=%d, Flags=0x%x, Signature=0x%x, Features=0x%x\n",
            proc->local_apic_id, proc->flags, proc->signature, proc->feature_flags);
+
+    if(!(proc->flags & MP_PROCESSOR_ENABLED)) return;
+
+    if(proc->flags & MP_PROCESSOR_BSP){
+        smp->cpus[SMP_BSP].apic_id = proc->local_apic_id;
+        return;
+    }
+
+    if(smp->count == SMP_MAX_CPUS){
+        dbgprintf("Ignoring processor %d, at most %d are used\n", proc->local_apic_id, SMP_MAX_CPUS);
+        return;
+    }
+    smp->cpus[smp->count++].apic_id = proc->local_apic_id;
 }
 
 static void smp_print_io_apic_info(const struct entry_io_apic* io_apic) {
     dbgprintf("I/O APIC: ID=%d, Address=0x%x\n", io_apic->id, io_apic->address);
+    if(smp->io_apic_address == 0){
+        smp->io_apic_address = io_apic->address;
+        smp->io_apic_id = io_apic->id;
+    }
 }
 
 static void smp_print_bus_info(const struct entry_bus* bus) {
@@ -29,11 +126,45 @@ static void smp_print_bus_info(const struct entry_bus* bus) {
     memcpy(bus_type_str, bus->bus_type, 6);
     bus_type_str[6] = '\0'; /* Ensure null-termination */
     dbgprintf("Bus: ID=%d, Type=%s\n", bus->bus_id, bus_type_str);
+
+    if(bus->bus_id >= SMP_MAX_BUSES) return;
+    if(memcmp(bus->bus_type, "ISA", 3) == 0){
+        smp->isa_buses |= 1 << bus->bus_id;
+    } else if(memcmp(bus->bus_type, "PCI", 3) == 0){
+        smp->pci_buses |= 1 << bus->bus_id;
+    }
 }
 
 static void smp_print_io_interrupt_info(const struct entry_io_interrupt* io_int) {
     //dbgprintf("I/O Interrupt: Type=%d, Flags=0x%x, Source Bus ID=%d, Source IRQ=%d, Dest IO APIC ID=%d, Dest IO APIC INTIN=%d\n",
     //          io_int->interrupt_type, io_int->flags, io_int->source_bus_id, io_int->source_bus_irq, io_int->destination_io_apic_id, io_int->destination_io_apic_intin);
+
+    /* Only the first IO APIC is used */
+    if(io_int->interrupt_type != MP_IRQ_INT || io_int->source_bus_id >= SMP_MAX_BUSES) return;
+    if(io_int->destination_io_apic_id != smp->io_apic_id && io_int->destination_io_apic_id != 0xFF) return;
+
+    uint32_t bus = 1 << io_int->source_bus_id;
+    int pin = io_int->destination_io_apic_intin;
+    int polarity = MP_IRQ_POLARITY(io_int->flags);
+    int trigger = MP_IRQ_TRIGGER(io_int->flags);
+
+    struct smp_irq* line;
+    if(smp->isa_buses & bus){
+        if(io_int->source_bus_irq >= SMP_ISA_IRQS) return;
+        /* Overrides like the PIT moving to pin 2 */
+        line = &smp->irqs[io_int->source_bus_irq];
+        line->active_low = polarity == MP_IRQ_ACTIVE_LOW;
+        line->level = trigger == MP_IRQ_LEVEL;
+    } else if(smp->pci_buses & bus){
+        /* The source is a device and pin, the chipset steers it to the ISA line of the same number */
+        if(pin >= SMP_ISA_IRQS) return;
+        line = &smp->irqs[pin];
+        line->active_low = polarity == MP_IRQ_CONFORMS || polarity == MP_IRQ_ACTIVE_LOW;
+        line->level = trigger == MP_IRQ_CONFORMS || trigger == MP_IRQ_LEVEL;
+    } else {
+        return;
+    }
+    line->pin = pin;
 }
 
 static void smp_print_local_interrupt_info(const struct entry_local_interrupt* local_int) {
@@ -69,11 +200,17 @@ int smp_parse()
 
     dbgprintf("MP Floating Pointer Structure found at 0x%x\n", mp_ptr);
 
+    /* ISA lines are wired to the IO APIC pin of the same number unless an I/O interrupt entry says otherwise */
+    for (int i = 0; i < SMP_ISA_IRQS; i++){
+        smp->irqs[i] = (struct smp_irq) { .pin = i };
+    }
+
     /* The MP Floating Pointer Structure contains the physical address of the MP Configuration Table. */
     struct mp_table* mp_table = ( struct mp_table* )mp_ptr->table;
     if (memcmp(mp_table->signature, "PCMP", 4) != 0) {
         return -1;
     }
+    smp->lapic_address = mp_table->lapic_address;
 
     /* Start parsing the MP Configuration Table */
     uint8_t* entries = (uint8_t*)(mp_table + 1); /* Pointer to the first entry */
@@ -110,3 +247,248 @@ int smp_parse()
 
     return 0;  /* Successful initialization */
 }
+
+
+struct process* smp_process()
+{
+    return &smp_cpu()->process;
+}
+
+struct cpu* smp_get_cpu(int id)
+{
+    if(id < 0 || id >= smp->count) return NULL;
+    return &smp->cpus[id];
+}
+
+int smp_cpu_count()
+{
+    return smp->count;
+}
+
+/* Physical address of the first IO APIC, 0 if the MP table listed none */
+uint32_t smp_io_apic_address()
+{
+    return smp->io_apic_address;
+}
+
+/**
+ * @brief Gets the IO APIC pin and trigger mode of an ISA interrupt line, from the MP table.
+ * @param irq ISA interrupt line, 0 to 15.
+ * @param line Output pin and trigger mode.
+ */
+void smp_get_irq(int irq, struct smp_irq* line)
+{
+    if(irq < 0 || irq >= SMP_ISA_IRQS){
+        *line = (struct smp_irq) { .pin = irq };
+        return;
+    }
+    *line = smp->irqs[irq];
+}
+
+/**
+ * @brief Sets up the per processor state of the bootstrap processor.
+ * Must be called before anything else, critical sections need the per processor segment.
+ */
+void smp_init_bsp()
+{
+    for (int i = 0; i < SMP_MAX_CPUS; i++){
+        smp->cpus[i].self = &smp->cpus[i];
+        smp->cpus[i].id = i;
+        smp->cpus[i].process.current = &boot_pcb;
+    }
+    smp->cpus[SMP_BSP].started = 1;
+
+    init_gdt(&smp->cpus[SMP_BSP]);
+    init_tss(&smp->cpus[SMP_BSP]);
+    init_fpu();
+}
+
+/**
+ * @brief Enables the local APIC of the bootstrap processor, after memory is initialized.
+ * Without a local APIC the kernel keeps running on the bootstrap processor only.
+ */
+void smp_init()
+{
+    if(init_lapic(smp->lapic_address) != ERROR_OK){
+        dbgprintf("[SMP] No local APIC, using a single processor\n");
+        smp->count = 1;
+        return;
+    }
+
+    smp->lapic = 1;
+    lapic_enable(1);
+    smp->cpus[SMP_BSP].apic_id = lapic_id();
+
+    /* Needed by the application processors and by the tick of the bootstrap processor in APIC mode */
+    lapic_timer_calibrate();
+
+    dbgprintf("[SMP] %d processors found\n", smp->count);
+}
+
+static void __int_handler smp_reschedule_interrupt()
+{
+    kernel_preempt();
+}
+
+/**
+ * @brief Entry point of application processors, called by the trampoline with paging enabled.
+ * Once the processor is set up it starts its idle task and joins scheduling.
+ */
+static void __noreturn smp_ap_main(struct cpu* cpu)
+{
+    init_gdt(cpu);
+    init_tss(cpu);
+    interrupt_load_idt();
+    init_fpu();
+    lapic_enable(0);
+
+    /* The bootstrap processor waits for this while holding the kernel lock */
+    cpu->started = 1;
+
+    ENTER_CRITICAL();
+
+    PANIC_ON_ERR(sched_init_default(get_scheduler(), 0));
+    init_local_timer();
+    start("idled", 0, NULL);
+
+    dbgprintf("[SMP] Processor %d (APIC %d) started\n", cpu->id, cpu->apic_id);
+
+    kernel_yield();
+    UNREACHABLE();
+}
+
+/**
+ * @brief Starts all application processors found by smp_parse.
+ * Must be called with paging enabled, the processors load the paging state of the caller.
+ * Each processor gets an INIT, followed by up to two startup interrupts pointing at the trampoline.
+ */
+void smp_start_aps()
+{
+    if(!smp->lapic || smp->count == 1) return;
+
+    interrupt_install_handler(LAPIC_RESCHEDULE_VECTOR, &smp_reschedule_interrupt);
+
+    memcpy((void*)SMP_TRAMPOLINE, smp_trampoline_start, smp_trampoline_end - smp_trampoline_start);
+    struct smp_trampoline_args* args = (struct smp_trampoline_args*)(SMP_TRAMPOLINE + (smp_trampoline_args - smp_trampoline_start));
+
+    for (int i = 1; i < smp->count; i++){
+        struct cpu* cpu = &smp->cpus[i];
+
+        cpu->stack = kalloc(SMP_STACK_SIZE);
+        if(cpu->stack == NULL){
+            warningf("Out of memory for processor stacks\n");
+            break;
+        }
+
+        args->cr3 = rcr3();
+        args->cr4 = rcr4();
+        args->cr0 = rcr0();
+        args->stack = (uint32_t)cpu->stack + SMP_STACK_SIZE;
+        args->cpu = (uint32_t)cpu;
+        args->entry = (uint32_t)&smp_ap_main;
+
+        lapic_send_init(cpu->apic_id);
+        lapic_udelay(10000);
+
+        lapic_send_startup(cpu->apic_id, SMP_TRAMPOLINE >> 12);
+        lapic_udelay(200);
+        if(!cpu->started){
+            lapic_send_startup(cpu->apic_id, SMP_TRAMPOLINE >> 12);
+        }
+
+        /* The arguments are reused for the next processor, wait until this one is past them */
+        for (int wait = 0; wait < 100 && !cpu->started; wait++){
+            lapic_udelay(1000);
+        }
+
+        if(!cpu->started){
+            warningf("Processor %d (APIC %d) did not start\n", cpu->id, cpu->apic_id);
+            continue;
+        }
+        smp->started++;
+    }
+
+    dbgprintf("[SMP] %d of %d processors started\n", smp->started, smp->count);
+}
+
+void smp_send_reschedule(int id)
+{
+    struct cpu* cpu = smp_get_cpu(id);
+    if(cpu == NULL || !cpu->started) return;
+
+    cpu->ipis++;
+    lapic_send_ipi(cpu->apic_id, LAPIC_RESCHEDULE_VECTOR);
+}
+
+/**
+ * @brief Flushes the TLB of the calling processor if a shootdown happened since its last flush.
+ * Called from the TLB shootdown interrupt and from every spin loop, a processor spinning
+ * with interrupts disabled would otherwise never answer a shootdown.
+ */
+void smp_tlb_poll()
+{
+    struct cpu* cpu = smp_cpu();
+    uint32_t generation = smp->tlb_generation;
+
+    if(cpu->tlb_generation != generation){
+        /* Reloading cr3 drops all non global entries, the shared kernel mappings are global */
+        asm volatile ("movl %%cr3, %%eax; movl %%eax, %%cr3" : : : "eax", "memory");
+        cpu->tlb_generation = generation;
+    }
+}
+
+/**
+ * @brief Makes sure no processor uses stale translations after mappings were removed or changed.
+ * Returns once all started processors have flushed their TLB.
+ */
+void smp_tlb_shootdown()
+{
+    if(smp->started == 1) return;
+
+    uint32_t generation = __sync_add_and_fetch(&smp->tlb_generation, 1);
+    smp_tlb_poll();
+
+    lapic_send_ipi_others(LAPIC_TLB_VECTOR);
+
+    for (int i = 0; i < smp->count; i++){
+        struct cpu* cpu = &smp->cpus[i];
+        if(!cpu->started) continue;
+
+        while((int)(generation - cpu->tlb_generation) > 0){
+            smp_tlb_poll();
+            asm volatile ("pause");
+        }
+    }
+}
+
+/**
+ * @brief Gets the state of a processor.
+ * @param index Processor id, 0 to smp_cpu_count()-1.
+ * @param info Output state.
+ * @return error_t 0 on success, -ERROR_INDEX if there is no such processor.
+ */
+error_t smp_get_info(int index, struct smp_cpu_info* info)
+{
+    ERR_ON_NULL(info);
+    if(index < 0 || index >= smp->count){
+        return -ERROR_INDEX;
+    }
+
+    struct cpu* cpu = &smp->cpus[index];
+    CRITICAL_SECTION({
+        info->id = cpu->id;
+        info->apic_id = cpu->apic_id;
+        info->started = cpu->started;
+        info->pid = cpu->process.current->pid;
+        info->runnable = cpu->sched != NULL ? sched_queued(cpu->sched) : 0;
+        info->pulled = cpu->sched != NULL ? cpu->sched->pulled : 0;
+        info->ipis = cpu->ipis;
+        info->switch_cycles = cpu->switch_cycles;
+        info->fpu_traps = cpu->fpu_traps;
+        info->cr3_skips = cpu->cr3_skips;
+        info->latency_preempts = cpu->sched != NULL ? cpu->sched->latency.preempts : 0;
+        info->latency_throttles = cpu->sched != NULL ? cpu->sched->latency.throttles : 0;
+    });
+
+    return ERROR_OK;
+}
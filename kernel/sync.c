@@ -15,29 +15,256 @@
 #include <pcb.h>
 #include <serial.h>
 #include <assert.h>
+#include <timer.h>
+#include <smp.h>
+#include <libc.h>
+#include <lockstat.h>
 
 #ifndef KDEBUG_SYNC
 #undef dbgprintf
 #define dbgprintf(...)
 #endif
 
-void spin_lock(spinlock_t* lock) {
-    WAIT(__sync_lock_test_and_set(lock, SPINLOCK_LOCKED));
+/* Spins before a contended spinlock yields to its holder, if it may */
+#define SPIN_YIELD_AFTER 1000
+
+/**
+ * @brief Kernel lock
+ * A critical section used to mean interrupts are disabled, which on a single processor
+ * is enough to own all kernel state. The outermost critical section of a processor also
+ * takes the kernel lock, so critical sections exclude each other on all processors while code
+ * outside of them runs in parallel. The depth is per processor and saved in the pcb on a switch,
+ * the lock stays with the processor across the switch and is released by the next pcb.
+ */
+static spinlock_t kernel_lock = SPINLOCK_UNLOCKED;
+
+/* Takes a lock with interrupts disabled, TLB shootdowns waiting on this processor are served while spinning */
+static inline void __spin_wait(spinlock_t* lock)
+{
+    while(__sync_lock_test_and_set(lock, SPINLOCK_LOCKED)){
+        while(*lock != SPINLOCK_UNLOCKED){
+            smp_tlb_poll();
+            asm volatile ("pause");
+        }
+    }
+}
+
+/* Takes the kernel lock, spinlock waiters in critical sections can see it is being waited for */
+static inline void __kernel_lock_wait(struct cpu* cpu)
+{
+    cpu->kernel_waiting = 1;
+    __spin_wait(&kernel_lock);
+    cpu->kernel_waiting = 0;
+}
+
+void critical_enter()
+{
+    asm volatile ("cli");
+    struct cpu* cpu = smp_cpu();
+    if(cpu->critical++ == 0){
+#ifdef LOCKSTAT
+        uint64_t start = rdtsc();
+        int contended = kernel_lock != SPINLOCK_UNLOCKED;
+        __kernel_lock_wait(cpu);
+        lockstat_kernel_acquired(start, contended);
+#else
+        __kernel_lock_wait(cpu);
+#endif
+    }
+}
+
+void critical_leave()
+{
+    struct cpu* cpu = smp_cpu();
+    if(--cpu->critical == 0){
+#ifdef LOCKSTAT
+        lockstat_kernel_released();
+#endif
+        __sync_lock_release(&kernel_lock);
+        if(cpu->spinlocks == 0){
+            asm volatile ("sti");
+        }
+    }
+}
+
+/* Leaves without enabling interrupts, for the kernel entry points which return with iret */
+void critical_leave_noirq()
+{
+    struct cpu* cpu = smp_cpu();
+    if(--cpu->critical == 0){
+#ifdef LOCKSTAT
+        lockstat_kernel_released();
+#endif
+        __sync_lock_release(&kernel_lock);
+    }
 }
 
-void spin_unlock(spinlock_t* lock) {
+/**
+ * @brief Leaves the critical section and halts until the next interrupt.
+ * sti is directly followed by hlt, an interrupt is only taken after the instruction
+ * following sti, so a wake up cannot be lost in between. Does not halt if still critical.
+ */
+void critical_leave_halt()
+{
+    struct cpu* cpu = smp_cpu();
+    if(--cpu->critical == 0){
+#ifdef LOCKSTAT
+        lockstat_kernel_released();
+#endif
+        __sync_lock_release(&kernel_lock);
+        if(cpu->spinlocks == 0){
+            asm volatile ("sti; hlt");
+        }
+    }
+}
+
+int critical_depth()
+{
+    return smp_cpu()->critical;
+}
+
+/* Whether the pcb holding a spinlock is running, or switched out waiting for its processor */
+static int __spin_holder_running(struct pcb* holder)
+{
+    struct cpu* cpu = smp_get_cpu(holder->cpu);
+    return cpu != NULL && cpu->process.current == holder;
+}
+
+/* Whether the holder of a spinlock can only make progress once it gets the kernel lock */
+static int __spin_holder_needs_kernel(struct pcb* holder)
+{
+    if(!__spin_holder_running(holder)) return 1;
+
+    return smp_get_cpu(holder->cpu)->kernel_waiting;
+}
+
+/**
+ * @brief Takes a spinlock, spinning until it is free.
+ * The lock stores the pcb holding it. Interrupts stay disabled on this processor while any
+ * spinlock is held, so interrupt handlers never wait for a lock held by the code they interrupted.
+ * A waiter in a critical section keeps the kernel lock while spinning, so the critical section
+ * stays atomic. Critical sections may be entered while holding a spinlock though, so if the holder
+ * waits for the kernel lock or is switched out, the waiter gives it up like it would when blocking
+ * and takes it back after, as neither could make progress otherwise.
+ * A holder which is switched out can not make progress while the waiter spins, it is yielded to.
+ */
+void spin_lock(spinlock_t* lock)
+{
+    int spins = 0;
+    int dropped = 0;
+    struct pcb* self = $process->current;
+#ifdef LOCKSTAT
+    uint64_t start = rdtsc();
+    int contended = 0;
+#endif
+
+    asm volatile ("cli");
+    smp_cpu()->spinlocks++;
+
+    while(__sync_val_compare_and_swap(lock, SPINLOCK_UNLOCKED, (int)self) != SPINLOCK_UNLOCKED){
+#ifdef LOCKSTAT
+        contended = 1;
+#endif
+        struct cpu* cpu = smp_cpu();
+        struct pcb* holder = (struct pcb*) *lock;
+        if(cpu->critical > 0 && !dropped && holder != NULL && __spin_holder_needs_kernel(holder)){
+            __sync_lock_release(&kernel_lock);
+            dropped = 1;
+        }
+
+        smp_tlb_poll();
+        asm volatile ("pause");
+
+        if(++spins < SPIN_YIELD_AFTER) continue;
+        spins = 0;
+
+        holder = (struct pcb*) *lock;
+        if(holder == NULL || __spin_holder_running(holder)) continue;
+
+        /* The scheduler runs under the kernel lock */
+        if(dropped){
+            __kernel_lock_wait(cpu);
+            dropped = 0;
+        }
+
+        cpu->spinlocks--;
+        kernel_yield();
+        asm volatile ("cli");
+        smp_cpu()->spinlocks++;
+    }
+
+    if(dropped){
+        __kernel_lock_wait(smp_cpu());
+    }
+
+#ifdef LOCKSTAT
+    lockstat_spin_acquired(lock, start, contended);
+#endif
+}
+
+void spin_unlock(spinlock_t* lock)
+{
+#ifdef LOCKSTAT
+    lockstat_spin_released(lock);
+#endif
     __sync_lock_release(lock);
+
+    struct cpu* cpu = smp_cpu();
+    if(--cpu->spinlocks == 0 && cpu->critical == 0){
+        asm volatile ("sti");
+    }
+}
+
+/**
+ * @brief Takes a spinlock with interrupts disabled, returning the previous interrupt flag.
+ * Never yields and keeps no per processor state, so it can be used from interrupt handlers
+ * and for locks around code which may itself be called with any lock held.
+ * No other lock may be taken while it is held.
+ * @return uint32_t flags to pass to spin_unlock_irqrestore.
+ */
+uint32_t spin_lock_irqsave(spinlock_t* lock)
+{
+    uint32_t flags;
+    asm volatile ("pushfl; popl %0; cli" : "=r" (flags) : : "memory");
+
+    __spin_wait(lock);
+
+    return flags;
+}
+
+void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags)
+{
+    __sync_lock_release(lock);
+    asm volatile ("pushl %0; popfl" : : "r" (flags) : "memory", "cc");
+}
+
+/**
+ * @brief Unlocks the spinlock, use through spinlock_init.
+ * @param name Declaration of the lock, its lockstat class.
+ */
+void __spinlock_init(spinlock_t* lock, const char* name)
+{
+    *lock = SPINLOCK_UNLOCKED;
+#ifdef LOCKSTAT
+    lockstat_spinlock(lock, name);
+#endif
 }
 
 /**
  * @brief Initializes the given lock. Most importantly it sets the blocked list.
- * 
+ * Use through mutex_init, which names the lock after its declaration.
  * @param l Lock to initialize.
+ * @param name Declaration of the lock, its lockstat class.
  */
-void mutex_init(mutex_t* l)
+void __mutex_init(mutex_t* l, const char* name)
 {
     l->blocked = pcb_new_queue();
     l->state = UNLOCKED;
+    l->lclass = NULL;
+    l->held_since = 0;
+#ifdef LOCKSTAT
+    l->lclass = lockstat_class(name);
+#endif
     dbgprintf("Lock 0x%x initiated by %s\n", l, $process->current->name);
 }
 
@@ -52,6 +279,10 @@ void acquire(mutex_t* l)
     dbgprintf("Locking 0x%x\n", l);
 
     struct pcb* current;
+#ifdef LOCKSTAT
+    uint64_t start = rdtsc();
+    int contended = l->state == LOCKED;
+#endif
 
     ENTER_CRITICAL();
     switch (l->state){
@@ -76,6 +307,38 @@ void acquire(mutex_t* l)
 
     assert(l->state == LOCKED);
     LEAVE_CRITICAL();
+
+#ifdef LOCKSTAT
+    lockstat_acquired(l->lclass, start, contended);
+    l->held_since = rdtsc();
+#endif
+}
+
+/**
+ * @brief Locks the given lock only if it is free, never blocks.
+ * Used by threads which must stay runnable, like the idle task.
+ * @param l mutex_t object.
+ * @return int 1 if the lock was taken, 0 if it is already locked.
+ */
+int try_acquire(mutex_t* l)
+{
+    int taken = 0;
+
+    ENTER_CRITICAL();
+    if(l->state == UNLOCKED){
+        l->state = LOCKED;
+        taken = 1;
+    }
+    LEAVE_CRITICAL();
+
+#ifdef LOCKSTAT
+    if(taken){
+        lockstat_acquired(l->lclass, 0, 0);
+        l->held_since = rdtsc();
+    }
+#endif
+
+    return taken;
 }
 
 /**
@@ -90,17 +353,358 @@ void release(mutex_t* l)
         warningf("Lock 0x%x is already unlocked\n", l);
     }
 
+#ifdef LOCKSTAT
+    lockstat_released(l->lclass, l->held_since);
+    l->held_since = 0;
+#endif
+
     ENTER_CRITICAL();
-    struct pcb* blocked = l->blocked->ops->pop(l->blocked);
-    if(blocked != NULL){
-        get_scheduler()->ops->add(get_scheduler(), blocked);
-        blocked->state = RUNNING;
+    struct pcb* blocked;
+    while((blocked = l->blocked->ops->pop(l->blocked)) != NULL){
+        if(blocked->state == BLOCKED){
+            /* The lock is handed over to the woken waiter, on the processor it blocked on as its FPU state may still be there */
+            blocked->queued = PCB_UNQUEUED;
+            get_scheduler()->ops->wake(get_scheduler(), blocked);
 
-        assert(l->state == LOCKED);
-        LEAVE_CRITICAL();
-        return;
+            assert(l->state == LOCKED);
+            LEAVE_CRITICAL();
+            return;
+        }
+        /* A waiter which is no longer blocked was killed, it is only queued to be reaped */
+        get_scheduler()->ops->add(get_scheduler(), blocked);
     }
     //assert(l->state != UNLOCKED);
     l->state = UNLOCKED;
     LEAVE_CRITICAL();
-}
\ No newline at end of file
+}
+void waitqueue_init(waitqueue_t* wq)
+{
+    wq->head = NULL;
+    wq->tail = NULL;
+    wq->count = 0;
+}
+
+static void __waitqueue_link(waitqueue_t* wq, struct pcb* pcb)
+{
+    pcb->next = NULL;
+    pcb->prev = wq->tail;
+    if(wq->tail != NULL) wq->tail->next = pcb;
+    else wq->head = pcb;
+    wq->tail = pcb;
+    wq->count++;
+
+    pcb->waitqueue = wq;
+}
+
+/**
+ * @brief Removes a pcb from the wait queue it is blocked on.
+ * Used by the scheduler when a waiter is woken by its timeout or killed.
+ * @warning Must be called in a critical section.
+ */
+void waitqueue_remove(struct pcb* pcb)
+{
+    waitqueue_t* wq = pcb->waitqueue;
+    if(wq == NULL) return;
+
+    if(pcb->prev != NULL) pcb->prev->next = pcb->next;
+    else wq->head = pcb->next;
+    if(pcb->next != NULL) pcb->next->prev = pcb->prev;
+    else wq->tail = pcb->prev;
+    wq->count--;
+
+    pcb->next = NULL;
+    pcb->prev = NULL;
+    pcb->waitqueue = NULL;
+}
+
+/**
+ * @brief Blocks the current pcb on the wait queue until it is woken or the ticks have passed.
+ * Called by wait_event with the condition checked false in the same critical section,
+ * the critical section is left while blocked and entered again before returning.
+ * @param wq Wait queue to block on.
+ * @param ticks Ticks to wait at most, WAIT_FOREVER for no timeout.
+ * @return int ticks left of the timeout, WAIT_FOREVER if there is none.
+ */
+int waitqueue_sleep(waitqueue_t* wq, int ticks)
+{
+    ASSERT_CRITICAL();
+
+    struct pcb* current = $process->current;
+    int start = timer_get_tick();
+
+    __waitqueue_link(wq, current);
+    current->state = BLOCKED;
+    if(ticks != WAIT_FOREVER){
+        kernel_set_timeout(ticks);
+    }
+
+    LEAVE_CRITICAL();
+    kernel_yield();
+    ENTER_CRITICAL();
+
+    if(ticks != WAIT_FOREVER){
+        kernel_clear_timeout();
+    }
+    waitqueue_remove(current);
+
+    if(ticks == WAIT_FOREVER) return WAIT_FOREVER;
+
+    int left = ticks - (timer_get_tick() - start);
+    return left > 0 ? left : 0;
+}
+
+/**
+ * @brief Wakes the longest waiting pcb of the wait queue.
+ * Safe to call from interrupt context.
+ * @return int 1 if a pcb was woken, 0 if nobody was waiting.
+ */
+int wake_up_one(waitqueue_t* wq)
+{
+    struct pcb* pcb;
+
+    CRITICAL_SECTION({
+        pcb = wq->head;
+        if(pcb != NULL){
+            waitqueue_remove(pcb);
+            get_scheduler()->ops->wake(get_scheduler(), pcb);
+        }
+    });
+
+    return pcb != NULL;
+}
+
+/**
+ * @brief Wakes all pcbs waiting on the wait queue.
+ * @return int number of pcbs woken.
+ */
+int wake_up_all(waitqueue_t* wq)
+{
+    int woken = 0;
+
+    CRITICAL_SECTION({
+        while(wake_up_one(wq)){
+            woken++;
+        }
+    });
+
+    return woken;
+}
+
+void cond_init(condvar_t* cv)
+{
+    waitqueue_init(&cv->waiters);
+}
+
+/**
+ * @brief Releases the mutex and waits for the condition to be signaled, then acquires it again.
+ * Releasing and starting to wait happen in the same critical section, so a signal sent
+ * right after the mutex is released is not lost. Like with any condition variable
+ * the caller has to check its condition again in a loop.
+ * @param cv Condition variable to wait on.
+ * @param l Locked mutex protecting the condition.
+ */
+void cond_wait(condvar_t* cv, mutex_t* l)
+{
+    ENTER_CRITICAL();
+    release(l);
+    waitqueue_sleep(&cv->waiters, WAIT_FOREVER);
+    LEAVE_CRITICAL();
+
+    acquire(l);
+}
+
+void cond_signal(condvar_t* cv)
+{
+    wake_up_one(&cv->waiters);
+}
+
+void cond_broadcast(condvar_t* cv)
+{
+    wake_up_all(&cv->waiters);
+}
+
+void sem_init(semaphore_t* sem, int count)
+{
+    sem->count = count;
+    waitqueue_init(&sem->waiters);
+}
+
+/**
+ * @brief Takes one unit of the semaphore, blocking while there is none.
+ */
+void sem_wait(semaphore_t* sem)
+{
+    ENTER_CRITICAL();
+    while(sem->count <= 0){
+        waitqueue_sleep(&sem->waiters, WAIT_FOREVER);
+    }
+    sem->count--;
+    LEAVE_CRITICAL();
+}
+
+/**
+ * @brief Takes one unit of the semaphore only if one is available, never blocks.
+ * @return int 1 if a unit was taken, 0 otherwise.
+ */
+int sem_trywait(semaphore_t* sem)
+{
+    int taken = 0;
+
+    CRITICAL_SECTION({
+        if(sem->count > 0){
+            sem->count--;
+            taken = 1;
+        }
+    });
+
+    return taken;
+}
+
+/**
+ * @brief Returns one unit to the semaphore, waking a waiter.
+ * Safe to call from interrupt context.
+ */
+void sem_post(semaphore_t* sem)
+{
+    CRITICAL_SECTION({
+        sem->count++;
+        wake_up_one(&sem->waiters);
+    });
+}
+
+/**
+ * @brief Initializes the lock, use through rwlock_init.
+ * @param name Declaration of the lock, its lockstat class.
+ */
+void __rwlock_init(rwlock_t* rw, const char* name)
+{
+    rw->state = 0;
+    rw->writers_waiting = 0;
+    rw->readers_waiting = 0;
+    waitqueue_init(&rw->readers);
+    waitqueue_init(&rw->writers);
+    rw->lclass = NULL;
+    rw->held_since = 0;
+#ifdef LOCKSTAT
+    rw->lclass = lockstat_class(name);
+#endif
+}
+
+/* Adds a reader unless write locked or a writer is waiting */
+static int __read_trylock(rwlock_t* rw)
+{
+    int state;
+    while(rw->writers_waiting == 0 && (state = rw->state) >= 0){
+        if(__sync_bool_compare_and_swap(&rw->state, state, state + 1)) return 1;
+    }
+    return 0;
+}
+
+static int __write_trylock(rwlock_t* rw)
+{
+    return __sync_bool_compare_and_swap(&rw->state, 0, RWLOCK_WRITER);
+}
+
+/**
+ * @brief Takes the lock for reading, sleeping while it is write locked or a writer waits.
+ * The waiting count is raised before the lock is checked again, and unlocking checks it after
+ * releasing, both with locked instructions, so either the waiter sees the lock free or the
+ * unlocker sees the waiter and wakes it.
+ */
+void read_lock(rwlock_t* rw)
+{
+#ifdef LOCKSTAT
+    uint64_t start = rdtsc();
+#endif
+    if(__read_trylock(rw)){
+#ifdef LOCKSTAT
+        lockstat_acquired(rw->lclass, start, 0);
+#endif
+        return;
+    }
+
+    __sync_add_and_fetch(&rw->readers_waiting, 1);
+    wait_event(&rw->readers, __read_trylock(rw));
+    __sync_sub_and_fetch(&rw->readers_waiting, 1);
+
+#ifdef LOCKSTAT
+    lockstat_acquired(rw->lclass, start, 1);
+#endif
+}
+
+void read_unlock(rwlock_t* rw)
+{
+    if(__sync_sub_and_fetch(&rw->state, 1) == 0 && rw->writers_waiting > 0){
+        wake_up_one(&rw->writers);
+    }
+}
+
+/**
+ * @brief Takes the lock for writing, sleeping until all readers and the writer are gone.
+ * While waiting new readers are held back.
+ */
+void write_lock(rwlock_t* rw)
+{
+#ifdef LOCKSTAT
+    uint64_t start = rdtsc();
+    int contended = 0;
+#endif
+
+    if(!__write_trylock(rw)){
+#ifdef LOCKSTAT
+        contended = 1;
+#endif
+        __sync_add_and_fetch(&rw->writers_waiting, 1);
+        wait_event(&rw->writers, __write_trylock(rw));
+        __sync_sub_and_fetch(&rw->writers_waiting, 1);
+    }
+
+#ifdef LOCKSTAT
+    lockstat_acquired(rw->lclass, start, contended);
+    rw->held_since = rdtsc();
+#endif
+}
+
+/**
+ * @brief Releases the write lock, handing it to the next writer if one waits,
+ * else letting all waiting readers in.
+ */
+void write_unlock(rwlock_t* rw)
+{
+#ifdef LOCKSTAT
+    lockstat_released(rw->lclass, rw->held_since);
+#endif
+    __sync_lock_test_and_set(&rw->state, 0);
+
+    if(rw->writers_waiting > 0){
+        wake_up_one(&rw->writers);
+    } else if(rw->readers_waiting > 0){
+        wake_up_all(&rw->readers);
+    }
+}
+
+/* Use through seqlock_init, the writer spinlock is named after the seqlock */
+void __seqlock_init(seqlock_t* sl, const char* name)
+{
+    sl->sequence = 0;
+    __spinlock_init(&sl->lock, name);
+}
+
+/**
+ * @brief Starts an update, the sequence is odd until write_sequnlock.
+ * Interrupts stay disabled while the spinlock is held, so a reader on the same processor
+ * never spins on an update it interrupted.
+ */
+void write_seqlock(seqlock_t* sl)
+{
+    spin_lock(&sl->lock);
+    sl->sequence++;
+    __sync_synchronize();
+}
+
+void write_sequnlock(seqlock_t* sl)
+{
+    __sync_synchronize();
+    sl->sequence++;
+    spin_unlock(&sl->lock);
+}
@@ -30,22 +30,32 @@ int sys_create_thread(void (*entry)(), void* arg, byte_t flags)
 }
 EXPORT_SYSCALL(SYSCALL_CREATE_THREAD, sys_create_thread);
 
-int system_call(int index, int arg1, int arg2, int arg3)
+int system_call(int index, int arg1, int arg2, int arg3, uintptr_t eip)
 {	
 	/* Call system call function based on index. */
 	if(index < 0 || index > 255){
 		return -1;
 	}
 	
+	/* System calls are made from user mode, kernel threads call the kernel directly */
+	struct pcb* pcb = $process->current;
+	pcb_account(pcb, 0);
+
 	/* the system call interrupt entered a critcal section */
 	LEAVE_CRITICAL();
 
+	/* where the system call was made from, allocation tracing attributes user heap blocks to it */
+	pcb->syscall_eip = eip;
+
 	syscall_t fn = syscall[index];
 	int ret = fn(arg1, arg2, arg3);
-	EOI(48);
+
+	pcb->syscall_eip = 0;
 
 	/* Enter critical section again */
 	ENTER_CRITICAL();
 
+	pcb_account(pcb, (pcb->cs & 3) == 3);
+
 	return ret;
 }
@@ -0,0 +1,76 @@
+/*
+	Application processor startup code.
+	Copied to SMP_TRAMPOLINE (0x9000) by smp_start_aps, processors woken by a startup
+	interrupt begin here in real mode. The code is position dependent, all addresses are
+	relative to the copy at 0x9000. Switches to protected mode, loads the paging state of the
+	bootstrap processor and calls the entry point with the struct cpu of the processor.
+*/
+
+.code16
+.section .text
+.global smp_trampoline_start
+smp_trampoline_start:
+    cli
+    cld
+
+    xorw %ax, %ax
+    movw %ax, %ds
+
+    lgdtl (trampoline_gdt_ptr - smp_trampoline_start + 0x9000)
+
+    movl %cr0, %eax
+    orl $1, %eax
+    movl %eax, %cr0
+
+    ljmpl $0x08, $(trampoline_protected - smp_trampoline_start + 0x9000)
+
+.code32
+trampoline_protected:
+    movw $0x10, %ax
+    movw %ax, %ds
+    movw %ax, %es
+    movw %ax, %ss
+    xorw %ax, %ax
+    movw %ax, %fs
+    movw %ax, %gs
+
+    /* Paging state of the bootstrap processor, cr4 before cr3 for 4MB pages */
+    movl (smp_trampoline_args - smp_trampoline_start + 0x9000 + 4), %eax
+    movl %eax, %cr4
+    movl (smp_trampoline_args - smp_trampoline_start + 0x9000), %eax
+    movl %eax, %cr3
+    movl (smp_trampoline_args - smp_trampoline_start + 0x9000 + 8), %eax
+    movl %eax, %cr0
+
+    movl (smp_trampoline_args - smp_trampoline_start + 0x9000 + 12), %esp
+    pushl (smp_trampoline_args - smp_trampoline_start + 0x9000 + 16)
+    movl (smp_trampoline_args - smp_trampoline_start + 0x9000 + 20), %eax
+    call *%eax
+
+trampoline_halt:
+    cli
+    hlt
+    jmp trampoline_halt
+
+.align 8
+trampoline_gdt:
+    .quad 0x0000000000000000
+    .quad 0x00CF9A000000FFFF /* Kernel code */
+    .quad 0x00CF92000000FFFF /* Kernel data */
+trampoline_gdt_ptr:
+    .word trampoline_gdt_ptr - trampoline_gdt - 1
+    .long trampoline_gdt - smp_trampoline_start + 0x9000
+
+/* Filled in for each processor, see struct smp_trampoline_args */
+.align 4
+.global smp_trampoline_args
+smp_trampoline_args:
+    .long 0 /* cr3 */
+    .long 0 /* cr4 */
+    .long 0 /* cr0 */
+    .long 0 /* stack */
+    .long 0 /* struct cpu */
+    .long 0 /* entry */
+
+.global smp_trampoline_end
+smp_trampoline_end:
@@ -14,6 +14,9 @@
 #include <sync.h>
 #include <bitmap.h>
 #include <assert.h>
+#include <program.h>
+#include <kmemtrace.h>
+#include <smp.h>
 
 struct virtual_memory_allocator;
 
@@ -47,7 +50,7 @@ struct virtual_memory_operations {
 struct virtual_memory_allocator {
 	int used_pages;
 	int total_pages;
-	bitmap_t pages;
+	struct hbitmap* pages;
 
 	uint32_t start;
 	uint32_t end;
@@ -62,6 +65,9 @@ struct virtual_memory_allocator* vmem_default = &__vmem_default;
 static struct virtual_memory_allocator __vmem_manager;
 struct virtual_memory_allocator* vmem_manager = &__vmem_manager;
 
+/* Cache for heap allocation nodes, created in vmem_init */
+static struct kmem_cache* vmem_allocation_cache = NULL;
+
 /* HELPER FUNCTIONS */
 static inline uint32_t* vmem_get_page_table(struct pcb* pcb, uint32_t addr)
 {
@@ -73,6 +79,18 @@ static inline void vmem_map(uint32_t* page_table, uint32_t vaddr, uint32_t paddr
 	page_table[TABLE_INDEX(vaddr)] = (paddr & ~PAGE_MASK) | (access == 0 ? vmem_default_permissions : vmem_user_permissions);
 }
 
+/* Maps a shared frame which is never written. */
+static inline void vmem_map_readonly(uint32_t* page_table, uint32_t vaddr, uint32_t paddr)
+{
+	page_table[TABLE_INDEX(vaddr)] = (paddr & ~PAGE_MASK) | USER | PRESENT;
+}
+
+/* Maps a shared frame read-only, the first write copies it. */
+static inline void vmem_map_cow(uint32_t* page_table, uint32_t vaddr, uint32_t paddr)
+{
+	page_table[TABLE_INDEX(vaddr)] = (paddr & ~PAGE_MASK) | USER | PRESENT | PAGE_COW;
+}
+
 static inline void vmem_unmap(uint32_t* page_table, uint32_t vaddr)
 {
 	page_table[TABLE_INDEX(vaddr)] = 0;
@@ -86,24 +104,32 @@ static inline void vmem_add_table(uint32_t* directory, uint32_t vaddr, uint32_t*
 /**
  * Allocates a page of virtual memory from the given virtual memory allocator.
  * @param struct virtual_memory_allocator* vmem: pointer to virtual memory allocator
+ * @param caller return address recorded by allocation tracing
  * @return pointer to the allocated page or NULL if no free pages are available.
  */
-static uint32_t* vmem_alloc(struct virtual_memory_allocator* vmem)
+static uint32_t* __vmem_alloc(struct virtual_memory_allocator* vmem, uintptr_t caller)
 {
 	uint32_t* paddr = NULL;
 	
 	LOCK(vmem, {
 
-		int bit = get_free_bitmap(vmem->pages, vmem->total_pages);
+		int bit = hbitmap_alloc(vmem->pages);
 		assert(bit != -1);
 
 		paddr = (uint32_t*) (vmem->start + (bit * PAGE_SIZE));
 		vmem->used_pages++;
 	});
 
+	kmemtrace_alloc(KMEMTRACE_FRAME, paddr, PAGE_SIZE, caller, $process->current->pid);
+
 	return paddr;
 }
 
+static uint32_t* vmem_alloc(struct virtual_memory_allocator* vmem)
+{
+	return __vmem_alloc(vmem, (uintptr_t) __builtin_return_address(0));
+}
+
 /**
  * Frees the virtual memory page at the given address in the given virtual memory allocator.
  * @param struct virtual_memory_allocator* vmem: pointer to virtual memory allocator
@@ -112,6 +138,8 @@ static uint32_t* vmem_alloc(struct virtual_memory_allocator* vmem)
  */
 static void vmem_free(struct virtual_memory_allocator* vmem, void* addr)
 {
+	kmemtrace_free(KMEMTRACE_FRAME, addr, $process->current->pid);
+
 	LOCK(vmem, {
 
 		if((uint32_t)addr > vmem->end  ||  (uint32_t)addr < vmem->start)
@@ -121,113 +149,370 @@ static void vmem_free(struct virtual_memory_allocator* vmem, void* addr)
 		if(bit < 0 || bit > (vmem->total_pages))
 			break;
 		
-		unset_bitmap(vmem->pages, bit);
+		hbitmap_free(vmem->pages, bit);
 		vmem->used_pages--;
 		dbgprintf("VMEM MANAGER] Free page %d at 0x%x\n", bit, addr);
 
 	});
 }
 
-static int vmem_page_align_size(int size)
+/**
+ * @brief Allocates a physical page frame for use outside of vmem.
+ * @return uint32_t* identity mapped frame, not zeroed.
+ */
+uint32_t* vmem_alloc_frame()
 {
-	int multiple = PAGE_SIZE;
-    int closest;
-    int quotient = size / multiple;
-    int remainder = size % multiple;
-
-    if (remainder > 0) {
-        closest = (quotient + 1) * multiple;
-    } else {
-        closest = quotient * multiple;
-    }
+	return __vmem_alloc(vmem_default, (uintptr_t) __builtin_return_address(0));
+}
 
-	return closest;
+void vmem_free_frame(void* frame)
+{
+	vmem_default->ops->free(vmem_default, frame);
 }
 
-static struct vmem_page_region* vmem_create_page_region(struct pcb* pcb, void* base, int num, int access)
+/**
+ * @brief Pool of pre-zeroed frames
+ * Zeroing a frame writes a full page on the allocating thread, often inside the page fault handler.
+ * The idle task zeroes frames ahead of time (vmem_zero_pool_refill) once the pool drops
+ * below VMEM_ZERO_POOL_LOW, and keeps going in small chunks until it is full again.
+ * Frames in the pool count as used in vmem_default.
+ */
+static struct vmem_zero_pool {
+	uint32_t* frames[VMEM_ZERO_POOL_SIZE];
+	int count;
+	/* set when the pool went below the low watermark, cleared when it is full */
+	int refilling;
+
+	int hits;
+	int misses;
+} __vmem_zero_pool;
+static struct vmem_zero_pool* vmem_zero_pool = &__vmem_zero_pool;
+
+/* Frames always left free in vmem_default for allocations, vmem_alloc can not fail gracefully */
+#define VMEM_ZERO_POOL_RESERVE (VMEM_ZERO_POOL_SIZE*2)
+
+/**
+ * @brief Allocates a page without blocking, fails if the allocator is locked.
+ */
+static uint32_t* vmem_try_alloc(struct virtual_memory_allocator* vmem)
 {
-	struct vmem_page_region* allocation = create(struct vmem_page_region);
-	if(allocation == NULL){
+	if(!try_acquire(&vmem->lock)){
 		return NULL;
 	}
 
-	allocation->bits = kalloc(sizeof(int)*num);
-	if(allocation->bits == NULL){
-		kfree(allocation);
-		return NULL;
+	uint32_t* paddr = NULL;
+	if(vmem->total_pages - vmem->used_pages > VMEM_ZERO_POOL_RESERVE){
+		int bit = hbitmap_alloc(vmem->pages);
+		if(bit != -1){
+			paddr = (uint32_t*) (vmem->start + (bit * PAGE_SIZE));
+			vmem->used_pages++;
+		}
 	}
+	release(&vmem->lock);
 
-	allocation->refs = 0;
-	allocation->size = num*PAGE_SIZE;
-	allocation->used = 0;
-	allocation->basevaddr = base;
+	return paddr;
+}
 
-	uint32_t* heap_table = vmem_get_page_table(pcb, VMEM_HEAP);
-	for (int i = 0; i < num; i++){
-		/*
-		 * 1. Allocate a page
-		 * 2. Map it to virtual heap
-		 * 3. add it to bits
-		 */
-		uint32_t paddr = (uint32_t)vmem_default->ops->alloc(vmem_default);
-		if(paddr == 0){
-			kfree(allocation->bits);
-			for (int j = 0; j < i; j++){
-				vmem_default->ops->free(vmem_default, (void*) (VMEM_START_ADDRESS + (allocation->bits[j] * PAGE_SIZE)));
+/**
+ * @brief Allocates a zeroed physical page frame, from the zero pool if possible.
+ * @return uint32_t* identity mapped zeroed frame.
+ */
+uint32_t* vmem_alloc_zeroed_frame()
+{
+	uint32_t* frame = NULL;
+	CRITICAL_SECTION({
+		if(vmem_zero_pool->count > 0){
+			frame = vmem_zero_pool->frames[--vmem_zero_pool->count];
+			vmem_zero_pool->hits++;
+		} else {
+			vmem_zero_pool->misses++;
+		}
+
+		if(vmem_zero_pool->count < VMEM_ZERO_POOL_LOW){
+			vmem_zero_pool->refilling = 1;
+		}
+	});
+
+	if(frame != NULL){
+		/* Pool frames are traced when they are handed out, not when the idle task zeroes them */
+		kmemtrace_alloc(KMEMTRACE_FRAME, frame, PAGE_SIZE, (uintptr_t) __builtin_return_address(0), $process->current->pid);
+		return frame;
+	}
+
+	frame = __vmem_alloc(vmem_default, (uintptr_t) __builtin_return_address(0));
+	memset(frame, 0, PAGE_SIZE);
+
+	return frame;
+}
+
+/**
+ * @brief Zeroes up to max frames into the zero pool. Called by the idle tasks,
+ * so it never blocks: it gives up if vmem_default is locked.
+ * @param max Number of frames to zero before returning.
+ * @return int number of frames added to the pool.
+ */
+int vmem_zero_pool_refill(int max)
+{
+	if(vmem_zero_pool->count < VMEM_ZERO_POOL_LOW){
+		vmem_zero_pool->refilling = 1;
+	}
+
+	int added = 0;
+	while(vmem_zero_pool->refilling && added < max){
+		uint32_t* frame = vmem_try_alloc(vmem_default);
+		if(frame == NULL){
+			break;
+		}
+		memset(frame, 0, PAGE_SIZE);
+
+		/* Every processor runs an idle task, another one may have filled the pool meanwhile */
+		int full = 0;
+		CRITICAL_SECTION({
+			if(vmem_zero_pool->count < VMEM_ZERO_POOL_SIZE){
+				vmem_zero_pool->frames[vmem_zero_pool->count++] = frame;
+			} else {
+				full = 1;
 			}
-			return NULL;
+			if(vmem_zero_pool->count == VMEM_ZERO_POOL_SIZE){
+				vmem_zero_pool->refilling = 0;
+			}
+		});
+		if(full){
+			vmem_free_frame(frame);
+			break;
 		}
-		int bit = (paddr - VMEM_START_ADDRESS)/PAGE_SIZE;
-		allocation->bits[i] = bit;
-		//dbgprintf("Allocating %d continious blocks on heap 0x%x.\n", num, heap_table);
-		vmem_map(heap_table, (uint32_t)allocation->basevaddr+(i*PAGE_SIZE), paddr, access);
+		added++;
 	}
 
-	return allocation;
+	return added;
 }
 
-static int vmem_page_region_alloc(struct vmem_page_region* pages, int size)
+error_t vmem_zero_pool_get_info(struct vmem_zero_pool_info* info)
 {
-	ERR_ON_NULL(pages);
+	ERR_ON_NULL(info);
 
-	pages->used += size;
-	pages->refs++;
+	CRITICAL_SECTION({
+		info->count = vmem_zero_pool->count;
+		info->size = VMEM_ZERO_POOL_SIZE;
+		info->hits = vmem_zero_pool->hits;
+		info->misses = vmem_zero_pool->misses;
+	});
 
-	return 0;
+	return ERROR_OK;
 }
 
-static int vmem_free_page_region(struct pcb* pcb, struct vmem_page_region* region, int size)
+/**
+ * @brief Per process heap
+ * The heap spans the single page table mapped at VMEM_HEAP. Blocks are described by
+ * struct allocation nodes kept in kernel memory, never inside the user heap itself.
+ * All blocks form an address ordered list (the boundary tags) so neighbours can be
+ * coalesced in O(1) on free. Free blocks are kept in segregated free lists by size class,
+ * with a bitmap of non empty classes, and allocated blocks are found by address in a hash table.
+ * Allocating only reserves the pages a block covers, they are backed by a zeroed frame
+ * on first access (see vmem_page_fault) and unmapped when the last block on them is freed.
+ * The heap spinlock protects the lists, page_refs, mapped_pages and the heap page table.
+ * vmem_stack_alloc expects the caller to hold it, vmem_stack_free and the page fault path take it themselves.
+ * Frames are allocated and freed outside of it, the frame allocator may block.
+ */
+
+#define VMEM_HEAP_HASH(addr) ((((uint32_t)(addr)) >> 4) % VMEM_HEAP_BUCKETS)
+
+/* Size classes: 16 exact classes of 16 bytes up to 256 bytes, then one class per power of two. */
+static inline int vmem_heap_class(int size)
 {
-	ERR_ON_NULL(region);
-	if(region->refs > 1){
-		region->refs--;
-		region->used -= size;
-		return 0;
+	if(size <= VMEM_HEAP_SMALL_LIMIT){
+		return size / VMEM_HEAP_ALIGN - 1;
 	}
 
-	dbgprintf("Freeing %d pages. 0x%x\n", region->size/PAGE_SIZE, region->basevaddr);
+	int class = VMEM_HEAP_SMALL_CLASSES + (31 - __builtin_clz(size - 1)) - 8;
+	return class < VMEM_HEAP_CLASSES ? class : VMEM_HEAP_CLASSES - 1;
+}
 
-	int num_pages = region->size / PAGE_SIZE;
-	dbgprintf("Freeing %d pages\n", num_pages);
-	for (int i = 0; i < num_pages; i++){
-		if(region->bits[i] == 0) continue;
-		
-		/* Free the physical page */
-		void* paddr = (void*) (vmem_default->start + (region->bits[i] * PAGE_SIZE));
-		vmem_default->ops->free(vmem_default, (void*) paddr);
+static void vmem_heap_free_list_add(struct virtual_allocations* heap, struct allocation* block)
+{
+	int class = vmem_heap_class(block->size);
 
-		/* Unmap the virtual page */
-		void* vaddr = (void*) (region->basevaddr + (i * PAGE_SIZE));
-		dbgprintf("Unmapping 0x%x\n", vaddr);
-		uint32_t* heap_table = vmem_get_page_table(pcb, (uint32_t)vaddr);
-		dbgprintf("Table: 0x%x\n", heap_table);
+	block->fprev = NULL;
+	block->fnext = heap->free[class];
+	if(heap->free[class] != NULL){
+		heap->free[class]->fprev = block;
+	}
+	heap->free[class] = block;
+	heap->free_map |= 1U << class;
+
+	heap->free_bytes += block->size;
+	heap->free_blocks++;
+}
 
-		vmem_unmap(heap_table, (uint32_t)vaddr);
+static void vmem_heap_free_list_remove(struct virtual_allocations* heap, struct allocation* block)
+{
+	int class = vmem_heap_class(block->size);
+
+	if(block->fprev != NULL){
+		block->fprev->fnext = block->fnext;
+	} else {
+		heap->free[class] = block->fnext;
+	}
+	if(block->fnext != NULL){
+		block->fnext->fprev = block->fprev;
 	}
-	kfree(region->bits);
-	kfree(region);
+	if(heap->free[class] == NULL){
+		heap->free_map &= ~(1U << class);
+	}
+	block->fprev = NULL;
+	block->fnext = NULL;
 
-	return 0;
+	heap->free_bytes -= block->size;
+	heap->free_blocks--;
+}
+
+static void vmem_heap_hash_add(struct virtual_allocations* heap, struct allocation* block)
+{
+	int bucket = VMEM_HEAP_HASH(block->address);
+	block->hnext = heap->hash[bucket];
+	heap->hash[bucket] = block;
+}
+
+static struct allocation* vmem_heap_hash_remove(struct virtual_allocations* heap, void* ptr)
+{
+	struct allocation** iter = &heap->hash[VMEM_HEAP_HASH(ptr)];
+	while(*iter != NULL){
+		if((*iter)->address == ptr){
+			struct allocation* block = *iter;
+			*iter = block->hnext;
+			block->hnext = NULL;
+			return block;
+		}
+		iter = &(*iter)->hnext;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Finds a free block of at least size bytes.
+ * Takes the first block of the smallest non empty class which is guaranteed to fit,
+ * only falls back to searching its own class if no larger class has free blocks.
+ */
+static struct allocation* vmem_heap_find_free(struct virtual_allocations* heap, int size)
+{
+	int class = vmem_heap_class(size);
+
+	/* Blocks in exact classes always fit, range classes may hold smaller blocks. */
+	uint32_t mask = heap->free_map & (~0U << (class < VMEM_HEAP_SMALL_CLASSES ? class : class + 1));
+	if(mask != 0){
+		return heap->free[__builtin_ctz(mask)];
+	}
+
+	for (struct allocation* iter = heap->free[class]; iter != NULL; iter = iter->fnext){
+		if(iter->size >= size) return iter;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Coalesces a block with its free neighbours and puts it on a free list.
+ */
+static void vmem_heap_release(struct virtual_allocations* heap, struct allocation* block)
+{
+	/* Coalesce with the following block */
+	struct allocation* next = block->next;
+	if(next != NULL && next->used == 0){
+		vmem_heap_free_list_remove(heap, next);
+		block->size += next->size;
+		block->next = next->next;
+		if(next->next != NULL) next->next->prev = block;
+		kmem_cache_free(vmem_allocation_cache, next);
+	}
+
+	/* Coalesce with the previous block */
+	struct allocation* prev = block->prev;
+	if(prev != NULL && prev->used == 0){
+		vmem_heap_free_list_remove(heap, prev);
+		prev->size += block->size;
+		prev->next = block->next;
+		if(block->next != NULL) block->next->prev = prev;
+		kmem_cache_free(vmem_allocation_cache, block);
+		block = prev;
+	}
+
+	vmem_heap_free_list_add(heap, block);
+}
+
+/**
+ * @brief Reserves the pages covered by a block, refcounted per page.
+ * Pages are only backed by a frame on the first fault, see vmem_page_fault.
+ */
+static void vmem_heap_reserve_pages(struct virtual_allocations* heap, struct allocation* block)
+{
+	int first = ((uint32_t)block->address - VMEM_HEAP) / PAGE_SIZE;
+	int last = ((uint32_t)block->address + block->size - 1 - VMEM_HEAP) / PAGE_SIZE;
+
+	for (int page = first; page <= last; page++){
+		heap->page_refs[page]++;
+	}
+}
+
+/**
+ * @brief Drops the page references of a block from *page on, unmapping pages no other block uses.
+ * Stops once frames is full, the unmapped frames are freed by the caller outside of the heap spinlock.
+ * @warning Heap spinlock must be held.
+ * @return number of unmapped frames put in frames.
+ */
+static int vmem_heap_release_pages(struct pcb* pcb, struct virtual_allocations* heap, struct allocation* block, int* page, uint32_t* frames)
+{
+	uint32_t* heap_table = vmem_get_page_table(pcb, VMEM_HEAP);
+	int last = ((uint32_t)block->address + block->size - 1 - VMEM_HEAP) / PAGE_SIZE;
+	int unmapped = 0;
+
+	for (; *page <= last && unmapped < VMEM_HEAP_FREE_BATCH; (*page)++){
+		if(--heap->page_refs[*page] > 0 || heap_table[*page] == 0) continue;
+
+		frames[unmapped++] = heap_table[*page] & ~PAGE_MASK;
+		vmem_unmap(heap_table, VMEM_HEAP + *page*PAGE_SIZE);
+		tlb_flush_addr(VMEM_HEAP + *page*PAGE_SIZE);
+		heap->mapped_pages--;
+	}
+
+	return unmapped;
+}
+
+/**
+ * @brief Lazily sets up the heap on first use, kernel threads rarely need one.
+ */
+static int vmem_heap_init(struct virtual_allocations* heap)
+{
+	heap->page_refs = kcalloc(sizeof(uint16_t)*VMEM_HEAP_PAGES);
+	if(heap->page_refs == NULL){
+		return -ERROR_ALLOC;
+	}
+
+	struct allocation* block = kmem_cache_zalloc(vmem_allocation_cache);
+	if(block == NULL){
+		kfree(heap->page_refs);
+		heap->page_refs = NULL;
+		return -ERROR_ALLOC;
+	}
+
+	block->address = (uint32_t*) VMEM_HEAP;
+	block->size = VMEM_HEAP_SIZE;
+	heap->head = block;
+	vmem_heap_free_list_add(heap, block);
+
+	return ERROR_OK;
+}
+
+struct virtual_allocations* vmem_heap_create(int pid)
+{
+	struct virtual_allocations* heap = create(struct virtual_allocations);
+	if(heap == NULL){
+		return NULL;
+	}
+	heap->pid = pid;
+	spinlock_init(&heap->spinlock);
+	sem_init(&heap->fault_lock, 1);
+
+	return heap;
 }
 
 int vmem_free_allocations(struct pcb* pcb)
@@ -235,34 +520,33 @@ int vmem_free_allocations(struct pcb* pcb)
 	uint32_t heap_table = (uint32_t)pcb->page_dir[DIRECTORY_INDEX(VMEM_HEAP)] & ~PAGE_MASK;
 	assert(heap_table != 0);
 
-	if(pcb->allocations->head == NULL){
-		kfree(pcb->allocations);
-		return 0;
-	}
+	/* Called for the last pcb using the heap, nothing else can take its spinlock */
+	struct virtual_allocations* heap = pcb->allocations;
+
 	ENTER_CRITICAL();
-	
-	/* Free all malloc allocation */
-	struct allocation* iter = pcb->allocations->head;
-	/**
-	 * @brief Very weird bug: a corrupt allocation at 0x1b0004
-	 * causes a page fault when trying to free it.
-	 * This somehow fixes it, but I have no idea why.
-	 */
-	while(iter != NULL && (int)iter != 0x1b0004){
-		struct allocation* old = iter;
-		iter = iter->next;
 
-		dbgprintf("Freeing %d bytes of data from 0x%x (0x%x)\n", old->size, old->address, old);
-		dbgprintf("head: 0x%x\n", pcb->allocations->head);
-		vmem_free_page_region(pcb, old->region, old->size);
-	
-		kfree(old);
+	/* Heap is set up on first allocation */
+	if(heap->head != NULL){
+		/* The whole heap is going away, free every mapped page regardless of refcount */
+		for (int page = 0; page < VMEM_HEAP_PAGES; page++){
+			if(heap->page_refs[page] == 0 || ((uint32_t*)heap_table)[page] == 0) continue;
+
+			uint32_t paddr = ((uint32_t*)heap_table)[page] & ~PAGE_MASK;
+			vmem_default->ops->free(vmem_default, (void*) paddr);
+			vmem_unmap((uint32_t*)heap_table, VMEM_HEAP + page*PAGE_SIZE);
+		}
+
+		struct allocation* iter = heap->head;
+		while(iter != NULL){
+			struct allocation* old = iter;
+			iter = iter->next;
+			kmem_cache_free(vmem_allocation_cache, old);
+		}
+		kfree(heap->page_refs);
 	}
 
 	vmem_default->ops->free(vmem_default, (void*) heap_table);
-	
-	/* Free allocation list */
-	kfree(pcb->allocations);
+	kfree(heap);
 
 	LEAVE_CRITICAL();
 
@@ -295,250 +579,546 @@ void __deprecated vmem_free_allocation(struct allocation* allocation)
 
 }
 
-
 /**
- * @brief Frees a virtual stack allocation
- * 
+ * @brief Frees a heap allocation
+ * Looks up the block by address, unmaps pages no other block uses and
+ * coalesces the block with free neighbours before putting it back on a free list.
+ * Takes the heap spinlock, unmapped frames are freed in batches after dropping it.
+ * The block is in neither the hash table nor a free list meanwhile, so its pages stay reserved.
  * @param pcb Process to free from.
  * @param ptr Pointer to the address to free.
  */
 void vmem_stack_free(struct pcb* pcb, void* ptr)
 {
-	/* Check if allocation is first in list */
+	struct virtual_allocations* heap = pcb->allocations;
+	uint32_t frames[VMEM_HEAP_FREE_BATCH];
+
+	spin_lock(&heap->spinlock);
 
-	if(pcb->allocations->head == NULL){
-		warningf("Trying to free allocation from empty list.\n");
+	struct allocation* block = vmem_heap_hash_remove(heap, ptr);
+	if(block == NULL){
+		spin_unlock(&heap->spinlock);
+		warningf("Trying to free unknown allocation 0x%x.\n", ptr);
 		return;
 	}
 
-	if(ptr == pcb->allocations->head->address){
-		struct allocation* old = pcb->allocations->head;
-		pcb->allocations->head = pcb->allocations->head->next;
-		pcb->used_memory -= old->size;
+	heap->allocated_bytes -= block->size;
+	heap->allocated_blocks--;
+	pcb->used_memory -= block->size;
+	block->used = 0;
 
-		vmem_free_page_region(pcb, old->region, old->size);
-		
-		dbgprintf("[1] Free %d bytes of data from 0x%x\n", old->size, old->address);
-		return;
-	}
+	kmemtrace_free(KMEMTRACE_HEAP, ptr, heap->pid);
 
-	/* Iterates over all allocations to find ptr */
-	struct allocation* iter = pcb->allocations->head;
-	while(iter->next != NULL){
-		if(iter->next->address == ptr){
-			
-			struct allocation* save = iter->next;
-			iter->next = iter->next->next;
-			pcb->used_memory -= save->size;
+	int page = ((uint32_t)block->address - VMEM_HEAP) / PAGE_SIZE;
+	int last = ((uint32_t)block->address + block->size - 1 - VMEM_HEAP) / PAGE_SIZE;
+	while(1){
+		int unmapped = vmem_heap_release_pages(pcb, heap, block, &page, frames);
+		int done = page > last;
+		if(done){
+			vmem_heap_release(heap, block);
+		}
+
+		spin_unlock(&heap->spinlock);
 
-			vmem_free_page_region(pcb, save->region, save->size);
-			
-			dbgprintf("[2] Free %d bytes of data from 0x%x\n", save->size, save->address);
-			return;
+		/* Threads of the process may run on other processors and still cache the frames */
+		if(unmapped > 0){
+			smp_tlb_shootdown();
 		}
-		iter = iter->next;
+		for (int i = 0; i < unmapped; i++){
+			vmem_default->ops->free(vmem_default, (void*) frames[i]);
+		}
+
+		if(done) break;
+
+		spin_lock(&heap->spinlock);
 	}
+
+	dbgprintf("Free data from 0x%x\n", ptr);
 }
 
 /**
- * 
- * @brief Allocates a chunk of virtual memory for the specified process control block (PCB).
- * The vmem_stack_alloc() function is responsible for allocating a contiguous block of virtual memory for the given PCB.
- * It uses a page-aligned size and ensures that the allocation aligns with page boundaries for efficient memory management.
- * If the PCB's allocations list is empty, the function allocates memory from the beginning of the virtual memory heap.
- * Otherwise, it traverses the list of existing allocations to find a suitable gap for the new allocation. If a suitable space is found,
- * the function inserts the new allocation into the list and updates the memory map accordingly.
- * In case no suitable gap is found in the existing allocations, the function adds the new allocation at the end, extending the virtual memory heap.
- * It then updates the memory map to include the newly allocated pages.
+ * @brief Allocates a chunk of the heap for the specified process control block (PCB).
+ * Finds a free block through the segregated free lists and splits off the remainder.
+ * Only virtual space is reserved, pages are backed on first access.
+ * @warning Heap spinlock must be held.
  * @param pcb A pointer to the process control block (PCB) for which memory needs to be allocated.
  * @param _size The size of memory to be allocated in bytes.
+ * @param caller Allocation site the block is traced under, see kmemtrace.
  * @return A pointer to the start of the allocated memory block, or NULL if the allocation fails.
- * @note The function uses page-aligned sizes and ensures efficient memory utilization.
- * @note The function assumes that the vmem_continious_allocation_map() function is defined and handles memory mapping.
- * @note The function uses kalloc() to allocate memory for internal data structures (e.g., struct allocation and bits array).
- * TODO: Needs to be synchronized among threads.
  */
-void* vmem_stack_alloc(struct pcb* pcb, int _size)
+void* vmem_stack_alloc(struct pcb* pcb, int _size, uintptr_t caller)
 {
-	int size = vmem_page_align_size(_size);
-	int num_pages = size / PAGE_SIZE;
+	struct virtual_allocations* heap = pcb->allocations;
+	if(_size <= 0 || _size > VMEM_HEAP_SIZE) return NULL;
 
-	struct allocation* allocation = create(struct allocation);
-	if(allocation == NULL){
-		warningf("Out memory\n");
+	if(heap->head == NULL && vmem_heap_init(heap) < 0){
+		warningf("Out of memory\n");
 		return NULL;
 	}
-	dbgprintf("New allocation: 0x%x\n", allocation);
-	
-	allocation->size = _size;
-	allocation->used = _size;
 
-	/**
-	 * @brief Part1: Default case
-	 * Create a physical page allocation and attach it to the virtual allocation.
-	 * Setup the allocation size and adress and add it to the pcb.
-	 */
-	if(pcb->allocations->head == NULL){
+	int size = ALIGN(_size, VMEM_HEAP_ALIGN);
 
-		struct vmem_page_region* physical = vmem_create_page_region(pcb, (void*)VMEM_HEAP, num_pages, USER);
-		if(physical == NULL){
-			kfree(allocation);
-			warningf("Out of heap memory\n");
-			return NULL;
+	struct allocation* block = vmem_heap_find_free(heap, size);
+	if(block == NULL){
+		warningf("Out of heap memory\n");
+		return NULL;
+	}
+	vmem_heap_free_list_remove(heap, block);
+
+	/* Split off the remainder as a new free block */
+	if(block->size - size >= VMEM_HEAP_ALIGN){
+		struct allocation* rest = kmem_cache_zalloc(vmem_allocation_cache);
+		if(rest != NULL){
+			rest->address = (uint32_t*)((uint32_t)block->address + size);
+			rest->size = block->size - size;
+			rest->prev = block;
+			rest->next = block->next;
+			if(block->next != NULL) block->next->prev = rest;
+			block->next = rest;
+			block->size = size;
+			vmem_heap_free_list_add(heap, rest);
 		}
-		allocation->region = physical;
-		
-		vmem_page_region_alloc(physical, _size);
+	}
 
-		allocation->address = (uint32_t*) VMEM_HEAP;
-		allocation->size = _size;
-		allocation->next = NULL;
+	block->used = _size;
+	vmem_heap_reserve_pages(heap, block);
 
-		pcb->allocations->head = allocation;
-		pcb->used_memory += size;
+	vmem_heap_hash_add(heap, block);
+	heap->allocated_bytes += block->size;
+	heap->allocated_blocks++;
+	pcb->used_memory += block->size;
 
-		dbgprintf("[1] Allocated %d bytes of data to 0x%x\n", _size, allocation->address);
-		return (void*) allocation->address;
-	}
+	kmemtrace_alloc(KMEMTRACE_HEAP, block->address, block->size, caller, heap->pid);
 
-	/**
-	 * @brief Part 1.5: If first allocation is freed, allocate from start of heap.
-	 */
-	if(pcb->allocations->head->address > (uint32_t*) VMEM_HEAP && pcb->allocations->head->address <= (uint32_t*) VMEM_HEAP+size){
-
-		/* TODO: Clean this up, redudent code */
-		struct vmem_page_region* physical = vmem_create_page_region(pcb, (void*)VMEM_HEAP, num_pages, USER);
-		if(physical == NULL){
-			kfree(allocation);
-			warningf("Out of heap memory\n");
-			return NULL;
+	dbgprintf("Allocated %d bytes of data to 0x%x\n", _size, block->address);
+	return (void*) block->address;
+}
+
+/**
+ * @brief Gets usage and fragmentation statistics of a process heap.
+ * @param pcb Process owning the heap.
+ * @param info Output statistics.
+ * @return 0 on success, error code on failure.
+ */
+error_t vmem_heap_get_info(struct pcb* pcb, struct vmem_heap_info* info)
+{
+	ERR_ON_NULL(pcb);
+	ERR_ON_NULL(info);
+	ERR_ON_NULL(pcb->allocations);
+
+	struct virtual_allocations* heap = pcb->allocations;
+	struct vmem_heap_info _info = {0};
+
+	SPINLOCK(heap, {
+		_info.allocated_bytes = heap->allocated_bytes;
+		_info.allocated_blocks = heap->allocated_blocks;
+		_info.free_bytes = heap->free_bytes;
+		_info.free_blocks = heap->free_blocks;
+		_info.mapped_pages = heap->mapped_pages;
+
+		/* Largest free block is in the highest non empty class */
+		if(heap->free_map != 0){
+			int class = 31 - __builtin_clz(heap->free_map);
+			for (struct allocation* iter = heap->free[class]; iter != NULL; iter = iter->fnext){
+				if(iter->size > _info.largest_free) _info.largest_free = iter->size;
+			}
 		}
-		allocation->region = physical;
-		
-		vmem_page_region_alloc(physical, _size);
+	});
+
+	/* Percentage of free memory not usable by the largest possible allocation */
+	_info.fragmentation = _info.free_bytes == 0 ? 0 : 100 - (_info.largest_free * 100) / _info.free_bytes;
+
+	*info = _info;
+	return ERROR_OK;
+}
+
+void vmem_dump_heap(struct allocation* allocation)
+{
+	dbgprintf(" ------- Memory Heap --------\n");
+	struct allocation* iter = allocation;
+	while(iter != NULL){
+		dbgprintf("     0x%x --- size %d (%s)\n", iter->address, iter->size, iter->used ? "used" : "free");
+		iter = iter->next;
+	}
+	dbgprintf(" -------     &End     --------\n");
+}
+
+/**
+ * @brief Demand paging
+ * Heap pages reserved by vmem_stack_alloc and user stack pages are not backed
+ * by a physical frame until they are first accessed. The page fault handler
+ * then maps a zeroed frame and restarts the faulting instruction.
+ * The stack grows down from VMEM_STACK until VMEM_STACK_LIMIT, the page below
+ * is a guard page which is never mapped so overflows are caught.
+ * Program pages are mapped from the program image on first access, read-only
+ * pages share the image frame and writable pages are shared copy-on-write (PAGE_COW)
+ * until the first write. Program pages only covering bss get a private zeroed frame.
+ */
 
-		allocation->address = (uint32_t*) VMEM_HEAP;
-		allocation->size = _size;
-		allocation->next = NULL;
+/* Bytes of address space covered by a single page table */
+#define VMEM_TABLE_SPAN (PAGE_SIZE*1024)
 
-		dbgprintf("[1.5] Allocated %d bytes of data to 0x%x\n", _size, allocation->address);
-		return (void*) allocation->address;
+/**
+ * @brief Backs a single page with a zeroed frame.
+ */
+static error_t vmem_fault_in(uint32_t* table, uint32_t vaddr)
+{
+	uint32_t* frame = vmem_alloc_zeroed_frame();
+	if(frame == NULL){
+		return -ERROR_OUT_OF_MEMORY;
 	}
 
-	/**
-	 * @brief Part 2: Find spot for allocation.
-	 * Iterate over all allocations and find a spot where the next allocation is far enough away.
-	 * Two options, first option is finding a free allocation inside a already allocated phsyical page region.
-	 * Then we can simply add new allocation to the exisitng one physical one.
-	 * Second option is we need to allocate a new physical page allocation, between two existing ones.
-	 */
-	struct allocation* iter = pcb->allocations->head;
-	while(iter->next != NULL){
-
-		/**
-		 * @brief This case checks if there is space inside a single physical allocation (between virtual allocations).
-		 * Also, means the physical area is already mapped so we can attach to the existing one.
-		 */
-		if((uint32_t)(iter->next->address) - ((uint32_t)(iter->address)+iter->size) >= (uint32_t)_size && iter->region == iter->next->region){
-			
-			/* Found spot for allocation */
-			allocation->address = (uint32_t*)((uint32_t)(iter->address)+iter->size);
-			allocation->region = iter->region;
-
-			struct allocation* next = iter->next;
-			iter->next = allocation;
-			allocation->next = next;
-
-			vmem_page_region_alloc(iter->region, _size);
-			dbgprintf("[2] Allocated %d bytes of data to 0x%x\n", _size, allocation->address);
-			return (void*) allocation->address;
+	vmem_map(table, vaddr, (uint32_t) frame, USER);
+
+	return ERROR_OK;
+}
+
+/**
+ * @brief Maps a zeroed frame at a heap page if it is part of a reserved block.
+ * The frame allocator may block, so the frame is allocated before taking the heap spinlock.
+ * The page is checked and mapped under it, so a block freed meanwhile can not leave a mapped
+ * page without references behind. The spare frame is freed if the page is not mapped with it.
+ * @return 0 on success, -ERROR_ACCESS_DENIED if the page is not reserved.
+ */
+static error_t vmem_map_heap(struct pcb* pcb, uint32_t vaddr)
+{
+	struct virtual_allocations* heap = pcb->allocations;
+	uint32_t* table = vmem_get_page_table(pcb, VMEM_HEAP);
+	error_t ret = -ERROR_ACCESS_DENIED;
+
+	if(table == NULL){
+		return -ERROR_ACCESS_DENIED;
+	}
+
+	uint32_t* frame = vmem_alloc_zeroed_frame();
+	if(frame == NULL){
+		return -ERROR_OUT_OF_MEMORY;
+	}
+
+	SPINLOCK(heap, {
+		if(heap->page_refs == NULL || heap->page_refs[(vaddr - VMEM_HEAP) / PAGE_SIZE] == 0) break;
+
+		/* Another thread of the process mapped the page first */
+		if(table[TABLE_INDEX(vaddr)] & PRESENT){
+			ret = ERROR_OK;
+			break;
 		}
-	
-		/**
-		 * @brief This case checks if there is space at the end of a phsyical region.
-		 * Only is possible if the next allocation is in a different physical region.
-		 * @note This is mostly for reusing the virtual heap address space.
-		 */
-		int space_at_end = ((uint32_t)(iter->region->basevaddr)+iter->region->size) - ((uint32_t)(iter->address)+iter->size);
-		if(iter->region != iter->next->region && space_at_end >= _size)
-		{
-			/* Found spot for allocation */
-			allocation->address = (uint32_t*)((uint32_t)(iter->address)+iter->size);
-			allocation->region = iter->region;
-
-			struct allocation* next = iter->next;
-			iter->next = allocation;
-			allocation->next = next;
-
-			vmem_page_region_alloc(iter->region, _size);
-
-			dbgprintf("[2.5] Allocated %d bytes of data to 0x%x\n", _size, allocation->address);
-			return (void*) allocation->address;
 
+		vmem_map(table, vaddr, (uint32_t) frame, USER);
+		heap->mapped_pages++;
+		frame = NULL;
+		ret = ERROR_OK;
+	});
+
+	if(frame != NULL){
+		vmem_free_frame(frame);
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Maps a zeroed frame at a reserved heap page or a user stack page.
+ * @return 0 on success, -ERROR_ACCESS_DENIED if the page is not reserved.
+ */
+static error_t vmem_map_reserved(struct pcb* pcb, uint32_t vaddr)
+{
+	uint32_t* table = NULL;
+
+	if(vaddr >= VMEM_HEAP && vaddr < VMEM_HEAP + VMEM_HEAP_SIZE){
+		return vmem_map_heap(pcb, vaddr);
+	} else if(vaddr >= VMEM_STACK_LIMIT && vaddr < VMEM_STACK_TOP){
+		/* Kernel threads have no user stack table */
+		table = vmem_get_page_table(pcb, VMEM_STACK);
+	} else if(vaddr >= VMEM_STACK_LIMIT - PAGE_SIZE && vaddr < VMEM_STACK_LIMIT){
+		warningf("Stack overflow in %s (0x%x)\n", pcb->name, vaddr);
+	}
+
+	if(table == NULL){
+		return -ERROR_ACCESS_DENIED;
+	}
+
+	/* Stacks are private to a thread, the page may have been populated ahead of time */
+	if(table[TABLE_INDEX(vaddr)] & PRESENT){
+		return ERROR_OK;
+	}
+
+	return vmem_fault_in(table, vaddr);
+}
+
+/**
+ * @brief Gives the process a private copy of a shared program page.
+ * @return 0 on success, -ERROR_ACCESS_DENIED if the page is not copy-on-write.
+ */
+static error_t vmem_copy_on_write(struct pcb* pcb, uint32_t vaddr)
+{
+	uint32_t* table = vmem_get_page_table(pcb, vaddr);
+	if(table == NULL || !(table[TABLE_INDEX(vaddr)] & PRESENT)){
+		return -ERROR_ACCESS_DENIED;
+	}
+
+	/* Another thread of the process already made the private copy */
+	if((table[TABLE_INDEX(vaddr)] & (READ_WRITE | PAGE_COW)) == READ_WRITE){
+		return ERROR_OK;
+	}
+
+	if(!(table[TABLE_INDEX(vaddr)] & PAGE_COW)){
+		return -ERROR_ACCESS_DENIED;
+	}
+
+	uint32_t* frame = vmem_default->ops->alloc(vmem_default);
+	if(frame == NULL){
+		return -ERROR_OUT_OF_MEMORY;
+	}
+
+	memcpy(frame, (void*)(table[TABLE_INDEX(vaddr)] & ~PAGE_MASK), PAGE_SIZE);
+	vmem_map(table, vaddr, (uint32_t) frame, USER);
+	tlb_flush_addr(vaddr);
+	smp_tlb_shootdown();
+
+	dbgprintf("[VMEM] Copied page 0x%x for %s\n", vaddr, pcb->name);
+
+	return ERROR_OK;
+}
+
+/**
+ * @brief Maps a page of the program image.
+ * Pages with file contents are mapped to the frame shared through the image, which is
+ * read from disk by the first process touching it. A write fault on a writable page
+ * copies it right away instead of taking a second fault on the shared mapping.
+ * @return 0 on success, -ERROR_ACCESS_DENIED if the page is not part of the program.
+ */
+static error_t vmem_map_program(struct pcb* pcb, uint32_t vaddr, uint32_t err)
+{
+	struct program_image* image = pcb->image;
+	if(image == NULL){
+		return -ERROR_ACCESS_DENIED;
+	}
+
+	int flags = program_image_page_flags(image, vaddr);
+	uint32_t* table = vmem_get_page_table(pcb, vaddr);
+	if(!(flags & PROGRAM_PAGE_MAPPED) || table == NULL){
+		return -ERROR_ACCESS_DENIED;
+	}
+
+	/* Another thread of the process mapped the page first, a write may still have to copy it */
+	if(table[TABLE_INDEX(vaddr)] & PRESENT){
+		if((err & PAGE_FAULT_WRITE) && (table[TABLE_INDEX(vaddr)] & PAGE_COW)){
+			return vmem_copy_on_write(pcb, vaddr);
 		}
+		return ERROR_OK;
+	}
 
-		iter = iter->next;
+	if(!(flags & PROGRAM_PAGE_FILE)){
+		RETURN_ON_ERR(vmem_fault_in(table, vaddr));
+		pcb->minor_faults++;
+		return ERROR_OK;
 	}
 
-	/**
-	 * @brief Part 2.5: Check if there is space at the end of the last allocation.
-	 * This avoids creating new physical page allocations.
-	 */
-	int space_at_end = ((uint32_t)(iter->region->basevaddr)+iter->region->size) - ((uint32_t)(iter->address)+iter->size);
-	if(space_at_end >= _size)
-	{
-		/* Found spot for allocation */
-		allocation->address = (uint32_t*)((uint32_t)(iter->address)+iter->size);
-		allocation->region = iter->region;
+	int loaded = 0;
+	uint32_t frame = program_image_frame(image, vaddr, &loaded);
+	if(frame == 0){
+		return -ERROR_OUT_OF_MEMORY;
+	}
 
-		struct allocation* next = iter->next;
-		iter->next = allocation;
-		allocation->next = next;
+	if(loaded){
+		pcb->major_faults++;
+	} else {
+		pcb->minor_faults++;
+	}
 
-		vmem_page_region_alloc(iter->region, _size);
+	if(!(flags & PROGRAM_PAGE_WRITE)){
+		vmem_map_readonly(table, vaddr, frame);
+		return ERROR_OK;
+	}
 
-		dbgprintf("[3] Allocated %d bytes of data to 0x%x\n", _size, allocation->address);
-		return (void*) allocation->address;
+	vmem_map_cow(table, vaddr, frame);
+	if(err & PAGE_FAULT_WRITE){
+		RETURN_ON_ERR(vmem_copy_on_write(pcb, vaddr));
 	}
 
-	/**
-	 * @brief Part 3: No spot found, allocate at end of heap.
-	 * At this point we have not found a spot inbetween existing allocations, so append at the end.
-	 * This means we need to allocate a new physical page allocation.
-	 * @note "iter" will point to the last element in the allocation list.
-	 */
-	struct vmem_page_region* physical = vmem_create_page_region(pcb, (void*)((byte_t*)iter->region->basevaddr + iter->region->size), num_pages, USER);
-	if(physical == NULL){
-		kfree(allocation);
-		warningf("Out of heap memory\n");
-		return NULL;
+	return ERROR_OK;
+}
+
+/**
+ * @brief Frees the private program pages of a process and the program page tables,
+ * then drops the reference on the program image.
+ * @return number of freed pages.
+ */
+static int vmem_free_program(struct pcb* pcb)
+{
+	int freed_pages = 0;
+	struct program_image* image = pcb->image;
+	uint32_t end = image->start + image->pages*PAGE_SIZE;
+
+	for (uint32_t addr = image->start & ~(VMEM_TABLE_SPAN-1); addr < end; addr += VMEM_TABLE_SPAN){
+		uint32_t* table = vmem_get_page_table(pcb, addr);
+		assert(table != NULL);
+
+		for (int i = 0; i < 1024; i++){
+			if(table[i] == 0) continue;
+
+			/* Pages still shared with the program image are left to the image */
+			uint32_t vaddr = addr + i*PAGE_SIZE;
+			int page = (vaddr - image->start) / PAGE_SIZE;
+			if(vaddr >= image->start && page < image->pages && image->frames[page] == (table[i] & ~PAGE_MASK)) continue;
+
+			vmem_default->ops->free(vmem_default, (void*)(table[i] & ~PAGE_MASK));
+			freed_pages++;
+		}
+
+		vmem_default->ops->free(vmem_default, (void*) table);
+		freed_pages++;
 	}
-	allocation->region = physical;
 
-	allocation->address = (uint32_t*)((uint32_t)(iter->region->basevaddr)+iter->region->size);
-	vmem_page_region_alloc(allocation->region, _size);
-	allocation->next = NULL;
+	program_image_put(image);
+	pcb->image = NULL;
 
-	pcb->used_memory += size;
-	iter->next = allocation;
-	dbgprintf("[3.5] Allocated %d bytes of data to 0x%x\n", _size, allocation->address);
-	return (void*) allocation->address;
+	return freed_pages;
 }
 
-void vmem_dump_heap(struct allocation* allocation)
+static error_t __vmem_page_fault(struct pcb* pcb, uint32_t addr, uint32_t err)
 {
-	dbgprintf(" ------- Memory Heap --------\n");
-	struct allocation* iter = allocation;
-	struct vmem_page_region* region = NULL;
-	while(iter != NULL){
-		if(region != iter->region){
-			region = iter->region;
-			dbgprintf(" ------- Region 0x%x -> 0x%x (%d/%d) %d refs --------\n", region->basevaddr, region->basevaddr+region->size, region->used, region->size, region->refs);
+	if(err & PAGE_FAULT_PRESENT){
+		if(!(err & PAGE_FAULT_WRITE)){
+			return -ERROR_ACCESS_DENIED;
 		}
-		dbgprintf("     0x%x --- size %d\n", iter->address, iter->used);
-		iter = iter->next;
+
+		RETURN_ON_ERR(vmem_copy_on_write(pcb, addr & ~PAGE_MASK));
+		pcb->minor_faults++;
+
+		return ERROR_OK;
 	}
-	dbgprintf(" -------     &End     --------\n");
+
+	if(addr >= VMEM_DATA && addr < VMEM_DATA_LIMIT){
+		return vmem_map_program(pcb, addr & ~PAGE_MASK, err);
+	}
+
+	RETURN_ON_ERR(vmem_map_reserved(pcb, addr & ~PAGE_MASK));
+	pcb->minor_faults++;
+
+	dbgprintf("[VMEM] Mapped page 0x%x for %s\n", addr & ~PAGE_MASK, pcb->name);
+
+	return ERROR_OK;
+}
+
+/**
+ * @brief Resolves a page fault by mapping a frame at the faulting address.
+ * Resolves not present faults on program pages, reserved heap pages and on the user stack,
+ * and write faults on copy-on-write program pages. Anything else (unreserved addresses,
+ * writes to read-only pages, the stack guard page) is an invalid access.
+ * @param pcb Process which faulted.
+ * @param addr Faulting address (cr2).
+ * @param err Page fault error code.
+ * @return 0 if the fault was resolved, negative error code otherwise.
+ */
+error_t vmem_page_fault(struct pcb* pcb, uint32_t addr, uint32_t err)
+{
+	ERR_ON_NULL(pcb);
+	ERR_ON_NULL(pcb->allocations);
+
+	error_t ret;
+
+	/* Threads share the page tables, the entry is checked again under the lock */
+	sem_wait(&pcb->allocations->fault_lock);
+	ret = __vmem_page_fault(pcb, addr, err);
+	sem_post(&pcb->allocations->fault_lock);
+
+	return ret;
+}
+
+/**
+ * @brief Maps all pages in a reserved range ahead of time.
+ * Used when the kernel has to write into the memory of a process which is not running.
+ * @return 0 on success, negative error code otherwise.
+ */
+error_t vmem_populate(struct pcb* pcb, uint32_t addr, int size)
+{
+	error_t ret = ERROR_OK;
+
+	sem_wait(&pcb->allocations->fault_lock);
+	for (uint32_t vaddr = addr & ~PAGE_MASK; vaddr < addr + size && ret == ERROR_OK; vaddr += PAGE_SIZE){
+		ret = vmem_map_reserved(pcb, vaddr);
+	}
+	sem_post(&pcb->allocations->fault_lock);
+
+	return ret;
+}
+
+/**
+ * @brief Resolves the faults a write to the address would take, without writing to it.
+ * Afterwards the address is backed by a frame private to the process, not a page shared
+ * copy-on-write with the program image. Used before keying anything on the frame, see futex.c.
+ * @return 0 on success, negative error code if a write to the address is an invalid access.
+ */
+error_t vmem_fault_writable(struct pcb* pcb, uint32_t addr)
+{
+	ERR_ON_NULL(pcb);
+	ERR_ON_NULL(pcb->allocations);
+
+	if(addr < VMEM_DATA || addr >= VMEM_STACK_TOP){
+		return -ERROR_ACCESS_DENIED;
+	}
+
+	error_t ret = ERROR_OK;
+
+	sem_wait(&pcb->allocations->fault_lock);
+	uint32_t* table = vmem_get_page_table(pcb, addr);
+	uint32_t entry = table != NULL ? table[TABLE_INDEX(addr)] : 0;
+	if(!(entry & PRESENT)){
+		ret = __vmem_page_fault(pcb, addr, PAGE_FAULT_WRITE);
+	} else if(!(entry & READ_WRITE)){
+		ret = __vmem_page_fault(pcb, addr, PAGE_FAULT_PRESENT | PAGE_FAULT_WRITE);
+	}
+	sem_post(&pcb->allocations->fault_lock);
+
+	return ret;
+}
+
+/**
+ * @brief Translates a mapped user address of the process.
+ * @param physical Output physical address.
+ * @return 0 on success, -ERROR_ACCESS_DENIED if the address is not a mapped user address.
+ */
+error_t vmem_get_physical(struct pcb* pcb, uint32_t addr, uint32_t* physical)
+{
+	ERR_ON_NULL(pcb);
+	ERR_ON_NULL(physical);
+
+	if(addr < VMEM_DATA || addr >= VMEM_STACK_TOP || !(pcb->page_dir[DIRECTORY_INDEX(addr)] & PRESENT)){
+		return -ERROR_ACCESS_DENIED;
+	}
+
+	uint32_t entry = vmem_get_page_table(pcb, addr)[TABLE_INDEX(addr)];
+	if(!(entry & PRESENT) || !(entry & USER)){
+		return -ERROR_ACCESS_DENIED;
+	}
+
+	*physical = (entry & ~PAGE_MASK) | (addr & PAGE_MASK);
+	return ERROR_OK;
+}
+
+/**
+ * @brief Frees all mapped pages of the user stack and the stack table.
+ * @return number of freed pages.
+ */
+static int vmem_free_stack(struct pcb* pcb)
+{
+	int freed_pages = 0;
+	uint32_t* stack_table = vmem_get_page_table(pcb, VMEM_STACK);
+	assert(stack_table != NULL);
+
+	for (uint32_t vaddr = VMEM_STACK_LIMIT; vaddr < VMEM_STACK_TOP; vaddr += PAGE_SIZE){
+		if(stack_table[TABLE_INDEX(vaddr)] == 0) continue;
+
+		vmem_default->ops->free(vmem_default, (void*)(stack_table[TABLE_INDEX(vaddr)] & ~PAGE_MASK));
+		freed_pages++;
+	}
+
+	vmem_default->ops->free(vmem_default, (void*) stack_table);
+	freed_pages++;
+
+	return freed_pages;
 }
 
 /**
@@ -558,23 +1138,17 @@ void vmem_init_process_thread(struct pcb* parent, struct pcb* thread)
 	 */
 	
 	/* inheret directory */
-	uint32_t* thread_directory = vmem_default->ops->alloc(vmem_default);
+	uint32_t* thread_directory = vmem_alloc_zeroed_frame();
 	for (int i = 0; i < 1024; i++){
 		/* copy over pages, this will include heap and data */
 		if(parent->page_dir[i] != 0) thread_directory[i] = parent->page_dir[i];
 	}
 
-	/* Allocate table for stack */
-	uint32_t* thread_stack_table = vmem_default->ops->alloc(vmem_default);
-	
-	/* create 8kb stack, 2 4kb pages */
-	uint32_t* thread_stack_page = vmem_default->ops->alloc(vmem_default);
-	memset(thread_stack_page, 0, PAGE_SIZE);
-	vmem_map(thread_stack_table, VMEM_STACK, (uint32_t) thread_stack_page, USER);
+	/* Allocate table for stack, the stack itself is mapped on demand. */
+	uint32_t* thread_stack_table = vmem_alloc_zeroed_frame();
 
-	uint32_t* thread_stack_page2 = vmem_default->ops->alloc(vmem_default);
-	memset(thread_stack_page2, 0, PAGE_SIZE);
-	vmem_map(thread_stack_table, VMEM_STACK+PAGE_SIZE, (uint32_t) thread_stack_page2, USER);
+	/* The first stack page is touched right away */
+	vmem_fault_in(thread_stack_table, VMEM_STACK & ~PAGE_MASK);
 
 	/* Insert and replace stack in directory. */
 	vmem_add_table(thread_directory, VMEM_STACK, thread_stack_table, USER);
@@ -589,26 +1163,21 @@ void vmem_init_process_thread(struct pcb* parent, struct pcb* thread)
  * @brief Initializes the virtual memory for the specified process control block (PCB).
  * The vmem_init_process() function is responsible for initializing the virtual memory for the given PCB.
  * @param pcb A pointer to the process control block (PCB) for which memory needs to be initialized.
- * @param data in memory data to be copied into the process data section.
- * @param size size of the data to be copied.
- * TODO: Should probably be on demand paging.
+ * @param image program image to map into the data section, the caller's reference is handed over to the pcb.
  */
-void vmem_init_process(struct pcb* pcb, byte_t* data, int size)
+void vmem_init_process(struct pcb* pcb, struct program_image* image)
 {
 	int allocated_pages = 0;
 
-	/* Allocate directory and tables for data and stack */
-	uint32_t* process_directory = vmem_default->ops->alloc(vmem_default);
+	/* Allocate directory and tables for stack and heap, unmapped entries must be empty */
+	uint32_t* process_directory = vmem_alloc_zeroed_frame();
 	allocated_pages++;
-	uint32_t* process_data_table = vmem_default->ops->alloc(vmem_default);
+	uint32_t* process_stack_table = vmem_alloc_zeroed_frame();
 	allocated_pages++;
-	uint32_t* process_stack_table = vmem_default->ops->alloc(vmem_default);
-	allocated_pages++;
-	uint32_t* process_heap_table = vmem_default->ops->alloc(vmem_default);
+	uint32_t* process_heap_table = vmem_alloc_zeroed_frame();
 	allocated_pages++;
 
 	dbgprintf("[INIT PROCESS] Directory: 0x%x\n", process_directory);
-	dbgprintf("[INIT PROCESS] Data: 	 0x%x\n", process_data_table);
 	dbgprintf("[INIT PROCESS] Stack:	 0x%x\n", process_stack_table);
 	dbgprintf("[INIT PROCESS] Heap: 	 0x%x\n", process_heap_table);
 
@@ -617,52 +1186,31 @@ void vmem_init_process(struct pcb* pcb, byte_t* data, int size)
 		if(kernel_page_dir[i] != 0) process_directory[i] = kernel_page_dir[i];
 	}
 
-	uint32_t* process_data_page;
-	/* Map the process data to a page */
-	int i = 0;
-	while (size > PAGE_SIZE){
-		process_data_page = vmem_default->ops->alloc(vmem_default);
+	/**
+	 * Program pages are mapped from the image on demand, only the tables are created
+	 * up front so threads created later share them through the copied directory.
+	 */
+	for (uint32_t addr = image->start & ~(VMEM_TABLE_SPAN-1); addr < image->start + image->pages*PAGE_SIZE; addr += VMEM_TABLE_SPAN){
+		uint32_t* process_data_table = vmem_alloc_zeroed_frame();
 		allocated_pages++;
-		/* copy in process data. */
-		memcpy(process_data_page, &data[i*PAGE_SIZE], PAGE_SIZE);
-		vmem_map(process_data_table, VMEM_DATA+(i*PAGE_SIZE), (uint32_t) process_data_page, USER);
-		size -= PAGE_SIZE;
-		i++;
-	}
-	/* fill in rest. */
-	process_data_page = vmem_default->ops->alloc(vmem_default);
-	allocated_pages++;
-	memcpy(process_data_page, &data[i*PAGE_SIZE], size);
-	vmem_map(process_data_table, VMEM_DATA+(i*PAGE_SIZE), (uint32_t) process_data_page, USER);
+		vmem_add_table(process_directory, addr, process_data_table, USER);
+	}
+	pcb->image = image;
 	dbgprintf("[INIT PROCESS] Finished mapping data.\n");
 
-	/* Map the process stack 8Kb to a page */
-	uint32_t* process_stack_page = vmem_default->ops->alloc(vmem_default);
-	allocated_pages++;
-	memset(process_stack_page, 0, PAGE_SIZE);
-	dbgprintf("[INIT PROCESS] Finished allocating 1/2 stack page.\n");
-	vmem_map(process_stack_table, VMEM_STACK, (uint32_t) process_stack_page, USER);
-	dbgprintf("[INIT PROCESS] Finished mapping 1/2 stack page.\n");
-
-	uint32_t* process_stack_page2 = vmem_default->ops->alloc(vmem_default);
+	/* The stack is mapped on demand, only map the first page which is touched right away */
+	vmem_fault_in(process_stack_table, VMEM_STACK & ~PAGE_MASK);
 	allocated_pages++;
-	dbgprintf("[INIT PROCESS] Finished allocating 2/2 stack page.\n");
-	memset(process_stack_page2, 0, PAGE_SIZE);
-	dbgprintf("[INIT PROCESS] Finished clearing 2/2 stack page.\n");
-	vmem_map(process_stack_table, VMEM_STACK-PAGE_SIZE, (uint32_t) process_stack_page2, USER);
 	dbgprintf("[INIT PROCESS] Finished mapping stack.\n");
 
 	/* Insert page and data tables in directory. */
 	vmem_add_table(process_directory, VMEM_HEAP, process_heap_table, USER);
 	vmem_add_table(process_directory, VMEM_STACK, process_stack_table, USER);
-	vmem_add_table(process_directory, VMEM_DATA, process_data_table, USER); 
 
-	pcb->allocations = create(struct virtual_allocations);
+	pcb->allocations = vmem_heap_create(pcb->pid);
 	if(pcb->allocations == NULL){
 		kernel_panic("Out of memory while allocating virtual memory allocations.");
 	}
-	pcb->allocations->head = NULL;
-	pcb->allocations->spinlock = 0;
 
 
 	dbgprintf("[INIT PROCESS] Process paging setup done: allocated %d pages.\n", allocated_pages);
@@ -684,14 +1232,7 @@ void vmem_cleanup_process_thead(struct pcb* thread)
 	 * 
 	 */
 
-	uint32_t stack_table = (uint32_t)thread->page_dir[DIRECTORY_INDEX(VMEM_STACK)] & ~PAGE_MASK;
-	uint32_t stack_page = (uint32_t)((uint32_t*)(thread->page_dir[DIRECTORY_INDEX(VMEM_STACK)] & ~PAGE_MASK))[TABLE_INDEX(VMEM_STACK)]& ~PAGE_MASK;
-	uint32_t stack_page2 = (uint32_t)((uint32_t*)(thread->page_dir[DIRECTORY_INDEX((VMEM_STACK-PAGE_SIZE))] & ~PAGE_MASK))[TABLE_INDEX(VMEM_STACK)]& ~PAGE_MASK;
-
-	vmem_default->ops->free(vmem_default, (void*) stack_page);
-	vmem_default->ops->free(vmem_default, (void*) stack_page2);
-	vmem_default->ops->free(vmem_default, (void*) stack_table);
-
+	vmem_free_stack(thread);
 	vmem_default->ops->free(vmem_default, (void*) thread->page_dir);
 
 }
@@ -721,43 +1262,17 @@ void vmem_cleanup_process(struct pcb* pcb)
 	uint32_t directory = (uint32_t)pcb->page_dir;
 
 	/**
-	 * Free all data pages, first get correct data table then
-	 * free all pages based on the size of pcb.
+	 * Free all private data pages (copied on write and bss),
+	 * pages still shared with the program image are left to the image.
 	 */
-	uint32_t data_table = (uint32_t)pcb->page_dir[DIRECTORY_INDEX(VMEM_DATA)] & ~PAGE_MASK;
-	assert(data_table != 0);
-
-	int size = pcb->data_size;
-	int i = 0;
-	while(size > 4096){
-		uint32_t data_page = (uint32_t)((uint32_t*)(pcb->page_dir[DIRECTORY_INDEX(VMEM_DATA)] & ~PAGE_MASK))[TABLE_INDEX((VMEM_DATA+(i*4096)))]& ~PAGE_MASK;
-		vmem_default->ops->free(vmem_default, (void*) data_page);
-		freed_pages++;
-		size -= 4096;
-		i++;
-	}
-	uint32_t data_page = (uint32_t)((uint32_t*)(pcb->page_dir[DIRECTORY_INDEX(VMEM_DATA)] & ~PAGE_MASK))[TABLE_INDEX((VMEM_DATA+(i*4096)))]& ~PAGE_MASK;
-	
-	vmem_default->ops->free(vmem_default, (void*) data_page);
-	freed_pages++;
-	vmem_default->ops->free(vmem_default, (void*) data_table);
-	freed_pages++;
+	freed_pages += vmem_free_program(pcb);
 
 	dbgprintf("[Memory] Cleaning up data from pcb [DONE].\n");
 
 	/**
 	 * Free all stack pages
 	 */
-	uint32_t stack_table = (uint32_t)pcb->page_dir[DIRECTORY_INDEX(VMEM_STACK)] & ~PAGE_MASK;
-	uint32_t stack_page = (uint32_t)((uint32_t*)(pcb->page_dir[DIRECTORY_INDEX(VMEM_STACK)] & ~PAGE_MASK))[TABLE_INDEX(VMEM_STACK)]& ~PAGE_MASK;
-	uint32_t stack_page2 = (uint32_t)((uint32_t*)(pcb->page_dir[DIRECTORY_INDEX((VMEM_STACK-PAGE_SIZE))] & ~PAGE_MASK))[TABLE_INDEX(VMEM_STACK)]& ~PAGE_MASK;
-
-	vmem_default->ops->free(vmem_default, (void*) stack_page);
-	freed_pages++;
-	vmem_default->ops->free(vmem_default, (void*) stack_page2);
-	freed_pages++;
-	vmem_default->ops->free(vmem_default, (void*) stack_table);
-	freed_pages++;
+	freed_pages += vmem_free_stack(pcb);
 
 	dbgprintf("[Memory] Cleaning up stack from pcb [DONE].\n");
 
@@ -776,57 +1291,109 @@ void vmem_cleanup_process(struct pcb* pcb)
 	dbgprintf("[Memory] Cleaning up pages from pcb: freed %d pages.\n", freed_pages);
 }
 
+/* CPU support for 4MB pages (PSE) and global pages (PGE), detected in vmem_init_kernel */
+static int vmem_large_pages = 0;
+static int vmem_global_pages = 0;
+
+/**
+ * @brief Identity maps [addr, addr+size) in the kernel directory as global supervisor pages.
+ * Each 4MB chunk starting inside the region is mapped with a single 4MB page when the CPU supports PSE
+ * and either the region covers the whole chunk, or round is set. Device apertures are aligned to their
+ * size, so a device region starting on a 4MB boundary can be rounded up to a full 4MB page.
+ * Everything else is mapped with 4KB pages, reusing the chunk's table if it already has one.
+ * @param vmem Allocator for page tables.
+ * @param addr Start of region, page aligned.
+ * @param size Size of region in bytes.
+ * @param round Map partially covered chunks starting in the region with 4MB pages.
+ * @return number of page tables allocated.
+ */
+static int vmem_identity_map(struct virtual_memory_allocator* vmem, uint32_t addr, uint32_t size, int round)
+{
+	int tables = 0;
+	uint32_t last = addr + size - 1;
+	uint32_t global = vmem_global_pages ? PAGE_GLOBAL : 0;
+
+	for (uint32_t chunk = addr & ~(VMEM_TABLE_SPAN-1);; chunk += VMEM_TABLE_SPAN){
+		/* Inclusive bounds, the last chunk ends at 0xFFFFFFFF */
+		uint32_t chunk_last = chunk + (VMEM_TABLE_SPAN-1);
+		uint32_t from = chunk > addr ? chunk : addr;
+		uint32_t to = chunk_last < last ? chunk_last : last;
+		uint32_t entry = kernel_page_dir[DIRECTORY_INDEX(chunk)];
+
+		if(entry & PAGE_LARGE){
+			/* Already mapped by a 4MB page */
+		} else if(vmem_large_pages && from == chunk && entry == 0 && (to == chunk_last || round)){
+			kernel_page_dir[DIRECTORY_INDEX(chunk)] = chunk | PAGE_LARGE | global | PRESENT | READ_WRITE;
+		} else {
+			uint32_t* table = (uint32_t*)(entry & ~PAGE_MASK);
+			if(table == NULL){
+				table = vmem->ops->alloc(vmem);
+				memset(table, 0, PAGE_SIZE);
+				vmem_add_table(kernel_page_dir, chunk, table, SUPERVISOR);
+				tables++;
+			}
+
+			for (uint32_t page = from & ~PAGE_MASK; page <= to && page >= chunk; page += PAGE_SIZE){
+				table[TABLE_INDEX(page)] = page | global | PRESENT | READ_WRITE;
+			}
+		}
+
+		if(chunk_last >= last) break;
+	}
+
+	return tables;
+}
+
 /**
  * @brief Initializes the virtual memory for the kernel.
  * The vmem_init_kernel() function is responsible for initializing the virtual memory for the kernel.
- * It first allocates a page directory and a page table for the kernel.
- * It then maps the first 4MB of the virtual memory to the first 4MB of the physical memory.
- * It then maps the virtual memory heap to the virtual memory address space.
+ * It first allocates a page directory, then identity maps the first 16MB of physical memory,
+ * using 4MB pages if the CPU supports PSE. The identity map is the same in every process and is marked global.
+ * It then adds the page table for the kernel heap, which is replaced in every process and not global.
  * @return void
- * @note The function uses the vmem_default_ops structure to initialize the virtual memory allocator for the kernel.
+ * @note The function uses the vmem_manager allocator for the kernel page directory and tables.
  */
 void vmem_init_kernel()
 {	
 	int total_mem = memory_map_get()->total;
 
-	kernel_page_dir = vmem_manager->ops->alloc(vmem_manager);
+	uint32_t features = cpuid_edx(1);
+	vmem_large_pages = (features & CPUID_EDX_PSE) != 0;
+	vmem_global_pages = (features & CPUID_EDX_PGE) != 0;
 
-	/* identity map first 4 mb of data. */
-	uint32_t* kernel_page_table = vmem_manager->ops->alloc(vmem_manager);
-	for (int addr = 0; addr < 0x400000; addr += PAGE_SIZE){
-		vmem_map(kernel_page_table, addr, addr, SUPERVISOR);
+	/* PSE has to be enabled before the directory is loaded, PGE is enabled after paging. */
+	if(vmem_large_pages){
+		lcr4(rcr4() | CR4_PSE);
 	}
 
-	int start = VMEM_HEAP;
-	uint32_t* kernel_heap_memory_table = vmem_manager->ops->alloc(vmem_manager);;
-	vmem_add_table(kernel_page_dir, start, kernel_heap_memory_table, SUPERVISOR);
+	kernel_page_dir = vmem_manager->ops->alloc(vmem_manager);
+	memset(kernel_page_dir, 0, PAGE_SIZE);
 
-	/* identity map rest of memory above 4MB */
-	dbgprintf("Initiating memory from 0x%x - %d\n", 0x400000, ((total_mem)/(1024*1024)) - 4);
-	for (int i = 1; i < 16/4; i++){
-		uint32_t* kernel_page_table_memory = vmem_manager->ops->alloc(vmem_manager);
-		if (kernel_page_table_memory == NULL){
-			PANIC();
-		}
-		
-		for (int k = 0; k < 1024; k += 1){
-			int addr = 0x400000*i + k*PAGE_SIZE;
-			vmem_map(kernel_page_table_memory, addr, addr, SUPERVISOR);
-		}
-		vmem_add_table(kernel_page_dir, 0x400000*i, kernel_page_table_memory, SUPERVISOR);
-		dbgprintf("Initiated memory between 0x%x and 0x%x\n", 0x400000*i, 0x400000*(i+1));
-	}
-	dbgprintf("Initiated memory between 0x%x and 0x%x\n", 0x400000, 0x400000 + total_mem - 4*1024*1024);
-	
-	/* test if 0x80d000 is identity mapped */
+	/* identity map first 16mb of memory */
+	dbgprintf("Initiating memory from 0x%x - %d\n", 0, ((total_mem)/(1024*1024)));
+	int tables = vmem_identity_map(vmem_manager, 0, MB(16), 0);
+	dbgprintf("Initiated memory between 0x%x and 0x%x (%d tables, PSE %d, PGE %d)\n", 0, MB(16), tables, vmem_large_pages, vmem_global_pages);
 
-	vmem_add_table(kernel_page_dir, 0, kernel_page_table, SUPERVISOR);
+	int start = VMEM_HEAP;
+	uint32_t* kernel_heap_memory_table = vmem_manager->ops->alloc(vmem_manager);
+	memset(kernel_heap_memory_table, 0, PAGE_SIZE);
+	vmem_add_table(kernel_page_dir, start, kernel_heap_memory_table, SUPERVISOR);
 	
 	dbgprintf("[INIT KERNEL] Directory: 		0x%x\n", kernel_page_dir);
-	dbgprintf("[INIT KERNEL] 0x0 - 0x400000: 	0x%x\n", kernel_page_table);
 	dbgprintf("[INIT KERNEL] Heap (Kthreads): 	0x%x\n", kernel_heap_memory_table);
 }
 
+/**
+ * @brief Enables global pages, must be called after paging is enabled.
+ * Kernel mappings marked PAGE_GLOBAL then stay in the TLB across context switches.
+ */
+void vmem_enable_global_pages()
+{
+	if(vmem_global_pages){
+		lcr4(rcr4() | CR4_PGE);
+	}
+}
+
 int vmem_allocator_create(struct virtual_memory_allocator* allocator, int from, int to)
 {
 	allocator->start = from;
@@ -834,22 +1401,23 @@ int vmem_allocator_create(struct virtual_memory_allocator* allocator, int from,
 	allocator->total_pages = (to-from)/PAGE_SIZE;
 	allocator->ops = &vmem_default_ops;
 	allocator->used_pages = 0;
-	allocator->pages = create_bitmap(allocator->total_pages);
+	allocator->pages = hbitmap_create(allocator->total_pages);
 	mutex_init(&allocator->lock);
 	dbgprintf("Created new allocator\n");
 	return 0;
 }
 
+/**
+ * @brief Identity maps a memory mapped device region in the kernel directory.
+ * Regions starting on a 4MB boundary, like the linear framebuffer, use 4MB pages.
+ * @param addr Physical address of the region.
+ * @param size Size of the region in pages.
+ */
 void vmem_map_driver_region(uint32_t addr, int size)
 {
-	uint32_t* kernel_page_table_driver = vmem_default->ops->alloc(vmem_default);;
-	for (int i = 0; i < size; i++)
-		vmem_map(kernel_page_table_driver, (uint32_t) addr+(PAGE_SIZE*i), (uint32_t) addr+(PAGE_SIZE*i), SUPERVISOR);
+	vmem_identity_map(vmem_default, addr & ~PAGE_MASK, size*PAGE_SIZE + (addr & PAGE_MASK), 1);
 	
 	dbgprintf("[mmap] Page for 0x%x set\n", addr);
-
-	vmem_add_table(kernel_page_dir,  addr, kernel_page_table_driver, SUPERVISOR);
-	return;
 }
 
 int vmem_total_usage()
@@ -881,6 +1449,9 @@ void vmem_init()
 	dbgprintf("Manager start: 0x%x - 0x%x (%d)\n", VMEM_MANAGER_START, VMEM_MANAGER_END, VMEM_MANAGER_PAGES);
 
 	vmem_allocator_create(vmem_manager, VMEM_MANAGER_START, VMEM_MANAGER_END);
+
+	vmem_allocation_cache = kmem_cache_create("allocation", sizeof(struct allocation));
+	assert(vmem_allocation_cache != NULL);
 	dbgprintf("Default: 0x%x - 0x%x (%d)\n", VMEM_START_ADDRESS, VMEM_END_ADDRESS, VMEM_TOTAL_PAGES);
 
 	dbgprintf("[VIRTUAL MEMORY] %d free pagable pages.\n", VMEM_TOTAL_PAGES);
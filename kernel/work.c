@@ -4,9 +4,15 @@
  * @brief Work queue for kernel.
  * @version 0.1
  * @date 2024-01-10
- * 
+ *
+ * Work is spread over WORK_WORKERS worker threads, each owning a bounded deque per
+ * priority class. Work queued by a worker goes to its own deque, other work is handed
+ * out round robin. A worker runs the oldest work of its own deque and, once that is empty,
+ * steals the newest work of the other workers. Work which does not fit is kept on a shared
+ * overflow list instead of being dropped. Works are allocated from a slab cache.
+ *
  * @copyright Copyright (c) 2024
- * 
+ *
  */
 #include <kconfig.h>
 #include <work.h>
@@ -21,49 +27,146 @@
 #define dbgprintf(...)
 #endif
 
-/* Limits amount of works in queue and eliminates the need for kalloc */
-#define WORK_POOL_SIZE 25
-static struct work __work_pool[WORK_POOL_SIZE];
-static int works_in_queue = 0;
+static struct kmem_cache* work_cache = NULL;
+static int works_allocated = 0;
 
-static struct work* get_new_work() {
+static struct work_queue __work_queue;
+static struct work_queue* queue = &__work_queue;
+
+static struct work* get_new_work()
+{
     struct work* new = NULL;
 
+    /* Work is also queued from interrupts, keep them out while the cache is locked */
     CRITICAL_SECTION({
-
-        for (int i = 0; i < WORK_POOL_SIZE; i++){
-            if(__work_pool[i].in_use == 0){
-                __work_pool[i].in_use = 1;
-                new = &__work_pool[i];
-                break;
-            }
+        if(works_allocated < WORK_MAX_PENDING){
+            new = kmem_cache_alloc(work_cache);
+            if(new != NULL) works_allocated++;
         }
-        
     });
-    
+
     return new;
 }
 
-static struct work_queue queue = {
-    .head = NULL,
-    .tail = NULL,
-    .size = 0
-};
+static void __work_free(struct work* work)
+{
+    CRITICAL_SECTION({
+        kmem_cache_free(work_cache, work);
+        works_allocated--;
+    });
+}
+
+static int __work_deque_push(struct work_deque* deque, struct work* work)
+{
+    if(deque->count == WORK_DEQUE_SIZE) return -1;
+
+    deque->slots[(deque->head + deque->count) % WORK_DEQUE_SIZE] = work;
+    deque->count++;
+    return 0;
+}
+
+/* Owner side, oldest work first */
+static struct work* __work_deque_take(struct work_deque* deque)
+{
+    if(deque->count == 0) return NULL;
+
+    struct work* work = deque->slots[deque->head];
+    deque->head = (deque->head + 1) % WORK_DEQUE_SIZE;
+    deque->count--;
+    return work;
+}
+
+/* Thief side, newest work first, which the owner would get to last */
+static struct work* __work_deque_steal(struct work_deque* deque)
+{
+    if(deque->count == 0) return NULL;
+
+    deque->count--;
+    return deque->slots[(deque->head + deque->count) % WORK_DEQUE_SIZE];
+}
 
 /**
- * @brief Adds new work which will call function work_fn and call the call back with the
- * return value of work_fn
- * 
- * @param work_fn function the worker will call
- * @param arg argument to work_fn
- * @param callback with return value of work_fn
+ * @brief Gets the worker of the running pcb.
+ * @return struct worker* worker, NULL if the pcb is not a worker.
  */
-int work_queue_add(int (*fn)(void*), void* arg, void(*callback)(int))
+static struct worker* __work_current_worker()
+{
+    for (int i = 0; i < queue->worker_count; i++){
+        if(queue->workers[i].pid == $process->current->pid) return &queue->workers[i];
+    }
+    return NULL;
+}
+
+static void __work_queue_push(struct work* work)
+{
+    CRITICAL_SECTION({
+        struct worker* worker = __work_current_worker();
+        if(worker == NULL && queue->worker_count > 0){
+            worker = &queue->workers[queue->next];
+            queue->next = (queue->next + 1) % queue->worker_count;
+        }
+
+        if(worker == NULL || __work_deque_push(&worker->deques[(int)work->priority], work) < 0){
+            work->next = NULL;
+            if(queue->overflow[(int)work->priority] == NULL){
+                queue->overflow[(int)work->priority] = work;
+            } else {
+                queue->overflow_tail[(int)work->priority]->next = work;
+            }
+            queue->overflow_tail[(int)work->priority] = work;
+            queue->overflowed++;
+        }
+
+        queue->queued++;
+        wake_up_one(&queue->waiters);
+    });
+}
+
+/**
+ * @brief Finds the next work for the given worker.
+ * Priority classes are served strictly in order: for each class the own deque is
+ * tried first, then the overflow list and lastly the deques of the other workers.
+ * @warning Must be called in a critical section.
+ * @return struct work* work, NULL if nothing is queued.
+ */
+static struct work* __work_queue_take(struct worker* self)
+{
+    int self_index = self - queue->workers;
+
+    for (int prio = 0; prio < WORK_PRIO_CLASSES; prio++){
+        struct work* work = __work_deque_take(&self->deques[prio]);
+        if(work != NULL) return work;
+
+        work = queue->overflow[prio];
+        if(work != NULL){
+            queue->overflow[prio] = work->next;
+            work->next = NULL;
+            return work;
+        }
+
+        for (int i = 1; i < queue->worker_count; i++){
+            struct worker* victim = &queue->workers[(self_index + i) % queue->worker_count];
+            work = __work_deque_steal(&victim->deques[prio]);
+            if(work != NULL){
+                self->steals++;
+                return work;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static struct work* __work_create(int (*fn)(void*), void* arg, void(*callback)(int), int priority)
 {
+    if(priority < 0 || priority >= WORK_PRIO_CLASSES){
+        return NULL;
+    }
+
     struct work* work = get_new_work();
     if(work == NULL){
         warningf("Out of works\n");
-        return -ERROR_WORK_QUEUE_FULL;
+        return NULL;
     }
 
     int (*work_fn)(void*) = (int (*)(void*)) fn;
@@ -71,66 +174,154 @@ int work_queue_add(int (*fn)(void*), void* arg, void(*callback)(int))
     work->work_fn = work_fn;
     work->arg = arg;
     work->state = WORK_WAITING;
+    work->priority = priority;
     work->callback = callback;
     work->next = NULL;
 
-    dbgprintf("Adding work 0x%x\n", work);
+    return work;
+}
+
+/* Timer callback of delayed work, runs in interrupt context */
+static void __work_delay_expired(void* arg)
+{
+    queue->delayed--;
+    __work_queue_push((struct work*) arg);
+}
+
+/**
+ * @brief Adds new work of the given priority class, see work_queue_add.
+ *
+ * @param priority one of enum work_priority
+ * @return int 0 on success, -ERROR_WORK_QUEUE_FULL if too many works are pending.
+ */
+int work_queue_add_prio(int (*fn)(void*), void* arg, void(*callback)(int), int priority)
+{
+    struct work* work = __work_create(fn, arg, callback, priority);
+    if(work == NULL){
+        return -ERROR_WORK_QUEUE_FULL;
+    }
+
+    dbgprintf("Adding work 0x%x (priority %d)\n", work, priority);
+
+    __work_queue_push(work);
+
+    return 0;
+}
+
+/**
+ * @brief Adds new work which will call function work_fn and call the call back with the
+ * return value of work_fn
+ *
+ * @param work_fn function the worker will call
+ * @param arg argument to work_fn
+ * @param callback with return value of work_fn
+ */
+int work_queue_add(int (*fn)(void*), void* arg, void(*callback)(int))
+{
+    return work_queue_add_prio(fn, arg, callback, WORK_PRIO_NORMAL);
+}
+
+/**
+ * @brief Adds new work which is only handed to the workers after the given number of ticks.
+ * The work holds on to its pool entry while it waits.
+ *
+ * @param work_fn function the worker will call
+ * @param arg argument to work_fn
+ * @param callback with return value of work_fn
+ * @param ticks ticks to wait before queueing the work
+ */
+int work_queue_add_delayed(int (*fn)(void*), void* arg, void(*callback)(int), int ticks)
+{
+    struct work* work = __work_create(fn, arg, callback, WORK_PRIO_NORMAL);
+    if(work == NULL){
+        return -ERROR_WORK_QUEUE_FULL;
+    }
+
+    dbgprintf("Adding work 0x%x delayed by %d ticks\n", work, ticks);
 
     CRITICAL_SECTION({
-        if (queue.head == NULL) {
-            queue.head = work;
-            queue.tail = work;
-        } else {
-            queue.tail->next = work;
-            queue.tail = work;
-        }
-        works_in_queue++;
+        queue->delayed++;
     });
 
+    ktimer_init(&work->timer, &__work_delay_expired, work);
+    ktimer_add(&work->timer, ticks);
+
     return 0;
 }
 
-void init_worker()
+/**
+ * @brief Gets the queue depth and statistics of a worker.
+ * @param index Worker index, 0 to WORK_WORKERS-1.
+ * @param info Output statistics.
+ * @return error_t 0 on success, -ERROR_INDEX if the worker is not running.
+ */
+error_t work_queue_get_info(int index, struct work_worker_info* info)
 {
-    for (int i = 0; i < WORK_POOL_SIZE; i++){
-        __work_pool[i].in_use = 0;
+    ERR_ON_NULL(info);
+    if(index < 0 || index >= queue->worker_count){
+        return -ERROR_INDEX;
     }
+
+    struct worker* worker = &queue->workers[index];
+    CRITICAL_SECTION({
+        info->pid = worker->pid;
+        info->depth = 0;
+        for (int prio = 0; prio < WORK_PRIO_CLASSES; prio++){
+            info->depth += worker->deques[prio].count;
+        }
+        info->executed = worker->executed;
+        info->steals = worker->steals;
+    });
+
+    return ERROR_OK;
 }
 
-static int workers = 0;
+void init_worker()
+{
+    memset(queue, 0, sizeof(struct work_queue));
+
+    work_cache = kmem_cache_create("work", sizeof(struct work));
+    assert(work_cache != NULL);
+}
 
 void worker_thread()
-{  
-    int my_id = workers++;
-    dbgprintf("[%d] Starting worker thread...\n", my_id);
+{
+    struct worker* self = NULL;
+
+    CRITICAL_SECTION({
+        if(queue->worker_count < WORK_WORKERS){
+            self = &queue->workers[queue->worker_count++];
+            self->pid = $process->current->pid;
+        }
+    });
+
+    if(self == NULL){
+        warningf("All %d workers are already running\n", WORK_WORKERS);
+        return;
+    }
+
+    dbgprintf("[%d] Starting worker thread...\n", self - queue->workers);
     while (1) {
 
         ENTER_CRITICAL();
-        if(queue.head == NULL) {
-            /* Should block */
-            LEAVE_CRITICAL();
-            kernel_yield();
-            continue;
+        while(queue->queued == 0) {
+            waitqueue_sleep(&queue->waiters, WAIT_FOREVER);
         }
 
         ASSERT_CRITICAL();
-        struct work* work = queue.head;
-        queue.head = queue.head->next;
-        works_in_queue--;
+        struct work* work = __work_queue_take(self);
+        assert(work != NULL);
+        queue->queued--;
 
-        if (queue.head == NULL) {
-            queue.tail = NULL;
-        }
-        
         LEAVE_CRITICAL();
 
         work->state = WORK_STARTED;
-        dbgprintf("[%d] Running work... 0x%x (arg: %d)\n", my_id, work->work_fn, work->arg);
+        dbgprintf("[%d] Running work... 0x%x (arg: %d)\n", self - queue->workers, work->work_fn, work->arg);
         int ret = work->work_fn(work->arg);
         if(work->callback != NULL){
             work->callback(ret);
         }
-        work->in_use = 0;
-        work->next = NULL;
+        self->executed++;
+        __work_free(work);
     }
-}
\ No newline at end of file
+}
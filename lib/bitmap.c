@@ -3,16 +3,27 @@
  * @author Joe Bayer (joexbayer)
  * @brief Simple bitmap api from stackoverflow.
  * @see https://stackoverflow.com/questions/16947492/looking-for-a-bitmap-implementation-api-in-linux-c
- * @version 0.1
+ * @version 0.2
  * @date 2022-06-24
- * 
+ *
+ * The plain bitmap_t api is a byte array (it is stored as is on disk by ext),
+ * searches scan it a 32bit word at a time and skip full words.
+ * The hbitmap api adds a summary level, one bit per 32bit word which is set when the
+ * word is full, and a next-fit hint. It is used by the in memory allocators.
+ *
  * @copyright Copyright (c) 2022
- * 
+ *
  */
 
 #include <bitmap.h>
 #include <memory.h>
 
+#define BITMAP_WORD_BITS 32
+#define BITMAP_WORD_FULL 0xFFFFFFFF
+
+/* Words alias the byte array of a bitmap_t */
+typedef uint32_t __attribute__((__may_alias__)) bitmap_word_t;
+
 void set_bitmap(bitmap_t b, int i)
 {
     b[i / 8] |= 1 << (i & 7);
@@ -45,15 +56,38 @@ void destroy_bitmap(bitmap_t b)
     kfree((void*) b);
 }
 
-inline int __continous_helper(bitmap_t b, int start, int size)
+/**
+ * @brief Finds the first bit in [from, n) with the given value.
+ * Whole words are only read when all their bits are inside the bitmap,
+ * the remaining tail bits are checked one at a time.
+ * @param b bitmap
+ * @param from first bit to check
+ * @param n size of bitmap in bits
+ * @param value 0 to find a free bit, 1 to find a used bit
+ * @return int index of bit, n if not found.
+ */
+static int __bitmap_find(bitmap_t b, int from, int n, int value)
 {
-    for (int j = 0; j < size; j++)
-    {
-        if(get_bitmap(b, start+j) != 0){
-            return -1;
+    bitmap_word_t* words = (bitmap_word_t*) b;
+    int full_words = n / BITMAP_WORD_BITS;
+    int i = from;
+
+    while (i < full_words * BITMAP_WORD_BITS){
+        uint32_t word = value ? words[i / BITMAP_WORD_BITS] : ~words[i / BITMAP_WORD_BITS];
+        word &= BITMAP_WORD_FULL << (i % BITMAP_WORD_BITS);
+        if(word != 0){
+            return (i & ~(BITMAP_WORD_BITS-1)) + __builtin_ctz(word);
         }
+        i = (i & ~(BITMAP_WORD_BITS-1)) + BITMAP_WORD_BITS;
     }
-    return 0;
+
+    for (; i < n; i++){
+        if(get_bitmap(b, i) == value){
+            return i;
+        }
+    }
+
+    return n;
 }
 
 int bitmap_unset_continous(bitmap_t b, int start, int size)
@@ -67,22 +101,17 @@ int bitmap_unset_continous(bitmap_t b, int start, int size)
 
 int bitmap_get_continous(bitmap_t b, int n, int size)
 {
-    for (int i = 0; i < n; i++)
-    {
-        if(get_bitmap(b, i) == 0)
-        {
-            
-            int ret = __continous_helper(b, i, size);
-
-            if(ret < 0)
-                break;
-
-            for (int j = 0; j < size; j++)
-            {
+    int i = __bitmap_find(b, 0, n, 0);
+    while (i + size <= n){
+        /* Check if the run of free bits starting at i is long enough */
+        int end = __bitmap_find(b, i, i + size, 1);
+        if(end == i + size){
+            for (int j = 0; j < size; j++){
                 set_bitmap(b, i+j);
             }
             return i;
         }
+        i = __bitmap_find(b, end, n, 0);
     }
 
     return -1;
@@ -90,14 +119,229 @@ int bitmap_get_continous(bitmap_t b, int n, int size)
 
 int get_free_bitmap(bitmap_t b, int n)
 {
-    for (int i = 0; i < n; i++)
-    {
-        if(get_bitmap(b, i) == 0)
-        {
-            set_bitmap(b, i);
-            return i;
+    int i = __bitmap_find(b, 0, n, 0);
+    if(i == n){
+        return -1;
+    }
+
+    set_bitmap(b, i);
+    return i;
+}
+
+/* Hierarchical bitmap */
+
+#define HBITMAP_WORDS(n) (((n) + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS)
+#define HBITMAP_SUMMARY_WORDS(n) ((HBITMAP_WORDS(n) + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS)
+
+static inline void __hbitmap_update_summary(struct hbitmap* map, int word)
+{
+    if(map->words[word] == BITMAP_WORD_FULL){
+        map->summary[word / BITMAP_WORD_BITS] |= 1U << (word % BITMAP_WORD_BITS);
+    } else {
+        map->summary[word / BITMAP_WORD_BITS] &= ~(1U << (word % BITMAP_WORD_BITS));
+    }
+}
+
+/**
+ * @brief Returns the size in bytes needed to store a hbitmap of n bits.
+ * Can be used to provide storage when kalloc is not available.
+ */
+int hbitmap_storage_size(int n)
+{
+    return (HBITMAP_WORDS(n) + HBITMAP_SUMMARY_WORDS(n)) * sizeof(uint32_t);
+}
+
+/**
+ * @brief Initializes a hbitmap of n bits on the given storage.
+ * Bits past n in the last word, and summary bits past the last word,
+ * are marked as used so searches never have to check bounds.
+ * @param map hbitmap to initialize
+ * @param storage memory of at least hbitmap_storage_size(n) bytes
+ * @param n number of bits
+ */
+void hbitmap_init(struct hbitmap* map, void* storage, int n)
+{
+    map->bits = n;
+    map->nwords = HBITMAP_WORDS(n);
+    map->nsummary = HBITMAP_SUMMARY_WORDS(n);
+    map->words = (uint32_t*) storage;
+    map->summary = map->words + map->nwords;
+    map->hint = 0;
+    map->used = 0;
+
+    memset(storage, 0, hbitmap_storage_size(n));
+
+    if(n % BITMAP_WORD_BITS){
+        map->words[map->nwords-1] = BITMAP_WORD_FULL << (n % BITMAP_WORD_BITS);
+    }
+    if(map->nwords % BITMAP_WORD_BITS){
+        map->summary[map->nsummary-1] = BITMAP_WORD_FULL << (map->nwords % BITMAP_WORD_BITS);
+    }
+}
+
+struct hbitmap* hbitmap_create(int n)
+{
+    struct hbitmap* map = kalloc(sizeof(struct hbitmap) + hbitmap_storage_size(n));
+    if(map == NULL){
+        return NULL;
+    }
+
+    hbitmap_init(map, map+1, n);
+    return map;
+}
+
+void hbitmap_destroy(struct hbitmap* map)
+{
+    kfree(map);
+}
+
+/**
+ * @brief Finds the first word at or after from which is not full, using the summary.
+ * @return int word index, -1 if all remaining words are full.
+ */
+static int __hbitmap_find_word(struct hbitmap* map, int from)
+{
+    for (int k = from / BITMAP_WORD_BITS; k < map->nsummary; k++){
+        uint32_t free = ~map->summary[k];
+        if(k == from / BITMAP_WORD_BITS){
+            free &= BITMAP_WORD_FULL << (from % BITMAP_WORD_BITS);
+        }
+        if(free != 0){
+            return k * BITMAP_WORD_BITS + __builtin_ctz(free);
         }
     }
-    
     return -1;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Finds the first free bit at or after from.
+ * @return int bit index, -1 if none.
+ */
+static int __hbitmap_next_free(struct hbitmap* map, int from)
+{
+    if(from >= map->bits) return -1;
+
+    int word = from / BITMAP_WORD_BITS;
+    uint32_t free = ~map->words[word] & (BITMAP_WORD_FULL << (from % BITMAP_WORD_BITS));
+    if(free != 0){
+        return word * BITMAP_WORD_BITS + __builtin_ctz(free);
+    }
+
+    word = __hbitmap_find_word(map, word + 1);
+    if(word < 0) return -1;
+
+    return word * BITMAP_WORD_BITS + __builtin_ctz(~map->words[word]);
+}
+
+/**
+ * @brief Finds the first used bit in [from, limit), returns limit if there is none.
+ */
+static int __hbitmap_next_used(struct hbitmap* map, int from, int limit)
+{
+    int i = from;
+    while (i < limit){
+        uint32_t used = map->words[i / BITMAP_WORD_BITS] & (BITMAP_WORD_FULL << (i % BITMAP_WORD_BITS));
+        if(used != 0){
+            int bit = (i & ~(BITMAP_WORD_BITS-1)) + __builtin_ctz(used);
+            return bit < limit ? bit : limit;
+        }
+        i = (i & ~(BITMAP_WORD_BITS-1)) + BITMAP_WORD_BITS;
+    }
+    return limit;
+}
+
+static void __hbitmap_set_range(struct hbitmap* map, int start, int size, int value)
+{
+    int i = start;
+    int end = start + size;
+    while (i < end){
+        int word = i / BITMAP_WORD_BITS;
+        int offset = i % BITMAP_WORD_BITS;
+        int count = BITMAP_WORD_BITS - offset < end - i ? BITMAP_WORD_BITS - offset : end - i;
+        uint32_t mask = count == BITMAP_WORD_BITS ? BITMAP_WORD_FULL : ((1U << count) - 1) << offset;
+
+        if(value){
+            map->words[word] |= mask;
+        } else {
+            map->words[word] &= ~mask;
+        }
+        __hbitmap_update_summary(map, word);
+        i += count;
+    }
+    map->used += value ? size : -size;
+}
+
+/**
+ * @brief Allocates a single free bit, searching from the next-fit hint and wrapping around.
+ * @return int index of allocated bit, -1 if the bitmap is full.
+ */
+int hbitmap_alloc(struct hbitmap* map)
+{
+    int word = __hbitmap_find_word(map, map->hint);
+    if(word < 0){
+        word = __hbitmap_find_word(map, 0);
+        if(word < 0) return -1;
+    }
+
+    int bit = word * BITMAP_WORD_BITS + __builtin_ctz(~map->words[word]);
+    map->words[word] |= 1U << (bit % BITMAP_WORD_BITS);
+    __hbitmap_update_summary(map, word);
+    map->used++;
+    map->hint = word;
+
+    return bit;
+}
+
+/**
+ * @brief Allocates size contiguous free bits, searching from the next-fit hint and wrapping around.
+ * @return int index of first allocated bit, -1 if no run was found.
+ */
+int hbitmap_alloc_range(struct hbitmap* map, int size)
+{
+    if(size <= 0 || size > map->bits) return -1;
+    if(size == 1) return hbitmap_alloc(map);
+
+    int start = map->hint * BITMAP_WORD_BITS;
+    for (int pass = 0; pass < 2; pass++){
+        int limit = pass == 0 ? map->bits : start + size - 1;
+        if(limit > map->bits) limit = map->bits;
+
+        int i = __hbitmap_next_free(map, pass == 0 ? start : 0);
+        while (i >= 0 && i + size <= limit){
+            int end = __hbitmap_next_used(map, i, i + size);
+            if(end == i + size){
+                __hbitmap_set_range(map, i, size, 1);
+                map->hint = (i + size - 1) / BITMAP_WORD_BITS;
+                return i;
+            }
+            i = __hbitmap_next_free(map, end);
+        }
+    }
+
+    return -1;
+}
+
+void hbitmap_free(struct hbitmap* map, int i)
+{
+    if(i < 0 || i >= map->bits) return;
+
+    int word = i / BITMAP_WORD_BITS;
+    if(!(map->words[word] & (1U << (i % BITMAP_WORD_BITS)))) return;
+
+    map->words[word] &= ~(1U << (i % BITMAP_WORD_BITS));
+    __hbitmap_update_summary(map, word);
+    map->used--;
+}
+
+void hbitmap_free_range(struct hbitmap* map, int start, int size)
+{
+    if(start < 0 || size <= 0 || start + size > map->bits) return;
+
+    __hbitmap_set_range(map, start, size, 0);
+}
+
+int hbitmap_test(struct hbitmap* map, int i)
+{
+    if(i < 0 || i >= map->bits) return 1;
+    return map->words[i / BITMAP_WORD_BITS] & (1U << (i % BITMAP_WORD_BITS)) ? 1 : 0;
+}
@@ -38,7 +38,9 @@ static char* error_string[] = {
     "Window not found.",
     "Window operations are corrupted.",
     "Out of memory.",
-    "Access denied."
+    "Access denied.",
+    "Not supported by the hardware.",
+    "Value changed, try again."
 };
 
 char* error_get_string(error_t err)
@@ -12,6 +12,18 @@
 #include <hashmap.h>
 #include <memory.h>
 #include <libc.h>
+#include <kutils.h>
+#include <assert.h>
+
+/* Nodes are allocated from their own object cache, kalloc rounds them up to a whole block */
+static struct kmem_cache* hash_node_cache = NULL;
+
+static void hashmap_init_cache()
+{
+	hash_node_cache = kmem_cache_create("hashnode", sizeof(struct hash_node));
+	assert(hash_node_cache != NULL);
+}
+EXPORT_KCTOR(hashmap_init_cache);
 
 inline int simple_hash(char* key)
 {
@@ -28,7 +40,9 @@ void hashmap_put(hashmap_t* map, char* key, int value)
 {
 
 	int h = simple_hash(key);
-	struct hash_node* new_node = palloc(sizeof(struct hash_node));
+	struct hash_node* new_node = kmem_cache_alloc(hash_node_cache);
+	if(new_node == NULL) return;
+
 	new_node->key = key;
 	new_node->value = value;
 	new_node->next = map->buckets[h];
@@ -68,5 +82,13 @@ int hashmap_add(hashmap_t* map, char* key, int value)
 
 void hashmap_free(hashmap_t* map)
 {
-	/* hashmap currently uses non freeable memory. */
+	for (int i = 0; i < HASH_SIZE; i++){
+		struct hash_node* current = map->buckets[i];
+		while (current != NULL) {
+			struct hash_node* next = current->next;
+			kmem_cache_free(hash_node_cache, current);
+			current = next;
+		}
+		map->buckets[i] = NULL;
+	}
 }
\ No newline at end of file
@@ -17,8 +17,6 @@ extern "C" {
 
 #include <libc.h>
 
-int __cli_cnt = 0;
-
 float cos_60[60] = {6.123233995736766e-17,0.10452846326765346,0.20791169081775945,0.30901699437494745,0.4067366430758002,0.5000000000000001,0.5877852522924731,0.6691306063588582,0.7431448254773942,0.8090169943749475,0.8660254037844387,0.9135454576426009,0.9510565162951535,0.9781476007338057,0.9945218953682733,1.0,0.9945218953682733,0.9781476007338057,0.9510565162951535,0.9135454576426009,0.8660254037844387,0.8090169943749475,0.7431448254773942,0.6691306063588582,0.5877852522924731,0.5000000000000001,0.4067366430758002,0.30901699437494745,0.20791169081775945,0.10452846326765346,6.123233995736766e-17,-0.10452846326765333,-0.20791169081775912,-0.30901699437494734,-0.4067366430758001,-0.4999999999999998,-0.587785252292473,-0.6691306063588582,-0.7431448254773941,-0.8090169943749473,-0.8660254037844387,-0.9135454576426008,-0.9510565162951535,-0.9781476007338057,-0.9945218953682733,-1.0,-0.9945218953682734,-0.9781476007338057,-0.9510565162951535,-0.9135454576426011,-0.8660254037844386,-0.8090169943749475,-0.7431448254773942,-0.6691306063588585,-0.5877852522924732,-0.5000000000000004,-0.4067366430758001,-0.30901699437494756,-0.2079116908177598,-0.10452846326765336,
 };
 
@@ -103,6 +103,29 @@ int thread_create(void* entry, void* arg, int flags)
     return invoke_syscall(SYSCALL_CREATE_THREAD, (int)entry, (int)arg, flags);
 }
 
+int thread_join(int id)
+{
+    return invoke_syscall(SYSCALL_JOIN_THREAD, id, 0, 0);
+}
+
+/* Blocks while *addr == expected, returns early if it changed or on a spurious wake */
+int futex_wait(volatile int* addr, int expected)
+{
+    return invoke_syscall(SYSCALL_FUTEX_WAIT, (int)addr, expected, 0);
+}
+
+/* Wakes at most count threads waiting on addr, returns how many were woken */
+int futex_wake(volatile int* addr, int count)
+{
+    return invoke_syscall(SYSCALL_FUTEX_WAKE, (int)addr, count, 0);
+}
+
+/* CPU time and scheduling latency of a pid, see pcb_stats.h */
+int process_stats(int pid, struct pcb_stats* stats)
+{
+    return invoke_syscall(SYSCALL_PCB_STATS, pid, (int)stats, 0);
+}
+
 void* malloc(int size)
 {
     return (void*)invoke_syscall(SYSCALL_MALLOC, size, 0, 0);
@@ -14,6 +14,7 @@
 #include <net/net.h>
 #include <terminal.h>
 #include <serial.h>
+#include <sync.h>
 
 #ifndef KDEBUG_NET_ARP
 #undef dbgprintf
@@ -23,6 +24,8 @@
 #define MAX_ARP_ENTRIES 25
 
 static struct arp_entry arp_entry_table[MAX_ARP_ENTRIES];
+/* Looked up for every sent packet, only written when a new neighbour shows up */
+static seqlock_t arp_lock;
 
 static void arp_list()
 {
@@ -36,6 +39,8 @@ static void arp_list()
 
 void net_init_arp()
 {
+	seqlock_init(&arp_lock);
+
 	for (int i = 0; i < MAX_ARP_ENTRIES; i++)
 		arp_entry_table[i].sip = 0;
 
@@ -54,21 +59,28 @@ void net_init_arp()
 int net_arp_add_entry(struct arp_content* arp)
 {
 	dbgprintf("Adding %i to arp entries\n", arp->sip);
-	/* Check if ARP entry already exists. */
-	for (int i = 0; i < MAX_ARP_ENTRIES; i++)
-		if(memcmp((uint8_t*)&arp->smac, (uint8_t*)&arp_entry_table[i].smac, 6) == 0)
-			return 1;
+	int ret = 0;
 
+	write_seqlock(&arp_lock);
 	for (int i = 0; i < MAX_ARP_ENTRIES; i++){
+		/* Check if ARP entry already exists. */
+		if(memcmp((uint8_t*)&arp->smac, (uint8_t*)&arp_entry_table[i].smac, 6) == 0){
+			ret = 1;
+			break;
+		}
+	}
+
+	for (int i = 0; i < MAX_ARP_ENTRIES && ret == 0; i++){
 		if(arp_entry_table[i].sip == 0){
 			arp_entry_table[i].sip = arp->sip;
 			memcpy(&arp_entry_table[i].smac, &arp->smac, 6);
 			dbgprintf("Added APR entry.\n");
-			return 1;
+			ret = 1;
 		}
 	}
+	write_sequnlock(&arp_lock);
 
-	return 0;
+	return ret;
 }
 
 /**
@@ -82,11 +94,23 @@ int net_arp_add_entry(struct arp_content* arp)
 int net_arp_find_entry(uint32_t ip, uint8_t* mac)
 {
 	arp_list();
-	for (int i = 0; i < MAX_ARP_ENTRIES; i++){
-		if(arp_entry_table[i].sip == ip){
-			memcpy(mac, arp_entry_table[i].smac, 6);
-			return 1;
+
+	int found;
+	uint32_t seq;
+	do {
+		found = 0;
+		seq = read_seqbegin(&arp_lock);
+		for (int i = 0; i < MAX_ARP_ENTRIES; i++){
+			if(arp_entry_table[i].sip == ip){
+				memcpy(mac, arp_entry_table[i].smac, 6);
+				found = 1;
+				break;
+			}
 		}
+	} while(read_seqretry(&arp_lock, seq));
+
+	if(found){
+		return 1;
 	}
 	dbgprintf("Warning: Could not find arp for %i\n", ip);
 	return -1;
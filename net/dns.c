@@ -23,6 +23,8 @@
 
 static struct dns_cache __dns_cache[DNS_CACHE_ENTRIES];
 static mutex_t __dns_mutex;
+/* Cache lookups never block, queries only write on a new answer */
+static seqlock_t __dns_cache_lock;
 
 void net_init_dns();
 int gethostname(char* hostname);
@@ -35,6 +37,7 @@ void net_init_dns()
     }
 
     mutex_init(&__dns_mutex);
+    seqlock_init(&__dns_cache_lock);
 }
 
 static void __dns_name_compresion(uint8_t* request, char* host) 
@@ -56,13 +59,34 @@ static void __dns_name_compresion(uint8_t* request, char* host)
 
 static void __dns_add_cache(char* hostname, uint32_t ip)
 {
+    write_seqlock(&__dns_cache_lock);
     for (int i = 0; i < DNS_CACHE_ENTRIES; i++){
         if(__dns_cache[i].ip == 0){
             memcpy(__dns_cache[i].name, hostname, strlen(hostname));
             __dns_cache[i].ip = ip;
-            return;
+            break;
         }
     }
+    write_sequnlock(&__dns_cache_lock);
+}
+
+/* returns the cached ip of hostname, 0 if it is not cached */
+static uint32_t __dns_find_cache(char* hostname)
+{
+    uint32_t ip;
+    uint32_t seq;
+    do {
+        ip = 0;
+        seq = read_seqbegin(&__dns_cache_lock);
+        for (int i = 0; i < DNS_CACHE_ENTRIES; i++){
+            if(memcmp((uint8_t*) &__dns_cache[i].name,(uint8_t*) hostname, strlen(hostname)) == 0){
+                ip = __dns_cache[i].ip;
+                break;
+            }
+        }
+    } while(read_seqretry(&__dns_cache_lock, seq));
+
+    return ip;
 }
 
 /* returns -1 on error */
@@ -75,11 +99,11 @@ int gethostname(char* hostname)
     }
 
     /* Check for cache first. */
-    for (int i = 0; i < DNS_CACHE_ENTRIES; i++)
-        if(memcmp((uint8_t*) &__dns_cache[i].name,(uint8_t*) hostname, strlen(hostname)) == 0){
-            dbgprintf("[DNS] (%s at %i) (cache)\n", hostname, __dns_cache[i].ip);
-            return __dns_cache[i].ip;
-        }
+    uint32_t cached = __dns_find_cache(hostname);
+    if(cached != 0){
+        dbgprintf("[DNS] (%s at %i) (cache)\n", hostname, cached);
+        return cached;
+    }
 
     dbgprintf("[DNS] query for (%s)\n", hostname);
     
@@ -16,6 +16,10 @@
 #include <assert.h>
 #include <scheduler.h>
 #include <errors.h>
+#include <timer.h>
+
+/* time to wait for the SYN/ACK of a connection */
+#define NET_CONNECT_TIMEOUT_TICKS TIMER_MS_TO_TICKS(3000)
 
 /**
  * @brief Binds a IP and Port to a socket, mainly used for the server side.
@@ -85,16 +89,12 @@ error_t kernel_recv(struct sock* socket, void *buffer, int length, int flags)
 
 error_t kernel_recv_timeout(struct sock* socket, void *buffer, int length, int flags, int timeout)
 {
-    int time_start = get_time();
-
-    int read = -1;
-    while(read == -1){
-        if(get_time() - time_start > timeout+3)return 0;
-
+    /* timeout is given in seconds */
+    if(!wait_event_timeout(&socket->waiters, net_sock_data_ready(socket, length), timeout*TIMER_HZ)){
+        return 0;
     }
 
-    return read;
-
+    return kernel_recv(socket, buffer, length, flags);
 }
 
 error_t kernel_connect(struct sock* socket, const struct sockaddr *address, socklen_t address_len)
@@ -116,15 +116,10 @@ error_t kernel_connect(struct sock* socket, const struct sockaddr *address, sock
     tcp_connect(socket);
 
     dbgprintf(" [%d] Connecting...\n", socket);
-    /* block or spin */
-
-    int time_start = get_time();
-    while(socket->tcp->state != TCP_ESTABLISHED){
-        if(get_time() - time_start > 2){
-            dbgprintf(" [%d] Connection timed out\n", socket);
-            return -1;
-        }
-        kernel_yield();
+    /* Block until the SYN/ACK arrives or the connection times out */
+    if(!wait_event_timeout(&socket->waiters, socket->tcp->state == TCP_ESTABLISHED, NET_CONNECT_TIMEOUT_TICKS)){
+        dbgprintf(" [%d] Connection timed out\n", socket);
+        return -1;
     }
 
     dbgprintf(" [%d] succesfully connected!\n", socket);
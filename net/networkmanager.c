@@ -77,7 +77,7 @@ static int __default_start(struct networkmanager* netd)
         return 0;
     }
 
-    pid_t pid = start("netd", 0, NULL);
+    pid_t pid = start_class("netd", 0, NULL, PCB_CLASS_LATENCY);
     if(pid < 0){
         return -1;
     }
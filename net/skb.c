@@ -21,6 +21,17 @@ struct skb_queue_operations skb_queue_ops = {
 	.remove = &__skb_queue_remove
 };
 
+struct kmem_cache* skb_cache = NULL;
+struct kmem_cache* skb_data_cache = NULL;
+
+static void skb_init_caches()
+{
+	skb_cache = kmem_cache_create("skbuff", sizeof(struct sk_buff));
+	skb_data_cache = kmem_cache_create("skbdata", SKB_DATA_SIZE);
+	assert(skb_cache != NULL && skb_data_cache != NULL);
+}
+EXPORT_KCTOR(skb_init_caches);
+
 
 void skb_free_queue(struct skb_queue* queue)
 {
@@ -97,15 +108,14 @@ static struct sk_buff* __skb_queue_remove(struct skb_queue* skb_queue)
 void skb_free(struct sk_buff* skb)
 {
 	FREE_SKB(skb);
-	kfree(skb);
+	kmem_cache_free(skb_cache, skb);
 }
 
 struct sk_buff* skb_new()
 {
-	struct sk_buff* new = (struct sk_buff*) kalloc(sizeof(struct sk_buff));
+	struct sk_buff* new = (struct sk_buff*) kmem_cache_zalloc(skb_cache);
 	if(new == NULL) return NULL;
 
-	memset(new, 0, sizeof(struct sk_buff));
 	new->netdevice = &current_netdev;
 	ALLOCATE_SKB(new);
 
@@ -120,10 +130,10 @@ struct sk_buff* skb_new()
  */
 struct sk_buff* skb_consume(struct sk_buff* skb)
 {
-	struct sk_buff* new = create(struct sk_buff);
+	struct sk_buff* new = kmem_cache_alloc(skb_cache);
 
 	memcpy(new, skb, sizeof(struct sk_buff));
-	kfree(skb);
+	kmem_cache_free(skb_cache, skb);
 
 	return new;
 }
\ No newline at end of file
@@ -23,6 +23,8 @@
 #include <serial.h>
 
 static struct sock** socket_table;
+/* Lookups run for every received packet, the table only changes when sockets are created or closed */
+static rwlock_t socket_table_lock;
 static int total_sockets;
 static bitmap_t port_map;
 static bitmap_t socket_map;
@@ -107,11 +109,7 @@ error_t net_sock_read(struct sock* sock, uint8_t* buffer, unsigned int length)
 {
 	dbgprintf(" [SOCK] Waiting for data... %d\n", sock);
 	/* Should be blocking */
-    while(!net_sock_data_ready(sock, length)){
-        sock->waiting = $process->current;
-        $process->current->state = BLOCKED;
-	    kernel_yield();
-    }
+    wait_event(&sock->waiters, net_sock_data_ready(sock, length));
     
     if(sock->data_ready == -1){
         dbgprintf(" [SOCK] Socket closed!\n");
@@ -162,12 +160,7 @@ static inline error_t net_sock_add_data_segment(struct sock* sock, struct sk_buf
     sock->recvd += skb->data_len;
     sock->data_ready = sock->tcp == NULL ? 1 : skb->hdr.tcp->psh;
 
-    if(sock->waiting->state == BLOCKED){
-        /* need to clear waiting before setting it to run */
-        volatile struct pcb* pcb = sock->waiting;
-        sock->waiting = NULL;
-        pcb->state = RUNNING;
-    }
+    wake_up_all(&sock->waiters);
 
     sock->rx += skb->data_len;
 
@@ -241,15 +234,21 @@ error_t net_sock_data_ready(struct sock* sk, unsigned int length)
 
 struct sock* sock_find_listen_tcp(uint16_t d_port)
 {
+    struct sock* sk = NULL;
+
+    read_lock(&socket_table_lock);
     for (int i = 0; i < NET_NUMBER_OF_SOCKETS; i++){   
         if(socket_table[i] == NULL || socket_table[i]->tcp == NULL)
             continue;
 
-        if(socket_table[i]->bound_port == d_port &&  socket_table[i]->tcp->state == TCP_LISTEN)
-            return socket_table[i];
+        if(socket_table[i]->bound_port == d_port &&  socket_table[i]->tcp->state == TCP_LISTEN){
+            sk = sock_hold(socket_table[i]);
+            break;
+        }
     }
+    read_unlock(&socket_table_lock);
 
-    return NULL;
+    return sk;
 }
 
 
@@ -258,6 +257,7 @@ struct sock* net_sock_find_tcp(uint16_t s_port, uint16_t d_port, uint32_t ip)
     dbgprintf("[TCP] Looking for socket destintation %d: source %d\n", htons(d_port), htons(s_port));
     struct sock* _sk = NULL; /* save listen socket incase no established connection is found. */
 
+    read_lock(&socket_table_lock);
     for (int i = 0; i < NET_NUMBER_OF_SOCKETS; i++){
         if(socket_table[i] == NULL || socket_table[i]->tcp == NULL)
             continue;
@@ -286,9 +286,13 @@ struct sock* net_sock_find_tcp(uint16_t s_port, uint16_t d_port, uint32_t ip)
             //&& (socket_table[i]->tcp->state == TCP_ESTABLISHED || socket_table[i]->tcp->state == TCP_SYN_SENT)
             ){
                 dbgprintf("[TCP] Found socket %d\n", i);
-                return socket_table[i];
+                struct sock* sk = sock_hold(socket_table[i]);
+                read_unlock(&socket_table_lock);
+                return sk;
             }
     }
+    if(_sk != NULL) sock_hold(_sk);
+    read_unlock(&socket_table_lock);
 
     if(_sk != NULL){
         dbgprintf("[TCP] Found socket %d\n", _sk->socket);
@@ -323,16 +327,22 @@ int net_sock_accept(struct sock* sock, struct sock* new)
 
 struct sock* net_socket_find_udp(uint32_t ip, uint16_t port) 
 {   
+    struct sock* sk = NULL;
+
     /* Interate over sockets and add packet if socket exists with matching port and IP */
+    read_lock(&socket_table_lock);
     for (int i = 0; i < NET_NUMBER_OF_SOCKETS; i++){
         if(socket_table[i] == NULL)
             continue;
 
         if(socket_table[i]->bound_port == htons(port) && (socket_table[i]->bound_ip == ip || socket_table[i]->bound_ip == INADDR_ANY)) {
-            return socket_table[i];
+            sk = sock_hold(socket_table[i]);
+            break;
         }
     }
-    return NULL;
+    read_unlock(&socket_table_lock);
+
+    return sk;
 }
 
 void kernel_sock_shutdown(struct sock* socket, int how)
@@ -342,24 +352,48 @@ void kernel_sock_shutdown(struct sock* socket, int how)
     }
 }
 
-void kernel_sock_cleanup(struct sock* socket)
+/**
+ * @brief Takes a reference on a socket, lookups return held sockets.
+ * @warning Socket table lock must be held or the caller must already hold a reference.
+ */
+struct sock* sock_hold(struct sock* sk)
 {
-    tcp_free_connection(socket);
+    __sync_add_and_fetch(&sk->refs, 1);
+    return sk;
+}
 
-    while(SKB_QUEUE_READY(socket->skb_queue)){
-        struct sk_buff* skb = socket->skb_queue->ops->remove(socket->skb_queue);
+/**
+ * @brief Drops a reference on a socket, the socket is freed with the last reference.
+ * @param sk Socket to release, NULL is ignored.
+ */
+void sock_put(struct sock* sk)
+{
+    if(sk == NULL || __sync_sub_and_fetch(&sk->refs, 1) > 0) return;
+
+    tcp_free_connection(sk);
+
+    while(SKB_QUEUE_READY(sk->skb_queue)){
+        struct sk_buff* skb = sk->skb_queue->ops->remove(sk->skb_queue);
         skb_free(skb);
     }
 
-    skb_free_queue(socket->skb_queue);
-    rbuffer_free(socket->recv_buffer);
+    skb_free_queue(sk->skb_queue);
+    rbuffer_free(sk->recv_buffer);
 
-    kfree((void*) socket);
-    unset_bitmap(socket_map, (int)socket->socket);
+    kfree((void*) sk);
+}
 
+void kernel_sock_cleanup(struct sock* socket)
+{
+    /* Unlink first, no lookup can return the socket afterwards */
+    write_lock(&socket_table_lock);
     socket_table[socket->socket] = NULL;
-
+    unset_bitmap(socket_map, (int)socket->socket);
     total_sockets--;
+    write_unlock(&socket_table_lock);
+
+    /* Packets being handled hold their own reference, the last one frees the socket */
+    sock_put(socket);
 }
 
 void kernel_sock_close(struct sock* socket)
@@ -382,7 +416,7 @@ void kernel_sock_close(struct sock* socket)
 struct sock* kernel_socket_create(int domain, int type, int protocol)
 {
 
-    /* Should be a lock? */
+    write_lock(&socket_table_lock);
     ENTER_CRITICAL();
 
     //int current = get_free_bitmap(socket_map, NET_NUMBER_OF_SOCKETS);
@@ -390,6 +424,7 @@ struct sock* kernel_socket_create(int domain, int type, int protocol)
     if(current == -1){
         warningf("Unable to create socket, no free sockets!\n");
         LEAVE_CRITICAL();
+        write_unlock(&socket_table_lock);
         return NULL;
     }
 
@@ -413,10 +448,12 @@ struct sock* kernel_socket_create(int domain, int type, int protocol)
 
     socket_table[current]->skb_queue = skb_new_queue();
 
-    socket_table[current]->waiting = NULL;
+    waitqueue_init(&socket_table[current]->waiters);
     socket_table[current]->accept_sock = NULL;
 
     socket_table[current]->owner = $process->current;
+    /* reference of the socket table */
+    socket_table[current]->refs = 1;
 
     mutex_init(&(socket_table[current]->lock));
 
@@ -424,9 +461,12 @@ struct sock* kernel_socket_create(int domain, int type, int protocol)
 
     dbgprintf("Created new sock %d\n", current);
 
+    struct sock* sk = socket_table[current];
+
     LEAVE_CRITICAL();
+    write_unlock(&socket_table_lock);
 
-    return socket_table[current];
+    return sk;
 }
 
 void net_init_sockets()
@@ -435,4 +475,5 @@ void net_init_sockets()
     port_map = create_bitmap(NET_NUMBER_OF_DYMANIC_PORTS);
     socket_map = create_bitmap(NET_NUMBER_OF_SOCKETS);
     total_sockets = 0;
+    rwlock_init(&socket_table_lock);
 }
\ No newline at end of file
@@ -20,8 +20,11 @@
 #include <serial.h>
 #include <scheduler.h>
 #include <errors.h>
+#include <timer.h>
 
 #define TCB_MAX 32
+/* time to wait for an ACK before the segment is sent again */
+#define TCP_RETRANSMIT_TICKS TIMER_MS_TO_TICKS(1000)
 
 /** new implementation **/
 
@@ -91,16 +94,7 @@ tcb_new_error:
 
 #define IS_TCP_SOCKET(sock) (sock->type == SOCK_STREAM && sock->tcp != NULL)
 
-#define TCP_BLOCK(sock)\
-	sock->waiting = $process->current;\
-	$process->current->state = BLOCKED;\
-	kernel_yield();
-
-#define TCP_UNBLOCK(sock)\
-	if(sock->waiting != NULL){\
-		sock->waiting->state = RUNNING;\
-		sock->waiting = NULL;\
-	}
+#define TCP_UNBLOCK(sock) wake_up_all(&(sock)->waiters)
 
 
 static const char* tcp_state_str[] = {
@@ -273,7 +267,6 @@ static int __tcp_send(struct sock* sock, struct tcp_header* hdr, struct sk_buff*
 int tcp_send_segment(struct sock* sock, uint8_t* data, uint32_t len, uint8_t push)
 {
 	uint8_t retries;
-	uint32_t timeout;
 	int seq = sock->tcp->sequence;
 	int ack = sock->tcp->acknowledgement;
 	struct sk_buff* skb;
@@ -311,14 +304,11 @@ int tcp_send_segment(struct sock* sock, uint8_t* data, uint32_t len, uint8_t pus
 		/* Send segment, __tcp_send consumes skb */
 		__tcp_send(sock, &hdr, skb, data, len);
 
-		/* Wait for ACK */
-		timeout = get_time() + 1;
-
-		/* check if ack was receiver for timeout seconds. */
-		while((uint32_t)get_time() < timeout){
-			kernel_yield();
-			if(!net_sock_awaiting_ack(sock)) return ERROR_OK;
+		/* Wait for the ACK, tcp_parse wakes us when it arrives */
+		if(wait_event_timeout(&sock->waiters, !net_sock_awaiting_ack(sock), TCP_RETRANSMIT_TICKS)){
+			return ERROR_OK;
 		}
+
 		dbgprintf("[TCP] Timeout for %d\n", htonl(hdr.seq));
 	} while (retries++ < 3);
 
@@ -333,10 +323,8 @@ int tcp_accept_connection(struct sock* sock, struct sock* new)
         return -1;
      }
 
-    while(sock->backlog.count == 0){
-		dbgprintf("[TCP] Socket %d is listening but backlog is empty\n", sock);
-		TCP_BLOCK(sock);
-	}
+	dbgprintf("[TCP] Socket %d is waiting for a connection\n", sock);
+	wait_event(&sock->waiters, sock->backlog.count > 0);
 
 	struct sk_buff* skb = sock->backlog.queue->ops->remove(sock->backlog.queue);
 	ERR_ON_NULL(skb);
@@ -550,21 +538,8 @@ int tcp_close_connection(struct sock* sock)
 	return ERROR_OK;
 }
 
-int tcp_parse(struct sk_buff* skb)
+static int __tcp_parse(struct sock* sk, struct sk_buff* skb, struct tcp_header* hdr)
 {
-	/* Look if there is an active TCP connection, if not look for accept. */
-
-	struct tcp_header* hdr = (struct tcp_header* ) skb->data;
-	skb->hdr.tcp = hdr;
-	skb->data += hdr->doff*4;
-	skb->data_len = skb->hdr.ip->len - skb->hdr.ip->ihl*4 - hdr->doff*4;
-
-	struct sock* sk = net_sock_find_tcp(hdr->source, hdr->dest, htonl(skb->hdr.ip->saddr));
-	if(sk == NULL){
-		dbgprintf("[TCP] No socket found for TCP packet while parsing.\n");
-		return -1;
-	}
-
 	dbgprintf("[TCP] Incoming TCP packet: %d syn, %d ack, %d fin %d push\n", hdr->syn, hdr->ack, hdr->fin, hdr->psh);
 
 	switch (sk->tcp->state){
@@ -615,6 +590,7 @@ int tcp_parse(struct sk_buff* skb)
 			sk->tcp->state = TCP_ESTABLISHED;
 
 			dbgprintf("Socket %d set to established\n", sk);
+			TCP_UNBLOCK(sk);
 			skb_free(skb);
 			return ERROR_OK;
 		}
@@ -631,6 +607,7 @@ int tcp_parse(struct sk_buff* skb)
 
 			dbgprintf("Socket %d received ack for %d\n", sk, htonl(hdr->ack_seq));
 			tcp_recv_ack(sk, hdr);
+			TCP_UNBLOCK(sk);
 			skb_free(skb);
 			return ERROR_OK;
 		}
@@ -693,10 +670,9 @@ int tcp_parse(struct sk_buff* skb)
 		if(hdr->fin == 0 && hdr->ack == 1){	
 			sk->tcp->state = TCP_CLOSED;
 
-			if(sk->waiting != NULL){
-				sk->waiting->state = RUNNING;
-				sk->waiting = NULL;
+			if(sk->waiters.count > 0){
 				sk->data_ready = -1;
+				TCP_UNBLOCK(sk);
 			}
 
 		}
@@ -706,4 +682,26 @@ int tcp_parse(struct sk_buff* skb)
 	}
 	
 	return -1;
+}
+
+int tcp_parse(struct sk_buff* skb)
+{
+	/* Look if there is an active TCP connection, if not look for accept. */
+
+	struct tcp_header* hdr = (struct tcp_header* ) skb->data;
+	skb->hdr.tcp = hdr;
+	skb->data += hdr->doff*4;
+	skb->data_len = skb->hdr.ip->len - skb->hdr.ip->ihl*4 - hdr->doff*4;
+
+	struct sock* sk = net_sock_find_tcp(hdr->source, hdr->dest, htonl(skb->hdr.ip->saddr));
+	if(sk == NULL){
+		dbgprintf("[TCP] No socket found for TCP packet while parsing.\n");
+		return -1;
+	}
+
+	/* The reference keeps the socket and its connection alive if it is closed meanwhile */
+	int ret = __tcp_parse(sk, skb, hdr);
+	sock_put(sk);
+
+	return ret;
 }
\ No newline at end of file
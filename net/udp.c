@@ -78,6 +78,7 @@ int net_udp_parse(struct sk_buff* skb){
 	int ret = net_sock_add_data(sk, skb);
 	if(ret == 0)
 		skb_free(skb);
+	sock_put(sk);
 		
 	dbgprintf("PORT %d -> %d, len: %d.\n", hdr->srcport, hdr->destport, hdr->udp_length);
 
@@ -0,0 +1,119 @@
+#include <bitmap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Allocation cost of the hierarchical bitmap at different occupancies,
+ * compared to the old bit at a time search. Not a test, run with make bitmap_bench.
+ */
+
+FILE* filesystem = NULL;
+unsigned int* kernel_page_dir = 0;
+int kernel_size = 50000;
+
+#define BENCH_BITS (32*1024)
+#define BENCH_ITERATIONS 20000
+#define BENCH_RANGE 8
+
+/* Old bit at a time search from index 0, used as a baseline. */
+static int legacy_get_free(unsigned char* b, int n)
+{
+    for (int i = 0; i < n; i++){
+        if(!(b[i / 8] & (1 << (i & 7)))){
+            b[i / 8] |= 1 << (i & 7);
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int legacy_get_continous(unsigned char* b, int n, int size)
+{
+    for (int i = 0; i + size <= n; i++){
+        int j;
+        for (j = 0; j < size; j++){
+            if(b[(i+j) / 8] & (1 << ((i+j) & 7))) break;
+        }
+        if(j == size){
+            for (j = 0; j < size; j++) b[(i+j) / 8] |= 1 << ((i+j) & 7);
+            return i;
+        }
+        i += j;
+    }
+    return -1;
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Fill both bitmaps to the given occupancy with the same random pattern. */
+static void fill(struct hbitmap* map, unsigned char* legacy, int occupancy)
+{
+    while (hbitmap_alloc(map) >= 0);
+    memset(legacy, 0xFF, BENCH_BITS / 8);
+
+    srand(occupancy);
+    int target = BENCH_BITS * occupancy / 100;
+    while (map->used > target){
+        int i = rand() % BENCH_BITS;
+        if(!hbitmap_test(map, i)) continue;
+        hbitmap_free(map, i);
+        legacy[i / 8] &= ~(1 << (i & 7));
+    }
+}
+
+static void bench(int occupancy)
+{
+    struct hbitmap* map = hbitmap_create(BENCH_BITS);
+    unsigned char* legacy = malloc(BENCH_BITS / 8);
+    fill(map, legacy, occupancy);
+
+    double start = now_ns();
+    for (int i = 0; i < BENCH_ITERATIONS; i++){
+        int bit = hbitmap_alloc(map);
+        hbitmap_free(map, bit);
+    }
+    double single = (now_ns() - start) / BENCH_ITERATIONS;
+
+    start = now_ns();
+    for (int i = 0; i < BENCH_ITERATIONS; i++){
+        int bit = hbitmap_alloc_range(map, BENCH_RANGE);
+        if(bit >= 0) hbitmap_free_range(map, bit, BENCH_RANGE);
+    }
+    double range = (now_ns() - start) / BENCH_ITERATIONS;
+
+    start = now_ns();
+    for (int i = 0; i < BENCH_ITERATIONS; i++){
+        int bit = legacy_get_free(legacy, BENCH_BITS);
+        legacy[bit / 8] &= ~(1 << (bit & 7));
+    }
+    double legacy_single = (now_ns() - start) / BENCH_ITERATIONS;
+
+    start = now_ns();
+    for (int i = 0; i < BENCH_ITERATIONS; i++){
+        int bit = legacy_get_continous(legacy, BENCH_BITS, BENCH_RANGE);
+        if(bit >= 0) for (int j = 0; j < BENCH_RANGE; j++) legacy[(bit+j) / 8] &= ~(1 << ((bit+j) & 7));
+    }
+    double legacy_range = (now_ns() - start) / BENCH_ITERATIONS;
+
+    printf("%d%% occupancy: alloc %.0fns (legacy %.0fns), alloc %d %.0fns (legacy %.0fns)\n",
+        occupancy, single, legacy_single, BENCH_RANGE, range, legacy_range);
+
+    hbitmap_destroy(map);
+    free(legacy);
+}
+
+int main(int argc, char const *argv[])
+{
+    bench(10);
+    bench(50);
+    bench(95);
+
+    return 0;
+}
@@ -0,0 +1,39 @@
+#include <bitmap.h>
+#include <stdio.h>
+#include <mocks.h>
+
+FILE* filesystem = NULL;
+unsigned int* kernel_page_dir = 0;
+int kernel_size = 50000;
+
+int main(int argc, char const *argv[])
+{
+    /* Size is not a multiple of 32 to test the padding bits */
+    struct hbitmap* map = hbitmap_create(1000);
+    testprintf(map != NULL, "hbitmap_create() - Create bitmap");
+
+    int ok = 1;
+    for (int i = 0; i < 1000; i++){
+        if(hbitmap_alloc(map) != i) ok = 0;
+    }
+    testprintf(ok, "hbitmap_alloc() - Allocate all bits in order");
+    testprintf(hbitmap_alloc(map) == -1, "hbitmap_alloc() - Full bitmap");
+
+    hbitmap_free(map, 500);
+    testprintf(hbitmap_alloc(map) == 500, "hbitmap_alloc() - Reuse freed bit");
+
+    hbitmap_free_range(map, 100, 40);
+    testprintf(hbitmap_alloc_range(map, 41) == -1, "hbitmap_alloc_range() - Run too short");
+    testprintf(hbitmap_alloc_range(map, 40) == 100, "hbitmap_alloc_range() - Exact run across words");
+    testprintf(map->used == 1000, "hbitmap_alloc_range() - Used count");
+    hbitmap_destroy(map);
+
+    unsigned char* b = create_bitmap(100);
+    testprintf(get_free_bitmap(b, 100) == 0, "get_free_bitmap() - First bit");
+    testprintf(bitmap_get_continous(b, 100, 60) == 1, "bitmap_get_continous() - Run after used bit");
+    testprintf(bitmap_get_continous(b, 100, 40) == -1, "bitmap_get_continous() - No run left");
+    testprintf(get_free_bitmap(b, 100) == 61, "get_free_bitmap() - Skip used words");
+    destroy_bitmap(b);
+
+    return failed > 0 ? -1 : 0;
+}
@@ -1,6 +1,8 @@
 #ifndef __TEST_H
 #define __TEST_H
 
+extern int failed;
+
 void testprintf(int test,  const char* test_str);
 
 #endif // !__TEST_H
\ No newline at end of file
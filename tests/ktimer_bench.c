@@ -0,0 +1,63 @@
+#include <ktimer.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Cost of adding timers and of a tick with many timers pending on the wheel.
+ * Not a test, run with make ktimer_bench.
+ */
+
+FILE* filesystem = NULL;
+unsigned int* kernel_page_dir = 0;
+int kernel_size = 50000;
+
+#define BENCH_TIMERS 4096
+#define BENCH_TICKS (1 << 16)
+
+/* Dynamic tick is not part of the benchmark, the wheel is driven directly */
+void timer_tick_restart()
+{
+
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench_expiry(void* arg)
+{
+    (*(int*)arg)++;
+}
+
+/* Tick cost with BENCH_TIMERS pending timers spread over the wheel */
+static void bench()
+{
+    static struct ktimer timers[BENCH_TIMERS];
+    int expired = 0;
+
+    srand(1);
+    double start = now_ns();
+    for (int i = 0; i < BENCH_TIMERS; i++){
+        ktimer_init(&timers[i], &bench_expiry, &expired);
+        ktimer_add(&timers[i], 1 + rand() % BENCH_TICKS);
+    }
+    double add = (now_ns() - start) / BENCH_TIMERS;
+
+    start = now_ns();
+    for (int i = 0; i < BENCH_TICKS; i++) ktimer_tick();
+    double tick = (now_ns() - start) / BENCH_TICKS;
+
+    printf("ktimer: %d timers (%d expired), add %.1fns, tick %.1fns\n", BENCH_TIMERS, expired, add, tick);
+}
+
+int main(int argc, char const *argv[])
+{
+    bench();
+
+    return 0;
+}
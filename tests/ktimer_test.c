@@ -0,0 +1,115 @@
+#include <ktimer.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mocks.h>
+
+FILE* filesystem = NULL;
+unsigned int* kernel_page_dir = 0;
+int kernel_size = 50000;
+
+#define MANY_TIMERS 4096
+#define MANY_TICKS (1 << 16)
+
+/* Dynamic tick is not part of the test, the wheel is driven directly */
+void timer_tick_restart()
+{
+
+}
+
+/* Records the tick a timer expired at */
+static void record_expiry(void* arg)
+{
+    *(uint32_t*)arg = ktimer_now();
+}
+
+static int periodic_count = 0;
+static struct ktimer periodic;
+static void periodic_expiry(void* arg)
+{
+    periodic_count++;
+    ktimer_add(&periodic, (int)(intptr_t)arg);
+}
+
+static void run_ticks(int ticks)
+{
+    for (int i = 0; i < ticks; i++) ktimer_tick();
+}
+
+static void count_expiry(void* arg)
+{
+    (*(int*)arg)++;
+}
+
+int main(int argc, char const *argv[])
+{
+    /* Expiry exactly at the requested tick on every level of the wheel */
+    int deltas[] = {1, 2, 255, 256, 257, 1000, 16383, 16384, 16385, 100000, (1 << 20) + 7};
+    int count = sizeof(deltas) / sizeof(deltas[0]);
+    struct ktimer timers[sizeof(deltas) / sizeof(deltas[0])];
+    uint32_t fired[sizeof(deltas) / sizeof(deltas[0])];
+    uint32_t start = ktimer_now();
+
+    for (int i = 0; i < count; i++){
+        fired[i] = 0;
+        ktimer_init(&timers[i], &record_expiry, &fired[i]);
+        ktimer_add(&timers[i], deltas[i]);
+    }
+    testprintf(ktimer_pending(&timers[0]), "ktimer_add() - Timer is pending");
+
+    run_ticks(deltas[count-1]);
+    int exact = 1;
+    for (int i = 0; i < count; i++){
+        if(fired[i] != start + deltas[i]) exact = 0;
+    }
+    testprintf(exact, "ktimer_tick() - Timers expire at their tick on all levels");
+    testprintf(!ktimer_pending(&timers[0]), "ktimer_tick() - Expired timer is not pending");
+
+    /* Cancel */
+    uint32_t cancelled = 0;
+    struct ktimer timer;
+    ktimer_init(&timer, &record_expiry, &cancelled);
+    ktimer_add(&timer, 300);
+    run_ticks(100);
+    testprintf(ktimer_cancel(&timer) == 1, "ktimer_cancel() - Cancels pending timer");
+    run_ticks(300);
+    testprintf(cancelled == 0 && ktimer_cancel(&timer) == 0, "ktimer_cancel() - Cancelled timer never expires");
+
+    /* Re-adding a pending timer moves it */
+    uint32_t moved = 0;
+    ktimer_init(&timer, &record_expiry, &moved);
+    ktimer_add(&timer, 5000);
+    start = ktimer_now();
+    ktimer_add(&timer, 10);
+    run_ticks(5000);
+    testprintf(moved == start + 10, "ktimer_add() - Re-adding moves the expiry");
+
+    /* Callbacks may re-arm their own timer */
+    ktimer_init(&periodic, &periodic_expiry, (void*)(intptr_t)256);
+    ktimer_add(&periodic, 256);
+    run_ticks(256*10);
+    ktimer_cancel(&periodic);
+    testprintf(periodic_count == 10, "ktimer_tick() - Periodic timer re-arms from its callback");
+
+    /* Next expiry stops at the first timer or at the next cascade */
+    uint32_t next = 0;
+    ktimer_init(&timer, &record_expiry, &next);
+    ktimer_add(&timer, 40);
+    int cascade = KTIMER_ROOT_SIZE - (ktimer_now() & (KTIMER_ROOT_SIZE - 1));
+    testprintf(ktimer_next_expiry(54) == (cascade < 40 ? cascade : 40), "ktimer_next_expiry() - Ticks until the next timer");
+    ktimer_cancel(&timer);
+    testprintf(ktimer_next_expiry(54) == 54, "ktimer_next_expiry() - Limited by max without timers");
+
+    /* Many timers spread over the wheel all expire, timing them is left to ktimer_bench */
+    static struct ktimer many[MANY_TIMERS];
+    int expired = 0;
+    srand(1);
+    for (int i = 0; i < MANY_TIMERS; i++){
+        ktimer_init(&many[i], &count_expiry, &expired);
+        ktimer_add(&many[i], 1 + rand() % MANY_TICKS);
+    }
+    run_ticks(MANY_TICKS);
+    testprintf(expired == MANY_TIMERS, "ktimer_tick() - All spread out timers expired");
+
+    return failed > 0 ? -1 : 0;
+}
@@ -1,9 +1,57 @@
+#include <memory.h>
 #include <stdio.h>
-#include <mocks.h>
+#include <test.h>
 
-int main()
+FILE* filesystem = NULL;
+unsigned int* kernel_page_dir = 0;
+int kernel_size = 50000;
+
+/* Not a power of two, one page goes to the metadata and 99 pages are carved into 64 + 32 + 2 + 1 */
+#define PMEM_TEST_PAGES 100
+static char region[PMEM_TEST_PAGES*PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+int main(int argc, char const *argv[])
 {
-    testprintf(0 == 0, "Template test!");
+    struct pmem_info info;
+    uintptr_t base = (uintptr_t) region;
+
+    pmem_init(base, base + sizeof(region));
+    pmem_get_info(&info);
+    testprintf(info.total == 99*PAGE_SIZE && info.used == 0, "pmem_init() - Metadata is taken from the end of the region");
+    testprintf(info.free_blocks == 4 && info.largest_free == 64*PAGE_SIZE, "pmem_init() - Region is carved into aligned blocks");
+    /* 35 of the 99 free pages are outside the largest block */
+    testprintf(info.fragmentation == 36, "pmem_get_info() - Fragmentation of a fresh region");
+
+    /* Rounded up to 4 pages, split off the 64 page block */
+    void* block = palloc(3*PAGE_SIZE);
+    pmem_get_info(&info);
+    testprintf(block == (void*)(base + 64*PAGE_SIZE), "palloc() - Smallest fitting block is split");
+    testprintf(info.used == 4*PAGE_SIZE && info.free_blocks == 6, "palloc() - Upper halves go back on the free lists");
+
+    pfree(block);
+    pmem_get_info(&info);
+    testprintf(info.used == 0 && info.free_blocks == 4 && info.largest_free == 64*PAGE_SIZE, "pfree() - Buddies merge back into the original block");
+
+    pfree(block);
+    pmem_get_info(&info);
+    testprintf(info.used == 0 && info.free_blocks == 4, "pfree() - Double free is rejected");
+
+    block = palloc(PAGE_SIZE);
+    pfree((char*)block + 16);
+    pfree((char*)block + PAGE_SIZE*PMEM_TEST_PAGES);
+    pmem_get_info(&info);
+    testprintf(block != NULL && info.used == PAGE_SIZE, "pfree() - Misaligned and foreign pointers are rejected");
+    pfree(block);
+
+    /* Left with 32 + 2 + 1 pages, 3 of 35 pages are outside the largest block */
+    void* large = palloc(64*PAGE_SIZE);
+    pmem_get_info(&info);
+    testprintf(large == region && info.largest_free == 32*PAGE_SIZE && info.fragmentation == 9, "pmem_get_info() - Fragmentation after a large allocation");
+
+    void* rest[3] = {palloc(32*PAGE_SIZE), palloc(2*PAGE_SIZE), palloc(PAGE_SIZE)};
+    pmem_get_info(&info);
+    testprintf(rest[0] && rest[1] && rest[2] && palloc(PAGE_SIZE) == NULL, "palloc() - Allocate the whole region");
+    testprintf(info.free_blocks == 0 && info.fragmentation == 0, "pmem_get_info() - No fragmentation without free memory");
 
     return failed > 0 ? -1 : 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,79 @@
+#include <pcb.h>
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * Context switch rate of the run queue, compared to the old single linked list.
+ * Not a test, run with make pcb_bench.
+ */
+
+FILE* filesystem = NULL;
+unsigned int* kernel_page_dir = 0;
+int kernel_size = 50000;
+
+#define BENCH_THREADS 64
+#define BENCH_SWITCHES 1000000
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Old append by walking the whole single linked list, used as a baseline. */
+static void legacy_push(struct pcb** list, struct pcb* pcb)
+{
+    pcb->next = NULL;
+    if(*list == NULL){
+        *list = pcb;
+        return;
+    }
+    struct pcb* current = *list;
+    while (current->next != NULL){
+        current = current->next;
+    }
+    current->next = pcb;
+}
+
+/* Context switch rate of the queue operations with BENCH_THREADS runnable threads and an idle thread */
+static void bench()
+{
+    static struct pcb pcbs[BENCH_THREADS+1];
+    struct pcb_runqueue rq;
+    pcb_runqueue_init(&rq);
+
+    for (int i = 0; i <= BENCH_THREADS; i++){
+        pcbs[i].priority = i == BENCH_THREADS ? PCB_PRIORITY_IDLE : PCB_PRIORITY_DEFAULT;
+        pcb_runqueue_push(&rq, &pcbs[i]);
+    }
+
+    double start = now_ns();
+    for (int i = 0; i < BENCH_SWITCHES; i++){
+        struct pcb* next = pcb_runqueue_pop(&rq);
+        pcb_runqueue_push(&rq, next);
+    }
+    double runqueue = (now_ns() - start) / BENCH_SWITCHES;
+
+    struct pcb* list = NULL;
+    for (int i = 0; i <= BENCH_THREADS; i++){
+        legacy_push(&list, &pcbs[i]);
+    }
+
+    start = now_ns();
+    for (int i = 0; i < BENCH_SWITCHES; i++){
+        struct pcb* next = list;
+        list = next->next;
+        legacy_push(&list, next);
+    }
+    double legacy = (now_ns() - start) / BENCH_SWITCHES;
+
+    printf("%d threads: switch %.1fns, %.1fM switches/s (legacy %.1fns, %.1fM switches/s)\n",
+        BENCH_THREADS, runqueue, 1e3 / runqueue, legacy, 1e3 / legacy);
+}
+
+int main(int argc, char const *argv[])
+{
+    bench();
+    return 0;
+}
@@ -3,7 +3,6 @@
 
 FILE* filesystem = NULL;
 unsigned int* kernel_page_dir = 0;
-int __cli_cnt = 0;
 int kernel_size = 50000;
 
 int main(int argc, char const *argv[])
@@ -34,5 +33,47 @@ int main(int argc, char const *argv[])
     testprintf(peeked_pcb == NULL, "__pcb_queue_remove() - Remove PCB from Queue");    
     printf("%p\n", peeked_pcb);
 
+    // Test push order of the double linked queue
+    struct pcb fifo[3] = {0};
+    for (int i = 0; i < 3; i++) new_queue->ops->push(new_queue, &fifo[i]);
+    new_queue->ops->remove(new_queue, &fifo[1]);
+    int fifo_ok = new_queue->ops->pop(new_queue) == &fifo[0] && new_queue->ops->pop(new_queue) == &fifo[2] && new_queue->ops->pop(new_queue) == NULL;
+    testprintf(fifo_ok, "__pcb_queue_push() - FIFO order after removing the middle PCB");
+
+    // Test run queue levels
+    struct pcb_runqueue rq;
+    pcb_runqueue_init(&rq);
+    testprintf(pcb_runqueue_pop(&rq) == NULL, "pcb_runqueue_pop() - Empty run queue");
+
+    struct pcb levels[4] = {
+        {.priority = PCB_PRIORITY_IDLE},
+        {.priority = PCB_PRIORITY_DEFAULT},
+        {.priority = PCB_PRIORITY_HIGH},
+        {.priority = PCB_PRIORITY_DEFAULT},
+    };
+    for (int i = 0; i < 4; i++) pcb_runqueue_push(&rq, &levels[i]);
+    testprintf(rq.bitmap == ((1 << PCB_PRIORITY_HIGH) | (1 << PCB_PRIORITY_DEFAULT) | (1 << PCB_PRIORITY_IDLE)), "pcb_runqueue_push() - Bitmap of non empty levels");
+
+    struct pcb* order[4];
+    for (int i = 0; i < 4; i++) order[i] = pcb_runqueue_pop(&rq);
+    testprintf(order[0] == &levels[2] && order[1] == &levels[1] && order[2] == &levels[3] && order[3] == &levels[0], "pcb_runqueue_pop() - Priority then FIFO order");
+    testprintf(rq.bitmap == 0 && rq.total == 0, "pcb_runqueue_pop() - Empty after popping all");
+
+    for (int i = 0; i < 4; i++) pcb_runqueue_push(&rq, &levels[i]);
+    pcb_runqueue_remove(&rq, &levels[2]);
+    pcb_runqueue_remove(&rq, &levels[3]);
+    testprintf(!(rq.bitmap & (1 << PCB_PRIORITY_HIGH)) && rq.tail[PCB_PRIORITY_DEFAULT] == &levels[1], "pcb_runqueue_remove() - Clears empty levels and tails");
+
+    // Test killing a pcb waiting on a mutex, the lock is handed to the next waiter instead
+    struct pcb waiters[3] = {0};
+    for (int i = 0; i < 3; i++) new_queue->ops->push(new_queue, &waiters[i]);
+    testprintf(waiters[1].lockqueue == new_queue, "__pcb_queue_push() - Waiter knows its queue");
+    pcb_queue_unlink(&waiters[1]);
+    testprintf(waiters[1].lockqueue == NULL && new_queue->total == 2, "pcb_queue_unlink() - Killed waiter leaves the queue");
+    pcb_queue_unlink(&waiters[1]);
+    testprintf(new_queue->total == 2, "pcb_queue_unlink() - Unlinking twice is a no-op");
+    int handover_ok = new_queue->ops->pop(new_queue) == &waiters[0] && new_queue->ops->pop(new_queue) == &waiters[2] && new_queue->ops->pop(new_queue) == NULL;
+    testprintf(handover_ok && waiters[0].lockqueue == NULL && waiters[2].lockqueue == NULL, "__pcb_queue_pop() - Killed waiter is never popped");
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,210 @@
+#include <sched_fair.h>
+#include <pcb.h>
+#include <stdio.h>
+#include <test.h>
+
+FILE* filesystem = NULL;
+unsigned int* kernel_page_dir = 0;
+int kernel_size = 50000;
+
+/* One tick worth of CPU time in Kcycles */
+#define SIM_SLICE 1000
+#define SIM_TASKS 4
+
+/**
+ * Simulated task, runs for burst Kcycles and then sleeps for sleep Kcycles.
+ * A task with no burst never sleeps.
+ */
+struct sim_task {
+    struct pcb pcb;
+    uint32_t burst;
+    uint32_t sleep;
+    /* results */
+    uint64_t ran;
+    uint64_t wait;
+    uint64_t wait_max;
+    /* state */
+    int sleeping;
+    uint64_t wake_at;
+    uint64_t queued_at;
+    uint32_t burst_left;
+};
+
+static struct fair_runqueue rq;
+static struct sim_task tasks[SIM_TASKS];
+static int task_count;
+static uint64_t sim_now;
+
+static struct sim_task* add_task(int priority, uint32_t burst, uint32_t sleep)
+{
+    struct sim_task* task = &tasks[task_count];
+    memset(task, 0, sizeof(*task));
+    task->pcb.pid = task_count++;
+    task->pcb.priority = priority;
+    task->burst = burst;
+    task->sleep = sleep;
+    task->burst_left = burst;
+    fair_enqueue(&rq, &task->pcb, FAIR_ENQUEUE_NEW);
+    return task;
+}
+
+static void sim_reset()
+{
+    fair_runqueue_init(&rq);
+    task_count = 0;
+    sim_now = 0;
+}
+
+static void wake_sleepers()
+{
+    for (int i = 0; i < task_count; i++){
+        struct sim_task* task = &tasks[i];
+        if(task->sleeping && task->wake_at <= sim_now){
+            task->sleeping = 0;
+            task->queued_at = sim_now;
+            task->burst_left = task->burst;
+            fair_enqueue(&rq, &task->pcb, FAIR_ENQUEUE_WAKEUP);
+        }
+    }
+}
+
+/* Runs the queue like the tick driven scheduler does, a task runs until its slice ends or it sleeps */
+static void simulate(uint64_t duration)
+{
+    uint64_t end = sim_now + duration;
+    while(sim_now < end){
+        wake_sleepers();
+
+        struct pcb* pcb = fair_pop(&rq);
+        if(pcb == NULL){
+            sim_now += SIM_SLICE / 10;
+            continue;
+        }
+        struct sim_task* task = &tasks[pcb->pid];
+
+        uint64_t waited = sim_now - task->queued_at;
+        task->wait += waited;
+        if(waited > task->wait_max) task->wait_max = waited;
+
+        uint32_t ran = SIM_SLICE;
+        if(task->burst != 0 && task->burst_left < ran){
+            ran = task->burst_left;
+        }
+        sim_now += ran;
+        task->ran += ran;
+        fair_charge(&rq, pcb, ran);
+
+        if(task->burst != 0){
+            task->burst_left -= ran;
+            if(task->burst_left == 0){
+                task->sleeping = 1;
+                task->wake_at = sim_now + task->sleep;
+                continue;
+            }
+        }
+
+        task->queued_at = sim_now;
+        fair_enqueue(&rq, pcb, 0);
+    }
+}
+
+/* a / b within tolerance percent of expected / 1000 */
+static int ratio_within(uint64_t a, uint64_t b, uint64_t expected, int tolerance)
+{
+    uint64_t ratio = (a * 1000) / b;
+    uint64_t slack = (expected * tolerance) / 100;
+    return ratio + slack >= expected && ratio <= expected + slack;
+}
+
+static int heap_valid()
+{
+    for (int i = 0; i < rq.total; i++){
+        if(rq.heap[i]->fair_index != i) return 0;
+        int child = i * 2 + 1;
+        if(child < rq.total && rq.heap[child]->vruntime < rq.heap[i]->vruntime) return 0;
+        if(child + 1 < rq.total && rq.heap[child + 1]->vruntime < rq.heap[i]->vruntime) return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char const *argv[])
+{
+    /* Equal priorities share equally */
+    sim_reset();
+    struct sim_task* a = add_task(PCB_PRIORITY_DEFAULT, 0, 0);
+    struct sim_task* b = add_task(PCB_PRIORITY_DEFAULT, 0, 0);
+    simulate(1000 * SIM_SLICE);
+    testprintf(ratio_within(a->ran, b->ran, 1000, 2), "fair - Equal priorities get equal shares");
+
+    /* One level apart gets the ratio of the weights */
+    sim_reset();
+    a = add_task(PCB_PRIORITY_DEFAULT - 1, 0, 0);
+    b = add_task(PCB_PRIORITY_DEFAULT, 0, 0);
+    simulate(4000 * SIM_SLICE);
+    uint64_t expected = ((uint64_t)fair_weight(PCB_PRIORITY_DEFAULT - 1) * 1000) / fair_weight(PCB_PRIORITY_DEFAULT);
+    testprintf(ratio_within(a->ran, b->ran, expected, 5), "fair - Shares follow the priority weights");
+    printf("fair: priority %d vs %d ran %llu vs %llu Kcycles, expected ratio %llu/1000\n",
+        PCB_PRIORITY_DEFAULT - 1, PCB_PRIORITY_DEFAULT, (unsigned long long)a->ran, (unsigned long long)b->ran, (unsigned long long)expected);
+
+    /* A mostly sleeping task gets all it asks for and runs soon after waking */
+    sim_reset();
+    a = add_task(PCB_PRIORITY_DEFAULT, 0, 0);
+    b = add_task(PCB_PRIORITY_DEFAULT, 0, 0);
+    struct sim_task* interactive = add_task(PCB_PRIORITY_DEFAULT, SIM_SLICE / 10, 5 * SIM_SLICE);
+    simulate(2000 * SIM_SLICE);
+    uint64_t wakeups = interactive->ran / (SIM_SLICE / 10);
+    uint64_t demand = (2000 * SIM_SLICE) / (5 * SIM_SLICE + SIM_SLICE / 10);
+    testprintf(wakeups + 2 >= demand, "fair - Interactive task gets its demand");
+    testprintf(interactive->wait_max <= SIM_SLICE, "fair - Interactive task waits at most a slice");
+    testprintf(ratio_within(a->ran, b->ran, 1000, 2), "fair - Hogs still share equally");
+
+    /* A long sleep is not turned into a long burst */
+    sim_reset();
+    a = add_task(PCB_PRIORITY_DEFAULT, 0, 0);
+    struct sim_task* sleeper = add_task(PCB_PRIORITY_DEFAULT, 0, 0);
+    fair_dequeue(&rq, &sleeper->pcb, 0);
+    simulate(1000 * SIM_SLICE);
+    fair_enqueue(&rq, &sleeper->pcb, FAIR_ENQUEUE_WAKEUP);
+    testprintf(rq.min_vruntime - sleeper->pcb.vruntime <= FAIR_WAKEUP_BONUS, "fair - Wakeup bonus is bounded");
+    uint64_t before = a->ran;
+    simulate(20 * SIM_SLICE);
+    testprintf(a->ran - before >= 5 * SIM_SLICE, "fair - Others keep running after a long sleeper wakes");
+
+    /* Removing from the middle keeps the heap ordered */
+    sim_reset();
+    struct pcb pcbs[32];
+    memset(pcbs, 0, sizeof(pcbs));
+    for (int i = 0; i < 32; i++){
+        pcbs[i].priority = PCB_PRIORITY_DEFAULT;
+        pcbs[i].vruntime = (i * 7919) % 97;
+        fair_enqueue(&rq, &pcbs[i], 0);
+    }
+    for (int i = 0; i < 32; i += 3){
+        fair_dequeue(&rq, &pcbs[i], 0);
+    }
+    int valid = heap_valid();
+    uint64_t last = 0;
+    int ordered = 1;
+    struct pcb* pcb;
+    while((pcb = fair_pop(&rq)) != NULL){
+        if(pcb->vruntime < last) ordered = 0;
+        last = pcb->vruntime;
+    }
+    testprintf(valid && ordered, "fair_dequeue() - Heap stays ordered");
+
+    /* Migrating keeps the lag behind min_vruntime */
+    struct fair_runqueue other;
+    fair_runqueue_init(&rq);
+    fair_runqueue_init(&other);
+    rq.min_vruntime = 100000;
+    other.min_vruntime = 5000;
+    struct pcb migrated = {0};
+    migrated.priority = PCB_PRIORITY_DEFAULT;
+    migrated.vruntime = 100250;
+    fair_enqueue(&rq, &migrated, 0);
+    fair_dequeue(&rq, &migrated, 1);
+    fair_enqueue(&other, &migrated, FAIR_ENQUEUE_MIGRATE);
+    testprintf(migrated.vruntime == 5250, "fair_enqueue() - Migration keeps the relative virtual runtime");
+
+    return failed > 0 ? -1 : 0;
+}
@@ -93,8 +93,43 @@ void spin_lock(spinlock_t* lock) {
 void spin_unlock(spinlock_t* lock) {
 }
 
+uint32_t spin_lock_irqsave(spinlock_t* lock) {
+    return 0;
+}
+
+void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags) {
+}
+
+/* Tests run on a single processor, critical sections only keep count */
+static int __critical_depth = 0;
+
+void critical_enter()
+{
+    __critical_depth++;
+}
+
+void critical_leave()
+{
+    __critical_depth--;
+}
 
-void mutex_init(mutex_t* l)
+void critical_leave_noirq()
+{
+    __critical_depth--;
+}
+
+int critical_depth()
+{
+    return __critical_depth;
+}
+
+struct process* smp_process()
+{
+    return $process;
+}
+
+
+void __mutex_init(mutex_t* l, const char* name)
 {
 
 }
@@ -109,6 +144,36 @@ void release(mutex_t* l)
 
 }
 
+void __rwlock_init(rwlock_t* rw, const char* name)
+{
+
+}
+
+void __spinlock_init(spinlock_t* lock, const char* name)
+{
+    *lock = 0;
+}
+
+void read_lock(rwlock_t* rw)
+{
+
+}
+
+void read_unlock(rwlock_t* rw)
+{
+
+}
+
+void write_lock(rwlock_t* rw)
+{
+
+}
+
+void write_unlock(rwlock_t* rw)
+{
+
+}
+
 int disk_size()
 {
     return DISKSIZE;